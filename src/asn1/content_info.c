@@ -3,6 +3,7 @@
 #include <errno.h>
 #include "file.h"
 #include "log.h"
+#include "object_store.h"
 #include "oid.h"
 #include "asn1/decode.h"
 #include "asn1/asn1c/ContentType.h"
@@ -28,14 +29,14 @@ validate(struct ContentInfo *info)
 }
 
 static int
-decode(struct file_contents *fc, struct ContentInfo **result)
+decode(unsigned char const *buffer, size_t size, struct ContentInfo **result)
 {
 	struct ContentInfo *cinfo;
 	int error;
 
 	/* Validate DER encoding rfc6488#section3 bullet 1.l */
-	error = asn1_decode_fc(fc, &asn_DEF_ContentInfo, (void **) &cinfo,
-	    true, true);
+	error = asn1_decode(buffer, size, &asn_DEF_ContentInfo,
+	    (void **) &cinfo, true, true);
 	if (error)
 		return error;
 
@@ -52,14 +53,18 @@ decode(struct file_contents *fc, struct ContentInfo **result)
 int
 content_info_load(struct rpki_uri *uri, struct ContentInfo **result)
 {
+	struct stored_object object;
 	struct file_contents fc;
 	int error;
 
+	if (object_store_get(uri_get_local(uri), &object) == 0)
+		return decode(object.content, object.content_len, result);
+
 	error = file_load(uri_get_local(uri), &fc);
 	if (error)
 		return error;
 
-	error = decode(&fc, result);
+	error = decode(fc.buffer, fc.buffer_size, result);
 
 	file_free(&fc);
 	return error;
@@ -1,6 +1,7 @@
 #include "asn1/signed_data.h"
 
 #include <errno.h>
+#include <openssl/err.h>
 
 #include "algorithm.h"
 #include "config.h"
@@ -13,6 +14,7 @@
 #include "asn1/asn1c/MessageDigest.h"
 #include "asn1/asn1c/SignedDataPKCS7.h"
 #include "crypto/hash.h"
+#include "crypto/sig_verifier.h"
 #include "object/certificate.h"
 
 static const OID oid_cta = OID_CONTENT_TYPE_ATTR;
@@ -33,6 +35,7 @@ signed_object_args_init(struct signed_object_args *args,
 	args->uri = uri;
 	args->crls = crls;
 	memset(&args->refs, 0, sizeof(args->refs));
+	args->expiration = 0;
 	return 0;
 }
 
@@ -113,6 +116,9 @@ handle_sdata_certificate(ANY_t *cert_encoded, struct signed_object_args *args,
 	error = certificate_get_resources(cert, args->res, EE);
 	if (error)
 		goto end2;
+	error = x509_time_get(X509_get_notAfter(cert), &args->expiration);
+	if (error)
+		goto end2;
 
 end2:
 	X509_free(cert);
@@ -474,6 +480,59 @@ signed_data_validate(struct signed_data *sdata, struct signed_object_args *args)
 	return validate(sdata->decoded, sdata->encoded, args);
 }
 
+/*
+ * Schedules the verification of @sdata's signatures in @batch: the EE
+ * certificate's (by @issuer), and the signed attributes' (by the EE
+ * certificate).
+ *
+ * SignedDatas that don't look right are skipped; signed_data_validate() will
+ * complain about them.
+ */
+int
+signed_data_batch_signatures(struct signed_data *sdata, X509 *issuer,
+    struct sig_batch *batch)
+{
+	struct SignedData *decoded;
+	struct SignerInfo *sinfo;
+	ANY_t *cert_encoded;
+	const unsigned char *tmp;
+	X509 *cert;
+	int error;
+
+	decoded = sdata->decoded;
+
+	/* The preconditions of find_signedAttrs(); see validate() */
+	if (decoded->signerInfos.list.count != 1)
+		return 0;
+	sinfo = decoded->signerInfos.list.array[0];
+	if (sinfo == NULL || sinfo->signedAttrs == NULL)
+		return 0;
+	if (sinfo->sid.present != SignerIdentifier_PR_subjectKeyIdentifier)
+		return 0;
+	if (decoded->crls != NULL)
+		return 0;
+	if (decoded->certificates == NULL ||
+	    decoded->certificates->list.count != 1)
+		return 0;
+
+	cert_encoded = decoded->certificates->list.array[0];
+	tmp = (const unsigned char *) cert_encoded->buf;
+	cert = d2i_X509(NULL, &tmp, cert_encoded->size);
+	if (cert == NULL) {
+		/* handle_sdata_certificate() will report it */
+		ERR_clear_error();
+		return 0;
+	}
+
+	error = sig_batch_add_cert(batch, issuer, cert);
+	if (!error)
+		error = certificate_batch_signature(batch, cert, sdata->encoded,
+		    &sinfo->signature);
+
+	X509_free(cert);
+	return error;
+}
+
 void
 signed_data_cleanup(struct signed_data *sdata)
 {
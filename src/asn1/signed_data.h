@@ -25,6 +25,8 @@ struct signed_object_args {
 	 * recorded for future validation.
 	 */
 	struct certificate_refs refs;
+	/** When the embedded certificate expires. */
+	time_t expiration;
 };
 
 int signed_object_args_init(struct signed_object_args *, struct rpki_uri *,
@@ -38,6 +40,9 @@ struct signed_data {
 
 int signed_data_decode(struct signed_data *, ANY_t *);
 int signed_data_validate(struct signed_data *, struct signed_object_args *);
+struct sig_batch;
+int signed_data_batch_signatures(struct signed_data *, X509 *,
+    struct sig_batch *);
 void signed_data_cleanup(struct signed_data *);
 
 int get_content_type_attr(struct SignedData *, OBJECT_IDENTIFIER_t **);
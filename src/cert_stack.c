@@ -1,33 +1,62 @@
 #include "cert_stack.h"
 
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <sys/queue.h>
 
+#include "config.h"
 #include "resource.h"
 #include "str_token.h"
 #include "thread_var.h"
 #include "data_structure/array_list.h"
 #include "object/name.h"
 
-enum defer_node_type {
-	DNT_SEPARATOR,
-	DNT_CERT,
+struct defer_node {
+	struct deferred_cert deferred;
+	/* Certificate chain @deferred was found in. (Its parent is the tip.) */
+	struct metadata_node *chain;
+
+	/** Used by the defer queue. Points to the next deferred certificate. */
+	TAILQ_ENTRY(defer_node) next;
 };
 
-struct defer_node {
-	enum defer_node_type type;
+TAILQ_HEAD(defer_list, defer_node);
 
-	/**
-	 * This field is only relevant if @type == PCT_CERT.
-	 * Do not dereference members otherwise.
+/*
+ * One worker's deferred certificates.
+ *
+ * The owner pushes and pops at the head, so its own traversal is depth-first,
+ * like it always was. Thieves take from the tail, where the certificates
+ * closest to the root (and therefore, the largest subtrees) are.
+ */
+struct defer_queue {
+	struct defer_list nodes;
+	pthread_mutex_t lock;
+};
+
+/** The defer queues of all the workers that traverse the same tree. */
+struct defer_pool {
+	struct defer_queue *queues;
+	unsigned int capacity;
+	/* Number of queues already handed to workers. */
+	atomic_uint workers;
+
+	/* Certificates currently sitting in the queues. */
+	atomic_uint available;
+	/*
+	 * Certificates queued or being traversed. (The latter might still
+	 * defer more certificates.) Once this reaches zero, the tree is done.
 	 */
-	struct deferred_cert deferred;
+	atomic_uint pending;
+	/* Workers sleeping on @cond. */
+	atomic_uint idle;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
 
-	/** Used by certstack. Points to the next stacked certificate. */
-	SLIST_ENTRY(defer_node) next;
+	atomic_uint references;
 };
 
-SLIST_HEAD(defer_stack, defer_node);
-
 struct serial_number {
 	BIGNUM *number;
 	char *file; /* File where this serial number was found. */
@@ -44,10 +73,22 @@ STATIC_ARRAY_LIST(subjects, struct subject_name)
 
 /**
  * Cached certificate data.
+ *
+ * These are shared: The chain of a certificate is also the chain prefix of
+ * all its descendants, which can be validated by any worker. So they are
+ * immutable, except for the children data, which is guarded by @lock.
  */
 struct metadata_node {
 	struct rpki_uri *uri;
+	X509 *x509;
 	struct resources *resources;
+	/*
+	 * Certificate repository "level". This aims to identify if the
+	 * certificate is located at a distinct server than its father (common
+	 * case when the RIRs delegate RPKI repositories).
+	 */
+	unsigned int level;
+
 	/*
 	 * Serial numbers of the children.
 	 * This is an unsorted array list for two reasons: Certificates usually
@@ -55,25 +96,13 @@ struct metadata_node {
 	 */
 	struct serial_numbers serials;
 	struct subjects subjects;
+	pthread_mutex_t lock;
 
-	/** Used by certstack. Points to the next stacked certificate. */
-	SLIST_ENTRY(metadata_node) next;
-};
-
-SLIST_HEAD(metadata_stack, metadata_node);
-
-/**
- * Certificate repository "level". This aims to identify if the
- * certificate is located at a distinct server than its father (common
- * case when the RIRs delegate RPKI repositories).
- */
-struct repo_level_node {
-	unsigned int level;
-	SLIST_ENTRY(repo_level_node) next;
+	/* Issuer of this certificate. NULL if this is the TA. */
+	struct metadata_node *parent;
+	atomic_uint references;
 };
 
-SLIST_HEAD(repo_level_stack, repo_level_node);
-
 /**
  * This is the foundation through which we pull off our iterative traversal,
  * as opposed to a stack-threatening recursive one.
@@ -82,45 +111,115 @@ SLIST_HEAD(repo_level_stack, repo_level_node);
  * in the function stack.
  */
 struct cert_stack {
+	struct defer_pool *pool;
 	/**
 	 * Defer stack. Certificates we haven't iterated through yet.
 	 *
 	 * Every time a certificate validates successfully, its children are
-	 * stored here so they can be traversed later.
+	 * stored here so they can be traversed later (by this or some other
+	 * worker).
 	 */
-	struct defer_stack defers;
+	struct defer_queue *defers;
+	/* Was the last certificate returned by deferstack_pop() finished? */
+	bool traversing;
+	/* Queue we'll try to steal from next. */
+	unsigned int victim;
 
 	/**
 	 * x509 stack. Parents of the certificate we're currently iterating
 	 * through.
 	 * Formatted for immediate libcrypto consumption.
+	 * (The certificates belong to the metadata nodes.)
 	 */
 	STACK_OF(X509) *x509s;
 
 	/**
-	 * Stacked additional data to each @x509 certificate.
+	 * Additional data of the top of @x509s. Its ancestors hold the rest.
 	 *
 	 * (These two stacks should always have the same size. The reason why I
 	 * don't combine them is because libcrypto's validation function needs
 	 * the X509 stack, and I'm not creating it over and over again.)
-	 *
-	 * (This is a SLIST and not a STACK_OF because the OpenSSL stack
-	 * implementation is different than the LibreSSL one, and the latter is
-	 * seemingly not intended to be used outside of its library.)
-	 */
-	struct metadata_stack metas;
-
-	/**
-	 * Stacked data to store the repository "levels" (each level is a
-	 * delegation of an RPKI server).
 	 */
-	struct repo_level_stack levels;
+	struct metadata_node *meta;
 };
 
-int
-certstack_create(struct cert_stack **result)
+static int
+pool_create(struct defer_pool **result)
+{
+	struct defer_pool *pool;
+	unsigned int i;
+
+	pool = malloc(sizeof(struct defer_pool));
+	if (pool == NULL)
+		return pr_enomem();
+
+	/* The fetchers need queues too; they return the parked certificates */
+	pool->capacity = config_get_validation_workers()
+	    + config_get_fetch_workers();
+	pool->queues = calloc(pool->capacity, sizeof(struct defer_queue));
+	if (pool->queues == NULL) {
+		free(pool);
+		return pr_enomem();
+	}
+
+	for (i = 0; i < pool->capacity; i++) {
+		TAILQ_INIT(&pool->queues[i].nodes);
+		pthread_mutex_init(&pool->queues[i].lock, NULL);
+	}
+
+	atomic_init(&pool->workers, 0);
+	atomic_init(&pool->available, 0);
+	atomic_init(&pool->pending, 0);
+	atomic_init(&pool->idle, 0);
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	atomic_init(&pool->references, 1);
+
+	*result = pool;
+	return 0;
+}
+
+static void
+defer_destroy(struct defer_node *);
+
+static void
+pool_refput(struct defer_pool *pool)
+{
+	struct defer_node *node;
+	unsigned int deleted;
+	unsigned int i;
+
+	if (atomic_fetch_sub(&pool->references, 1) != 1)
+		return;
+
+	deleted = 0;
+	for (i = 0; i < pool->capacity; i++) {
+		while (!TAILQ_EMPTY(&pool->queues[i].nodes)) {
+			node = TAILQ_FIRST(&pool->queues[i].nodes);
+			TAILQ_REMOVE(&pool->queues[i].nodes, node, next);
+			defer_destroy(node);
+			deleted++;
+		}
+		pthread_mutex_destroy(&pool->queues[i].lock);
+	}
+	pr_val_debug("Deleted %u deferred certificates.", deleted);
+
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->cond);
+	free(pool->queues);
+	free(pool);
+}
+
+static int
+__certstack_create(struct defer_pool *pool, struct cert_stack **result)
 {
 	struct cert_stack *stack;
+	unsigned int index;
+
+	index = atomic_fetch_add(&pool->workers, 1);
+	if (index >= pool->capacity)
+		pr_crit("The defer pool only has room for %u workers.",
+		    pool->capacity);
 
 	stack = malloc(sizeof(struct cert_stack));
 	if (stack == NULL)
@@ -132,27 +231,51 @@ certstack_create(struct cert_stack **result)
 		return val_crypto_err("sk_X509_new_null() returned NULL");
 	}
 
-	SLIST_INIT(&stack->defers);
-	SLIST_INIT(&stack->metas);
-	SLIST_INIT(&stack->levels);
+	stack->pool = pool;
+	stack->defers = &pool->queues[index];
+	stack->traversing = false;
+	stack->victim = index + 1;
+	stack->meta = NULL;
 
 	*result = stack;
 	return 0;
 }
 
-static void
-defer_destroy(struct defer_node *defer)
+/**
+ * Creates the first worker's certificate stack, along with the pool the rest
+ * of the workers will join.
+ */
+int
+certstack_create(struct cert_stack **result)
 {
-	switch (defer->type) {
-	case DNT_SEPARATOR:
-		break;
-	case DNT_CERT:
-		uri_refput(defer->deferred.uri);
-		rpp_refput(defer->deferred.pp);
-		break;
-	}
+	struct defer_pool *pool;
+	int error;
 
-	free(defer);
+	pool = NULL; /* Warning killer */
+	error = pool_create(&pool);
+	if (error)
+		return error;
+
+	error = __certstack_create(pool, result);
+	if (error)
+		pool_refput(pool);
+	return error;
+}
+
+/**
+ * Creates another worker's certificate stack. It will share @sibling's
+ * deferred certificates.
+ */
+int
+certstack_create_worker(struct cert_stack *sibling, struct cert_stack **result)
+{
+	int error;
+
+	atomic_fetch_add(&sibling->pool->references, 1);
+	error = __certstack_create(sibling->pool, result);
+	if (error)
+		pool_refput(sibling->pool);
+	return error;
 }
 
 static void
@@ -173,55 +296,75 @@ static void
 meta_destroy(struct metadata_node *meta)
 {
 	uri_refput(meta->uri);
+	X509_free(meta->x509);
 	resources_destroy(meta->resources);
 	serial_numbers_cleanup(&meta->serials, serial_cleanup);
 	subjects_cleanup(&meta->subjects, subject_cleanup);
+	pthread_mutex_destroy(&meta->lock);
 	free(meta);
 }
 
-void
-certstack_destroy(struct cert_stack *stack)
+static void
+meta_refget(struct metadata_node *meta)
 {
-	unsigned int stack_size;
-	struct metadata_node *meta;
-	struct defer_node *post;
-	struct repo_level_node *level;
-
-	stack_size = 0;
-	while (!SLIST_EMPTY(&stack->defers)) {
-		post = SLIST_FIRST(&stack->defers);
-		SLIST_REMOVE_HEAD(&stack->defers, next);
-		defer_destroy(post);
-		stack_size++;
-	}
-	pr_val_debug("Deleted %u deferred certificates.", stack_size);
+	if (meta != NULL)
+		atomic_fetch_add(&meta->references, 1);
+}
 
-	pr_val_debug("Deleting %d stacked x509s.", sk_X509_num(stack->x509s));
-	sk_X509_pop_free(stack->x509s, X509_free);
+/* Also releases the ancestors that are no longer referenced. */
+static void
+meta_refput(struct metadata_node *meta)
+{
+	struct metadata_node *parent;
 
-	stack_size = 0;
-	while (!SLIST_EMPTY(&stack->metas)) {
-		meta = SLIST_FIRST(&stack->metas);
-		SLIST_REMOVE_HEAD(&stack->metas, next);
+	while (meta != NULL && atomic_fetch_sub(&meta->references, 1) == 1) {
+		parent = meta->parent;
 		meta_destroy(meta);
-		stack_size++;
+		meta = parent;
 	}
-	pr_val_debug("Deleted %u metadatas.", stack_size);
-
-	stack_size = 0;
-	while (!SLIST_EMPTY(&stack->levels)) {
-		level = SLIST_FIRST(&stack->levels);
-		SLIST_REMOVE_HEAD(&stack->levels, next);
-		free(level);
-		stack_size++;
+}
+
+static void
+defer_destroy(struct defer_node *defer)
+{
+	uri_refput(defer->deferred.uri);
+	rpp_refput(defer->deferred.pp);
+	meta_refput(defer->chain);
+	free(defer);
+}
+
+/* The certificate the last deferstack_pop() returned has been traversed. */
+static void
+task_done(struct cert_stack *stack)
+{
+	struct defer_pool *pool = stack->pool;
+
+	stack->traversing = false;
+	if (atomic_fetch_sub(&pool->pending, 1) == 1) {
+		/* That was the last one; wake everyone up so they can quit. */
+		pthread_mutex_lock(&pool->lock);
+		pthread_cond_broadcast(&pool->cond);
+		pthread_mutex_unlock(&pool->lock);
 	}
-	pr_val_debug("Deleted %u stacked levels.", stack_size);
+}
+
+void
+certstack_destroy(struct cert_stack *stack)
+{
+	if (stack->traversing)
+		task_done(stack);
+
+	pr_val_debug("Deleting %d stacked x509s.", sk_X509_num(stack->x509s));
+	sk_X509_free(stack->x509s);
+	meta_refput(stack->meta);
 
+	pool_refput(stack->pool);
 	free(stack);
 }
 
-int
-deferstack_push(struct cert_stack *stack, struct deferred_cert *deferred)
+static int
+defer_create(struct cert_stack *stack, struct deferred_cert *deferred,
+    struct defer_node **result)
 {
 	struct defer_node *node;
 
@@ -229,64 +372,188 @@ deferstack_push(struct cert_stack *stack, struct deferred_cert *deferred)
 	if (node == NULL)
 		return pr_enomem();
 
-	node->type = DNT_CERT;
 	node->deferred = *deferred;
 	uri_refget(deferred->uri);
 	rpp_refget(deferred->pp);
-	SLIST_INSERT_HEAD(&stack->defers, node, next);
+	node->chain = stack->meta;
+	meta_refget(node->chain);
+
+	*result = node;
 	return 0;
 }
 
 static void
-x509stack_pop(struct cert_stack *stack)
+defer_enqueue(struct cert_stack *stack, struct defer_node *node)
 {
-	X509 *cert;
-	struct metadata_node *meta;
-	struct repo_level_node *repo;
+	struct defer_pool *pool = stack->pool;
 
-	cert = sk_X509_pop(stack->x509s);
-	if (cert == NULL)
-		pr_crit("Attempted to pop empty X509 stack");
-	X509_free(cert);
+	atomic_fetch_add(&pool->available, 1);
+	pthread_mutex_lock(&stack->defers->lock);
+	TAILQ_INSERT_HEAD(&stack->defers->nodes, node, next);
+	pthread_mutex_unlock(&stack->defers->lock);
 
-	meta = SLIST_FIRST(&stack->metas);
-	if (meta == NULL)
-		pr_crit("Attempted to pop empty metadata stack");
-	SLIST_REMOVE_HEAD(&stack->metas, next);
-	meta_destroy(meta);
+	/*
+	 * Both counters are sequentially consistent, and idle workers
+	 * increase @idle before checking @available; either they see the new
+	 * certificate, or we see them.
+	 */
+	if (atomic_load(&pool->idle) > 0) {
+		pthread_mutex_lock(&pool->lock);
+		pthread_cond_signal(&pool->cond);
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+int
+deferstack_push(struct cert_stack *stack, struct deferred_cert *deferred)
+{
+	struct defer_node *node;
+	int error;
+
+	error = defer_create(stack, deferred, &node);
+	if (error)
+		return error;
+
+	atomic_fetch_add(&stack->pool->pending, 1);
+	defer_enqueue(stack, node);
+	return 0;
+}
+
+/**
+ * Puts the traversal of @deferred on hold. (Eg. because its repository has to
+ * be fetched first.) It will remember the current certificate chain, and the
+ * tree won't be considered done until somebody returns it to the pool through
+ * deferstack_unpark().
+ */
+int
+deferstack_park(struct cert_stack *stack, struct deferred_cert *deferred,
+    struct defer_node **result)
+{
+	int error;
+
+	error = defer_create(stack, deferred, result);
+	if (error)
+		return error;
+
+	atomic_fetch_add(&stack->pool->pending, 1);
+	return 0;
+}
 
-	repo = SLIST_FIRST(&stack->levels);
-	if (repo == NULL)
-		pr_crit("Attempted to pop empty repo level stack");
-	SLIST_REMOVE_HEAD(&stack->levels, next);
-	free(repo);
+/**
+ * Queues a certificate parked by deferstack_park(). (Any worker can call this,
+ * not just the one that parked it.)
+ */
+void
+deferstack_unpark(struct cert_stack *stack, struct defer_node *node)
+{
+	defer_enqueue(stack, node);
+}
+
+static struct defer_node *
+queue_take(struct defer_pool *pool, struct defer_queue *queue, bool head)
+{
+	struct defer_node *node;
+
+	pthread_mutex_lock(&queue->lock);
+	node = head
+	    ? TAILQ_FIRST(&queue->nodes)
+	    : TAILQ_LAST(&queue->nodes, defer_list);
+	if (node != NULL) {
+		TAILQ_REMOVE(&queue->nodes, node, next);
+		atomic_fetch_sub(&pool->available, 1);
+	}
+	pthread_mutex_unlock(&queue->lock);
+
+	return node;
+}
+
+static struct defer_node *
+steal(struct cert_stack *stack)
+{
+	struct defer_pool *pool = stack->pool;
+	struct defer_node *node;
+	unsigned int workers;
+	unsigned int i;
+
+	workers = atomic_load(&pool->workers);
+	for (i = 0; i < workers; i++) {
+		stack->victim %= workers;
+		if (&pool->queues[stack->victim] != stack->defers) {
+			node = queue_take(pool, &pool->queues[stack->victim],
+			    false);
+			if (node != NULL)
+				return node;
+		}
+		stack->victim++;
+	}
+
+	return NULL;
+}
+
+/* Makes @meta (and its ancestors) the current certificate chain. */
+static void
+chain_set(struct cert_stack *stack, struct metadata_node *meta)
+{
+	struct metadata_node *cursor;
+
+	if (stack->meta == meta)
+		return;
+
+	sk_X509_zero(stack->x509s);
+	for (cursor = meta; cursor != NULL; cursor = cursor->parent)
+		/* Capacity is reused, so this only allocates while warming up */
+		if (sk_X509_unshift(stack->x509s, cursor->x509) <= 0)
+			pr_crit("Could not rebuild the certificate chain.");
+
+	meta_refget(meta);
+	meta_refput(stack->meta);
+	stack->meta = meta;
 }
 
 /**
+ * Returns the next certificate to traverse. It comes from the worker's own
+ * defer stack if possible, or is stolen from another worker's otherwise.
+ * Blocks while other workers are still traversing (since they might defer
+ * more certificates), and it also marks the previously returned certificate
+ * as finished, so don't call it until you're done with it.
+ *
  * Contract: Returns either 0 or -ENOENT. No other outcomes.
+ * -ENOENT means the entire tree has been traversed.
  */
 int
 deferstack_pop(struct cert_stack *stack, struct deferred_cert *result)
 {
+	struct defer_pool *pool = stack->pool;
 	struct defer_node *node;
 
-again:	node = SLIST_FIRST(&stack->defers);
+	if (stack->traversing)
+		task_done(stack);
+
+	do {
+		node = queue_take(pool, stack->defers, true);
+		if (node == NULL)
+			node = steal(stack);
+		if (node != NULL)
+			break;
+
+		pthread_mutex_lock(&pool->lock);
+		atomic_fetch_add(&pool->idle, 1);
+		while (atomic_load(&pool->available) == 0
+		    && atomic_load(&pool->pending) != 0)
+			pthread_cond_wait(&pool->cond, &pool->lock);
+		atomic_fetch_sub(&pool->idle, 1);
+		pthread_mutex_unlock(&pool->lock);
+	} while (atomic_load(&pool->pending) != 0);
+
 	if (node == NULL)
 		return -ENOENT;
 
-	if (node->type == DNT_SEPARATOR) {
-		x509stack_pop(stack);
-
-		SLIST_REMOVE_HEAD(&stack->defers, next);
-		defer_destroy(node);
-		goto again;
-	}
+	chain_set(stack, node->chain);
+	stack->traversing = true;
 
 	*result = node->deferred;
 	uri_refget(node->deferred.uri);
 	rpp_refget(node->deferred.pp);
-
-	SLIST_REMOVE_HEAD(&stack->defers, next);
 	defer_destroy(node);
 	return 0;
 }
@@ -294,7 +561,7 @@ again:	node = SLIST_FIRST(&stack->defers);
 bool
 deferstack_is_empty(struct cert_stack *stack)
 {
-	return SLIST_EMPTY(&stack->defers);
+	return atomic_load(&stack->pool->pending) == 0;
 }
 
 /** Steals ownership of @x509 on success. */
@@ -303,29 +570,18 @@ x509stack_push(struct cert_stack *stack, struct rpki_uri *uri, X509 *x509,
     enum rpki_policy policy, enum cert_type type)
 {
 	struct metadata_node *meta;
-	struct repo_level_node *repo, *head_repo;
-	struct defer_node *defer_separator;
 	unsigned int work_repo_level;
 	int ok;
 	int error;
 
-	repo = malloc(sizeof(struct repo_level_node));
-	if (repo == NULL)
+	meta = malloc(sizeof(struct metadata_node));
+	if (meta == NULL)
 		return pr_enomem();
 
-	repo->level = 0;
+	meta->level = 0;
 	work_repo_level = working_repo_peek_level();
-	head_repo = SLIST_FIRST(&stack->levels);
-	if (head_repo != NULL && work_repo_level > head_repo->level)
-		repo->level = work_repo_level;
-
-	SLIST_INSERT_HEAD(&stack->levels, repo, next);
-
-	meta = malloc(sizeof(struct metadata_node));
-	if (meta == NULL) {
-		error = pr_enomem();
-		goto end3;
-	}
+	if (stack->meta != NULL && work_repo_level > stack->meta->level)
+		meta->level = work_repo_level;
 
 	meta->uri = uri;
 	uri_refget(uri);
@@ -354,13 +610,6 @@ x509stack_push(struct cert_stack *stack, struct rpki_uri *uri, X509 *x509,
 		goto end5;
 	}
 
-	defer_separator = malloc(sizeof(struct defer_node));
-	if (defer_separator == NULL) {
-		error = pr_enomem();
-		goto end5;
-	}
-	defer_separator->type = DNT_SEPARATOR;
-
 	ok = sk_X509_push(stack->x509s, x509);
 	if (ok <= 0) {
 		error = val_crypto_err(
@@ -368,8 +617,11 @@ x509stack_push(struct cert_stack *stack, struct rpki_uri *uri, X509 *x509,
 		goto end5;
 	}
 
-	SLIST_INSERT_HEAD(&stack->defers, defer_separator, next);
-	SLIST_INSERT_HEAD(&stack->metas, meta, next);
+	meta->x509 = x509;
+	pthread_mutex_init(&meta->lock, NULL);
+	meta->parent = stack->meta; /* Inherits the stack's reference */
+	atomic_init(&meta->references, 1);
+	stack->meta = meta;
 
 	return 0;
 
@@ -378,7 +630,6 @@ end4:	subjects_cleanup(&meta->subjects, subject_cleanup);
 	serial_numbers_cleanup(&meta->serials, serial_cleanup);
 	uri_refput(meta->uri);
 	free(meta);
-end3:	free(repo);
 	return error;
 }
 
@@ -392,15 +643,17 @@ end3:	free(repo);
 void
 x509stack_cancel(struct cert_stack *stack)
 {
-	struct defer_node *defer_separator;
+	struct metadata_node *meta;
 
-	x509stack_pop(stack);
+	meta = stack->meta;
+	if (meta == NULL)
+		pr_crit("Attempted to pop empty metadata stack");
+	if (sk_X509_pop(stack->x509s) == NULL)
+		pr_crit("Attempted to pop empty X509 stack");
 
-	defer_separator = SLIST_FIRST(&stack->defers);
-	if (defer_separator == NULL)
-		pr_crit("Attempted to pop empty defer stack");
-	SLIST_REMOVE_HEAD(&stack->defers, next);
-	defer_destroy(defer_separator);
+	stack->meta = meta->parent;
+	meta_refget(stack->meta);
+	meta_refput(meta);
 }
 
 X509 *
@@ -413,22 +666,19 @@ x509stack_peek(struct cert_stack *stack)
 struct rpki_uri *
 x509stack_peek_uri(struct cert_stack *stack)
 {
-	struct metadata_node *meta = SLIST_FIRST(&stack->metas);
-	return (meta != NULL) ? meta->uri : NULL;
+	return (stack->meta != NULL) ? stack->meta->uri : NULL;
 }
 
 struct resources *
 x509stack_peek_resources(struct cert_stack *stack)
 {
-	struct metadata_node *meta = SLIST_FIRST(&stack->metas);
-	return (meta != NULL) ? meta->resources : NULL;
+	return (stack->meta != NULL) ? stack->meta->resources : NULL;
 }
 
 unsigned int
 x509stack_peek_level(struct cert_stack *stack)
 {
-	struct repo_level_node *repo = SLIST_FIRST(&stack->levels);
-	return (repo != NULL) ? repo->level : 0;
+	return (stack->meta != NULL) ? stack->meta->level : 0;
 }
 
 static int
@@ -468,7 +718,7 @@ x509stack_store_serial(struct cert_stack *stack, BIGNUM *number)
 
 	/* Remember to free @number if you return 0 but don't store it. */
 
-	meta = SLIST_FIRST(&stack->metas);
+	meta = stack->meta;
 	if (meta == NULL) {
 		BN_free(number);
 		return 0; /* The TA lacks siblings, so serial is unique. */
@@ -495,6 +745,7 @@ x509stack_store_serial(struct cert_stack *stack, BIGNUM *number)
 	 *
 	 * TODO I haven't seen this warning in a while. Review.
 	 */
+	pthread_mutex_lock(&meta->lock); /* Siblings might be racing us */
 	ARRAYLIST_FOREACH(&meta->serials, cursor, i) {
 		if (BN_cmp(cursor->number, number) == 0) {
 			BN2string(number, &string);
@@ -502,19 +753,22 @@ x509stack_store_serial(struct cert_stack *stack, BIGNUM *number)
 			    string, cursor->file);
 			BN_free(number);
 			free(string);
-			return 0;
+			error = 0;
+			goto end;
 		}
 	}
 
 	duplicate.number = number;
 	error = get_current_file_name(&duplicate.file);
 	if (error)
-		return error;
+		goto end;
 
 	error = serial_numbers_add(&meta->serials, &duplicate);
 	if (error)
 		free(duplicate.file);
 
+end:
+	pthread_mutex_unlock(&meta->lock);
 	return error;
 }
 
@@ -575,17 +829,18 @@ x509stack_store_subject(struct cert_stack *stack, struct rfc5280_name *subject,
 	 *
 	 */
 
-	meta = SLIST_FIRST(&stack->metas);
+	meta = stack->meta;
 	if (meta == NULL)
 		return 0; /* The TA lacks siblings, so subject is unique. */
 
 	/* See the large comment in certstack_x509_store_serial(). */
 	duplicated = false;
+	pthread_mutex_lock(&meta->lock);
 	ARRAYLIST_FOREACH(&meta->subjects, cursor, i) {
 		if (x509_name_equals(cursor->name, subject)) {
 			error = cb(&duplicated, cursor->file, arg);
 			if (error)
-				return error;
+				goto end;
 
 			if (!duplicated)
 				continue;
@@ -596,7 +851,8 @@ x509stack_store_subject(struct cert_stack *stack, struct rfc5280_name *subject,
 			    (serial != NULL) ? "/" : "",
 			    (serial != NULL) ? serial : "",
 			    cursor->file);
-			return 0;
+			error = 0;
+			goto end;
 		}
 	}
 
@@ -611,12 +867,14 @@ x509stack_store_subject(struct cert_stack *stack, struct rfc5280_name *subject,
 	if (error)
 		goto revert_file;
 
-	return 0;
+	goto end;
 
 revert_file:
 	free(duplicate.file);
 revert_name:
 	x509_name_put(subject);
+end:
+	pthread_mutex_unlock(&meta->lock);
 	return error;
 }
 
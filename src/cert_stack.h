@@ -9,9 +9,9 @@
 #include "object/name.h"
 
 /*
- * One certificate stack is allocated per validation cycle, and it is used
- * through its entirety to hold the certificates relevant to the ongoing
- * validation.
+ * One certificate stack is allocated per validation worker, and it is used
+ * through the worker's entirety to hold the certificates relevant to the
+ * ongoing validation.
  *
  * Keep in mind: This module deals with two different (but correlated) stack
  * data structures, and they both store "certificates" (albeit in different
@@ -22,24 +22,43 @@
  *   list, and haven't been opened yet.)
  *   It prevents us from having to validate the RPKI tree in a recursive manner,
  *   which would be prone to stack overflow.
+ *   The defer stacks of all the workers that traverse the same TAL form a
+ *   pool. A worker whose stack runs dry steals certificates from the others,
+ *   so a single large tree can keep all of them busy.
+ *   Certificates whose repository is still being fetched are parked outside
+ *   of the stacks, and return to them once the fetch is done.
  * - x509 stack: It is a chain of certificates, ready to be validated by
  *   libcrypto.
  *   For any given certificate being validated, this stack stores all of its
- *   parents.
+ *   parents. Every deferred certificate remembers the chain it was found in,
+ *   so any worker can pick it up.
  */
 
 struct cert_stack;
+struct defer_node;
 
 struct deferred_cert {
 	struct rpki_uri *uri;
 	struct rpp *pp;
+	/* Was the parent's repository fetched through RRDP? */
+	bool rrdp_workspace;
+	/*
+	 * If the certificate was already being traversed, but had to wait for
+	 * its repository, this is where the traversal should resume.
+	 * NULL otherwise.
+	 */
+	struct ca_fetch *fetch;
 };
 
 int certstack_create(struct cert_stack **);
+int certstack_create_worker(struct cert_stack *, struct cert_stack **);
 void certstack_destroy(struct cert_stack *);
 
 int deferstack_push(struct cert_stack *, struct deferred_cert *cert);
 int deferstack_pop(struct cert_stack *, struct deferred_cert *cert);
+int deferstack_park(struct cert_stack *, struct deferred_cert *,
+    struct defer_node **);
+void deferstack_unpark(struct cert_stack *, struct defer_node *);
 bool deferstack_is_empty(struct cert_stack *);
 
 int x509stack_push(struct cert_stack *, struct rpki_uri *, X509 *,
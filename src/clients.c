@@ -32,7 +32,7 @@ clients_db_init(void)
 }
 
 static struct hashable_client *
-create_client(int fd, struct sockaddr_storage addr, pthread_t tid)
+create_client(int fd, struct sockaddr_storage addr)
 {
 	struct hashable_client *client;
 
@@ -46,7 +46,6 @@ create_client(int fd, struct sockaddr_storage addr, pthread_t tid)
 	client->meat.serial_number_set = false;
 	client->meat.rtr_version_set = false;
 	client->meat.addr = addr;
-	client->meat.tid = tid;
 
 	return client;
 }
@@ -55,12 +54,12 @@ create_client(int fd, struct sockaddr_storage addr, pthread_t tid)
  * If the client whose file descriptor is @fd isn't already stored, store it.
  */
 int
-clients_add(int fd, struct sockaddr_storage addr, pthread_t tid)
+clients_add(int fd, struct sockaddr_storage addr)
 {
 	struct hashable_client *new_client;
 	struct hashable_client *old_client;
 
-	new_client = create_client(fd, addr, tid);
+	new_client = create_client(fd, addr);
 	if (new_client == NULL)
 		return pr_enomem();
 
@@ -231,17 +230,15 @@ clients_foreach(clients_foreach_cb cb, void *arg)
 }
 
 /*
- * Destroy the clients DB, the @join_thread_cb will be made for each thread
- * that was started by the parent process (@arg will be sent at that call).
+ * Destroy the clients DB. The connections are owned by the event loops (see
+ * rtr/event_loop.c), which are expected to have been stopped already.
  */
 void
-clients_db_destroy(join_thread_cb cb, void *arg)
+clients_db_destroy(void)
 {
 	struct hashable_client *node, *tmp;
 
 	HASH_ITER(hh, db.clients, node, tmp) {
-		/* Not much to do on failure */
-		cb(node->meat.tid, arg);
 		HASH_DEL(db.clients, node);
 		free(node);
 	}
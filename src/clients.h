@@ -10,11 +10,6 @@
 struct client {
 	int fd;
 	struct sockaddr_storage addr;
-	/*
-	 * The join should be made when the db is cleared, so the main process
-	 * should do it.
-	 */
-	pthread_t tid;
 
 	serial_t serial_number;
 	bool serial_number_set;
@@ -25,7 +20,7 @@ struct client {
 
 int clients_db_init(void);
 
-int clients_add(int, struct sockaddr_storage, pthread_t);
+int clients_add(int, struct sockaddr_storage);
 void clients_update_serial(int, serial_t);
 void clients_forget(int);
 typedef int (*clients_foreach_cb)(struct client *, void *);
@@ -36,7 +31,6 @@ int clients_get_addr(int, struct sockaddr_storage *);
 int clients_set_rtr_version(int, uint8_t);
 int clients_get_rtr_version_set(int, bool *, uint8_t *);
 
-typedef int (*join_thread_cb)(pthread_t, void *);
-void clients_db_destroy(join_thread_cb, void *);
+void clients_db_destroy(void);
 
 #endif /* SRC_CLIENTS_H_ */
@@ -279,6 +279,14 @@ dir_exists(char const *path, bool *result)
 	return 0;
 }
 
+/*
+ * Other threads might be deleting empty directories meanwhile (see
+ * delete_dir_recursive_bottom_up()), so a parent can vanish right after it was
+ * created. That many walks are attempted before giving up.
+ */
+#define CREATE_DIR_ATTEMPTS 4
+
+/* Returns -ENOENT, without logging, if the parent directory is missing. */
 static int
 create_dir(char *path)
 {
@@ -286,6 +294,8 @@ create_dir(char *path)
 
 	error = mkdir(path, 0777);
 
+	if (error && errno == ENOENT)
+		return -ENOENT;
 	if (error && errno != EEXIST)
 		return pr_op_errno(errno, "Error while making directory '%s'",
 		    path);
@@ -301,6 +311,7 @@ int
 create_dir_recursive(char const *path)
 {
 	char *localuri;
+	unsigned int attempt;
 	int i, error;
 	bool exist = false;
 
@@ -314,21 +325,27 @@ create_dir_recursive(char const *path)
 	if (localuri == NULL)
 		return pr_enomem();
 
-	for (i = 1; localuri[i] != '\0'; i++) {
-		if (localuri[i] == '/') {
-			localuri[i] = '\0';
-			error = create_dir(localuri);
-			localuri[i] = '/';
-			if (error) {
-				/* error msg already printed */
-				free(localuri);
-				return error;
+	for (attempt = 1; attempt <= CREATE_DIR_ATTEMPTS; attempt++) {
+		for (i = 1; localuri[i] != '\0'; i++) {
+			if (localuri[i] == '/') {
+				localuri[i] = '\0';
+				error = create_dir(localuri);
+				localuri[i] = '/';
+				if (error)
+					break;
 			}
 		}
+		if (error != -ENOENT)
+			break;
 	}
 
+	if (error == -ENOENT)
+		pr_op_err("Error while making the parent directories of '%s': A parent keeps disappearing.",
+		    path);
+
+	/* Other error messages already printed */
 	free(localuri);
-	return 0;
+	return error;
 }
 
 static int
@@ -393,8 +410,11 @@ delete_dir_recursive_bottom_up(char const *path)
 		if (!error)
 			continue; /* Keep deleting up */
 
-		/* Stop if there's content in the dir */
-		if (errno == ENOTEMPTY || errno == EEXIST)
+		/*
+		 * Stop if there's content in the dir, or if somebody else
+		 * already deleted it
+		 */
+		if (errno == ENOTEMPTY || errno == EEXIST || errno == ENOENT)
 			break;
 
 		error = pr_op_errno(errno, "Couldn't delete dir %s", work_loc);
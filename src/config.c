@@ -50,6 +50,18 @@ struct rpki_config {
 	 * Prevents arbitrarily long paths and loops.
 	 */
 	unsigned int maximum_certificate_depth;
+	/** Number of threads that traverse each TAL's tree */
+	unsigned int validation_workers;
+	/** Number of threads that fetch each TAL's repositories */
+	unsigned int fetch_workers;
+	/** Maximum simultaneous fetches from the same server */
+	unsigned int max_fetches_per_host;
+	/** Keep the RRDP objects in a pack file instead of one file each */
+	bool rrdp_object_store;
+	/** Megabytes of decoded objects kept between validation cycles */
+	unsigned int object_cache_encoded_size;
+	/** Number of threads that verify signatures in batches */
+	unsigned int signature_workers;
 	/** File or directory where the .slurm file(s) is(are) located */
 	char *slurm;
 	/* Run as RTR server or standalone validation */
@@ -67,6 +79,10 @@ struct rpki_config {
 		char *port;
 		/** Outstanding connections in the socket's listen queue */
 		unsigned int backlog;
+		/** Number of threads that serve the RTR clients */
+		unsigned int workers;
+		/** Response bytes that are buffered before writing them */
+		unsigned int flush_threshold;
 
 		struct {
 			/** Interval used to look for updates at VRPs location */
@@ -77,6 +93,15 @@ struct rpki_config {
 		} interval;
 	} server;
 
+	struct {
+		/** Address (or UNIX socket path) the metrics are served at */
+		char *address;
+		/** Port of @address, if it's not a socket */
+		char *port;
+		/** Spans each thread remembers for /trace; 0 disables tracing */
+		unsigned int trace_spans;
+	} metrics;
+
 	struct {
 		/* Enables the protocol */
 		bool enabled;
@@ -292,6 +317,52 @@ static const struct option_field options[] = {
 		 * overflow and will never be bigger than this.
 		 */
 		.max = UINT_MAX - 1,
+	}, {
+		.id = 1006,
+		.name = "validation-workers",
+		.type = &gt_uint,
+		.offset = offsetof(struct rpki_config, validation_workers),
+		.doc = "Number of threads that validate each TAL's tree",
+		.min = 1,
+		.max = 128,
+	}, {
+		.id = 1007,
+		.name = "fetch-workers",
+		.type = &gt_uint,
+		.offset = offsetof(struct rpki_config, fetch_workers),
+		.doc = "Number of threads that fetch each TAL's repositories in the background (0 fetches them synchronously)",
+		.min = 0,
+		.max = 128,
+	}, {
+		.id = 1008,
+		.name = "maximum-fetches-per-host",
+		.type = &gt_uint,
+		.offset = offsetof(struct rpki_config, max_fetches_per_host),
+		.doc = "Maximum number of simultaneous fetches from the same server",
+		.min = 1,
+		.max = 128,
+	}, {
+		.id = 1009,
+		.name = "rrdp-object-store",
+		.type = &gt_bool,
+		.offset = offsetof(struct rpki_config, rrdp_object_store),
+		.doc = "Store the RRDP objects in a single pack file, instead of one file per object",
+	}, {
+		.id = 1010,
+		.name = "object-cache-encoded-size",
+		.type = &gt_uint,
+		.offset = offsetof(struct rpki_config, object_cache_encoded_size),
+		.doc = "Maximum combined size (in megabytes) of the encoded forms of the decoded objects kept between validation cycles (0 disables the cache)",
+		.min = 0,
+		.max = 65536,
+	}, {
+		.id = 1011,
+		.name = "signature-workers",
+		.type = &gt_uint,
+		.offset = offsetof(struct rpki_config, signature_workers),
+		.doc = "Number of threads that verify the signatures of each publication point in parallel (0 verifies them during the traversal)",
+		.min = 0,
+		.max = 128,
 	}, {
 		.id = 1003,
 		.name = "slurm",
@@ -403,6 +474,46 @@ static const struct option_field options[] = {
 		 */
 		.min = 600,
 		.max = 172800,
+	}, {
+		.id = 5007,
+		.name = "server.workers",
+		.type = &gt_uint,
+		.offset = offsetof(struct rpki_config, server.workers),
+		.doc = "Number of threads that serve the RTR clients",
+		.min = 1,
+		.max = 128,
+	}, {
+		.id = 5008,
+		.name = "server.flush-threshold",
+		.type = &gt_uint,
+		.offset = offsetof(struct rpki_config, server.flush_threshold),
+		.doc = "Number of response bytes the RTR server accumulates before writing them to the client's socket",
+		.min = 1,
+		.max = 16777216,
+	},
+
+	/* Metrics fields */
+	{
+		.id = 11000,
+		.name = "metrics.address",
+		.type = &gt_string,
+		.offset = offsetof(struct rpki_config, metrics.address),
+		.doc = "Address (or absolute path of a UNIX socket) where the Prometheus metrics will be served over HTTP. Metrics aren't served if unset.",
+		.arg_doc = "<address>",
+	}, {
+		.id = 11001,
+		.name = "metrics.port",
+		.type = &gt_string,
+		.offset = offsetof(struct rpki_config, metrics.port),
+		.doc = "Port of the metrics address. Can be a string, in which case a number will be resolved.",
+	}, {
+		.id = 11002,
+		.name = "metrics.trace-spans",
+		.type = &gt_uint,
+		.offset = offsetof(struct rpki_config, metrics.trace_spans),
+		.doc = "Number of recent timing spans each thread remembers, to be exported at the /trace path of the metrics server (0 disables tracing)",
+		.min = 0,
+		.max = 1048576,
 	},
 
 	/* RSYNC fields */
@@ -885,23 +996,39 @@ set_default_values(void)
 	}
 
 	rpki_config.server.backlog = SOMAXCONN;
+	rpki_config.server.workers = 2;
+	rpki_config.server.flush_threshold = 65536;
 	rpki_config.server.interval.validation = 3600;
 	rpki_config.server.interval.refresh = 3600;
 	rpki_config.server.interval.retry = 600;
 	rpki_config.server.interval.expire = 7200;
 
+	rpki_config.metrics.address = NULL;
+	rpki_config.metrics.trace_spans = 0;
+	rpki_config.metrics.port = strdup("9324");
+	if (rpki_config.metrics.port == NULL) {
+		error = pr_enomem();
+		goto revert_port;
+	}
+
 	rpki_config.tal = NULL;
 	rpki_config.slurm = NULL;
 
 	rpki_config.local_repository = strdup("/tmp/fort/repository");
 	if (rpki_config.local_repository == NULL) {
 		error = pr_enomem();
-		goto revert_port;
+		goto revert_metrics_port;
 	}
 
 	rpki_config.sync_strategy = RSYNC_ROOT_EXCEPT_TA;
 	rpki_config.shuffle_tal_uris = false;
 	rpki_config.maximum_certificate_depth = 32;
+	rpki_config.validation_workers = 4;
+	rpki_config.fetch_workers = 8;
+	rpki_config.max_fetches_per_host = 2;
+	rpki_config.rrdp_object_store = false;
+	rpki_config.object_cache_encoded_size = 64;
+	rpki_config.signature_workers = 4;
 	rpki_config.mode = SERVER;
 	rpki_config.work_offline = false;
 
@@ -992,6 +1119,8 @@ revert_rsync_program:
 	free(rpki_config.rsync.program);
 revert_repository:
 	free(rpki_config.local_repository);
+revert_metrics_port:
+	free(rpki_config.metrics.port);
 revert_port:
 	free(rpki_config.server.port);
 revert_address:
@@ -1178,6 +1307,36 @@ config_get_server_queue(void)
 	return rpki_config.server.backlog;
 }
 
+unsigned int
+config_get_server_workers(void)
+{
+	return rpki_config.server.workers;
+}
+
+unsigned int
+config_get_server_flush_threshold(void)
+{
+	return rpki_config.server.flush_threshold;
+}
+
+char const *
+config_get_metrics_address(void)
+{
+	return rpki_config.metrics.address;
+}
+
+char const *
+config_get_metrics_port(void)
+{
+	return rpki_config.metrics.port;
+}
+
+unsigned int
+config_get_metrics_trace_spans(void)
+{
+	return rpki_config.metrics.trace_spans;
+}
+
 bool
 config_get_work_offline(void)
 {
@@ -1238,6 +1397,42 @@ config_get_max_cert_depth(void)
 	return rpki_config.maximum_certificate_depth;
 }
 
+unsigned int
+config_get_validation_workers(void)
+{
+	return rpki_config.validation_workers;
+}
+
+unsigned int
+config_get_fetch_workers(void)
+{
+	return rpki_config.fetch_workers;
+}
+
+unsigned int
+config_get_max_fetches_per_host(void)
+{
+	return rpki_config.max_fetches_per_host;
+}
+
+bool
+config_get_rrdp_object_store(void)
+{
+	return rpki_config.rrdp_object_store;
+}
+
+unsigned int
+config_get_object_cache_encoded_size(void)
+{
+	return rpki_config.object_cache_encoded_size;
+}
+
+unsigned int
+config_get_signature_workers(void)
+{
+	return rpki_config.signature_workers;
+}
+
 bool
 config_get_op_log_enabled(void)
 {
@@ -19,6 +19,11 @@ void free_rpki_config(void);
 struct string_array const *config_get_server_address(void);
 char const *config_get_server_port(void);
 int config_get_server_queue(void);
+unsigned int config_get_server_workers(void);
+unsigned int config_get_server_flush_threshold(void);
+char const *config_get_metrics_address(void);
+char const *config_get_metrics_port(void);
+unsigned int config_get_metrics_trace_spans(void);
 unsigned int config_get_validation_interval(void);
 unsigned int config_get_interval_refresh(void);
 unsigned int config_get_interval_retry(void);
@@ -29,6 +34,12 @@ char const *config_get_tal(void);
 char const *config_get_local_repository(void);
 bool config_get_shuffle_tal_uris(void);
 unsigned int config_get_max_cert_depth(void);
+unsigned int config_get_validation_workers(void);
+unsigned int config_get_fetch_workers(void);
+unsigned int config_get_max_fetches_per_host(void);
+bool config_get_rrdp_object_store(void);
+unsigned int config_get_object_cache_encoded_size(void);
+unsigned int config_get_signature_workers(void);
 enum mode config_get_mode(void);
 bool config_get_work_offline(void);
 char const *config_get_http_user_agent(void);
@@ -6,6 +6,7 @@
 #include <openssl/bio.h>
 
 int base64_decode(BIO *, unsigned char *, bool, size_t, size_t *);
+int base64_decode_str(char const *, size_t, unsigned char *, size_t *);
 int base64url_decode(char const *, unsigned char **, size_t *);
 
 int base64url_encode(unsigned char const *, int, char **);
@@ -2,13 +2,16 @@
 
 #include <errno.h>
 #include <openssl/evp.h>
+#include <openssl/sha.h>
 #include <sys/stat.h>
 #include <sys/types.h> /* For blksize_t */
 
 #include "common.h"
 #include "file.h"
 #include "log.h"
+#include "object_store.h"
 #include "asn1/oid.h"
+#include "crypto/hash_cache.h"
 
 static int
 get_md(char const *algorithm, EVP_MD const **result)
@@ -33,12 +36,56 @@ hash_matches(unsigned char const *expected, size_t expected_len,
 	    && (memcmp(expected, actual, expected_len) == 0);
 }
 
+/* hash_local_file(), except unchanged files are only hashed once. */
 static int
-hash_file(char const *algorithm, struct rpki_uri *uri, unsigned char *result,
-    unsigned int *result_len)
+hash_local_file_cached(char const *algorithm, char const *path,
+    unsigned char *result, unsigned int *result_len)
+{
+	struct stat meta;
+	int error;
+
+	if (strcmp(algorithm, "sha256") != 0 || stat(path, &meta) != 0)
+		return hash_local_file(algorithm, path, result, result_len);
+
+	if (hash_cache_get(path, &meta, result)) {
+		*result_len = SHA256_DIGEST_LENGTH;
+		return 0;
+	}
+
+	error = hash_local_file(algorithm, path, result, result_len);
+	if (!error)
+		hash_cache_put(path, &meta, result);
+
+	return error;
+}
+
+/*
+ * @cached: Is @uri a repository object? (As opposed to a transient file, such
+ * as an RRDP delta.) If so, its hash is remembered for the next cycles.
+ */
+static int
+hash_file(char const *algorithm, struct rpki_uri *uri, bool cached,
+    unsigned char *result, unsigned int *result_len)
 {
-	return hash_local_file(algorithm, uri_get_local(uri), result,
-		result_len);
+	struct stored_object object;
+
+	if (object_store_get(uri_get_local(uri), &object) != 0) {
+		if (cached)
+			return hash_local_file_cached(algorithm,
+			    uri_get_local(uri), result, result_len);
+		return hash_local_file(algorithm, uri_get_local(uri), result,
+		    result_len);
+	}
+
+	/* The store already knows this one. */
+	if (strcmp(algorithm, "sha256") == 0) {
+		memcpy(result, object.sha256, SHA256_DIGEST_LENGTH);
+		*result_len = SHA256_DIGEST_LENGTH;
+		return 0;
+	}
+
+	return hash_buffer(algorithm, object.content, object.content_len,
+	    result, result_len);
 }
 
 int
@@ -131,7 +178,7 @@ hash_validate_mft_file(char const *algorithm, struct rpki_uri *uri,
 		return pr_val_err("Hash string has unused bits.");
 
 	do {
-		error = hash_file(algorithm, uri, actual, &actual_len);
+		error = hash_file(algorithm, uri, true, actual, &actual_len);
 		if (!error)
 			break;
 
@@ -168,7 +215,7 @@ hash_validate_file(char const *algorithm, struct rpki_uri *uri,
 	unsigned int actual_len;
 	int error;
 
-	error = hash_file(algorithm, uri, actual, &actual_len);
+	error = hash_file(algorithm, uri, false, actual, &actual_len);
 	if (error)
 		return error;
 
@@ -180,7 +227,7 @@ hash_validate_file(char const *algorithm, struct rpki_uri *uri,
 	return 0;
 }
 
-static int
+int
 hash_buffer(char const *algorithm,
     unsigned char const *content, size_t content_len,
     unsigned char *hash, unsigned int *hash_len)
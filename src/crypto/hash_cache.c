@@ -0,0 +1,324 @@
+#include "crypto/hash_cache.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/sha.h>
+
+#include "config.h"
+#include "file.h"
+#include "line_file.h"
+#include "log.h"
+#include "data_structure/uthash_nonfatal.h"
+
+#define CACHE_NAME "hash.cache"
+#define CACHE_VERSION 1
+
+struct cached_hash {
+	/* key */
+	char *path;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	unsigned char sha256[SHA256_DIGEST_LENGTH];
+	/* Was the file looked up (or written) since the last save? */
+	bool used;
+	UT_hash_handle hh;
+};
+
+static struct cached_hash *cache;
+
+/* Guards @cache. */
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool
+same_file(struct cached_hash *hash, struct stat const *meta)
+{
+	return hash->ino == meta->st_ino
+	    && hash->size == meta->st_size
+	    && hash->mtime.tv_sec == meta->st_mtim.tv_sec
+	    && hash->mtime.tv_nsec == meta->st_mtim.tv_nsec;
+}
+
+static void
+cached_hash_destroy(struct cached_hash *hash)
+{
+	free(hash->path);
+	free(hash);
+}
+
+/* Call with @cache_lock held. */
+static int
+cached_hash_add(char const *path, struct cached_hash **result)
+{
+	struct cached_hash *hash;
+
+	hash = malloc(sizeof(struct cached_hash));
+	if (hash == NULL)
+		return pr_enomem();
+	/* Needed by uthash */
+	memset(hash, 0, sizeof(struct cached_hash));
+
+	hash->path = strdup(path);
+	if (hash->path == NULL) {
+		free(hash);
+		return pr_enomem();
+	}
+
+	errno = 0;
+	HASH_ADD_KEYPTR(hh, cache, hash->path, strlen(hash->path), hash);
+	if (errno) {
+		cached_hash_destroy(hash);
+		return pr_enomem();
+	}
+
+	*result = hash;
+	return 0;
+}
+
+static void
+cache_destroy(void)
+{
+	struct cached_hash *hash, *tmp;
+
+	HASH_ITER(hh, cache, hash, tmp) {
+		HASH_DEL(cache, hash);
+		cached_hash_destroy(hash);
+	}
+}
+
+static int
+get_cache_path(char **result)
+{
+	char const *repository;
+	char *path;
+
+	repository = config_get_local_repository();
+	path = malloc(strlen(repository) + strlen(CACHE_NAME) + 2);
+	if (path == NULL)
+		return pr_enomem();
+	sprintf(path, "%s/%s", repository, CACHE_NAME);
+
+	*result = path;
+	return 0;
+}
+
+/*
+ * The cache file has a version line, followed by one line per file:
+ *
+ * 	<inode> <size> <mtime seconds> <mtime nanoseconds> <SHA-256> <path>
+ */
+static int
+load_line(char const *line)
+{
+	unsigned long long ino;
+	long long size, sec;
+	long nsec;
+	char hex[2 * SHA256_DIGEST_LENGTH + 1];
+	int path_start;
+	struct cached_hash *hash;
+	unsigned int i;
+	int error;
+
+	path_start = 0;
+	if (sscanf(line, "%llu %lld %lld %ld %64s %n", &ino, &size, &sec,
+	    &nsec, hex, &path_start) != 5 || path_start == 0 ||
+	    line[path_start] == '\0')
+		return -EINVAL;
+	if (strlen(hex) != 2 * SHA256_DIGEST_LENGTH)
+		return -EINVAL;
+
+	HASH_FIND_STR(cache, line + path_start, hash);
+	if (hash != NULL)
+		return -EINVAL;
+
+	error = cached_hash_add(line + path_start, &hash);
+	if (error)
+		return error;
+
+	hash->ino = ino;
+	hash->size = size;
+	hash->mtime.tv_sec = sec;
+	hash->mtime.tv_nsec = nsec;
+	hash->used = false;
+	for (i = 0; i < SHA256_DIGEST_LENGTH; i++)
+		if (sscanf(hex + 2 * i, "%2hhx", &hash->sha256[i]) != 1)
+			return -EINVAL;
+
+	return 0;
+}
+
+static int
+load_cache(char const *path)
+{
+	struct line_file *lfile;
+	char *line;
+	unsigned int version;
+	int error;
+
+	error = lfile_open(path, &lfile);
+	if (error)
+		return error;
+
+	error = lfile_read(lfile, &line);
+	if (error)
+		goto end;
+	if (line == NULL || sscanf(line, "fort-hash-cache %u", &version) != 1
+	    || version != CACHE_VERSION) {
+		free(line);
+		error = -EINVAL;
+		goto end;
+	}
+	free(line);
+
+	do {
+		error = lfile_read(lfile, &line);
+		if (error)
+			goto end;
+		if (line == NULL)
+			break;
+
+		error = load_line(line);
+		free(line);
+		if (error)
+			goto end;
+	} while (true);
+
+	pr_op_debug("Recovered the hashes of %u files.", HASH_COUNT(cache));
+end:
+	lfile_close(lfile);
+	return error;
+}
+
+int
+hash_cache_init(void)
+{
+	char *path;
+	int error;
+
+	cache = NULL;
+
+	error = get_cache_path(&path);
+	if (error)
+		return error;
+
+	/* Not fatal; the files will simply be hashed again */
+	if (load_cache(path) != 0)
+		cache_destroy();
+
+	free(path);
+	return 0;
+}
+
+void
+hash_cache_cleanup(void)
+{
+	cache_destroy();
+}
+
+/*
+ * Writes the SHA-256 of the file located at @path (described by @meta) to
+ * @result, if it's known.
+ */
+bool
+hash_cache_get(char const *path, struct stat const *meta,
+    unsigned char *result)
+{
+	struct cached_hash *hash;
+	bool found;
+
+	pthread_mutex_lock(&cache_lock);
+	HASH_FIND_STR(cache, path, hash);
+	found = (hash != NULL) && same_file(hash, meta);
+	if (found) {
+		memcpy(result, hash->sha256, SHA256_DIGEST_LENGTH);
+		hash->used = true;
+	}
+	pthread_mutex_unlock(&cache_lock);
+
+	return found;
+}
+
+/*
+ * Remembers @sha256 as the SHA-256 of the file located at @path. @meta has to
+ * be the result of a stat() performed before the file was hashed (or after it
+ * was written).
+ */
+void
+hash_cache_put(char const *path, struct stat const *meta,
+    unsigned char const *sha256)
+{
+	struct cached_hash *hash;
+
+	pthread_mutex_lock(&cache_lock);
+
+	HASH_FIND_STR(cache, path, hash);
+	if (hash == NULL && cached_hash_add(path, &hash) != 0)
+		goto end;
+
+	hash->ino = meta->st_ino;
+	hash->size = meta->st_size;
+	hash->mtime = meta->st_mtim;
+	memcpy(hash->sha256, sha256, SHA256_DIGEST_LENGTH);
+	hash->used = true;
+
+end:
+	pthread_mutex_unlock(&cache_lock);
+}
+
+static int
+write_cache(FILE *file, void *arg)
+{
+	struct cached_hash *hash, *tmp;
+	unsigned int i;
+
+	fprintf(file, "fort-hash-cache %u\n", CACHE_VERSION);
+
+	HASH_ITER(hh, cache, hash, tmp) {
+		fprintf(file, "%llu %lld %lld %ld ",
+		    (unsigned long long) hash->ino, (long long) hash->size,
+		    (long long) hash->mtime.tv_sec, hash->mtime.tv_nsec);
+		for (i = 0; i < SHA256_DIGEST_LENGTH; i++)
+			fprintf(file, "%02x", hash->sha256[i]);
+		fprintf(file, " %s\n", hash->path);
+	}
+
+	return 0;
+}
+
+/*
+ * Forgets the files nobody asked about since the previous save (they're no
+ * longer listed by any manifest), and writes the rest to the cache file. Call
+ * between validation cycles.
+ */
+int
+hash_cache_save(void)
+{
+	struct cached_hash *hash, *tmp;
+	char *path;
+	int error;
+
+	error = get_cache_path(&path);
+	if (error)
+		return error;
+
+	pthread_mutex_lock(&cache_lock);
+
+	HASH_ITER(hh, cache, hash, tmp) {
+		if (hash->used) {
+			hash->used = false;
+		} else {
+			HASH_DEL(cache, hash);
+			cached_hash_destroy(hash);
+		}
+	}
+
+	error = file_write_atomic(path, write_cache, NULL);
+
+	pthread_mutex_unlock(&cache_lock);
+
+	free(path);
+	return error;
+}
@@ -0,0 +1,25 @@
+#ifndef SRC_CRYPTO_HASH_CACHE_H_
+#define SRC_CRYPTO_HASH_CACHE_H_
+
+#include <stdbool.h>
+#include <sys/stat.h>
+
+/*
+ * Remembers the SHA-256 of the files in the local repository, so the unchanged
+ * ones don't need to be read again every time a manifest lists them.
+ *
+ * Files are identified by their path, inode, size and modification time (with
+ * nanoseconds). If any of them changes, the hash is recomputed.
+ *
+ * The cache survives restarts: hash_cache_save() writes it to
+ * <local-repository>/hash.cache, and hash_cache_init() reads it back.
+ */
+
+int hash_cache_init(void);
+void hash_cache_cleanup(void);
+int hash_cache_save(void);
+
+bool hash_cache_get(char const *, struct stat const *, unsigned char *);
+void hash_cache_put(char const *, struct stat const *, unsigned char const *);
+
+#endif /* SRC_CRYPTO_HASH_CACHE_H_ */
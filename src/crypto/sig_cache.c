@@ -0,0 +1,235 @@
+#include "crypto/sig_cache.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/evp.h>
+
+#include "log.h"
+#include "data_structure/uthash_nonfatal.h"
+
+struct verified_sig {
+	/* key */
+	struct sig_cache_key key;
+	/* Was the verification looked up (or added) during this cycle? */
+	bool used;
+	UT_hash_handle hh;
+};
+
+static struct verified_sig *sigs;
+
+static struct {
+	unsigned int hits;
+	unsigned int misses;
+} stats;
+
+/* Guards everything above. */
+static pthread_mutex_t sigs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+sigs_destroy(void)
+{
+	struct verified_sig *sig, *tmp;
+
+	HASH_ITER(hh, sigs, sig, tmp) {
+		HASH_DEL(sigs, sig);
+		free(sig);
+	}
+}
+
+int
+sig_cache_init(void)
+{
+	sigs = NULL;
+	memset(&stats, 0, sizeof(stats));
+	return 0;
+}
+
+void
+sig_cache_cleanup(void)
+{
+	sigs_destroy();
+}
+
+/* Starts a key digest with the digest of @signer's public key. */
+static int
+key_init(X509 *signer, EVP_MD_CTX **result)
+{
+	unsigned char md[EVP_MAX_MD_SIZE];
+	unsigned int md_len;
+	EVP_MD_CTX *ctx;
+
+	if (!X509_pubkey_digest(signer, EVP_sha256(), md, &md_len))
+		return val_crypto_err("X509_pubkey_digest() returned error");
+
+	ctx = EVP_MD_CTX_new();
+	if (ctx == NULL)
+		return pr_enomem();
+
+	if (!EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) ||
+	    !EVP_DigestUpdate(ctx, md, md_len)) {
+		EVP_MD_CTX_free(ctx);
+		return val_crypto_err("Could not start the signature cache key");
+	}
+
+	*result = ctx;
+	return 0;
+}
+
+/* Appends @buf to the key digest, finishes it, and releases @ctx. */
+static int
+key_final(EVP_MD_CTX *ctx, unsigned char const *buf, size_t len,
+    struct sig_cache_key *key)
+{
+	int ok;
+
+	ok = EVP_DigestUpdate(ctx, buf, len)
+	    && EVP_DigestFinal_ex(ctx, key->sha256, NULL);
+	EVP_MD_CTX_free(ctx);
+
+	return ok ? 0 : val_crypto_err("Could not finish the signature cache key");
+}
+
+/* Identifies the verification of @cert's signature, by @issuer. */
+int
+sig_cache_key_cert(X509 *issuer, X509 *cert, struct sig_cache_key *key)
+{
+	unsigned char md[EVP_MAX_MD_SIZE];
+	unsigned int md_len;
+	EVP_MD_CTX *ctx;
+	int error;
+
+	/* The encoding contains both the TBSCertificate and the signature */
+	if (!X509_digest(cert, EVP_sha256(), md, &md_len))
+		return val_crypto_err("X509_digest() returned error");
+
+	error = key_init(issuer, &ctx);
+	if (error)
+		return error;
+	return key_final(ctx, md, md_len, key);
+}
+
+/* Identifies the verification of @crl's signature, by @issuer. */
+int
+sig_cache_key_crl(X509 *issuer, X509_CRL *crl, struct sig_cache_key *key)
+{
+	unsigned char md[EVP_MAX_MD_SIZE];
+	unsigned int md_len;
+	EVP_MD_CTX *ctx;
+	int error;
+
+	if (!X509_CRL_digest(crl, EVP_sha256(), md, &md_len))
+		return val_crypto_err("X509_CRL_digest() returned error");
+
+	error = key_init(issuer, &ctx);
+	if (error)
+		return error;
+	return key_final(ctx, md, md_len, key);
+}
+
+/*
+ * Identifies the verification of a signed object's @signature (over its
+ * encoded @signed_attrs), by its EE certificate.
+ */
+int
+sig_cache_key_signed_attrs(X509 *ee, unsigned char const *signed_attrs,
+    size_t signed_attrs_len, unsigned char const *signature,
+    size_t signature_len, struct sig_cache_key *key)
+{
+	EVP_MD_CTX *ctx;
+	int error;
+
+	error = key_init(ee, &ctx);
+	if (error)
+		return error;
+
+	if (!EVP_DigestUpdate(ctx, signed_attrs, signed_attrs_len)) {
+		EVP_MD_CTX_free(ctx);
+		return val_crypto_err("Could not update the signature cache key");
+	}
+
+	return key_final(ctx, signature, signature_len, key);
+}
+
+/* Was the signature identified by @key already verified? */
+bool
+sig_cache_contains(struct sig_cache_key const *key)
+{
+	struct verified_sig *sig;
+
+	pthread_mutex_lock(&sigs_lock);
+	HASH_FIND(hh, sigs, key, sizeof(*key), sig);
+	if (sig != NULL) {
+		sig->used = true;
+		stats.hits++;
+	} else {
+		stats.misses++;
+	}
+	pthread_mutex_unlock(&sigs_lock);
+
+	return sig != NULL;
+}
+
+/* Remembers that the signature identified by @key was successfully verified. */
+void
+sig_cache_add(struct sig_cache_key const *key)
+{
+	struct verified_sig *sig, *old;
+
+	sig = malloc(sizeof(struct verified_sig));
+	if (sig == NULL)
+		return;
+	memset(sig, 0, sizeof(struct verified_sig));
+	sig->key = *key;
+	sig->used = true;
+
+	pthread_mutex_lock(&sigs_lock);
+
+	HASH_FIND(hh, sigs, key, sizeof(*key), old);
+	if (old != NULL) {
+		/* Another thread verified the same signature */
+		pthread_mutex_unlock(&sigs_lock);
+		free(sig);
+		return;
+	}
+
+	errno = 0;
+	HASH_ADD(hh, sigs, key, sizeof(sig->key), sig);
+	if (errno)
+		free(sig);
+
+	pthread_mutex_unlock(&sigs_lock);
+}
+
+/*
+ * Forgets the verifications nobody asked about during the last cycle (their
+ * objects are gone or changed), and logs (and resets) the counters. Call
+ * between validation cycles.
+ */
+void
+sig_cache_sweep(void)
+{
+	struct verified_sig *sig, *tmp;
+	unsigned int lookups;
+
+	pthread_mutex_lock(&sigs_lock);
+
+	HASH_ITER(hh, sigs, sig, tmp) {
+		if (sig->used) {
+			sig->used = false;
+		} else {
+			HASH_DEL(sigs, sig);
+			free(sig);
+		}
+	}
+
+	lookups = stats.hits + stats.misses;
+	pr_op_info("Signature cache: %u hits, %u misses (%u%% hit ratio). %u signatures remembered.",
+	    stats.hits, stats.misses,
+	    (lookups != 0) ? (100 * stats.hits / lookups) : 0,
+	    HASH_COUNT(sigs));
+	memset(&stats, 0, sizeof(stats));
+
+	pthread_mutex_unlock(&sigs_lock);
+}
@@ -0,0 +1,40 @@
+#ifndef SRC_CRYPTO_SIG_CACHE_H_
+#define SRC_CRYPTO_SIG_CACHE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <openssl/sha.h>
+#include <openssl/x509.h>
+
+/*
+ * Remembers the signatures that were successfully verified, so the ones of
+ * unchanged objects don't need to be verified again on every cycle.
+ *
+ * A verification is identified by the SHA-256 of the signer's public key,
+ * followed by the signed bytes and the signature. (For certificates and CRLs,
+ * that's their whole encoding.) Only the RSA math is skipped; anything that
+ * depends on the current time (validity, CRL freshness, revocation) still
+ * needs to be checked by the caller.
+ *
+ * Verifications that aren't looked up during a cycle are forgotten at the end
+ * of it (sig_cache_sweep()).
+ */
+
+struct sig_cache_key {
+	unsigned char sha256[SHA256_DIGEST_LENGTH];
+};
+
+int sig_cache_init(void);
+void sig_cache_cleanup(void);
+
+int sig_cache_key_cert(X509 *, X509 *, struct sig_cache_key *);
+int sig_cache_key_crl(X509 *, X509_CRL *, struct sig_cache_key *);
+int sig_cache_key_signed_attrs(X509 *, unsigned char const *, size_t,
+    unsigned char const *, size_t, struct sig_cache_key *);
+
+bool sig_cache_contains(struct sig_cache_key const *);
+void sig_cache_add(struct sig_cache_key const *);
+
+void sig_cache_sweep(void);
+
+#endif /* SRC_CRYPTO_SIG_CACHE_H_ */
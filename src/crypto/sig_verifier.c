@@ -0,0 +1,377 @@
+#include "crypto/sig_verifier.h"
+
+#include <sys/queue.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+
+#include "config.h"
+#include "log.h"
+#include "data_structure/array_list.h"
+
+enum sig_job_type {
+	/* Certificate signed by @signer */
+	SJT_CERT,
+	/* CRL signed by @signer */
+	SJT_CRL,
+	/* SHA-256 digest signed by @signer */
+	SJT_DIGEST,
+};
+
+struct sig_job {
+	enum sig_job_type type;
+	/* Holds the public key. (Owns a reference.) */
+	X509 *signer;
+	union {
+		X509 *cert;
+		X509_CRL *crl;
+		struct {
+			unsigned char md[SHA256_DIGEST_LENGTH];
+			unsigned char *sig;
+			size_t sig_len;
+		} digest;
+	} obj;
+	/* Added to the signature cache if the signature is valid */
+	struct sig_cache_key key;
+};
+
+STATIC_ARRAY_LIST(sig_jobs, struct sig_job)
+
+struct sig_batch {
+	struct sig_jobs jobs;
+	/* Index of the first job nobody has claimed yet */
+	size_t next;
+	/* Jobs claimed, but not yet verified */
+	unsigned int running;
+	/* Signaled when the last job is verified */
+	pthread_cond_t done;
+	TAILQ_ENTRY(sig_batch) hook;
+};
+
+TAILQ_HEAD(sig_batches, sig_batch);
+
+static pthread_t *workers;
+static unsigned int worker_count;
+
+/* Batches that still have unclaimed jobs, oldest first */
+static struct sig_batches batches = TAILQ_HEAD_INITIALIZER(batches);
+static bool stopping;
+/* Signaled when @batches gains a batch, or @stopping is set */
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER;
+
+/* Guards everything above, as well as the batches' @next and @running. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool
+verify_digest(EVP_PKEY *pkey, struct sig_job *job)
+{
+	EVP_PKEY_CTX *ctx;
+	bool valid;
+
+	ctx = EVP_PKEY_CTX_new(pkey, NULL);
+	if (ctx == NULL)
+		return false;
+
+	valid = (EVP_PKEY_verify_init(ctx) > 0)
+	    && (EVP_PKEY_CTX_set_signature_md(ctx, EVP_sha256()) > 0)
+	    && (EVP_PKEY_verify(ctx, job->obj.digest.sig,
+	        job->obj.digest.sig_len, job->obj.digest.md,
+	        SHA256_DIGEST_LENGTH) == 1);
+
+	EVP_PKEY_CTX_free(ctx);
+	return valid;
+}
+
+static bool
+verify(struct sig_job *job)
+{
+	EVP_PKEY *pkey;
+
+	pkey = X509_get0_pubkey(job->signer);
+	if (pkey == NULL)
+		return false;
+
+	switch (job->type) {
+	case SJT_CERT:
+		return X509_verify(job->obj.cert, pkey) == 1;
+	case SJT_CRL:
+		return X509_CRL_verify(job->obj.crl, pkey) == 1;
+	case SJT_DIGEST:
+		return verify_digest(pkey, job);
+	}
+
+	return false;
+}
+
+/* Claims @batch's next job. Call with @lock held. */
+static struct sig_job *
+claim(struct sig_batch *batch)
+{
+	struct sig_job *job;
+
+	job = &batch->jobs.array[batch->next++];
+	batch->running++;
+	if (batch->next == batch->jobs.len)
+		TAILQ_REMOVE(&batches, batch, hook);
+
+	return job;
+}
+
+/* Verifies @job. Call with @lock held; it is released meanwhile. */
+static void
+run(struct sig_batch *batch, struct sig_job *job)
+{
+	pthread_mutex_unlock(&lock);
+
+	if (verify(job))
+		sig_cache_add(&job->key);
+	else
+		/* The traversal will complain; don't leave noise behind */
+		ERR_clear_error();
+
+	pthread_mutex_lock(&lock);
+	batch->running--;
+	if (batch->next == batch->jobs.len && batch->running == 0)
+		pthread_cond_broadcast(&batch->done);
+}
+
+static void *
+run_worker(void *arg)
+{
+	struct sig_batch *batch;
+
+	pthread_mutex_lock(&lock);
+	do {
+		while (!stopping && TAILQ_EMPTY(&batches))
+			pthread_cond_wait(&work, &lock);
+		if (stopping)
+			break;
+
+		batch = TAILQ_FIRST(&batches);
+		run(batch, claim(batch));
+	} while (true);
+	pthread_mutex_unlock(&lock);
+
+	return NULL;
+}
+
+int
+sig_verifier_init(void)
+{
+	unsigned int count;
+
+	stopping = false;
+	worker_count = 0;
+	count = config_get_signature_workers();
+	if (count == 0) {
+		workers = NULL;
+		return 0;
+	}
+
+	workers = calloc(count, sizeof(pthread_t));
+	if (workers == NULL)
+		return pr_enomem();
+
+	for (; worker_count < count; worker_count++) {
+		errno = pthread_create(&workers[worker_count], NULL, run_worker,
+		    NULL);
+		if (errno) {
+			pr_op_errno(errno, "Could not spawn a signature worker");
+			/* Not fatal; the ones that did start will do */
+			break;
+		}
+	}
+
+	return 0;
+}
+
+void
+sig_verifier_cleanup(void)
+{
+	unsigned int i;
+	int error;
+
+	pthread_mutex_lock(&lock);
+	stopping = true;
+	pthread_cond_broadcast(&work);
+	pthread_mutex_unlock(&lock);
+
+	for (i = 0; i < worker_count; i++) {
+		error = pthread_join(workers[i], NULL);
+		if (error)
+			pr_crit("pthread_join() threw %d on a signature worker.",
+			    error);
+	}
+
+	free(workers);
+	workers = NULL;
+	worker_count = 0;
+}
+
+/* Is it worth collecting signatures? */
+bool
+sig_verifier_enabled(void)
+{
+	return worker_count > 0;
+}
+
+int
+sig_batch_create(struct sig_batch **result)
+{
+	struct sig_batch *batch;
+
+	batch = malloc(sizeof(struct sig_batch));
+	if (batch == NULL)
+		return pr_enomem();
+
+	sig_jobs_init(&batch->jobs);
+	batch->next = 0;
+	batch->running = 0;
+	errno = pthread_cond_init(&batch->done, NULL);
+	if (errno) {
+		free(batch);
+		return pr_op_errno(errno, "pthread_cond_init() returned error");
+	}
+
+	*result = batch;
+	return 0;
+}
+
+static void
+sig_job_cleanup(struct sig_job *job)
+{
+	X509_free(job->signer);
+	switch (job->type) {
+	case SJT_CERT:
+		X509_free(job->obj.cert);
+		break;
+	case SJT_CRL:
+		X509_CRL_free(job->obj.crl);
+		break;
+	case SJT_DIGEST:
+		free(job->obj.digest.sig);
+		break;
+	}
+}
+
+void
+sig_batch_destroy(struct sig_batch *batch)
+{
+	sig_jobs_cleanup(&batch->jobs, sig_job_cleanup);
+	pthread_cond_destroy(&batch->done);
+	free(batch);
+}
+
+/* Takes over @job's references, even on error. */
+static int
+add_job(struct sig_batch *batch, struct sig_job *job)
+{
+	int error;
+
+	error = sig_jobs_add(&batch->jobs, job);
+	if (error)
+		sig_job_cleanup(job);
+	return error;
+}
+
+/*
+ * Schedules the verification of @cert's signature, by @issuer. Does nothing if
+ * the signature cache already knows it.
+ */
+int
+sig_batch_add_cert(struct sig_batch *batch, X509 *issuer, X509 *cert)
+{
+	struct sig_job job;
+	int error;
+
+	error = sig_cache_key_cert(issuer, cert, &job.key);
+	if (error)
+		return error;
+	if (sig_cache_contains(&job.key))
+		return 0;
+
+	job.type = SJT_CERT;
+	X509_up_ref(issuer);
+	job.signer = issuer;
+	X509_up_ref(cert);
+	job.obj.cert = cert;
+	return add_job(batch, &job);
+}
+
+/*
+ * Schedules the verification of @crl's signature, by @issuer. Does nothing if
+ * the signature cache already knows it.
+ */
+int
+sig_batch_add_crl(struct sig_batch *batch, X509 *issuer, X509_CRL *crl)
+{
+	struct sig_job job;
+	int error;
+
+	error = sig_cache_key_crl(issuer, crl, &job.key);
+	if (error)
+		return error;
+	if (sig_cache_contains(&job.key))
+		return 0;
+
+	job.type = SJT_CRL;
+	X509_up_ref(issuer);
+	job.signer = issuer;
+	X509_CRL_up_ref(crl);
+	job.obj.crl = crl;
+	return add_job(batch, &job);
+}
+
+/*
+ * Schedules the verification of @sig, @signer's signature over the SHA-256
+ * digest @md. @key identifies it in the signature cache. Does nothing if the
+ * cache already knows it.
+ */
+int
+sig_batch_add_digest(struct sig_batch *batch, X509 *signer,
+    unsigned char const *md, unsigned char const *sig, size_t sig_len,
+    struct sig_cache_key const *key)
+{
+	struct sig_job job;
+
+	if (sig_cache_contains(key))
+		return 0;
+
+	job.type = SJT_DIGEST;
+	memcpy(job.obj.digest.md, md, SHA256_DIGEST_LENGTH);
+	job.obj.digest.sig = malloc(sig_len);
+	if (job.obj.digest.sig == NULL)
+		return pr_enomem();
+	memcpy(job.obj.digest.sig, sig, sig_len);
+	job.obj.digest.sig_len = sig_len;
+	X509_up_ref(signer);
+	job.signer = signer;
+	job.key = *key;
+	return add_job(batch, &job);
+}
+
+/*
+ * Verifies @batch's signatures, and returns once all of them are done. The
+ * calling thread helps the workers.
+ */
+void
+sig_batch_run(struct sig_batch *batch)
+{
+	if (batch->next == batch->jobs.len)
+		return;
+
+	pthread_mutex_lock(&lock);
+
+	TAILQ_INSERT_TAIL(&batches, batch, hook);
+	pthread_cond_broadcast(&work);
+
+	while (batch->next < batch->jobs.len)
+		run(batch, claim(batch));
+	while (batch->running > 0)
+		pthread_cond_wait(&batch->done, &lock);
+
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,35 @@
+#ifndef SRC_CRYPTO_SIG_VERIFIER_H_
+#define SRC_CRYPTO_SIG_VERIFIER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <openssl/x509.h>
+#include "crypto/sig_cache.h"
+
+/*
+ * Verifies batches of signatures on a pool of threads
+ * (--signature-workers), shared by all the TALs.
+ *
+ * The verdicts are returned through the signature cache: the signatures that
+ * turn out to be valid are added to it, so the traversal doesn't need to
+ * verify them again. Invalid ones are simply left out; the traversal will
+ * verify (and report) them as usual.
+ */
+
+struct sig_batch;
+
+int sig_verifier_init(void);
+void sig_verifier_cleanup(void);
+bool sig_verifier_enabled(void);
+
+int sig_batch_create(struct sig_batch **);
+void sig_batch_destroy(struct sig_batch *);
+
+int sig_batch_add_cert(struct sig_batch *, X509 *, X509 *);
+int sig_batch_add_crl(struct sig_batch *, X509 *, X509_CRL *);
+int sig_batch_add_digest(struct sig_batch *, X509 *, unsigned char const *,
+    unsigned char const *, size_t, struct sig_cache_key const *);
+
+void sig_batch_run(struct sig_batch *);
+
+#endif /* SRC_CRYPTO_SIG_VERIFIER_H_ */
@@ -0,0 +1,326 @@
+#include "fetch_scheduler.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+
+#include "config.h"
+#include "log.h"
+
+/* A server that is being fetched from. */
+struct fetch_host {
+	char *name;
+	/* Fetches currently running against this server. */
+	unsigned int active;
+	SLIST_ENTRY(fetch_host) next;
+};
+
+struct fetch_job {
+	/*
+	 * Server the job will fetch from. Until the job starts, this is only
+	 * a candidate entry for @hosts; it becomes the actual one afterwards.
+	 */
+	struct fetch_host *host;
+	fetch_job_cb cb;
+	void *arg;
+	TAILQ_ENTRY(fetch_job) next;
+};
+
+TAILQ_HEAD(fetch_jobs, fetch_job);
+
+struct fetch_scheduler {
+	/* Jobs that haven't started yet. */
+	struct fetch_jobs jobs;
+	/* Fetcher threads that reported for duty, and how many of them can. */
+	unsigned int checked_in;
+	unsigned int fetchers;
+	/* The tree is done; fetchers should quit once there are no jobs. */
+	bool closed;
+};
+
+/*
+ * Servers with at least one running fetch. There are usually few of them,
+ * so a list will do.
+ */
+static SLIST_HEAD(fetch_hosts, fetch_host) hosts =
+    SLIST_HEAD_INITIALIZER(hosts);
+
+/*
+ * Guards @hosts and all the schedulers. Fetches are slow, so contention is not
+ * a concern.
+ */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+/* Signaled whenever a job is queued, a slot is freed, or a scheduler closes. */
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+int
+fetch_scheduler_create(struct fetch_scheduler **result)
+{
+	struct fetch_scheduler *scheduler;
+
+	scheduler = malloc(sizeof(struct fetch_scheduler));
+	if (scheduler == NULL)
+		return pr_enomem();
+
+	TAILQ_INIT(&scheduler->jobs);
+	scheduler->checked_in = 0;
+	scheduler->fetchers = 0;
+	scheduler->closed = false;
+
+	*result = scheduler;
+	return 0;
+}
+
+static void
+host_destroy(struct fetch_host *host)
+{
+	free(host->name);
+	free(host);
+}
+
+void
+fetch_scheduler_destroy(struct fetch_scheduler *scheduler)
+{
+	struct fetch_job *job;
+
+	while (!TAILQ_EMPTY(&scheduler->jobs)) {
+		job = TAILQ_FIRST(&scheduler->jobs);
+		TAILQ_REMOVE(&scheduler->jobs, job, next);
+		host_destroy(job->host);
+		free(job);
+	}
+	free(scheduler);
+}
+
+/* Creates an (inactive) entry for the server @uri points to. */
+static int
+host_create(char const *uri, struct fetch_host **result)
+{
+	struct fetch_host *host;
+	char const *start;
+	char const *end;
+
+	/* "<scheme>://<host>/<path>" */
+	start = strstr(uri, "://");
+	start = (start != NULL) ? (start + 3) : uri;
+	end = strchr(start, '/');
+	if (end == NULL)
+		end = start + strlen(start);
+
+	host = malloc(sizeof(struct fetch_host));
+	if (host == NULL)
+		return pr_enomem();
+
+	host->name = strndup(start, end - start);
+	if (host->name == NULL) {
+		free(host);
+		return pr_enomem();
+	}
+	host->active = 0;
+
+	*result = host;
+	return 0;
+}
+
+/*
+ * Takes one of the fetch slots of @candidate's server, if there's any left.
+ * Returns the server's entry, which will be @candidate itself if nobody else
+ * was fetching from it. (In which case @candidate now belongs to @hosts.)
+ *
+ * Call with @lock held.
+ */
+static struct fetch_host *
+slot_take(struct fetch_host *candidate)
+{
+	struct fetch_host *host;
+
+	SLIST_FOREACH(host, &hosts, next) {
+		if (strcmp(host->name, candidate->name) != 0)
+			continue;
+		if (host->active >= config_get_max_fetches_per_host())
+			return NULL;
+		host->active++;
+		return host;
+	}
+
+	candidate->active = 1;
+	SLIST_INSERT_HEAD(&hosts, candidate, next);
+	return candidate;
+}
+
+/* Call with @lock held. */
+static void
+slot_release(struct fetch_host *host)
+{
+	host->active--;
+	if (host->active == 0) {
+		SLIST_REMOVE(&hosts, host, fetch_host, next);
+		host_destroy(host);
+	}
+	pthread_cond_broadcast(&cond);
+}
+
+/**
+ * Queues a call to @cb(@arg), which will fetch from the server @uri points to.
+ * Some fetcher thread of @scheduler will run it as soon as the server has a
+ * free slot.
+ */
+int
+fetch_scheduler_submit(struct fetch_scheduler *scheduler, char const *uri,
+    fetch_job_cb cb, void *arg)
+{
+	struct fetch_job *job;
+	int error;
+
+	job = malloc(sizeof(struct fetch_job));
+	if (job == NULL)
+		return pr_enomem();
+
+	error = host_create(uri, &job->host);
+	if (error) {
+		free(job);
+		return error;
+	}
+	job->cb = cb;
+	job->arg = arg;
+
+	pthread_mutex_lock(&lock);
+	TAILQ_INSERT_TAIL(&scheduler->jobs, job, next);
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+
+	return 0;
+}
+
+/*
+ * Fetcher threads have to report whether they managed to initialize (@ready)
+ * before doing anything else.
+ */
+void
+fetch_scheduler_check_in(struct fetch_scheduler *scheduler, bool ready)
+{
+	pthread_mutex_lock(&lock);
+	scheduler->checked_in++;
+	if (ready)
+		scheduler->fetchers++;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Waits until @expected fetcher threads have checked in, and returns the number
+ * of them that are actually going to run jobs. Do not submit anything if this
+ * is zero.
+ */
+unsigned int
+fetch_scheduler_wait_fetchers(struct fetch_scheduler *scheduler,
+    unsigned int expected)
+{
+	unsigned int result;
+
+	pthread_mutex_lock(&lock);
+	while (scheduler->checked_in < expected)
+		pthread_cond_wait(&cond, &lock);
+	result = scheduler->fetchers;
+	pthread_mutex_unlock(&lock);
+
+	return result;
+}
+
+/*
+ * Dequeues the oldest job whose server has a free slot, and reserves the slot.
+ * Call with @lock held.
+ */
+static struct fetch_job *
+job_take(struct fetch_scheduler *scheduler)
+{
+	struct fetch_job *job;
+	struct fetch_host *host;
+
+	TAILQ_FOREACH(job, &scheduler->jobs, next) {
+		host = slot_take(job->host);
+		if (host == NULL)
+			continue;
+
+		if (host != job->host)
+			host_destroy(job->host);
+		job->host = host;
+		TAILQ_REMOVE(&scheduler->jobs, job, next);
+		return job;
+	}
+
+	return NULL;
+}
+
+/* The fetcher threads' main loop. Returns once @scheduler is closed. */
+void
+fetch_scheduler_run(struct fetch_scheduler *scheduler)
+{
+	struct fetch_job *job;
+
+	pthread_mutex_lock(&lock);
+	do {
+		job = job_take(scheduler);
+		if (job == NULL) {
+			if (scheduler->closed)
+				break;
+			pthread_cond_wait(&cond, &lock);
+			continue;
+		}
+
+		pthread_mutex_unlock(&lock);
+		job->cb(job->arg);
+		pthread_mutex_lock(&lock);
+
+		slot_release(job->host);
+		free(job);
+	} while (true);
+	pthread_mutex_unlock(&lock);
+}
+
+/* Tells @scheduler's fetchers to quit once they run out of jobs. */
+void
+fetch_scheduler_close(struct fetch_scheduler *scheduler)
+{
+	pthread_mutex_lock(&lock);
+	scheduler->closed = true;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+}
+
+/**
+ * Blocks until the server @uri points to has a free fetch slot, and takes it.
+ * For fetches that happen outside of the schedulers. Release the slot with
+ * fetch_host_release() once you're done.
+ */
+int
+fetch_host_acquire(char const *uri, struct fetch_host **result)
+{
+	struct fetch_host *candidate;
+	struct fetch_host *host;
+	int error;
+
+	error = host_create(uri, &candidate);
+	if (error)
+		return error;
+
+	pthread_mutex_lock(&lock);
+	while ((host = slot_take(candidate)) == NULL)
+		pthread_cond_wait(&cond, &lock);
+	pthread_mutex_unlock(&lock);
+
+	if (host != candidate)
+		host_destroy(candidate);
+
+	*result = host;
+	return 0;
+}
+
+void
+fetch_host_release(struct fetch_host *host)
+{
+	pthread_mutex_lock(&lock);
+	slot_release(host);
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,36 @@
+#ifndef SRC_FETCH_SCHEDULER_H_
+#define SRC_FETCH_SCHEDULER_H_
+
+#include <stdbool.h>
+
+/*
+ * Repository fetches that run in the background, so the validation workers
+ * can keep validating whatever has already been fetched.
+ *
+ * Every TAL tree gets its own scheduler, served by --fetch-workers threads.
+ * All the fetches of the process (background or not) share the same per-host
+ * limit, though (--maximum-fetches-per-host), so a repository server is never
+ * hit by more than that many downloads at once.
+ */
+
+struct fetch_scheduler;
+struct fetch_host;
+
+typedef void (*fetch_job_cb)(void *);
+
+int fetch_scheduler_create(struct fetch_scheduler **);
+void fetch_scheduler_destroy(struct fetch_scheduler *);
+
+int fetch_scheduler_submit(struct fetch_scheduler *, char const *,
+    fetch_job_cb, void *);
+
+void fetch_scheduler_check_in(struct fetch_scheduler *, bool);
+unsigned int fetch_scheduler_wait_fetchers(struct fetch_scheduler *,
+    unsigned int);
+void fetch_scheduler_run(struct fetch_scheduler *);
+void fetch_scheduler_close(struct fetch_scheduler *);
+
+int fetch_host_acquire(char const *, struct fetch_host **);
+void fetch_host_release(struct fetch_host *);
+
+#endif /* SRC_FETCH_SCHEDULER_H_ */
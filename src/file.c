@@ -2,6 +2,8 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "log.h"
 
 static int
@@ -51,6 +53,65 @@ file_close(FILE *file)
 		pr_val_errno(errno, "fclose() failed");
 }
 
+/*
+ * Writes @file_name's new content through @cb, in such a way that readers
+ * either see the old version of the file, or the complete new one. (Even after
+ * a crash.)
+ */
+int
+file_write_atomic(char const *file_name, file_write_cb cb, void *arg)
+{
+	char *tmp_name;
+	FILE *file;
+	int error;
+
+	tmp_name = malloc(strlen(file_name) + strlen(".tmp") + 1);
+	if (tmp_name == NULL)
+		return pr_enomem();
+	sprintf(tmp_name, "%s.tmp", file_name);
+
+	file = fopen(tmp_name, "wb");
+	if (file == NULL) {
+		error = pr_op_errno(errno, "Could not create '%s'", tmp_name);
+		goto free_name;
+	}
+
+	error = cb(file, arg);
+	if (error) {
+		fclose(file);
+		goto unlink_tmp;
+	}
+
+	if (fflush(file) != 0 || ferror(file)) {
+		error = pr_op_err("Could not write '%s'", tmp_name);
+		fclose(file);
+		goto unlink_tmp;
+	}
+	if (fsync(fileno(file)) != 0) {
+		error = pr_op_errno(errno, "Could not sync '%s'", tmp_name);
+		fclose(file);
+		goto unlink_tmp;
+	}
+	if (fclose(file) != 0) {
+		error = pr_op_errno(errno, "Could not write '%s'", tmp_name);
+		goto unlink_tmp;
+	}
+
+	if (rename(tmp_name, file_name) != 0) {
+		error = pr_op_errno(errno, "Could not rename '%s'", tmp_name);
+		goto unlink_tmp;
+	}
+
+	free(tmp_name);
+	return 0;
+
+unlink_tmp:
+	unlink(tmp_name);
+free_name:
+	free(tmp_name);
+	return error;
+}
+
 int
 file_load(char const *file_name, struct file_contents *fc)
 {
@@ -20,6 +20,9 @@ int file_open(char const *, FILE **, struct stat *);
 int file_write(char const *, FILE **, struct stat *);
 void file_close(FILE *);
 
+typedef int (*file_write_cb)(FILE *, void *);
+int file_write_atomic(char const *, file_write_cb, void *);
+
 int file_load(char const *, struct file_contents *);
 void file_free(struct file_contents *);
 
@@ -1,7 +1,11 @@
 #include "http.h"
 
 #include <errno.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 #include <curl/curl.h>
 #include <sys/stat.h>
@@ -9,6 +13,7 @@
 #include "config.h"
 #include "file.h"
 #include "log.h"
+#include "metrics.h"
 
 /* HTTP Response Code 200 (OK) */
 #define HTTP_OK			200
@@ -22,21 +27,136 @@ struct http_handler {
 	char errbuf[CURL_ERROR_SIZE];
 };
 
+/* TLS sessions and resolved names, shared by every request of every thread. */
+static CURLSH *share;
+static pthread_mutex_t share_locks[CURL_LOCK_DATA_LAST];
+
+/*
+ * Each thread's multi handle, which runs all of the thread's requests. Its
+ * connection cache outlives them, so the snapshot and deltas of a notification
+ * reuse the notification's connection, instead of repeating the handshakes.
+ *
+ * Open connections are not shared between threads; libcurl can't hand one
+ * over to another thread safely. A thread runs one request (or batch of
+ * requests) at a time.
+ */
+static pthread_key_t multi_key;
+
+static void
+share_lock(CURL *curl, curl_lock_data data, curl_lock_access access,
+    void *arg)
+{
+	pthread_mutex_lock(&share_locks[data]);
+}
+
+static void
+share_unlock(CURL *curl, curl_lock_data data, void *arg)
+{
+	pthread_mutex_unlock(&share_locks[data]);
+}
+
+static int
+share_init(void)
+{
+	unsigned int i;
+
+	share = curl_share_init();
+	if (share == NULL)
+		return pr_enomem();
+
+	for (i = 0; i < CURL_LOCK_DATA_LAST; i++)
+		pthread_mutex_init(&share_locks[i], NULL);
+
+	curl_share_setopt(share, CURLSHOPT_LOCKFUNC, share_lock);
+	curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+	return 0;
+}
+
+static void
+share_cleanup(void)
+{
+	unsigned int i;
+
+	curl_share_cleanup(share);
+	share = NULL;
+
+	for (i = 0; i < CURL_LOCK_DATA_LAST; i++)
+		pthread_mutex_destroy(&share_locks[i]);
+}
+
+static void
+multi_destroy(void *multi)
+{
+	curl_multi_cleanup(multi);
+}
+
+/* Returns the calling thread's multi handle, creating it if necessary. */
+static CURLM *
+thread_multi(void)
+{
+	CURLM *multi;
+
+	multi = pthread_getspecific(multi_key);
+	if (multi != NULL)
+		return multi;
+
+	multi = curl_multi_init();
+	if (multi == NULL)
+		return NULL;
+	curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+
+	if (pthread_setspecific(multi_key, multi) != 0) {
+		curl_multi_cleanup(multi);
+		return NULL;
+	}
+
+	return multi;
+}
+
 int
 http_init(void)
 {
 	CURLcode res;
+	int error;
+
 	res = curl_global_init(CURL_GLOBAL_SSL);
 	if (res != CURLE_OK)
 		return pr_op_err("Error initializing global curl (%s)",
 		    curl_easy_strerror(res));
 
+	error = pthread_key_create(&multi_key, multi_destroy);
+	if (error) {
+		pr_op_errno(error, "pthread_key_create() returned error");
+		goto cleanup_global;
+	}
+
+	error = share_init();
+	if (error)
+		goto delete_key;
+
 	return 0;
+delete_key:
+	pthread_key_delete(multi_key);
+cleanup_global:
+	curl_global_cleanup();
+	return error;
 }
 
 void
 http_cleanup(void)
 {
+	CURLM *multi;
+
+	/* The other threads' handles were released as they exited. */
+	multi = pthread_getspecific(multi_key);
+	if (multi != NULL)
+		curl_multi_cleanup(multi);
+	pthread_key_delete(multi_key);
+
+	share_cleanup();
 	curl_global_cleanup();
 }
 
@@ -96,6 +216,10 @@ http_easy_init(struct http_handler *handler)
 	/* Prepare for multithreading, avoid signals */
 	curl_easy_setopt(tmp, CURLOPT_NOSIGNAL, 1L);
 
+	/* Reuse what other requests learned */
+	if (share != NULL)
+		curl_easy_setopt(tmp, CURLOPT_SHARE, share);
+
 	handler->curl = tmp;
 
 	return 0;
@@ -108,23 +232,28 @@ curl_err_string(struct http_handler *handler, CURLcode res)
 	    handler->errbuf : curl_easy_strerror(res);
 }
 
-/*
- * Fetch data from @uri and write result using @cb (which will receive @arg).
- */
-static int
-http_fetch(struct http_handler *handler, char const *uri, long *response_code,
-    long *cond_met, bool log_operation, http_write_cb cb, void *arg)
+static void
+http_fetch_prepare(struct http_handler *handler, char const *uri,
+    http_write_cb cb, void *arg)
 {
-	CURLcode res;
-	long unmet = 0;
-
 	handler->errbuf[0] = 0;
 	curl_easy_setopt(handler->curl, CURLOPT_URL, uri);
 	curl_easy_setopt(handler->curl, CURLOPT_WRITEFUNCTION, cb);
 	curl_easy_setopt(handler->curl, CURLOPT_WRITEDATA, arg);
+}
+
+/* Interprets the outcome (@res) of the request @handler made to @uri. */
+static int
+http_fetch_result(struct http_handler *handler, char const *uri, CURLcode res,
+    long *response_code, long *cond_met, bool log_operation)
+{
+	long unmet = 0;
+	curl_off_t received;
+
+	if (curl_easy_getinfo(handler->curl, CURLINFO_SIZE_DOWNLOAD_T,
+	    &received) == CURLE_OK)
+		metrics_http_received(received);
 
-	pr_val_debug("Doing HTTP GET to '%s'.", uri);
-	res = curl_easy_perform(handler->curl);
 	curl_easy_getinfo(handler->curl, CURLINFO_RESPONSE_CODE, response_code);
 	if (res == CURLE_OK) {
 		if (*response_code != HTTP_OK)
@@ -158,23 +287,116 @@ http_fetch(struct http_handler *handler, char const *uri, long *response_code,
 	return EREQFAILED;
 }
 
+/*
+ * Fetch data from @uri and write result using @cb (which will receive @arg).
+ */
+static int
+http_fetch(struct http_handler *handler, char const *uri, long *response_code,
+    long *cond_met, bool log_operation, http_write_cb cb, void *arg)
+{
+	CURLM *multi;
+	CURLMcode mres;
+	CURLMsg *msg;
+	CURLcode res;
+	int pending;
+
+	multi = thread_multi();
+	if (multi == NULL)
+		return pr_enomem();
+
+	res = CURLE_OK;
+	http_fetch_prepare(handler, uri, cb, arg);
+
+	/* Same as curl_easy_perform(), but on the thread's connections */
+	pr_val_debug("Doing HTTP GET to '%s'.", uri);
+	mres = curl_multi_add_handle(multi, handler->curl);
+	if (mres != CURLM_OK)
+		return pr_val_err("Cannot start the request to '%s': %s", uri,
+		    curl_multi_strerror(mres));
+
+	do {
+		mres = curl_multi_perform(multi, &pending);
+		if (mres != CURLM_OK)
+			break;
+		msg = curl_multi_info_read(multi, &pending);
+		if (msg != NULL && msg->msg == CURLMSG_DONE) {
+			res = msg->data.result;
+			break;
+		}
+		mres = curl_multi_wait(multi, NULL, 0, 1000, NULL);
+	} while (mres == CURLM_OK);
+
+	curl_multi_remove_handle(multi, handler->curl);
+	if (mres != CURLM_OK)
+		return pr_val_err("HTTP transfer failed: %s",
+		    curl_multi_strerror(mres));
+
+	return http_fetch_result(handler, uri, res, response_code, cond_met,
+	    log_operation);
+}
+
 static void
 http_easy_cleanup(struct http_handler *handler)
 {
 	curl_easy_cleanup(handler->curl);
 }
 
+/*
+ * Returns (in @result) the path of the file @uri is downloaded into, before it
+ * replaces the local file. Also creates its parent directories.
+ */
+static int
+tmp_file_create(struct rpki_uri *uri, char **result)
+{
+	char const *tmp_suffix = "_tmp";
+	char const *original_file;
+	char *tmp_file;
+	int error;
+
+	original_file = uri_get_local(uri);
+	tmp_file = malloc(strlen(original_file) + strlen(tmp_suffix) + 1);
+	if (tmp_file == NULL)
+		return pr_enomem();
+
+	strcpy(tmp_file, original_file);
+	strcat(tmp_file, tmp_suffix);
+
+	error = create_dir_recursive(tmp_file);
+	if (error) {
+		free(tmp_file);
+		return error;
+	}
+
+	*result = tmp_file;
+	return 0;
+}
+
+/* Overwrites @uri's local file with the downloaded @tmp_file. */
+static int
+tmp_file_commit(char const *tmp_file, struct rpki_uri *uri)
+{
+	int error;
+
+	error = rename(tmp_file, uri_get_local(uri));
+	if (error) {
+		error = errno;
+		return pr_val_errno(error,
+		    "Renaming temporal file from '%s' to '%s'",
+		    tmp_file, uri_get_local(uri));
+	}
+
+	return 0;
+}
+
 static int
 __http_download_file(struct rpki_uri *uri, http_write_cb cb,
     long *response_code, long ims_value, long *cond_met, bool log_operation)
 {
-	char const *tmp_suffix = "_tmp";
 	struct http_handler handler;
 	struct stat stat;
 	FILE *out;
 	unsigned int retries;
-	char const *original_file;
-	char *tmp_file, *tmp;
+	char *tmp_file;
 	int error;
 
 	retries = 0;
@@ -184,23 +406,9 @@ __http_download_file(struct rpki_uri *uri, http_write_cb cb,
 		return 0;
 	}
 
-	original_file = uri_get_local(uri);
-	tmp_file = strdup(original_file);
-	if (tmp_file == NULL)
-		return pr_enomem();
-
-	tmp = realloc(tmp_file, strlen(tmp_file) + strlen(tmp_suffix) + 1);
-	if (tmp == NULL) {
-		error = pr_enomem();
-		goto release_tmp;
-	}
-
-	tmp_file = tmp;
-	strcat(tmp_file, tmp_suffix);
-
-	error = create_dir_recursive(tmp_file);
+	error = tmp_file_create(uri, &tmp_file);
 	if (error)
-		goto release_tmp;
+		return ENSURE_NEGATIVE(error);
 
 	error = file_write(tmp_file, &out, &stat);
 	if (error)
@@ -242,14 +450,9 @@ __http_download_file(struct rpki_uri *uri, http_write_cb cb,
 	if (error)
 		goto delete_dir;
 
-	/* Overwrite the original file */
-	error = rename(tmp_file, original_file);
-	if (error) {
-		error = errno;
-		pr_val_errno(error, "Renaming temporal file from '%s' to '%s'",
-		    tmp_file, original_file);
+	error = tmp_file_commit(tmp_file, uri);
+	if (error)
 		goto delete_dir;
-	}
 
 	free(tmp_file);
 	return 0;
@@ -257,7 +460,6 @@ close_file:
 	file_close(out);
 delete_dir:
 	delete_dir_recursive_bottom_up(tmp_file);
-release_tmp:
 	free(tmp_file);
 	return ENSURE_NEGATIVE(error);
 }
@@ -324,3 +526,540 @@ http_download_file_with_ims(struct rpki_uri *uri, http_write_cb cb, long value,
 	    log_operation);
 
 }
+
+/* One of the downloads of http_download_files(). */
+struct http_transfer {
+	struct rpki_uri *uri;
+	char *tmp_file;
+	FILE *out;
+	struct http_handler handler;
+	enum {
+		TRANSFER_QUEUED,
+		TRANSFER_RUNNING,
+		/* Failed; will be started again at @retry_at */
+		TRANSFER_WAITING,
+		TRANSFER_DONE,
+		TRANSFER_FAILED,
+	} state;
+	unsigned int retries;
+	time_t retry_at;
+};
+
+/* Opens @transfer's temporal file, and hands the request over to @multi. */
+static int
+transfer_start(CURLM *multi, struct http_transfer *transfer, http_write_cb cb)
+{
+	struct stat stat;
+	CURLMcode mres;
+	int error;
+
+	if (transfer->tmp_file == NULL) {
+		error = tmp_file_create(transfer->uri, &transfer->tmp_file);
+		if (error)
+			return error;
+	}
+
+	/* Truncates whatever a failed attempt left */
+	error = file_write(transfer->tmp_file, &transfer->out, &stat);
+	if (error)
+		return error;
+
+	error = http_easy_init(&transfer->handler);
+	if (error)
+		goto close_file;
+
+	http_fetch_prepare(&transfer->handler, uri_get_global(transfer->uri),
+	    cb, transfer->out);
+	curl_easy_setopt(transfer->handler.curl, CURLOPT_PRIVATE, transfer);
+
+	pr_val_debug("Doing HTTP GET to '%s'.", uri_get_global(transfer->uri));
+	mres = curl_multi_add_handle(multi, transfer->handler.curl);
+	if (mres != CURLM_OK) {
+		error = pr_val_err("Cannot start the request to '%s': %s",
+		    uri_get_global(transfer->uri), curl_multi_strerror(mres));
+		goto cleanup_curl;
+	}
+
+	transfer->state = TRANSFER_RUNNING;
+	return 0;
+
+cleanup_curl:
+	http_easy_cleanup(&transfer->handler);
+close_file:
+	file_close(transfer->out);
+	transfer->out = NULL;
+	return error;
+}
+
+/* Unhooks a running @transfer from @multi, releasing its handle and file. */
+static void
+transfer_stop(CURLM *multi, struct http_transfer *transfer)
+{
+	curl_multi_remove_handle(multi, transfer->handler.curl);
+	http_easy_cleanup(&transfer->handler);
+	file_close(transfer->out);
+	transfer->out = NULL;
+}
+
+/*
+ * Handles the outcome (@res) of the running @transfer. Returns nonzero if the
+ * whole batch should be given up.
+ */
+static int
+transfer_finish(CURLM *multi, struct http_transfer *transfer, CURLcode res,
+    bool log_operation)
+{
+	char const *uri;
+	long response_code;
+	long cond_met;
+	int error;
+
+	uri = uri_get_global(transfer->uri);
+	response_code = 0;
+	cond_met = 1;
+	error = http_fetch_result(&transfer->handler, uri, res, &response_code,
+	    &cond_met, log_operation);
+	transfer_stop(multi, transfer);
+	transfer->state = TRANSFER_FAILED;
+
+	if (error == EREQFAILED) {
+		if (transfer->retries == config_get_http_retry_count()) {
+			pr_val_warn("Max HTTP retries (%u) reached requesting for '%s', won't retry again.",
+			    transfer->retries, uri);
+			return error;
+		}
+		pr_val_warn("Retrying HTTP request '%s' in %u seconds, %u attempts remaining.",
+		    uri, config_get_http_retry_interval(),
+		    config_get_http_retry_count() - transfer->retries);
+		transfer->retries++;
+		transfer->retry_at = time(NULL) + config_get_http_retry_interval();
+		transfer->state = TRANSFER_WAITING;
+		return 0;
+	}
+	if (error)
+		return error;
+
+	error = tmp_file_commit(transfer->tmp_file, transfer->uri);
+	if (error)
+		return error;
+
+	free(transfer->tmp_file);
+	transfer->tmp_file = NULL;
+	transfer->state = TRANSFER_DONE;
+	return 0;
+}
+
+/* Returns the first transfer that can be started right now, if any. */
+static struct http_transfer *
+transfer_next(struct http_transfer *transfers, size_t count, size_t *queued,
+    unsigned int waiting)
+{
+	time_t now;
+	size_t i;
+
+	/* Retries go first; they're older */
+	if (waiting > 0) {
+		now = time(NULL);
+		for (i = 0; i < *queued; i++)
+			if (transfers[i].state == TRANSFER_WAITING &&
+			    transfers[i].retry_at <= now)
+				return &transfers[i];
+	}
+
+	if (*queued < count)
+		return &transfers[(*queued)++];
+
+	return NULL;
+}
+
+/* Milliseconds until the next retry is due, or @max if there's none sooner. */
+static int
+transfer_timeout(struct http_transfer *transfers, size_t queued,
+    unsigned int waiting, int max)
+{
+	time_t now;
+	int result;
+	size_t i;
+
+	if (waiting == 0)
+		return max;
+
+	now = time(NULL);
+	result = max;
+	for (i = 0; i < queued; i++) {
+		if (transfers[i].state != TRANSFER_WAITING)
+			continue;
+		if (transfers[i].retry_at <= now)
+			return 0;
+		if ((transfers[i].retry_at - now) * 1000 < result)
+			result = (transfers[i].retry_at - now) * 1000;
+	}
+
+	return result;
+}
+
+/*
+ * Downloads the @count @uris at the same time, each into its local file (which
+ * @cb writes into, same as in http_download_file()).
+ *
+ * Up to --maximum-fetches-per-host requests run at once; they reuse the
+ * thread's connections, and each one is retried on its own.
+ *
+ * Returns 0 if all of the files were downloaded. Otherwise, the (negative) error
+ * of the first failed request, -EREQFAILED if the server failed; none of the
+ * local files is left behind in that case.
+ */
+int
+http_download_files(struct rpki_uri **uris, size_t count, http_write_cb cb,
+    bool log_operation)
+{
+	struct http_transfer *transfers;
+	struct http_transfer *transfer;
+	CURLM *multi;
+	CURLMcode mres;
+	CURLMsg *msg;
+	size_t queued;
+	unsigned int max_running;
+	unsigned int running;
+	unsigned int waiting;
+	int pending;
+	size_t i;
+	int error;
+
+	if (!config_get_http_enabled() || count == 0)
+		return 0;
+
+	transfers = calloc(count, sizeof(struct http_transfer));
+	if (transfers == NULL)
+		return pr_enomem();
+	for (i = 0; i < count; i++) {
+		transfers[i].uri = uris[i];
+		transfers[i].state = TRANSFER_QUEUED;
+	}
+
+	multi = thread_multi();
+	if (multi == NULL) {
+		free(transfers);
+		return pr_enomem();
+	}
+
+	max_running = config_get_max_fetches_per_host();
+
+	queued = 0;
+	running = 0;
+	waiting = 0;
+	error = 0;
+	do {
+		while (running < max_running) {
+			transfer = transfer_next(transfers, count, &queued,
+			    waiting);
+			if (transfer == NULL)
+				break;
+			if (transfer->state == TRANSFER_WAITING)
+				waiting--;
+			error = transfer_start(multi, transfer, cb);
+			if (error)
+				goto abort;
+			running++;
+		}
+
+		if (running == 0 && waiting == 0)
+			break; /* Done */
+
+		mres = curl_multi_perform(multi, &pending);
+		if (mres != CURLM_OK) {
+			error = pr_val_err("HTTP transfers failed: %s",
+			    curl_multi_strerror(mres));
+			goto abort;
+		}
+
+		while ((msg = curl_multi_info_read(multi, &pending)) != NULL) {
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE,
+			    (char **) &transfer);
+			running--;
+			error = transfer_finish(multi, transfer,
+			    msg->data.result, log_operation);
+			if (error)
+				goto abort;
+			if (transfer->state == TRANSFER_WAITING)
+				waiting++;
+		}
+
+		mres = curl_multi_wait(multi, NULL, 0,
+		    transfer_timeout(transfers, queued, waiting, 1000), NULL);
+		if (mres != CURLM_OK) {
+			error = pr_val_err("HTTP transfers failed: %s",
+			    curl_multi_strerror(mres));
+			goto abort;
+		}
+	} while (true);
+
+	free(transfers);
+	return 0;
+
+abort:
+	for (i = 0; i < queued; i++) {
+		transfer = &transfers[i];
+		if (transfer->state == TRANSFER_RUNNING)
+			transfer_stop(multi, transfer);
+		if (transfer->tmp_file != NULL) {
+			delete_dir_recursive_bottom_up(transfer->tmp_file);
+			free(transfer->tmp_file);
+		} else if (transfer->state == TRANSFER_DONE) {
+			delete_dir_recursive_bottom_up(
+			    uri_get_local(transfer->uri));
+		}
+	}
+	free(transfers);
+	return ENSURE_NEGATIVE(error);
+}
+
+/*
+ * A download whose body is handed over to the reader (see http_stream_read())
+ * as it arrives, instead of being stored in a file.
+ */
+struct http_stream {
+	struct rpki_uri *uri;
+	bool log_operation;
+	struct http_handler handler;
+	/* The thread's (see thread_multi()) */
+	CURLM *multi;
+
+	/* Received, but not read yet. (From @offset to @len.) */
+	unsigned char *buffer;
+	size_t offset;
+	size_t len;
+	size_t size;
+
+	/* The reader already got something; the request can't be retried. */
+	bool started;
+	unsigned int retries;
+	/* The request is over. @error is its outcome. */
+	bool done;
+	int error;
+};
+
+static size_t
+stream_write(unsigned char *content, size_t size, size_t nmemb, void *arg)
+{
+	struct http_stream *stream = arg;
+	size_t read = size * nmemb;
+	unsigned char *tmp;
+	size_t new_size;
+
+	if (stream->offset == stream->len) {
+		stream->offset = 0;
+		stream->len = 0;
+	}
+
+	if (stream->len + read > stream->size) {
+		new_size = (stream->size > 0) ? stream->size : CURL_MAX_WRITE_SIZE;
+		while (stream->len + read > new_size)
+			new_size *= 2;
+		tmp = realloc(stream->buffer, new_size);
+		if (tmp == NULL)
+			return 0; /* Aborts the transfer */
+		stream->buffer = tmp;
+		stream->size = new_size;
+	}
+
+	memcpy(stream->buffer + stream->len, content, read);
+	stream->len += read;
+	return read;
+}
+
+static int
+stream_start(struct http_stream *stream)
+{
+	CURLMcode mres;
+	int error;
+
+	error = http_easy_init(&stream->handler);
+	if (error)
+		return error;
+
+	http_fetch_prepare(&stream->handler, uri_get_global(stream->uri),
+	    stream_write, stream);
+
+	pr_val_debug("Doing HTTP GET to '%s'.", uri_get_global(stream->uri));
+	mres = curl_multi_add_handle(stream->multi, stream->handler.curl);
+	if (mres != CURLM_OK) {
+		http_easy_cleanup(&stream->handler);
+		return pr_val_err("Cannot start the request to '%s': %s",
+		    uri_get_global(stream->uri), curl_multi_strerror(mres));
+	}
+
+	return 0;
+}
+
+static void
+stream_stop(struct http_stream *stream)
+{
+	curl_multi_remove_handle(stream->multi, stream->handler.curl);
+	http_easy_cleanup(&stream->handler);
+}
+
+/* Handles the end of the request. */
+static int
+stream_finish(struct http_stream *stream, CURLcode res)
+{
+	char const *uri;
+	long response_code;
+	long cond_met;
+	int error;
+
+	uri = uri_get_global(stream->uri);
+	response_code = 0;
+	cond_met = 1;
+	error = http_fetch_result(&stream->handler, uri, res, &response_code,
+	    &cond_met, stream->log_operation);
+	stream_stop(stream);
+
+	if (error != EREQFAILED || stream->started ||
+	    stream->retries == config_get_http_retry_count()) {
+		if (error == EREQFAILED && !stream->started)
+			pr_val_warn("Max HTTP retries (%u) reached requesting for '%s', won't retry again.",
+			    stream->retries, uri);
+		stream->done = true;
+		stream->error = error;
+		return 0;
+	}
+
+	pr_val_warn("Retrying HTTP request '%s' in %u seconds, %u attempts remaining.",
+	    uri, config_get_http_retry_interval(),
+	    config_get_http_retry_count() - stream->retries);
+	stream->retries++;
+	/* Drop whatever the failed attempt left */
+	stream->offset = 0;
+	stream->len = 0;
+	sleep(config_get_http_retry_interval());
+
+	error = stream_start(stream);
+	if (error) {
+		stream->done = true;
+		stream->error = error;
+	}
+	return error;
+}
+
+/* Lets curl work until there's something for the reader. */
+static int
+stream_wait(struct http_stream *stream)
+{
+	CURLMcode mres;
+	CURLMsg *msg;
+	int pending;
+
+	mres = curl_multi_perform(stream->multi, &pending);
+	if (mres != CURLM_OK)
+		return pr_val_err("HTTP transfer failed: %s",
+		    curl_multi_strerror(mres));
+
+	msg = curl_multi_info_read(stream->multi, &pending);
+	if (msg != NULL && msg->msg == CURLMSG_DONE)
+		return stream_finish(stream, msg->data.result);
+
+	if (stream->offset < stream->len)
+		return 0;
+
+	mres = curl_multi_wait(stream->multi, NULL, 0, 1000, NULL);
+	if (mres != CURLM_OK)
+		return pr_val_err("HTTP transfer failed: %s",
+		    curl_multi_strerror(mres));
+
+	return 0;
+}
+
+/*
+ * Starts downloading @uri. Its content will have to be consumed through
+ * http_stream_read(), and @result released with http_stream_close().
+ */
+int
+http_stream_open(struct rpki_uri *uri, bool log_operation,
+    struct http_stream **result)
+{
+	struct http_stream *stream;
+	int error;
+
+	stream = calloc(1, sizeof(struct http_stream));
+	if (stream == NULL)
+		return pr_enomem();
+
+	stream->uri = uri;
+	uri_refget(uri);
+	stream->log_operation = log_operation;
+
+	stream->multi = thread_multi();
+	if (stream->multi == NULL) {
+		error = pr_enomem();
+		goto release_stream;
+	}
+
+	error = stream_start(stream);
+	if (error)
+		goto release_stream;
+
+	*result = stream;
+	return 0;
+release_stream:
+	uri_refput(uri);
+	free(stream);
+	return error;
+}
+
+/*
+ * Copies up to @size bytes of @stream's content into @buffer, waiting for them
+ * to arrive if necessary.
+ *
+ * Returns the number of bytes copied, or 0 once there's nothing left to read.
+ * (Check http_stream_close() to find out whether the request was successful.)
+ * Returns a negative value on error.
+ */
+int
+http_stream_read(struct http_stream *stream, unsigned char *buffer,
+    size_t size)
+{
+	size_t available;
+	int error;
+
+	while (stream->offset == stream->len) {
+		if (stream->done)
+			return stream->error ? -EIO : 0;
+		error = stream_wait(stream);
+		if (error)
+			return ENSURE_NEGATIVE(error);
+	}
+
+	available = stream->len - stream->offset;
+	if (size > available)
+		size = available;
+	if (size > INT_MAX)
+		size = INT_MAX;
+
+	memcpy(buffer, stream->buffer + stream->offset, size);
+	stream->offset += size;
+	stream->started = true;
+	return size;
+}
+
+/*
+ * Releases @stream, aborting the download if it's still running. Returns the
+ * outcome of the request, same as http_download_file().
+ */
+int
+http_stream_close(struct http_stream *stream)
+{
+	int error;
+
+	if (!stream->done)
+		stream_stop(stream);
+	error = stream->error;
+
+	uri_refput(stream->uri);
+	free(stream->buffer);
+	free(stream);
+
+	return ENSURE_NEGATIVE(error);
+}
@@ -12,5 +12,11 @@ void http_cleanup(void);
 typedef size_t (http_write_cb)(unsigned char *, size_t, size_t, void *);
 int http_download_file(struct rpki_uri *, http_write_cb, bool);
 int http_download_file_with_ims(struct rpki_uri *, http_write_cb, long, bool);
+int http_download_files(struct rpki_uri **, size_t, http_write_cb, bool);
+
+struct http_stream;
+int http_stream_open(struct rpki_uri *, bool, struct http_stream **);
+int http_stream_read(struct http_stream *, unsigned char *, size_t);
+int http_stream_close(struct http_stream *);
 
 #endif /* SRC_HTTP_HTTP_H_ */
@@ -3,8 +3,15 @@
 #include "debug.h"
 #include "extension.h"
 #include "nid.h"
+#include "object_cache.h"
+#include "object_store.h"
 #include "reqs_errors.h"
+#include "rpp_memo.h"
 #include "thread_var.h"
+#include "trace.h"
+#include "crypto/hash_cache.h"
+#include "crypto/sig_cache.h"
+#include "crypto/sig_verifier.h"
 #include "http/http.h"
 #include "rtr/rtr.h"
 #include "rtr/db/vrps.h"
@@ -20,19 +27,57 @@ start_rtr_server(void)
 	if (error)
 		goto just_quit;
 
-	error = db_rrdp_init();
+	/* The RRDP journal needs to know whether the store was recovered */
+	error = object_store_init();
 	if (error)
 		goto vrps_cleanup;
 
-	error = reqs_errors_init();
+	error = db_rrdp_init();
+	if (error)
+		goto object_store_cleanup;
+
+	error = hash_cache_init();
 	if (error)
 		goto db_rrdp_cleanup;
 
+	error = object_cache_init();
+	if (error)
+		goto hash_cache_cleanup;
+
+	error = sig_cache_init();
+	if (error)
+		goto object_cache_cleanup;
+
+	error = sig_verifier_init();
+	if (error)
+		goto sig_cache_cleanup;
+
+	error = trace_init();
+	if (error)
+		goto sig_verifier_cleanup;
+
+	error = reqs_errors_init();
+	if (error)
+		goto trace_cleanup;
+
 	error = rtr_listen();
 
 	reqs_errors_cleanup();
+	rpp_memo_cleanup();
+trace_cleanup:
+	trace_cleanup();
+sig_verifier_cleanup:
+	sig_verifier_cleanup();
+sig_cache_cleanup:
+	sig_cache_cleanup();
+object_cache_cleanup:
+	object_cache_cleanup();
+hash_cache_cleanup:
+	hash_cache_cleanup();
 db_rrdp_cleanup:
 	db_rrdp_cleanup();
+object_store_cleanup:
+	object_store_cleanup();
 vrps_cleanup:
 	vrps_destroy();
 just_quit:
@@ -0,0 +1,775 @@
+#include "metrics.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "address.h"
+#include "clients.h"
+#include "config.h"
+#include "log.h"
+#include "trace.h"
+#include "data_structure/uthash_nonfatal.h"
+#include "rtr/db/vrps.h"
+
+/* Request bytes we look at. The rest of the request is ignored. */
+#define REQUEST_MAX_LEN		1024
+/* Seconds a scraper has to send its request, and to take the response */
+#define SCRAPE_TIMEOUT		5
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL		0
+#endif
+
+static char const *const OBJECT_TYPES[] = {
+	"certificate", "crl", "manifest", "roa", "ghostbusters",
+};
+static char const *const PROTOCOLS[] = { "rsync", "rrdp" };
+static char const *const PHASES[] = {
+	"validation", "slurm", "deltas", "publication",
+};
+
+struct tal_metrics {
+	char *file;
+	/* Of the last validation */
+	double seconds;
+	bool success;
+	UT_hash_handle hh;
+};
+
+struct repo_metrics {
+	char *uri;
+	unsigned long fetches;
+	unsigned long failures;
+	double seconds;
+	double last_seconds;
+	unsigned long long bytes;
+	UT_hash_handle hh;
+};
+
+/* Indexed by type, then by "is invalid" */
+static atomic_ullong objects[MO_COUNT][2];
+static atomic_ullong rtr_sent;
+/* Bytes this thread has ever received over HTTP */
+static _Thread_local size_t http_received;
+
+static struct tal_metrics *tals;
+/* Indexed by protocol */
+static struct repo_metrics *repos[MP_COUNT];
+/* Of the last vrps_update() */
+static double phases[MPH_COUNT];
+/* Guards @tals, @repos and @phases. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The HTTP server, if --metrics.address is set */
+static int server_fd = -1;
+static int wake[2];
+static pthread_t server;
+
+/* Seconds since some arbitrary point, for measuring durations. */
+double
+metrics_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1000000000.0;
+}
+
+void
+metrics_object(enum metrics_object type, int error)
+{
+	atomic_fetch_add(&objects[type][error != 0], 1);
+}
+
+/* Records the outcome of the validation of the TAL @file. */
+void
+metrics_tal(char const *file, double seconds, int error)
+{
+	struct tal_metrics *tal;
+
+	pthread_mutex_lock(&lock);
+
+	HASH_FIND_STR(tals, file, tal);
+	if (tal == NULL) {
+		tal = calloc(1, sizeof(struct tal_metrics));
+		if (tal == NULL)
+			goto enomem;
+		tal->file = strdup(file);
+		if (tal->file == NULL) {
+			free(tal);
+			goto enomem;
+		}
+
+		errno = 0;
+		HASH_ADD_KEYPTR(hh, tals, tal->file, strlen(tal->file), tal);
+		if (errno) {
+			free(tal->file);
+			free(tal);
+			goto enomem;
+		}
+	}
+
+	tal->seconds = seconds;
+	tal->success = (error == 0);
+	pthread_mutex_unlock(&lock);
+	return;
+
+enomem:
+	pthread_mutex_unlock(&lock);
+	pr_enomem();
+}
+
+/* To be called by whoever gets bytes from an HTTP server. */
+void
+metrics_http_received(size_t bytes)
+{
+	http_received += bytes;
+}
+
+/*
+ * Returns the number of bytes the calling thread has ever received over HTTP.
+ * Subtract two samples to know how much a fetch downloaded.
+ */
+size_t
+metrics_http_received_total(void)
+{
+	return http_received;
+}
+
+/*
+ * Records a fetch from the repository whose URI is the first @len characters of
+ * @uri. It took @seconds, and downloaded @bytes. (Which is only known for
+ * RRDP.)
+ */
+void
+metrics_fetch(enum metrics_protocol protocol, char const *uri, size_t len,
+    double seconds, size_t bytes, int error)
+{
+	struct repo_metrics *repo;
+
+	pthread_mutex_lock(&lock);
+
+	HASH_FIND(hh, repos[protocol], uri, len, repo);
+	if (repo == NULL) {
+		repo = calloc(1, sizeof(struct repo_metrics));
+		if (repo == NULL)
+			goto enomem;
+		repo->uri = strndup(uri, len);
+		if (repo->uri == NULL) {
+			free(repo);
+			goto enomem;
+		}
+
+		errno = 0;
+		HASH_ADD_KEYPTR(hh, repos[protocol], repo->uri, len, repo);
+		if (errno) {
+			free(repo->uri);
+			free(repo);
+			goto enomem;
+		}
+	}
+
+	repo->fetches++;
+	if (error)
+		repo->failures++;
+	repo->seconds += seconds;
+	repo->last_seconds = seconds;
+	repo->bytes += bytes;
+	pthread_mutex_unlock(&lock);
+	return;
+
+enomem:
+	pthread_mutex_unlock(&lock);
+	pr_enomem();
+}
+
+/*
+ * Records the duration of @phase, which began at @start. Returns the end, which
+ * is also the beginning of the next phase.
+ */
+double
+metrics_phase_end(enum metrics_phase phase, double start)
+{
+	double now;
+
+	now = metrics_now();
+	pthread_mutex_lock(&lock);
+	phases[phase] = now - start;
+	pthread_mutex_unlock(&lock);
+
+	return now;
+}
+
+void
+metrics_rtr_sent(size_t bytes)
+{
+	atomic_fetch_add(&rtr_sent, bytes);
+}
+
+static void
+print_header(FILE *out, char const *name, char const *type, char const *help)
+{
+	fprintf(out, "# HELP %s %s\n", name, help);
+	fprintf(out, "# TYPE %s %s\n", name, type);
+}
+
+/* Prints @value as a label value, escaped the way Prometheus wants it. */
+static void
+print_label(FILE *out, char const *value)
+{
+	for (; *value != '\0'; value++) {
+		switch (*value) {
+		case '\\':
+			fputs("\\\\", out);
+			break;
+		case '"':
+			fputs("\\\"", out);
+			break;
+		case '\n':
+			fputs("\\n", out);
+			break;
+		default:
+			fputc(*value, out);
+		}
+	}
+}
+
+static void
+print_objects(FILE *out)
+{
+	unsigned int type;
+
+	print_header(out, "fort_objects_total", "counter",
+	    "RPKI objects validated, by type and outcome.");
+	for (type = 0; type < MO_COUNT; type++) {
+		fprintf(out, "fort_objects_total{type=\"%s\",result=\"valid\"} %llu\n",
+		    OBJECT_TYPES[type], atomic_load(&objects[type][0]));
+		fprintf(out, "fort_objects_total{type=\"%s\",result=\"invalid\"} %llu\n",
+		    OBJECT_TYPES[type], atomic_load(&objects[type][1]));
+	}
+}
+
+static void
+print_tals(FILE *out)
+{
+	struct tal_metrics *tal, *tmp;
+
+	print_header(out, "fort_tal_validation_duration_seconds", "gauge",
+	    "Duration of the last validation of each TAL.");
+	HASH_ITER(hh, tals, tal, tmp) {
+		fputs("fort_tal_validation_duration_seconds{tal=\"", out);
+		print_label(out, tal->file);
+		fprintf(out, "\"} %.3f\n", tal->seconds);
+	}
+
+	print_header(out, "fort_tal_validation_success", "gauge",
+	    "Whether the last validation of each TAL succeeded.");
+	HASH_ITER(hh, tals, tal, tmp) {
+		fputs("fort_tal_validation_success{tal=\"", out);
+		print_label(out, tal->file);
+		fprintf(out, "\"} %d\n", tal->success);
+	}
+}
+
+/* Prints the "{protocol=...,repository=...}" of @repo. */
+static void
+print_repo_labels(FILE *out, unsigned int protocol, struct repo_metrics *repo)
+{
+	fprintf(out, "{protocol=\"%s\",repository=\"", PROTOCOLS[protocol]);
+	print_label(out, repo->uri);
+	fputs("\"}", out);
+}
+
+static void
+print_repos(FILE *out)
+{
+	struct repo_metrics *repo, *tmp;
+	unsigned int p;
+
+	print_header(out, "fort_fetches_total", "counter",
+	    "Fetches from each repository.");
+	for (p = 0; p < MP_COUNT; p++)
+		HASH_ITER(hh, repos[p], repo, tmp) {
+			fputs("fort_fetches_total", out);
+			print_repo_labels(out, p, repo);
+			fprintf(out, " %lu\n", repo->fetches);
+		}
+
+	print_header(out, "fort_fetch_failures_total", "counter",
+	    "Failed fetches from each repository.");
+	for (p = 0; p < MP_COUNT; p++)
+		HASH_ITER(hh, repos[p], repo, tmp) {
+			fputs("fort_fetch_failures_total", out);
+			print_repo_labels(out, p, repo);
+			fprintf(out, " %lu\n", repo->failures);
+		}
+
+	print_header(out, "fort_fetch_duration_seconds_total", "counter",
+	    "Time spent fetching from each repository.");
+	for (p = 0; p < MP_COUNT; p++)
+		HASH_ITER(hh, repos[p], repo, tmp) {
+			fputs("fort_fetch_duration_seconds_total", out);
+			print_repo_labels(out, p, repo);
+			fprintf(out, " %.3f\n", repo->seconds);
+		}
+
+	print_header(out, "fort_fetch_last_duration_seconds", "gauge",
+	    "Duration of the last fetch from each repository.");
+	for (p = 0; p < MP_COUNT; p++)
+		HASH_ITER(hh, repos[p], repo, tmp) {
+			fputs("fort_fetch_last_duration_seconds", out);
+			print_repo_labels(out, p, repo);
+			fprintf(out, " %.3f\n", repo->last_seconds);
+		}
+
+	/* rsync runs as a separate program, so it can't be measured. */
+	print_header(out, "fort_fetch_received_bytes_total", "counter",
+	    "Bytes downloaded from each RRDP repository.");
+	HASH_ITER(hh, repos[MP_RRDP], repo, tmp) {
+		fputs("fort_fetch_received_bytes_total", out);
+		print_repo_labels(out, MP_RRDP, repo);
+		fprintf(out, " %llu\n", repo->bytes);
+	}
+}
+
+static void
+print_phases(FILE *out)
+{
+	unsigned int phase;
+
+	print_header(out, "fort_update_phase_duration_seconds", "gauge",
+	    "Duration of each phase of the last database update.");
+	for (phase = 0; phase < MPH_COUNT; phase++)
+		fprintf(out, "fort_update_phase_duration_seconds{phase=\"%s\"} %.3f\n",
+		    PHASES[phase], phases[phase]);
+}
+
+static void
+print_vrps(FILE *out)
+{
+	struct vrps_summary summary;
+
+	if (vrps_get_summary(&summary) != 0)
+		return; /* No serial yet */
+
+	print_header(out, "fort_rtr_serial", "gauge",
+	    "Current serial number.");
+	fprintf(out, "fort_rtr_serial %u\n", summary.serial);
+	print_header(out, "fort_rtr_delta_history", "gauge",
+	    "Serials whose deltas are still being kept.");
+	fprintf(out, "fort_rtr_delta_history %u\n", summary.deltas);
+	print_header(out, "fort_valid_prefixes", "gauge",
+	    "Validated ROA payloads of the current serial.");
+	fprintf(out, "fort_valid_prefixes %u\n", summary.prefixes);
+	print_header(out, "fort_valid_router_keys", "gauge",
+	    "Router keys of the current serial.");
+	fprintf(out, "fort_valid_router_keys %u\n", summary.router_keys);
+}
+
+struct print_clients_args {
+	FILE *out;
+	unsigned int count;
+};
+
+static in_port_t
+client_port(struct sockaddr_storage const *addr)
+{
+	switch (addr->ss_family) {
+	case AF_INET:
+		return ntohs(((struct sockaddr_in const *) addr)->sin_port);
+	case AF_INET6:
+		return ntohs(((struct sockaddr_in6 const *) addr)->sin6_port);
+	}
+
+	return 0;
+}
+
+/*
+ * Clients are labeled by their address and port, which identify the connection.
+ * (File descriptors get reused as soon as the connection is closed.)
+ */
+static int
+print_client(struct client *client, void *arg)
+{
+	struct print_clients_args *args = arg;
+	char buffer[INET6_ADDRSTRLEN];
+
+	args->count++;
+	if (!client->serial_number_set)
+		return 0;
+
+	fprintf(args->out,
+	    "fort_rtr_client_serial{address=\"%s\",port=\"%u\",",
+	    sockaddr2str(&client->addr, buffer), client_port(&client->addr));
+	if (client->rtr_version_set)
+		fprintf(args->out, "version=\"%u\"}", client->rtr_version);
+	else
+		fputs("version=\"unknown\"}", args->out);
+	fprintf(args->out, " %u\n", client->serial_number);
+	return 0;
+}
+
+static void
+print_clients(FILE *out)
+{
+	struct print_clients_args args;
+
+	print_header(out, "fort_rtr_client_serial", "gauge",
+	    "Serial each RTR client was last known to be at.");
+	args.out = out;
+	args.count = 0;
+	clients_foreach(print_client, &args);
+
+	print_header(out, "fort_rtr_clients", "gauge",
+	    "Connected RTR clients.");
+	fprintf(out, "fort_rtr_clients %u\n", args.count);
+
+	print_header(out, "fort_rtr_sent_bytes_total", "counter",
+	    "PDU bytes sent to the RTR clients.");
+	fprintf(out, "fort_rtr_sent_bytes_total %llu\n",
+	    atomic_load(&rtr_sent));
+}
+
+/* Prints all the metrics, in the Prometheus text format. */
+static void
+print_metrics(FILE *out)
+{
+	print_objects(out);
+
+	pthread_mutex_lock(&lock);
+	print_tals(out);
+	print_repos(out);
+	print_phases(out);
+	pthread_mutex_unlock(&lock);
+
+	print_vrps(out);
+	print_clients(out);
+}
+
+static void
+send_all(int fd, char const *buffer, size_t len)
+{
+	ssize_t sent;
+
+	while (len > 0) {
+		sent = send(fd, buffer, len, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR)
+				continue;
+			return; /* The scraper went away; its problem */
+		}
+		buffer += sent;
+		len -= sent;
+	}
+}
+
+static void
+respond(int fd, char const *status, char const *type, char const *body,
+    size_t body_len)
+{
+	char header[256];
+	int header_len;
+
+	header_len = snprintf(header, sizeof(header),
+	    "HTTP/1.1 %s\r\n"
+	    "Content-Type: %s\r\n"
+	    "Content-Length: %zu\r\n"
+	    "Connection: close\r\n"
+	    "\r\n", status, type, body_len);
+	send_all(fd, header, header_len);
+	send_all(fd, body, body_len);
+}
+
+/* Responds the output of @print, whose format is @type. */
+static void
+respond_printed(int fd, void (*print)(FILE *), char const *type)
+{
+	FILE *out;
+	char *body;
+	size_t body_len;
+
+	body = NULL;
+	out = open_memstream(&body, &body_len);
+	if (out == NULL) {
+		pr_op_errno(errno, "Could not allocate the metrics response");
+		respond(fd, "500 Internal Server Error", "text/plain", "", 0);
+		return;
+	}
+
+	print(out);
+	fclose(out);
+
+	respond(fd, "200 OK", type, body, body_len);
+	free(body);
+}
+
+/* Reads the request, up to the end of its header, and answers it. */
+static void
+handle_request(int fd)
+{
+	char request[REQUEST_MAX_LEN + 1];
+	struct timeval timeout;
+	size_t len;
+	ssize_t consumed;
+	char *path;
+	char *path_end;
+
+	timeout.tv_sec = SCRAPE_TIMEOUT;
+	timeout.tv_usec = 0;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	len = 0;
+	do {
+		consumed = recv(fd, request + len, REQUEST_MAX_LEN - len, 0);
+		if (consumed < 0 && errno == EINTR)
+			continue;
+		if (consumed <= 0)
+			return;
+		len += consumed;
+		request[len] = '\0';
+	} while (strstr(request, "\r\n\r\n") == NULL && len < REQUEST_MAX_LEN);
+
+	if (strncmp(request, "GET ", 4) != 0) {
+		respond(fd, "405 Method Not Allowed", "text/plain", "", 0);
+		return;
+	}
+
+	path = request + 4;
+	path_end = strchr(path, ' ');
+	if (path_end != NULL)
+		*path_end = '\0';
+
+	if (strcmp(path, "/metrics") == 0 || strcmp(path, "/") == 0)
+		respond_printed(fd, print_metrics,
+		    "text/plain; version=0.0.4; charset=utf-8");
+	else if (strcmp(path, "/trace") == 0)
+		respond_printed(fd, trace_print, "application/json");
+	else
+		respond(fd, "404 Not Found", "text/plain", "", 0);
+}
+
+static void *
+serve(void *arg)
+{
+	struct pollfd fds[2];
+	int fd;
+
+	fds[0].fd = server_fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = wake[0];
+	fds[1].events = POLLIN;
+
+	do {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			pr_op_errno(errno, "poll() on the metrics socket failed");
+			break;
+		}
+		if (fds[1].revents != 0)
+			break; /* metrics_stop() */
+		if (!(fds[0].revents & POLLIN))
+			continue;
+
+		fd = accept(server_fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno != EINTR && errno != ECONNABORTED) {
+				pr_op_errno(errno, "Could not accept a metrics scraper");
+				/* Likely out of descriptors; give them time */
+				sleep(1);
+			}
+			continue;
+		}
+
+		handle_request(fd);
+		close(fd);
+	} while (true);
+
+	return NULL;
+}
+
+static int
+bind_unix(char const *path, int *result)
+{
+	struct sockaddr_un addr;
+	int fd;
+	int error;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return pr_op_err("The metrics socket path '%s' is too long.",
+		    path);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -pr_op_errno(errno, "socket() failed");
+
+	/* Probably left behind by a previous run */
+	unlink(path);
+
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		error = -pr_op_errno(errno,
+		    "Could not bind the metrics socket to '%s'", path);
+		close(fd);
+		return error;
+	}
+
+	*result = fd;
+	return 0;
+}
+
+static int
+bind_inet(char const *address, char const *port, int *result)
+{
+	struct addrinfo hints;
+	struct addrinfo *addrs;
+	struct addrinfo *addr;
+	int reuse;
+	int fd;
+	int error;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	error = getaddrinfo(address, port, &hints, &addrs);
+	if (error)
+		return pr_op_err("Could not infer a bindable address out of metrics address '%s' and port '%s': %s",
+		    address, port, gai_strerror(error));
+
+	reuse = 1;
+	for (addr = addrs; addr != NULL; addr = addr->ai_next) {
+		fd = socket(addr->ai_family, addr->ai_socktype,
+		    addr->ai_protocol);
+		if (fd < 0) {
+			pr_op_errno(errno, "socket() failed");
+			continue;
+		}
+
+		if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse,
+		    sizeof(reuse)) < 0) {
+			pr_op_errno(errno, "setsockopt(SO_REUSEADDR) failed");
+			close(fd);
+			continue;
+		}
+
+		if (bind(fd, addr->ai_addr, addr->ai_addrlen) < 0) {
+			pr_op_errno(errno, "bind() failed");
+			close(fd);
+			continue;
+		}
+
+		freeaddrinfo(addrs);
+		*result = fd;
+		return 0;
+	}
+
+	freeaddrinfo(addrs);
+	return pr_op_err("None of the metrics addrinfo candidates could be bound.");
+}
+
+/*
+ * Starts serving the metrics, if the configuration wants them served.
+ * Needs the clients DB.
+ */
+int
+metrics_start(void)
+{
+	char const *address;
+	int error;
+
+	address = config_get_metrics_address();
+	if (address == NULL)
+		return 0;
+
+	error = (address[0] == '/')
+	    ? bind_unix(address, &server_fd)
+	    : bind_inet(address, config_get_metrics_port(), &server_fd);
+	if (error)
+		return error;
+
+	if (listen(server_fd, SOMAXCONN) < 0) {
+		error = -pr_op_errno(errno, "Couldn't listen on the metrics socket");
+		goto close_server;
+	}
+
+	if (pipe(wake) < 0) {
+		error = -pr_op_errno(errno, "Could not create a wake up pipe");
+		goto close_server;
+	}
+
+	errno = pthread_create(&server, NULL, serve, NULL);
+	if (errno) {
+		error = -pr_op_errno(errno, "Could not spawn the metrics server");
+		goto close_pipe;
+	}
+
+	pr_op_info("Serving metrics at '%s'.", address);
+	return 0;
+
+close_pipe:
+	close(wake[0]);
+	close(wake[1]);
+close_server:
+	close(server_fd);
+	server_fd = -1;
+	return error;
+}
+
+void
+metrics_stop(void)
+{
+	struct tal_metrics *tal, *tal_tmp;
+	struct repo_metrics *repo, *repo_tmp;
+	char const *address;
+	unsigned int p;
+	int error;
+
+	if (server_fd != -1) {
+		if (write(wake[1], "", 1) < 0)
+			pr_op_errno(errno, "Could not stop the metrics server");
+		error = pthread_join(server, NULL);
+		if (error)
+			pr_crit("pthread_join() threw %d on the metrics server.",
+			    error);
+
+		close(wake[0]);
+		close(wake[1]);
+		close(server_fd);
+		server_fd = -1;
+
+		address = config_get_metrics_address();
+		if (address[0] == '/')
+			unlink(address);
+	}
+
+	HASH_ITER(hh, tals, tal, tal_tmp) {
+		HASH_DEL(tals, tal);
+		free(tal->file);
+		free(tal);
+	}
+	for (p = 0; p < MP_COUNT; p++)
+		HASH_ITER(hh, repos[p], repo, repo_tmp) {
+			HASH_DEL(repos[p], repo);
+			free(repo->uri);
+			free(repo);
+		}
+}
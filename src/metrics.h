@@ -0,0 +1,55 @@
+#ifndef SRC_METRICS_H_
+#define SRC_METRICS_H_
+
+#include <stddef.h>
+
+/*
+ * Counters and gauges about the validation and the RTR server, served in the
+ * Prometheus text format over HTTP (--metrics.address).
+ *
+ * Recording is cheap and always on; nothing is served unless the address is
+ * configured.
+ */
+
+enum metrics_object {
+	MO_CERTIFICATE,
+	MO_CRL,
+	MO_MANIFEST,
+	MO_ROA,
+	MO_GHOSTBUSTERS,
+#define MO_COUNT (MO_GHOSTBUSTERS + 1)
+};
+
+enum metrics_protocol {
+	MP_RSYNC,
+	MP_RRDP,
+#define MP_COUNT (MP_RRDP + 1)
+};
+
+/* The steps of vrps_update() */
+enum metrics_phase {
+	/* Traversal of all the TALs */
+	MPH_VALIDATION,
+	MPH_SLURM,
+	/* Sorting of the new table, and diff against the previous one */
+	MPH_DELTAS,
+	/* Construction of the new serial, up to its publication */
+	MPH_PUBLICATION,
+#define MPH_COUNT (MPH_PUBLICATION + 1)
+};
+
+int metrics_start(void);
+void metrics_stop(void);
+
+double metrics_now(void);
+
+void metrics_object(enum metrics_object, int);
+void metrics_tal(char const *, double, int);
+void metrics_http_received(size_t);
+size_t metrics_http_received_total(void);
+void metrics_fetch(enum metrics_protocol, char const *, size_t, double, size_t,
+    int);
+double metrics_phase_end(enum metrics_phase, double);
+void metrics_rtr_sent(size_t);
+
+#endif /* SRC_METRICS_H_ */
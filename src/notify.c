@@ -2,24 +2,10 @@
 
 #include <err.h>
 #include <stddef.h>
-#include "clients.h"
 #include "log.h"
-#include "rtr/pdu_sender.h"
+#include "rtr/event_loop.h"
 #include "rtr/db/vrps.h"
 
-static int
-send_notify(struct client *client, void *arg)
-{
-	serial_t *serial = arg;
-
-	/* Send Serial Notify PDU */
-	send_serial_notify_pdu(client->fd, client->rtr_version,
-	    *serial);
-
-	/* Errors already logged, do not interrupt notify to other clients */
-	return 0;
-}
-
 int
 notify_clients(void)
 {
@@ -30,5 +16,7 @@ notify_clients(void)
 	if (error)
 		return error;
 
-	return clients_foreach(send_notify, &serial);
+	/* Each client's loop sends the Serial Notify on its own time */
+	event_loops_notify(serial);
+	return 0;
 }
@@ -9,15 +9,22 @@
 #include "algorithm.h"
 #include "config.h"
 #include "extension.h"
+#include "fetch_scheduler.h"
 #include "log.h"
+#include "metrics.h"
 #include "nid.h"
+#include "object_cache.h"
+#include "object_store.h"
 #include "reqs_errors.h"
 #include "str_token.h"
 #include "thread_var.h"
+#include "trace.h"
 #include "asn1/decode.h"
 #include "asn1/oid.h"
 #include "asn1/asn1c/IPAddrBlocks.h"
 #include "crypto/hash.h"
+#include "crypto/sig_cache.h"
+#include "crypto/sig_verifier.h"
 #include "incidence/incidence.h"
 #include "object/bgpsec.h"
 #include "object/name.h"
@@ -689,6 +696,9 @@ find_signedAttrs(ANY_t *signedData, struct encoded_signedAttrs *result)
 	result->size += len_len;
 }
 
+/* Replaces the signedAttrs' IMPLICIT [0]; see below. */
+static const uint8_t EXPLICIT_SET_OF_TAG = 0x31;
+
 /*
  * TODO (next iteration) there exists a thing called "PKCS7_NOVERIFY", which
  * skips unnecessary validations when using the PKCS7 API. Maybe the methods
@@ -698,28 +708,17 @@ int
 certificate_validate_signature(X509 *cert, ANY_t *signedData,
     SignatureValue_t *signature)
 {
-	static const uint8_t EXPLICIT_SET_OF_TAG = 0x31;
-
 	X509_PUBKEY *public_key;
 	EVP_MD_CTX *ctx;
 	struct encoded_signedAttrs signedAttrs;
+	struct sig_cache_key key;
+	bool cacheable;
 	int error;
 
 	public_key = X509_get_X509_PUBKEY(cert);
 	if (public_key == NULL)
 		return val_crypto_err("Certificate seems to lack a public key");
 
-	/* Create the Message Digest Context */
-	ctx = EVP_MD_CTX_create();
-	if (ctx == NULL)
-		return val_crypto_err("EVP_MD_CTX_create() error");
-
-	if (1 != EVP_DigestVerifyInit(ctx, NULL, EVP_sha256(), NULL,
-	    X509_PUBKEY_get0(public_key))) {
-		error = val_crypto_err("EVP_DigestVerifyInit() error");
-		goto end;
-	}
-
 	/*
 	 * When the [signedAttrs] field is present
 	 * (...),
@@ -770,6 +769,22 @@ certificate_validate_signature(X509 *cert, ANY_t *signedData,
 
 	find_signedAttrs(signedData, &signedAttrs);
 
+	cacheable = sig_cache_key_signed_attrs(cert, signedAttrs.buffer,
+	    signedAttrs.size, signature->buf, signature->size, &key) == 0;
+	if (cacheable && sig_cache_contains(&key))
+		return 0;
+
+	/* Create the Message Digest Context */
+	ctx = EVP_MD_CTX_create();
+	if (ctx == NULL)
+		return val_crypto_err("EVP_MD_CTX_create() error");
+
+	if (1 != EVP_DigestVerifyInit(ctx, NULL, EVP_sha256(), NULL,
+	    X509_PUBKEY_get0(public_key))) {
+		error = val_crypto_err("EVP_DigestVerifyInit() error");
+		goto end;
+	}
+
 	error = EVP_DigestVerifyUpdate(ctx, &EXPLICIT_SET_OF_TAG,
 	    sizeof(EXPLICIT_SET_OF_TAG));
 	if (1 != error) {
@@ -789,6 +804,8 @@ certificate_validate_signature(X509 *cert, ANY_t *signedData,
 		goto end;
 	}
 
+	if (cacheable)
+		sig_cache_add(&key);
 	error = 0;
 
 end:
@@ -796,19 +813,95 @@ end:
 	return error;
 }
 
+/*
+ * Schedules the verification of the signature certificate_validate_signature()
+ * would check, in @batch.
+ *
+ * @signedData has to look like a valid signed object already, because
+ * find_signedAttrs() is not very forgiving.
+ */
+int
+certificate_batch_signature(struct sig_batch *batch, X509 *cert,
+    ANY_t *signedData, SignatureValue_t *signature)
+{
+	struct encoded_signedAttrs signedAttrs;
+	struct sig_cache_key key;
+	unsigned char md[SHA256_DIGEST_LENGTH];
+	EVP_MD_CTX *ctx;
+	int ok;
+	int error;
+
+	find_signedAttrs(signedData, &signedAttrs);
+
+	error = sig_cache_key_signed_attrs(cert, signedAttrs.buffer,
+	    signedAttrs.size, signature->buf, signature->size, &key);
+	if (error)
+		return error;
+
+	ctx = EVP_MD_CTX_new();
+	if (ctx == NULL)
+		return pr_enomem();
+	ok = EVP_DigestInit_ex(ctx, EVP_sha256(), NULL)
+	    && EVP_DigestUpdate(ctx, &EXPLICIT_SET_OF_TAG,
+	        sizeof(EXPLICIT_SET_OF_TAG))
+	    && EVP_DigestUpdate(ctx, signedAttrs.buffer, signedAttrs.size)
+	    && EVP_DigestFinal_ex(ctx, md, NULL);
+	EVP_MD_CTX_free(ctx);
+	if (!ok)
+		return val_crypto_err("Could not digest the signed attributes");
+
+	return sig_batch_add_digest(batch, cert, md, signature->buf,
+	    signature->size, &key);
+}
+
+static void
+x509_refget(void *cert)
+{
+	X509_up_ref(cert);
+}
+
+static void
+x509_refput(void *cert)
+{
+	X509_free(cert);
+}
+
+static struct object_cache_type const cert_cache_type = {
+	.refget = x509_refget,
+	.refput = x509_refput,
+};
+
 int
 certificate_load(struct rpki_uri *uri, X509 **result)
 {
+	struct object_cache_key key;
+	bool cacheable;
+	struct stored_object object;
 	X509 *cert = NULL;
 	BIO *bio;
 	int error;
 
-	bio = BIO_new(BIO_s_file());
-	if (bio == NULL)
-		return val_crypto_err("BIO_new(BIO_s_file()) returned NULL");
-	if (BIO_read_filename(bio, uri_get_local(uri)) <= 0) {
-		error = val_crypto_err("Error reading certificate");
-		goto end;
+	cacheable = object_cache_key(uri_get_local(uri), &key);
+	if (cacheable) {
+		cert = object_cache_get(&key, &cert_cache_type);
+		if (cert != NULL) {
+			*result = cert;
+			return 0;
+		}
+	}
+
+	if (object_store_get(uri_get_local(uri), &object) == 0) {
+		bio = BIO_new_mem_buf(object.content, object.content_len);
+		if (bio == NULL)
+			return val_crypto_err("BIO_new_mem_buf() returned NULL");
+	} else {
+		bio = BIO_new(BIO_s_file());
+		if (bio == NULL)
+			return val_crypto_err("BIO_new(BIO_s_file()) returned NULL");
+		if (BIO_read_filename(bio, uri_get_local(uri)) <= 0) {
+			error = val_crypto_err("Error reading certificate");
+			goto end;
+		}
 	}
 
 	cert = d2i_X509_bio(bio, NULL);
@@ -817,6 +910,10 @@ certificate_load(struct rpki_uri *uri, X509 **result)
 		goto end;
 	}
 
+	if (cacheable)
+		object_cache_put(uri_get_local(uri), &key, &cert_cache_type,
+		    cert);
+
 	*result = cert;
 	error = 0;
 end:
@@ -936,12 +1033,115 @@ release_ctx:
 
 }
 
+int
+x509_time_get(ASN1_TIME const *asn1, time_t *result)
+{
+	time_t now;
+	int days, secs;
+	int error;
+
+	error = get_current_time(&now);
+	if (error)
+		return error;
+
+	/* NULL means "from now" */
+	if (!ASN1_TIME_diff(&days, &secs, NULL, asn1))
+		return val_crypto_err("ASN1_TIME_diff() returned error");
+
+	*result = now + (time_t) days * 24 * 60 * 60 + secs;
+	return 0;
+}
+
+/* The signatures X509_verify_cert() checks on behalf of @cert. */
+struct chain_sigs {
+	struct sig_cache_key cert;
+	struct sig_cache_key crl;
+	/* Were the keys computed? */
+	bool cacheable;
+};
+
+/*
+ * Were @cert's and @crls' signatures verified (by @issuer) already, during a
+ * previous validation or by the signature verifier, and are they still
+ * current?
+ *
+ * The rest of @issuer's chain was validated (again) when it was pushed to the
+ * certificate stack, so the signatures are all X509_verify_cert() would
+ * recompute. But the time-dependent checks can't be skipped. If any of them
+ * fails, this returns false, and X509_verify_cert() gets to report it.
+ */
+static bool
+chain_verified(X509 *issuer, X509 *cert, STACK_OF(X509_CRL) *crls,
+    struct chain_sigs *sigs)
+{
+	X509_CRL *crl;
+	X509_REVOKED *revoked;
+	ASN1_TIME const *next_update;
+
+	sigs->cacheable = false;
+
+	/* Leave the unusual cases to libcrypto */
+	if (issuer == NULL || sk_X509_CRL_num(crls) != 1)
+		return false;
+	crl = sk_X509_CRL_value(crls, 0);
+	if (X509_NAME_cmp(X509_get_issuer_name(cert),
+	    X509_get_subject_name(issuer)) != 0)
+		return false;
+	if (X509_NAME_cmp(X509_CRL_get_issuer(crl),
+	    X509_get_subject_name(issuer)) != 0)
+		return false;
+
+	if (sig_cache_key_cert(issuer, cert, &sigs->cert) != 0)
+		return false;
+	if (sig_cache_key_crl(issuer, crl, &sigs->crl) != 0)
+		return false;
+	sigs->cacheable = true;
+
+	if (!sig_cache_contains(&sigs->cert) || !sig_cache_contains(&sigs->crl))
+		return false;
+
+	/* X509_cmp_current_time(): -1 means past, 1 means future, 0 error */
+	if (X509_cmp_current_time(X509_get0_notBefore(cert)) != -1)
+		return false;
+	if (X509_cmp_current_time(X509_get0_notAfter(cert)) != 1)
+		return false;
+	if (X509_cmp_current_time(X509_CRL_get0_lastUpdate(crl)) != -1)
+		return false;
+	next_update = X509_CRL_get0_nextUpdate(crl);
+	if (next_update == NULL || X509_cmp_current_time(next_update) != 1)
+		return false;
+
+	return X509_CRL_get0_by_cert(crl, &revoked, cert) == 0;
+}
+
+/* Remembers the signatures X509_verify_cert() just verified. */
+static void
+chain_sigs_add(X509_STORE_CTX *ctx, X509 *issuer, struct chain_sigs *sigs)
+{
+	STACK_OF(X509) *chain;
+
+	if (!sigs->cacheable)
+		return;
+
+	/* Make sure libcrypto used the same issuer as chain_verified() */
+	chain = X509_STORE_CTX_get0_chain(ctx);
+	if (chain == NULL || sk_X509_num(chain) < 2)
+		return;
+	if (X509_cmp(sk_X509_value(chain, 1), issuer) != 0)
+		return;
+
+	sig_cache_add(&sigs->cert);
+	sig_cache_add(&sigs->crl);
+}
+
 int
 certificate_validate_chain(X509 *cert, STACK_OF(X509_CRL) *crls)
 {
 	/* Reference: openbsd/src/usr.bin/openssl/verify.c */
 
 	struct validation *state;
+	X509 *issuer;
+	struct chain_sigs sigs;
 	X509_STORE_CTX *ctx;
 	int ok;
 	int error;
@@ -953,6 +1153,10 @@ certificate_validate_chain(X509 *cert, STACK_OF(X509_CRL) *crls)
 	if (state == NULL)
 		return -EINVAL;
 
+	issuer = x509stack_peek(validation_certstack(state));
+	if (chain_verified(issuer, cert, crls, &sigs))
+		return 0;
+
 	ctx = X509_STORE_CTX_new();
 	if (ctx == NULL) {
 		val_crypto_err("X509_STORE_CTX_new() returned NULL");
@@ -1011,6 +1215,7 @@ certificate_validate_chain(X509 *cert, STACK_OF(X509_CRL) *crls)
 		goto abort;
 	}
 
+	chain_sigs_add(ctx, issuer, &sigs);
 	X509_STORE_CTX_free(ctx);
 	return 0;
 
@@ -1901,6 +2106,23 @@ get_certificate_type(X509 *cert, bool is_ta)
 	return EE;
 }
 
+/* Forced download_files(), within the per-host fetch limit. */
+static int
+force_download(struct rpki_uri *uri)
+{
+	struct fetch_host *host;
+	int error;
+
+	error = fetch_host_acquire(uri_get_global(uri), &host);
+	if (error)
+		return error;
+
+	error = download_files(uri, false, true);
+
+	fetch_host_release(host);
+	return error;
+}
+
 /*
  * It does some of the things from validate_issuer(), but we can not wait for
  * such validation, since at this point the RSYNC URI at AIA extension must be
@@ -1918,7 +2140,7 @@ force_aia_validation(struct rpki_uri *caIssuers, X509 *son)
 
 	/* RSYNC is still the preferred access mechanism, force the sync */
 	do {
-		error = download_files(caIssuers, false, true);
+		error = force_download(caIssuers);
 		if (!error)
 			break;
 		if (error == EREQFAILED) {
@@ -2019,6 +2241,10 @@ certificate_validate_aia(struct rpki_uri *caIssuers, X509 *cert)
 static int
 verify_mft_loc(struct rpki_uri *mft_uri)
 {
+	struct stored_object object;
+
+	if (object_store_get(uri_get_local(mft_uri), &object) == 0)
+		return 0;
 	if (!valid_file_or_dir(uri_get_local(mft_uri), true, false,
 	    pr_val_errno))
 		return -EINVAL; /* Error already logged */
@@ -2034,6 +2260,7 @@ verify_mft_loc(struct rpki_uri *mft_uri)
 static int
 verify_rrdp_mft_loc(struct rpki_uri *mft_uri)
 {
+	struct stored_object object;
 	struct rpki_uri *tmp;
 	int error;
 
@@ -2046,7 +2273,8 @@ verify_rrdp_mft_loc(struct rpki_uri *mft_uri)
 	if (error)
 		return error;
 
-	if (!valid_file_or_dir(uri_get_local(tmp), true, false, NULL)) {
+	if (object_store_get(uri_get_local(tmp), &object) != 0 &&
+	    !valid_file_or_dir(uri_get_local(tmp), true, false, NULL)) {
 		uri_refput(tmp);
 		return -ENOENT;
 	}
@@ -2086,7 +2314,8 @@ exec_rrdp_method(struct sia_ca_uris *sia_uris)
 		return error;
 
 	data_updated = false;
-	error = rrdp_load(sia_uris->rpkiNotify.uri, &data_updated);
+	error = rrdp_load(sia_uris->rpkiNotify.uri, sia_uris->caRepository.uri,
+	    &data_updated);
 	if (error)
 		goto err;
 
@@ -2101,7 +2330,8 @@ exec_rrdp_method(struct sia_ca_uris *sia_uris)
 			goto err;
 
 		/* Otherwise, force the snapshot processing and check again */
-		error = rrdp_reload_snapshot(sia_uris->rpkiNotify.uri);
+		error = rrdp_reload_snapshot(sia_uris->rpkiNotify.uri,
+		    sia_uris->caRepository.uri);
 		if (error)
 			goto err;
 		error = verify_rrdp_mft_loc(sia_uris->mft.uri);
@@ -2398,6 +2628,254 @@ end:
 	return 0;
 }
 
+/* The URI the repository of @sia_uris will (most likely) be fetched from. */
+static char const *
+repository_uri(struct sia_ca_uris *sia_uris)
+{
+	if (sia_uris->rpkiNotify.uri != NULL && config_get_http_enabled())
+		return uri_get_global(sia_uris->rpkiNotify.uri);
+	return uri_get_global(sia_uris->caRepository.uri);
+}
+
+/*
+ * Has the repository of @sia_uris already been fetched during this cycle?
+ *
+ * This is only a hint. (The fetch might be running right now, or the access
+ * method might end up being a different one.) use_access_method() has the last
+ * word either way.
+ */
+static bool
+repository_is_fetched(struct sia_ca_uris *sia_uris, bool new_level)
+{
+	rrdp_req_status_t status;
+
+	/* See the RFC 8182 hole in use_access_method() */
+	if (!new_level && db_rrdp_uris_workspace_get() != NULL &&
+	    sia_uris->rpkiNotify.uri == NULL)
+		return true;
+
+	if (sia_uris->rpkiNotify.uri != NULL && config_get_http_enabled()) {
+		status = RRDP_URI_REQ_UNVISITED;
+		db_rrdp_uris_get_request_status(
+		    uri_get_global(sia_uris->rpkiNotify.uri), &status);
+		return status != RRDP_URI_REQ_UNVISITED;
+	}
+
+	return !config_get_rsync_enabled() ||
+	    rsync_is_downloaded(sia_uris->caRepository.uri);
+}
+
+/* use_access_method(), within the per-host fetch limit. */
+static int
+fetch_repository(struct sia_ca_uris *sia_uris, bool new_level,
+    bool *retry_repo_sync)
+{
+	struct fetch_host *host;
+	int error;
+
+	error = fetch_host_acquire(repository_uri(sia_uris), &host);
+	if (error)
+		return error;
+
+	error = use_access_method(sia_uris, exec_rsync_method,
+	    exec_rrdp_method, new_level, retry_repo_sync);
+
+	fetch_host_release(host);
+	return error;
+}
+
+/*
+ * Second half of the CA certificate traversal: Validates the manifest, and
+ * traverses the publication point. The repository has to be fetched already.
+ *
+ * Steals ownership of *@cert (and sets it to NULL) if it makes it to the
+ * certificate stack.
+ */
+static int
+traverse_ca(struct validation *state, struct rpki_uri *cert_uri, X509 **cert,
+    enum rpki_policy policy, bool is_ta, struct sia_ca_uris *sia_uris,
+    bool repo_retry)
+{
+	struct rpp *pp;
+	int error;
+
+	do {
+		/* Validate the manifest (@mft) pointed by the certificate */
+		error = x509stack_push(validation_certstack(state), cert_uri,
+		    *cert, policy, is_ta);
+		if (error)
+			return error;
+
+		*cert = NULL; /* Ownership stolen */
+
+		error = handle_manifest(sia_uris->mft.uri, !repo_retry, &pp);
+		if (error == 0 || !repo_retry)
+			break;
+
+		/*
+		 * Don't reach here if:
+		 * - Manifest is valid.
+		 * - Working with local files due to a download error.
+		 * - RRDP was utilized to fetch the manifest.
+		 * - There was a previous attempt to re-fetch the repository.
+		 */
+		pr_val_info("Retrying repository download to discard 'transient inconsistency' manifest issue (see RFC 6481 section 5) '%s'",
+		    uri_val_get_printable(sia_uris->caRepository.uri));
+		error = force_download(sia_uris->caRepository.uri);
+		if (error)
+			break;
+
+		/* Cancel stack, reload certificate (no need to revalidate) */
+		x509stack_cancel(validation_certstack(state));
+		error = certificate_load(cert_uri, cert);
+		if (error)
+			return error;
+
+		repo_retry = false;
+	} while (true);
+
+	if (error) {
+		x509stack_cancel(validation_certstack(state));
+		return error;
+	}
+
+	/* -- Validate & traverse the RPP (@pp) described by the manifest -- */
+	rpp_traverse(pp);
+
+	rpp_refput(pp);
+	return 0;
+}
+
+/*
+ * A CA certificate that has already been validated, but whose traversal is
+ * waiting for its repository to be fetched in the background.
+ */
+struct ca_fetch {
+	struct rpki_uri *uri;
+	X509 *cert;
+	enum rpki_policy policy;
+	struct sia_ca_uris sia_uris;
+	bool new_level;
+	/* The certificate's working repository level */
+	unsigned int repo_level;
+	/*
+	 * Input: Was the parent's repository fetched through RRDP?
+	 * Output: Was this one?
+	 */
+	bool rrdp_workspace;
+
+	/* use_access_method()'s outcome */
+	int error;
+	bool repo_retry;
+
+	struct defer_node *parked;
+};
+
+static void
+ca_fetch_destroy(struct ca_fetch *fetch)
+{
+	uri_refput(fetch->uri);
+	if (fetch->cert != NULL)
+		X509_free(fetch->cert);
+	sia_ca_uris_cleanup(&fetch->sia_uris);
+	free(fetch);
+}
+
+static void
+set_rrdp_workspace(bool enabled)
+{
+	if (enabled)
+		db_rrdp_uris_workspace_enable();
+	else
+		db_rrdp_uris_workspace_disable();
+}
+
+/* Runs in a fetcher thread. */
+static void
+fetch_in_background(void *arg)
+{
+	struct ca_fetch *fetch = arg;
+	struct validation *state;
+	unsigned int prev_level;
+	bool prev_workspace;
+
+	state = state_retrieve();
+	if (state == NULL)
+		pr_crit("The fetcher has no validation state.");
+
+	/* Might be a worker fetching inline; leave its context as it was. */
+	fnstack_push_uri(fetch->uri);
+	prev_level = working_repo_push_level(fetch->repo_level);
+	prev_workspace = (db_rrdp_uris_workspace_get() != NULL);
+	set_rrdp_workspace(fetch->rrdp_workspace);
+
+	fetch->repo_retry = true;
+	fetch->error = use_access_method(&fetch->sia_uris, exec_rsync_method,
+	    exec_rrdp_method, fetch->new_level, &fetch->repo_retry);
+	fetch->rrdp_workspace = (db_rrdp_uris_workspace_get() != NULL);
+
+	set_rrdp_workspace(prev_workspace);
+	working_repo_pop_level(prev_level);
+	fnstack_pop();
+
+	/* Some worker might resume (and release) @fetch right away */
+	deferstack_unpark(validation_certstack(state), fetch->parked);
+}
+
+/*
+ * Parks the traversal of @cert_uri until its repository has been fetched, so
+ * the worker can move on to the certificates that are ready.
+ *
+ * On success, steals ownership of @cert and @sia_uris' contents.
+ */
+static int
+park_certificate(struct validation *state, struct fetch_scheduler *fetches,
+    struct rpp *rpp_parent, struct rpki_uri *cert_uri, X509 *cert,
+    enum rpki_policy policy, struct sia_ca_uris *sia_uris, bool new_level)
+{
+	struct ca_fetch *fetch;
+	struct deferred_cert deferred;
+	int error;
+
+	fetch = malloc(sizeof(struct ca_fetch));
+	if (fetch == NULL)
+		return pr_enomem();
+
+	fetch->policy = policy;
+	fetch->new_level = new_level;
+	fetch->repo_level = working_repo_peek_level();
+	fetch->rrdp_workspace = (db_rrdp_uris_workspace_get() != NULL);
+	fetch->error = 0;
+	fetch->repo_retry = false;
+
+	deferred.uri = cert_uri;
+	deferred.pp = rpp_parent;
+	deferred.rrdp_workspace = fetch->rrdp_workspace;
+	deferred.fetch = fetch;
+	error = deferstack_park(validation_certstack(state), &deferred,
+	    &fetch->parked);
+	if (error) {
+		free(fetch);
+		return error;
+	}
+
+	fetch->uri = cert_uri;
+	uri_refget(cert_uri);
+	fetch->cert = cert;
+	fetch->sia_uris = *sia_uris;
+
+	pr_val_debug("Repository '%s' has not been fetched yet; queueing.",
+	    repository_uri(sia_uris));
+	error = fetch_scheduler_submit(fetches, repository_uri(sia_uris),
+	    fetch_in_background, fetch);
+	if (error) {
+		/* Fetch it ourselves, then */
+		fetch_in_background(fetch);
+	}
+
+	return 0;
+}
+
 /** Boilerplate code for CA certificate validation and recursive traversal. */
 int
 certificate_traverse(struct rpp *rpp_parent, struct rpki_uri *cert_uri)
@@ -2406,6 +2884,7 @@ certificate_traverse(struct rpp *rpp_parent, struct rpki_uri *cert_uri)
 #define IS_TA (rpp_parent == NULL)
 
 	struct validation *state;
+	struct fetch_scheduler *fetches;
 	int total_parents;
 	STACK_OF(X509_CRL) *rpp_parent_crl;
 	X509 *cert;
@@ -2414,9 +2893,10 @@ certificate_traverse(struct rpp *rpp_parent, struct rpki_uri *cert_uri)
 	unsigned char *ski;
 	enum rpki_policy policy;
 	enum cert_type type;
-	struct rpp *pp;
 	bool repo_retry;
 	bool new_level;
+	bool validated;
+	struct trace_span span;
 	int error;
 
 	state = state_retrieve();
@@ -2435,7 +2915,9 @@ certificate_traverse(struct rpp *rpp_parent, struct rpki_uri *cert_uri)
 		    uri_val_get_printable(cert_uri));
 
 	fnstack_push_uri(cert_uri);
+	trace_begin(&span, "certificate_traverse");
 	memset(&refs, 0, sizeof(refs));
+	validated = false;
 
 	error = rpp_crl(rpp_parent, &rpp_parent_crl);
 	if (error)
@@ -2498,13 +2980,14 @@ certificate_traverse(struct rpp *rpp_parent, struct rpki_uri *cert_uri)
 	if (error)
 		goto revert_uris;
 
+	/* Whatever fails from now on is not the certificate's fault */
+	validated = true;
+
 	if (type == BGPSEC) {
 		/* This is an EE, so there's no manifest to process */
 		error = handle_bgpsec(cert, ski,
 		    x509stack_peek_resources(validation_certstack(state)));
-		cert = NULL; /* Ownership stolen at x509stack_push */
 		free(ski); /* No need to remember it */
-		x509stack_cancel(validation_certstack(state));
 
 		goto revert_refs;
 	}
@@ -2516,6 +2999,24 @@ certificate_traverse(struct rpp *rpp_parent, struct rpki_uri *cert_uri)
 	if (error)
 		goto revert_uris;
 
+	/*
+	 * Don't keep the worker waiting for a download; there's probably
+	 * plenty of other certificates it can validate meanwhile.
+	 */
+	fetches = validation_fetch_scheduler(state);
+	if (fetches != NULL && !IS_TA &&
+	    !repository_is_fetched(&sia_uris, new_level)) {
+		error = park_certificate(state, fetches, rpp_parent, cert_uri,
+		    cert, policy, &sia_uris, new_level);
+		if (error)
+			goto revert_uris;
+
+		/* Ownership stolen */
+		cert = NULL;
+		sia_ca_uris_init(&sia_uris);
+		goto revert_uris;
+	}
+
 	/*
 	 * RFC 6481 section 5: "when the repository publication point contents
 	 * are updated, a repository operator cannot assure RPs that the
@@ -2528,55 +3029,13 @@ certificate_traverse(struct rpp *rpp_parent, struct rpki_uri *cert_uri)
 	 * Avoid to re-download the repo if the mft was fetched with RRDP.
 	 */
 	repo_retry = true;
-	error = use_access_method(&sia_uris, exec_rsync_method,
-	    exec_rrdp_method, new_level, &repo_retry);
+	error = fetch_repository(&sia_uris, new_level, &repo_retry);
 	if (error)
 		goto revert_uris;
 
-	do {
-		/* Validate the manifest (@mft) pointed by the certificate */
-		error = x509stack_push(validation_certstack(state), cert_uri,
-		    cert, policy, IS_TA);
-		if (error)
-			goto revert_uris;
-
-		cert = NULL; /* Ownership stolen */
+	error = traverse_ca(state, cert_uri, &cert, policy, IS_TA, &sia_uris,
+	    repo_retry);
 
-		error = handle_manifest(sia_uris.mft.uri, !repo_retry, &pp);
-		if (error == 0 || !repo_retry)
-			break;
-
-		/*
-		 * Don't reach here if:
-		 * - Manifest is valid.
-		 * - Working with local files due to a download error.
-		 * - RRDP was utilized to fetch the manifest.
-		 * - There was a previous attempt to re-fetch the repository.
-		 */
-		pr_val_info("Retrying repository download to discard 'transient inconsistency' manifest issue (see RFC 6481 section 5) '%s'",
-		    uri_val_get_printable(sia_uris.caRepository.uri));
-		error = download_files(sia_uris.caRepository.uri, false, true);
-		if (error)
-			break;
-
-		/* Cancel stack, reload certificate (no need to revalidate) */
-		x509stack_cancel(validation_certstack(state));
-		error = certificate_load(cert_uri, &cert);
-		if (error)
-			goto revert_uris;
-
-		repo_retry = false;
-	} while (true);
-
-	if (error) {
-		x509stack_cancel(validation_certstack(state));
-		goto revert_uris;
-	}
-
-	/* -- Validate & traverse the RPP (@pp) described by the manifest -- */
-	rpp_traverse(pp);
-
-	rpp_refput(pp);
 revert_uris:
 	sia_ca_uris_cleanup(&sia_uris);
 revert_refs:
@@ -2585,6 +3044,42 @@ revert_cert:
 	if (cert != NULL)
 		X509_free(cert);
 revert_fnstack_and_debug:
+	metrics_object(MO_CERTIFICATE, validated ? 0 : error);
+	trace_end(&span, uri_val_get_printable(cert_uri));
+	fnstack_pop();
+	pr_val_debug("}");
+	return error;
+}
+
+/**
+ * Picks up the traversal of a certificate that was parked by
+ * certificate_traverse(), now that its repository has been fetched.
+ * Releases @fetch.
+ */
+int
+certificate_resume(struct ca_fetch *fetch)
+{
+	struct validation *state;
+	int error;
+
+	state = state_retrieve();
+	if (state == NULL) {
+		ca_fetch_destroy(fetch);
+		return -EINVAL;
+	}
+
+	pr_val_debug("Certificate '%s' (fetched) {",
+	    uri_val_get_printable(fetch->uri));
+	fnstack_push_uri(fetch->uri);
+	working_repo_push_level(fetch->repo_level);
+	set_rrdp_workspace(fetch->rrdp_workspace);
+
+	error = fetch->error;
+	if (!error)
+		error = traverse_ca(state, fetch->uri, &fetch->cert,
+		    fetch->policy, false, &fetch->sia_uris, fetch->repo_retry);
+
+	ca_fetch_destroy(fetch);
 	fnstack_pop();
 	pr_val_debug("}");
 	return error;
@@ -33,6 +33,13 @@ int certificate_validate_rfc6487(X509 *, enum cert_type);
 
 int certificate_validate_signature(X509 *, ANY_t *coded, SignatureValue_t *);
 
+struct sig_batch;
+int certificate_batch_signature(struct sig_batch *, X509 *, ANY_t *,
+    SignatureValue_t *);
+
+/** Converts a certificate or CRL date into a time_t. */
+int x509_time_get(ASN1_TIME const *, time_t *);
+
 /**
  * Returns the IP and AS resources declared in the respective extensions.
  *
@@ -61,4 +68,7 @@ int certificate_validate_aia(struct rpki_uri *, X509 *);
 
 int certificate_traverse(struct rpp *, struct rpki_uri *);
 
+struct ca_fetch;
+int certificate_resume(struct ca_fetch *);
+
 #endif /* SRC_OBJECT_CERTIFICATE_H_ */
@@ -4,23 +4,60 @@
 #include "algorithm.h"
 #include "extension.h"
 #include "log.h"
+#include "object_cache.h"
+#include "object_store.h"
 #include "thread_var.h"
 #include "object/name.h"
 
+static void
+crl_refget(void *crl)
+{
+	X509_CRL_up_ref(crl);
+}
+
+static void
+crl_refput(void *crl)
+{
+	X509_CRL_free(crl);
+}
+
+static struct object_cache_type const crl_cache_type = {
+	.refget = crl_refget,
+	.refput = crl_refput,
+};
+
 static int
 __crl_load(struct rpki_uri *uri, X509_CRL **result)
 {
+	struct object_cache_key key;
+	bool cacheable;
+	struct stored_object object;
 	X509_CRL *crl;
 	BIO *bio;
 	int error;
 
-	bio = BIO_new(BIO_s_file());
-	if (bio == NULL)
-		return val_crypto_err("BIO_new(BIO_s_file()) returned NULL");
-	if (BIO_read_filename(bio, uri_get_local(uri)) <= 0) {
-		error = val_crypto_err("Error reading CRL '%s'",
-		    uri_val_get_printable(uri));
-		goto end;
+	cacheable = object_cache_key(uri_get_local(uri), &key);
+	if (cacheable) {
+		crl = object_cache_get(&key, &crl_cache_type);
+		if (crl != NULL) {
+			*result = crl;
+			return 0;
+		}
+	}
+
+	if (object_store_get(uri_get_local(uri), &object) == 0) {
+		bio = BIO_new_mem_buf(object.content, object.content_len);
+		if (bio == NULL)
+			return val_crypto_err("BIO_new_mem_buf() returned NULL");
+	} else {
+		bio = BIO_new(BIO_s_file());
+		if (bio == NULL)
+			return val_crypto_err("BIO_new(BIO_s_file()) returned NULL");
+		if (BIO_read_filename(bio, uri_get_local(uri)) <= 0) {
+			error = val_crypto_err("Error reading CRL '%s'",
+			    uri_val_get_printable(uri));
+			goto end;
+		}
 	}
 
 	crl = d2i_X509_CRL_bio(bio, NULL);
@@ -30,6 +67,10 @@ __crl_load(struct rpki_uri *uri, X509_CRL **result)
 		goto end;
 	}
 
+	if (cacheable)
+		object_cache_put(uri_get_local(uri), &key, &crl_cache_type,
+		    crl);
+
 	*result = crl;
 	error = 0;
 
@@ -1,6 +1,7 @@
 #include "object/ghostbusters.h"
 
 #include "log.h"
+#include "metrics.h"
 #include "thread_var.h"
 #include "asn1/oid.h"
 #include "object/signed_object.h"
@@ -55,6 +56,7 @@ revert_args:
 revert_sobj:
 	signed_object_cleanup(&sobj);
 revert_log:
+	metrics_object(MO_GHOSTBUSTERS, error);
 	pr_val_debug("}");
 	fnstack_pop();
 	return error;
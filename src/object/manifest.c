@@ -1,11 +1,14 @@
 #include "manifest.h"
 
 #include <errno.h>
+#include <openssl/evp.h>
 
 #include "algorithm.h"
 #include "common.h"
 #include "log.h"
+#include "metrics.h"
 #include "thread_var.h"
+#include "trace.h"
 #include "asn1/decode.h"
 #include "asn1/oid.h"
 #include "asn1/asn1c/GeneralizedTime.h"
@@ -156,12 +159,28 @@ build_rpp(struct Manifest *mft, struct rpki_uri *mft_uri, bool rrdp_workspace,
 	int i;
 	struct FileAndHash *fah;
 	struct rpki_uri *uri;
+	EVP_MD_CTX *digest;
+	unsigned char md[EVP_MAX_MD_SIZE];
 	int error;
 
 	*pp = rpp_create();
 	if (*pp == NULL)
 		return pr_enomem();
 
+	/*
+	 * Digest of the files that made it to the RPP, and their hashes. (See
+	 * rpp_set_digest().)
+	 */
+	digest = EVP_MD_CTX_new();
+	if (digest == NULL) {
+		error = pr_enomem();
+		goto fail;
+	}
+	if (!EVP_DigestInit_ex(digest, EVP_sha256(), NULL)) {
+		error = val_crypto_err("EVP_DigestInit_ex() failed");
+		goto fail;
+	}
+
 	for (i = 0; i < mft->fileList.list.count; i++) {
 		fah = mft->fileList.list.array[i];
 
@@ -195,6 +214,14 @@ build_rpp(struct Manifest *mft, struct rpki_uri *mft_uri, bool rrdp_workspace,
 			continue;
 		}
 
+		if (!EVP_DigestUpdate(digest, fah->file.buf, fah->file.size) ||
+		    !EVP_DigestUpdate(digest, "", 1) ||
+		    !EVP_DigestUpdate(digest, fah->hash.buf, fah->hash.size)) {
+			uri_refput(uri);
+			error = val_crypto_err("EVP_DigestUpdate() failed");
+			goto fail;
+		}
+
 		if (uri_has_extension(uri, ".cer"))
 			error = rpp_add_cert(*pp, uri);
 		else if (uri_has_extension(uri, ".roa"))
@@ -218,9 +245,17 @@ build_rpp(struct Manifest *mft, struct rpki_uri *mft_uri, bool rrdp_workspace,
 		goto fail;
 	}
 
+	if (!EVP_DigestFinal_ex(digest, md, NULL)) {
+		error = val_crypto_err("EVP_DigestFinal_ex() failed");
+		goto fail;
+	}
+	rpp_set_digest(*pp, md);
+
+	EVP_MD_CTX_free(digest);
 	return 0;
 
 fail:
+	EVP_MD_CTX_free(digest);
 	rpp_refput(*pp);
 	return error;
 }
@@ -238,11 +273,13 @@ handle_manifest(struct rpki_uri *uri, bool rrdp_workspace, struct rpp **pp)
 	struct signed_object_args sobj_args;
 	struct Manifest *mft;
 	STACK_OF(X509_CRL) *crl;
+	struct trace_span span;
 	int error;
 
 	/* Prepare */
 	pr_val_debug("Manifest '%s' {", uri_val_get_printable(uri));
 	fnstack_push_uri(uri);
+	trace_begin(&span, "handle_manifest");
 
 	/* Decode */
 	error = signed_object_decode(&sobj, uri);
@@ -289,6 +326,8 @@ revert_manifest:
 revert_sobj:
 	signed_object_cleanup(&sobj);
 revert_log:
+	metrics_object(MO_MANIFEST, error);
+	trace_end(&span, uri_val_get_printable(uri));
 	pr_val_debug("}");
 	fnstack_pop();
 	return error;
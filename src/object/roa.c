@@ -6,7 +6,9 @@
 
 #include "config.h"
 #include "log.h"
+#include "metrics.h"
 #include "thread_var.h"
+#include "trace.h"
 #include "asn1/decode.h"
 #include "asn1/oid.h"
 #include "asn1/asn1c/RouteOriginAttestation.h"
@@ -243,8 +245,12 @@ end_error:
 	return error;
 }
 
+/*
+ * On success, @expiration will be the moment the ROA stops being valid (ie.
+ * when its EE certificate expires).
+ */
 int
-roa_traverse(struct rpki_uri *uri, struct rpp *pp)
+roa_traverse(struct rpki_uri *uri, struct rpp *pp, time_t *expiration)
 {
 	static OID oid = OID_ROA;
 	struct oid_arcs arcs = OID2ARCS("roa", oid);
@@ -252,11 +258,13 @@ roa_traverse(struct rpki_uri *uri, struct rpp *pp)
 	struct signed_object_args sobj_args;
 	struct RouteOriginAttestation *roa;
 	STACK_OF(X509_CRL) *crl;
+	struct trace_span span;
 	int error;
 
 	/* Prepare */
 	pr_val_debug("ROA '%s' {", uri_val_get_printable(uri));
 	fnstack_push_uri(uri);
+	trace_begin(&span, "roa_traverse");
 
 	/* Decode */
 	error = signed_object_decode(&sobj, uri);
@@ -282,6 +290,9 @@ roa_traverse(struct rpki_uri *uri, struct rpp *pp)
 	if (error)
 		goto revert_args;
 	error = refs_validate_ee(&sobj_args.refs, pp, sobj_args.uri);
+	if (error)
+		goto revert_args;
+	*expiration = sobj_args.expiration;
 
 revert_args:
 	signed_object_args_cleanup(&sobj_args);
@@ -290,6 +301,8 @@ revert_roa:
 revert_sobj:
 	signed_object_cleanup(&sobj);
 revert_log:
+	metrics_object(MO_ROA, error);
+	trace_end(&span, uri_val_get_printable(uri));
 	fnstack_pop();
 	pr_val_debug("}");
 	return error;
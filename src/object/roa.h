@@ -1,10 +1,12 @@
 #ifndef SRC_OBJECT_ROA_H_
 #define SRC_OBJECT_ROA_H_
 
+#include <time.h>
+
 #include "address.h"
 #include "rpp.h"
 #include "uri.h"
 
-int roa_traverse(struct rpki_uri *, struct rpp *);
+int roa_traverse(struct rpki_uri *, struct rpp *, time_t *);
 
 #endif /* SRC_OBJECT_ROA_H_ */
@@ -1,24 +1,96 @@
 #include "signed_object.h"
 
 #include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
 #include "log.h"
+#include "object_cache.h"
 #include "asn1/content_info.h"
 
-int
-signed_object_decode(struct signed_object *sobj, struct rpki_uri *uri)
+struct decoded_signed_object {
+	struct ContentInfo *cinfo;
+	struct signed_data sdata;
+	atomic_uint references;
+};
+
+static void
+decoded_refget(void *arg)
+{
+	struct decoded_signed_object *decoded = arg;
+	atomic_fetch_add(&decoded->references, 1);
+}
+
+static void
+decoded_refput(void *arg)
+{
+	struct decoded_signed_object *decoded = arg;
+
+	if (atomic_fetch_sub(&decoded->references, 1) == 1) {
+		content_info_free(decoded->cinfo);
+		signed_data_cleanup(&decoded->sdata);
+		free(decoded);
+	}
+}
+
+static struct object_cache_type const sobj_cache_type = {
+	.refget = decoded_refget,
+	.refput = decoded_refput,
+};
+
+static int
+decode(struct rpki_uri *uri, struct decoded_signed_object **result)
 {
+	struct decoded_signed_object *decoded;
 	int error;
 
-	error = content_info_load(uri, &sobj->cinfo);
+	decoded = malloc(sizeof(struct decoded_signed_object));
+	if (decoded == NULL)
+		return pr_enomem();
+
+	error = content_info_load(uri, &decoded->cinfo);
 	if (error)
-		return error;
+		goto revert_decoded;
 
-	error = signed_data_decode(&sobj->sdata, &sobj->cinfo->content);
-	if (error) {
-		content_info_free(sobj->cinfo);
-		return error;
+	error = signed_data_decode(&decoded->sdata, &decoded->cinfo->content);
+	if (error)
+		goto revert_cinfo;
+
+	atomic_init(&decoded->references, 1);
+	*result = decoded;
+	return 0;
+
+revert_cinfo:
+	content_info_free(decoded->cinfo);
+revert_decoded:
+	free(decoded);
+	return error;
+}
+
+int
+signed_object_decode(struct signed_object *sobj, struct rpki_uri *uri)
+{
+	struct object_cache_key key;
+	bool cacheable;
+	struct decoded_signed_object *decoded;
+	int error;
+
+	decoded = NULL;
+	cacheable = object_cache_key(uri_get_local(uri), &key);
+	if (cacheable)
+		decoded = object_cache_get(&key, &sobj_cache_type);
+
+	if (decoded == NULL) {
+		error = decode(uri, &decoded);
+		if (error)
+			return error;
+		if (cacheable)
+			object_cache_put(uri_get_local(uri), &key,
+			    &sobj_cache_type, decoded);
 	}
 
+	sobj->cinfo = decoded->cinfo;
+	sobj->sdata = decoded->sdata;
+	sobj->decoded = decoded;
 	return 0;
 }
 
@@ -89,9 +161,28 @@ signed_object_validate(struct signed_object *sobj, struct oid_arcs const *oid,
 	return signed_data_validate(&sobj->sdata, args);
 }
 
+/*
+ * Decodes the signed object located at @uri, and schedules the verification of
+ * its signatures in @batch. (See signed_data_batch_signatures().)
+ */
+int
+signed_object_batch_signatures(struct rpki_uri *uri, X509 *issuer,
+    struct sig_batch *batch)
+{
+	struct signed_object sobj;
+	int error;
+
+	error = signed_object_decode(&sobj, uri);
+	if (error)
+		return error;
+	error = signed_data_batch_signatures(&sobj.sdata, issuer, batch);
+	signed_object_cleanup(&sobj);
+
+	return error;
+}
+
 void
 signed_object_cleanup(struct signed_object *sobj)
 {
-	content_info_free(sobj->cinfo);
-	signed_data_cleanup(&sobj->sdata);
+	decoded_refput(sobj->decoded);
 }
@@ -4,14 +4,23 @@
 #include "asn1/oid.h"
 #include "asn1/signed_data.h"
 
+struct decoded_signed_object;
+
 struct signed_object {
 	struct ContentInfo *cinfo;
 	struct signed_data sdata;
+	/*
+	 * Owns @cinfo and @sdata. Might be shared with other threads (through
+	 * the object cache), so don't modify them.
+	 */
+	struct decoded_signed_object *decoded;
 };
 
 int signed_object_decode(struct signed_object *, struct rpki_uri *);
 int signed_object_validate(struct signed_object *, struct oid_arcs const *,
     struct signed_object_args *);
+int signed_object_batch_signatures(struct rpki_uri *, X509 *,
+    struct sig_batch *);
 void signed_object_cleanup(struct signed_object *);
 
 #endif /* SRC_OBJECT_SIGNED_OBJECT_H_ */
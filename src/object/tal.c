@@ -15,14 +15,22 @@
 #include "cert_stack.h"
 #include "common.h"
 #include "config.h"
+#include "fetch_scheduler.h"
 #include "line_file.h"
 #include "log.h"
+#include "metrics.h"
+#include "object_cache.h"
+#include "object_store.h"
 #include "random.h"
 #include "reqs_errors.h"
+#include "rpp_memo.h"
 #include "state.h"
 #include "thread_var.h"
+#include "trace.h"
 #include "validation_handler.h"
 #include "crypto/base64.h"
+#include "crypto/hash_cache.h"
+#include "crypto/sig_cache.h"
 #include "http/http.h"
 #include "object/certificate.h"
 #include "rsync/rsync.h"
@@ -62,6 +70,8 @@ struct validation_thread {
 	/* Try to sync the current TA URI? */
 	bool sync_files;
 	void *arg;
+	/* Shared by all the TALs */
+	struct uri_list *rsync_visited_uris;
 	int exit_status;
 	/* This should also only be manipulated by the parent thread. */
 	SLIST_ENTRY(validation_thread) next;
@@ -70,8 +80,17 @@ struct validation_thread {
 /* List of threads, one per TAL file */
 SLIST_HEAD(threads_list, validation_thread);
 
+/* Additional thread that helps a TAL thread traverse its tree */
+struct validation_worker {
+	pthread_t pid;
+	/* The TAL thread's validation state */
+	struct validation *parent;
+	char const *tal_file;
+};
+
 struct tal_param {
-	struct db_table *db;
+	struct vrp_collector *vrps;
+	struct uri_list *rsync_visited_uris;
 	struct threads_list *threads;
 };
 
@@ -352,8 +371,11 @@ tal_load(char const *file_name, struct tal **result)
 {
 	struct line_file *lfile;
 	struct tal *tal;
+	struct trace_span span;
 	int error;
 
+	trace_begin(&span, "tal_load");
+
 	error = lfile_open(file_name, &lfile);
 	if (error) {
 		pr_op_errno(error, "Error opening file '%s'", file_name);
@@ -382,6 +404,7 @@ tal_load(char const *file_name, struct tal **result)
 
 	lfile_close(lfile);
 	*result = tal;
+	trace_end(&span, file_name);
 	return 0;
 
 fail1:
@@ -391,6 +414,7 @@ fail2:
 fail3:
 	lfile_close(lfile);
 fail4:
+	trace_end(&span, file_name);
 	return error;
 }
 
@@ -514,6 +538,222 @@ handle_https_uri(struct rpki_uri *uri)
 	    reqs_errors_log_uri(uri_get_global(uri)));
 }
 
+/* Traverses deferred certificates until the whole tree has been validated. */
+static void
+traverse_deferred(struct validation *state)
+{
+	struct cert_stack *certstack;
+	struct deferred_cert deferred;
+	int error;
+
+	certstack = validation_certstack(state);
+	if (certstack == NULL)
+		pr_crit("Validation state has no certificate stack");
+
+	do {
+		error = deferstack_pop(certstack, &deferred);
+		if (error == -ENOENT) /* No more certificates left; we're done. */
+			return;
+		else if (error) /* All other errors are critical, currently */
+			pr_crit("deferstack_pop() returned illegal %d.", error);
+
+		/* Look up the files where the parent found them. */
+		if (deferred.rrdp_workspace)
+			db_rrdp_uris_workspace_enable();
+		else
+			db_rrdp_uris_workspace_disable();
+
+		/*
+		 * Ignore result code; remaining certificates are unrelated,
+		 * so they should not be affected.
+		 */
+		if (deferred.fetch != NULL)
+			certificate_resume(deferred.fetch);
+		else
+			certificate_traverse(deferred.pp, deferred.uri);
+
+		uri_refput(deferred.uri);
+		rpp_refput(deferred.pp);
+	} while (true);
+}
+
+static void *
+run_validation_worker(void *arg)
+{
+	struct validation_worker *worker = arg;
+	struct validation *state;
+	int error;
+
+	fnstack_init();
+	fnstack_push(worker->tal_file);
+	working_repo_init();
+
+	error = validation_prepare_worker(&state, worker->parent);
+	if (!error) {
+		traverse_deferred(state);
+		validation_destroy(state);
+	}
+
+	working_repo_cleanup();
+	fnstack_cleanup();
+	return NULL;
+}
+
+static void *
+run_fetch_worker(void *arg)
+{
+	struct validation_worker *worker = arg;
+	struct fetch_scheduler *fetches;
+	struct validation *state;
+	int error;
+
+	fnstack_init();
+	fnstack_push(worker->tal_file);
+	working_repo_init();
+
+	fetches = validation_fetch_scheduler(worker->parent);
+	error = validation_prepare_worker(&state, worker->parent);
+	fetch_scheduler_check_in(fetches, !error);
+	if (!error) {
+		fetch_scheduler_run(fetches);
+		validation_destroy(state);
+	}
+
+	working_repo_cleanup();
+	fnstack_cleanup();
+	return NULL;
+}
+
+static unsigned int
+spawn_workers(struct validation_worker *workers, unsigned int count,
+    struct validation *state, char const *tal_file, void *(*cb)(void *),
+    char const *what)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		workers[i].parent = state;
+		workers[i].tal_file = tal_file;
+		errno = pthread_create(&workers[i].pid, NULL, cb, &workers[i]);
+		if (errno) {
+			pr_op_errno(errno, "Could not spawn a %s worker", what);
+			return i;
+		}
+	}
+
+	return count;
+}
+
+static void
+join_workers(struct validation_worker *workers, unsigned int count,
+    char const *tal_file)
+{
+	unsigned int i;
+	int error;
+
+	for (i = 0; i < count; i++) {
+		error = pthread_join(workers[i].pid, NULL);
+		if (error)
+			pr_crit("pthread_join() threw %d on a '%s' worker.",
+			    error, tal_file);
+	}
+}
+
+/*
+ * Starts the --fetch-workers threads that will download the tree's repositories
+ * in the background. Returns how many of them were spawned.
+ *
+ * If none of them can work, the fetches will be performed by the validation
+ * workers themselves.
+ */
+static unsigned int
+start_fetchers(struct validation *state, char const *tal_file,
+    struct validation_worker *fetchers, unsigned int count)
+{
+	struct fetch_scheduler *fetches;
+	int error;
+
+	if (count == 0)
+		return 0;
+
+	error = fetch_scheduler_create(&fetches);
+	if (error)
+		return 0;
+	validation_set_fetch_scheduler(state, fetches);
+
+	count = spawn_workers(fetchers, count, state, tal_file,
+	    run_fetch_worker, "fetch");
+	if (fetch_scheduler_wait_fetchers(fetches, count) == 0) {
+		/* (The ones that did start are quitting.) */
+		fetch_scheduler_close(fetches);
+		join_workers(fetchers, count, tal_file);
+		validation_set_fetch_scheduler(state, NULL);
+		fetch_scheduler_destroy(fetches);
+		return 0;
+	}
+
+	return count;
+}
+
+static void
+stop_fetchers(struct validation *state, char const *tal_file,
+    struct validation_worker *fetchers, unsigned int count)
+{
+	struct fetch_scheduler *fetches;
+
+	if (count == 0)
+		return;
+
+	fetches = validation_fetch_scheduler(state);
+	fetch_scheduler_close(fetches);
+	join_workers(fetchers, count, tal_file);
+	validation_set_fetch_scheduler(state, NULL);
+	fetch_scheduler_destroy(fetches);
+}
+
+/*
+ * Validates the certificates deferred by the TA, with the help of
+ * --validation-workers - 1 additional threads, while --fetch-workers more
+ * threads download the repositories they need.
+ */
+static void
+traverse_tree(struct validation *state, char const *tal_file)
+{
+	struct validation_worker *workers;
+	struct validation_worker *fetchers;
+	unsigned int worker_count;
+	unsigned int fetcher_count;
+
+	worker_count = config_get_validation_workers() - 1;
+	fetcher_count = config_get_fetch_workers();
+	workers = NULL;
+	fetchers = NULL;
+	if (worker_count + fetcher_count > 0) {
+		workers = calloc(worker_count + fetcher_count,
+		    sizeof(struct validation_worker));
+		if (workers == NULL) {
+			pr_enomem();
+			/* Do it alone, then. */
+			worker_count = 0;
+			fetcher_count = 0;
+		}
+		fetchers = workers + worker_count;
+	}
+
+	/* The fetchers go first, so nobody parks a certificate in vain */
+	fetcher_count = start_fetchers(state, tal_file, fetchers,
+	    fetcher_count);
+	worker_count = spawn_workers(workers, worker_count, state, tal_file,
+	    run_validation_worker, "validation");
+
+	traverse_deferred(state);
+
+	join_workers(workers, worker_count, tal_file);
+	stop_fetchers(state, tal_file, fetchers, fetcher_count);
+
+	free(workers);
+}
+
 /**
  * Performs the whole validation walkthrough on uri @uri, which is assumed to
  * have been extracted from a TAL.
@@ -538,8 +778,6 @@ handle_tal_uri(struct tal *tal, struct rpki_uri *uri, void *arg)
 	struct validation_thread *thread_arg = arg;
 	struct validation_handler validation_handler;
 	struct validation *state;
-	struct cert_stack *certstack;
-	struct deferred_cert deferred;
 	int error;
 
 	validation_handler.handle_roa_v4 = handle_roa_v4;
@@ -547,7 +785,8 @@ handle_tal_uri(struct tal *tal, struct rpki_uri *uri, void *arg)
 	validation_handler.handle_router_key = handle_router_key;
 	validation_handler.arg = thread_arg->arg;
 
-	error = validation_prepare(&state, tal, &validation_handler);
+	error = validation_prepare(&state, tal, thread_arg->rsync_visited_uris,
+	    &validation_handler);
 	if (error)
 		return ENSURE_NEGATIVE(error);
 
@@ -599,14 +838,6 @@ handle_tal_uri(struct tal *tal, struct rpki_uri *uri, void *arg)
 		goto fail;
 	}
 
-	/*
-	 * Set all RRDPs URIs to non-requested, this way we will force the
-	 * request on every cycle (to check if there are updates).
-	 */
-	error = db_rrdp_uris_set_all_unvisited();
-	if (error)
-		goto end;
-
 	/* Handle root certificate. */
 	error = certificate_traverse(NULL, uri);
 	if (error) {
@@ -630,28 +861,9 @@ handle_tal_uri(struct tal *tal, struct rpki_uri *uri, void *arg)
 	 */
 
 	/* Handle every other certificate. */
-	certstack = validation_certstack(state);
-	if (certstack == NULL)
-		pr_crit("Validation state has no certificate stack");
-
-	do {
-		error = deferstack_pop(certstack, &deferred);
-		if (error == -ENOENT) {
-			/* No more certificates left; we're done. */
-			error = 1;
-			goto end;
-		} else if (error) /* All other errors are critical, currently */
-			pr_crit("deferstack_pop() returned illegal %d.", error);
-
-		/*
-		 * Ignore result code; remaining certificates are unrelated,
-		 * so they should not be affected.
-		 */
-		certificate_traverse(deferred.pp, deferred.uri);
-
-		uri_refput(deferred.uri);
-		rpp_refput(deferred.pp);
-	} while (true);
+	traverse_tree(state, thread_arg->tal_file);
+	error = 1;
+	goto end;
 
 fail:	error = ENSURE_NEGATIVE(error);
 end:	validation_destroy(state);
@@ -683,8 +895,10 @@ do_file_validation(void *thread_arg)
 {
 	struct validation_thread *thread = thread_arg;
 	struct tal *tal;
+	double start;
 	int error;
 
+	start = metrics_now();
 	fnstack_init();
 	fnstack_push(thread->tal_file);
 
@@ -726,6 +940,7 @@ destroy_tal:
 end:
 	working_repo_cleanup();
 	fnstack_cleanup();
+	metrics_tal(thread->tal_file, metrics_now() - start, error);
 	thread->exit_status = error;
 	return NULL;
 }
@@ -745,22 +960,17 @@ __do_file_validation(char const *tal_file, void *arg)
 	struct validation_thread *thread;
 	int error;
 
-	error = db_rrdp_add_tal(tal_file);
-	if (error)
-		return error;
-
 	thread = malloc(sizeof(struct validation_thread));
-	if (thread == NULL) {
-		error = pr_enomem();
-		goto free_db_rrdp;
-	}
+	if (thread == NULL)
+		return pr_enomem();
 
 	thread->tal_file = strdup(tal_file);
 	if (thread->tal_file == NULL) {
 		error = pr_enomem();
 		goto free_thread;
 	}
-	thread->arg = t_param->db;
+	thread->arg = t_param->vrps;
+	thread->rsync_visited_uris = t_param->rsync_visited_uris;
 	thread->exit_status = -EINTR;
 	thread->retry_local = true;
 	thread->sync_files = true;
@@ -779,13 +989,11 @@ free_tal_file:
 	free(thread->tal_file);
 free_thread:
 	free(thread);
-free_db_rrdp:
-	db_rrdp_rem_tal(tal_file);
 	return error;
 }
 
 int
-perform_standalone_validation(struct db_table *table)
+perform_standalone_validation(struct vrp_collector *vrps)
 {
 	struct tal_param *param;
 	struct threads_list threads;
@@ -796,12 +1004,23 @@ perform_standalone_validation(struct db_table *table)
 	if (param == NULL)
 		return pr_enomem();
 
-	/* Set existent tal RRDP info to non visited */
-	db_rrdp_reset_visited_tals();
+	/*
+	 * Nothing has been downloaded during this cycle yet. Two TALs that reach
+	 * the same repository share the download (see rsync.c and db_rrdp.c).
+	 */
+	error = rsync_create(&param->rsync_visited_uris);
+	if (error) {
+		free(param);
+		return error;
+	}
+	db_rrdp_reset_visited();
+
+	/* Nobody's reading the previous cycle's objects anymore */
+	object_store_compact();
 
 	SLIST_INIT(&threads);
 
-	param->db = table;
+	param->vrps = vrps;
 	param->threads = &threads;
 
 	error = process_file_or_dir(config_get_tal(), TAL_FILE_EXTENSION, true,
@@ -814,6 +1033,7 @@ perform_standalone_validation(struct db_table *table)
 			SLIST_REMOVE_HEAD(&threads, next);
 			thread_destroy(thread);
 		}
+		rsync_destroy(param->rsync_visited_uris);
 		free(param);
 		return error;
 	}
@@ -836,17 +1056,31 @@ perform_standalone_validation(struct db_table *table)
 	}
 
 	/* The parameter isn't needed anymore */
+	rsync_destroy(param->rsync_visited_uris);
 	free(param);
 
 	/* Log the error'd URIs summary */
 	reqs_errors_log_summary();
 
+	/*
+	 * Remove the RRDP repositories nobody asked for. (Without HTTP, nobody
+	 * could.)
+	 */
+	if (!t_error && config_get_http_enabled())
+		db_rrdp_rem_nonvisited();
+
+	/* Remember where the RRDP repositories were left, for the next run */
+	if (object_store_save() == 0)
+		db_rrdp_save();
+	hash_cache_save();
+	/* Forget the publication points that are gone */
+	rpp_memo_sweep();
+	object_cache_log_stats();
+	sig_cache_sweep();
+
 	/* One thread has errors, validation can't keep the resulting table */
 	if (t_error)
 		return t_error;
 
-	/* Remove non-visited rrdps URIS by tal */
-	db_rrdp_rem_nonvisited_tals();
-
 	return error;
 }
@@ -0,0 +1,239 @@
+#include "object_cache.h"
+
+#include <sys/queue.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "log.h"
+#include "object_store.h"
+#include "crypto/hash_cache.h"
+#include "data_structure/uthash_nonfatal.h"
+
+struct cached_id {
+	unsigned char sha256[SHA256_DIGEST_LENGTH];
+	struct object_cache_type const *type;
+};
+
+struct cached_object {
+	/* key */
+	struct cached_id id;
+	void *object;
+	size_t size;
+	UT_hash_handle hh;
+	/* Most recently used first */
+	TAILQ_ENTRY(cached_object) lru;
+};
+
+TAILQ_HEAD(cached_objects, cached_object);
+
+static struct cached_object *objects;
+static struct cached_objects lru = TAILQ_HEAD_INITIALIZER(lru);
+/* Combined size of the (encoded) cached objects */
+static size_t objects_size;
+/* Maximum @objects_size; zero means the cache is disabled */
+static size_t budget;
+
+static struct {
+	unsigned int hits;
+	unsigned int misses;
+	unsigned int evictions;
+} stats;
+
+/* Guards everything above. */
+static pthread_mutex_t objects_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+cached_object_destroy(struct cached_object *cached)
+{
+	cached->id.type->refput(cached->object);
+	free(cached);
+}
+
+/* Call with @objects_lock held. */
+static void
+cached_object_remove(struct cached_object *cached)
+{
+	HASH_DEL(objects, cached);
+	TAILQ_REMOVE(&lru, cached, lru);
+	objects_size -= cached->size;
+	cached_object_destroy(cached);
+}
+
+int
+object_cache_init(void)
+{
+	objects = NULL;
+	objects_size = 0;
+	budget = (size_t) config_get_object_cache_encoded_size() << 20;
+	memset(&stats, 0, sizeof(stats));
+	return 0;
+}
+
+void
+object_cache_cleanup(void)
+{
+	while (!TAILQ_EMPTY(&lru))
+		cached_object_remove(TAILQ_FIRST(&lru));
+}
+
+/*
+ * Identifies the object located at @path. Returns false if its content hash
+ * isn't known (or the cache is disabled); such objects are not cached.
+ */
+bool
+object_cache_key(char const *path, struct object_cache_key *key)
+{
+	struct stored_object object;
+
+	if (budget == 0)
+		return false;
+
+	if (object_store_get(path, &object) == 0) {
+		/* The store never modifies an object in place. */
+		memcpy(key->sha256, object.sha256, SHA256_DIGEST_LENGTH);
+		key->size = object.content_len;
+		key->stored = true;
+		return true;
+	}
+
+	if (stat(path, &key->meta) != 0)
+		return false;
+	if (!hash_cache_get(path, &key->meta, key->sha256))
+		return false;
+	key->size = key->meta.st_size;
+	key->stored = false;
+	return true;
+}
+
+static void
+init_id(struct cached_id *id, struct object_cache_key const *key,
+    struct object_cache_type const *type)
+{
+	/* Needed by uthash */
+	memset(id, 0, sizeof(*id));
+	memcpy(id->sha256, key->sha256, SHA256_DIGEST_LENGTH);
+	id->type = type;
+}
+
+/*
+ * Returns a reference to the cached object identified by @key, or NULL. Release
+ * it through @type's refput().
+ */
+void *
+object_cache_get(struct object_cache_key const *key,
+    struct object_cache_type const *type)
+{
+	struct cached_id id;
+	struct cached_object *cached;
+	void *result;
+
+	init_id(&id, key, type);
+	result = NULL;
+
+	pthread_mutex_lock(&objects_lock);
+	HASH_FIND(hh, objects, &id, sizeof(id), cached);
+	if (cached != NULL) {
+		TAILQ_REMOVE(&lru, cached, lru);
+		TAILQ_INSERT_HEAD(&lru, cached, lru);
+		type->refget(cached->object);
+		result = cached->object;
+		stats.hits++;
+	} else {
+		stats.misses++;
+	}
+	pthread_mutex_unlock(&objects_lock);
+
+	return result;
+}
+
+/* Was the file modified after @key was computed? */
+static bool
+file_changed(char const *path, struct object_cache_key const *key)
+{
+	struct stat meta;
+
+	if (key->stored)
+		return false;
+	if (stat(path, &meta) != 0)
+		return true;
+
+	return meta.st_ino != key->meta.st_ino
+	    || meta.st_size != key->meta.st_size
+	    || meta.st_mtim.tv_sec != key->meta.st_mtim.tv_sec
+	    || meta.st_mtim.tv_nsec != key->meta.st_mtim.tv_nsec;
+}
+
+/*
+ * Offers @object (just decoded from @path) to the cache. The cache takes its
+ * own reference if it keeps it; the caller's is not affected.
+ */
+void
+object_cache_put(char const *path, struct object_cache_key const *key,
+    struct object_cache_type const *type, void *object)
+{
+	struct cached_object *cached, *old;
+
+	if (key->size > budget)
+		return;
+	/* The decoded content might not be the one that was hashed */
+	if (file_changed(path, key))
+		return;
+
+	cached = malloc(sizeof(struct cached_object));
+	if (cached == NULL)
+		return;
+	memset(cached, 0, sizeof(struct cached_object));
+	init_id(&cached->id, key, type);
+	cached->object = object;
+	cached->size = key->size;
+
+	pthread_mutex_lock(&objects_lock);
+
+	HASH_FIND(hh, objects, &cached->id, sizeof(cached->id), old);
+	if (old != NULL) {
+		/* Another thread decoded the same object */
+		pthread_mutex_unlock(&objects_lock);
+		free(cached);
+		return;
+	}
+
+	errno = 0;
+	HASH_ADD(hh, objects, id, sizeof(cached->id), cached);
+	if (errno) {
+		pthread_mutex_unlock(&objects_lock);
+		free(cached);
+		return;
+	}
+	type->refget(object);
+	TAILQ_INSERT_HEAD(&lru, cached, lru);
+	objects_size += cached->size;
+
+	while (objects_size > budget) {
+		cached_object_remove(TAILQ_LAST(&lru, cached_objects));
+		stats.evictions++;
+	}
+
+	pthread_mutex_unlock(&objects_lock);
+}
+
+/* Logs (and resets) the counters of the last validation cycle. */
+void
+object_cache_log_stats(void)
+{
+	unsigned int lookups;
+
+	if (budget == 0)
+		return;
+
+	pthread_mutex_lock(&objects_lock);
+	lookups = stats.hits + stats.misses;
+	pr_op_info("Object cache: %u hits, %u misses (%u%% hit ratio), %u evictions. %u objects, %zu of %zu encoded bytes in use.",
+	    stats.hits, stats.misses,
+	    (lookups != 0) ? (100 * stats.hits / lookups) : 0,
+	    stats.evictions, HASH_COUNT(objects), objects_size, budget);
+	memset(&stats, 0, sizeof(stats));
+	pthread_mutex_unlock(&objects_lock);
+}
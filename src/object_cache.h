@@ -0,0 +1,50 @@
+#ifndef SRC_OBJECT_CACHE_H_
+#define SRC_OBJECT_CACHE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <openssl/sha.h>
+
+/*
+ * Keeps decoded certificates, CRLs and signed objects between validation
+ * cycles (--object-cache-encoded-size), so unchanged files don't need to be
+ * parsed again.
+ *
+ * Objects are identified by the SHA-256 of their encoded content, which is
+ * known without reading them (see object_cache_key()). Cached objects are
+ * shared by every validation thread; they're reference counted, and must not
+ * be modified.
+ *
+ * The cache is bounded by the size of the encoded objects (which is known
+ * upfront), not by the memory their decoded versions take up. It evicts the
+ * least recently used ones first.
+ */
+
+/* Kind of object; the same content decodes differently in each. */
+struct object_cache_type {
+	void (*refget)(void *);
+	void (*refput)(void *);
+};
+
+struct object_cache_key {
+	unsigned char sha256[SHA256_DIGEST_LENGTH];
+	/* Of the encoded object */
+	size_t size;
+	/* Found in the RRDP object store? (Otherwise, it's a file.) */
+	bool stored;
+	struct stat meta;
+};
+
+int object_cache_init(void);
+void object_cache_cleanup(void);
+
+bool object_cache_key(char const *, struct object_cache_key *);
+void *object_cache_get(struct object_cache_key const *,
+    struct object_cache_type const *);
+void object_cache_put(char const *, struct object_cache_key const *,
+    struct object_cache_type const *, void *);
+
+void object_cache_log_stats(void);
+
+#endif /* SRC_OBJECT_CACHE_H_ */
@@ -0,0 +1,1030 @@
+#include "object_store.h"
+
+#include <sys/mman.h>
+#include <sys/queue.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+
+#include "common.h"
+#include "config.h"
+#include "file.h"
+#include "line_file.h"
+#include "log.h"
+#include "crypto/hash.h"
+#include "data_structure/uthash_nonfatal.h"
+
+#define PACK_NAME "rrdp.pack"
+#define INDEX_EXTENSION ".idx"
+#define INDEX_VERSION 1
+
+/* A distinct object; a piece of the pack. */
+struct blob {
+	/* key */
+	unsigned char sha256[SHA256_DIGEST_LENGTH];
+	off_t offset;
+	size_t len;
+	/* Index entries that point here. Zero means the blob is garbage. */
+	unsigned int refs;
+	/* Where the blob is mapped. NULL if nobody has asked for it yet. */
+	unsigned char const *data;
+	UT_hash_handle hh;
+};
+
+/* A local path, and the object that would have been written there. */
+struct entry {
+	/* key */
+	char *path;
+	struct blob *blob;
+	UT_hash_handle hh;
+};
+
+/*
+ * A read-only mapping of a piece of the pack. Each mapping starts where the
+ * previous one ended (give or take a page), and blobs are appended atomically,
+ * so every blob lies entirely inside one of them.
+ *
+ * Mappings are only released during compaction, so readers don't have to
+ * worry about the pointers they got.
+ */
+struct mapping {
+	unsigned char *base;
+	off_t start;
+	size_t len;
+	SLIST_ENTRY(mapping) next;
+};
+
+SLIST_HEAD(mappings, mapping);
+
+/* An object that was appended to the pack, but isn't indexed yet. */
+struct staged_object {
+	char *path;
+	struct blob *blob;
+	STAILQ_ENTRY(staged_object) next;
+};
+
+STAILQ_HEAD(staged_objects, staged_object);
+
+/* A directory whose objects are being removed. */
+struct root_dir {
+	/* key */
+	char *path;
+	UT_hash_handle hh;
+};
+
+static struct {
+	bool enabled;
+	/* Were the previous run's objects recovered? */
+	bool restored;
+	char *path;
+	char *index_path;
+	int fd;
+	/* Bytes in the pack */
+	off_t size;
+	/* Bytes in the pack that belong to unreferenced blobs */
+	off_t garbage;
+	struct blob *blobs;
+	struct entry *entries;
+	/* Newest first */
+	struct mappings mappings;
+} store;
+
+/* Guards @store. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+mappings_destroy(void)
+{
+	struct mapping *map;
+
+	while (!SLIST_EMPTY(&store.mappings)) {
+		map = SLIST_FIRST(&store.mappings);
+		SLIST_REMOVE_HEAD(&store.mappings, next);
+		munmap(map->base, map->len);
+		free(map);
+	}
+}
+
+static void
+entry_destroy(struct entry *entry)
+{
+	free(entry->path);
+	free(entry);
+}
+
+static void
+objects_destroy(void)
+{
+	struct entry *entry, *tmp_entry;
+	struct blob *blob, *tmp_blob;
+
+	HASH_ITER(hh, store.entries, entry, tmp_entry) {
+		HASH_DEL(store.entries, entry);
+		entry_destroy(entry);
+	}
+	HASH_ITER(hh, store.blobs, blob, tmp_blob) {
+		HASH_DEL(store.blobs, blob);
+		free(blob);
+	}
+}
+
+void
+object_store_cleanup(void)
+{
+	if (!store.enabled)
+		return;
+
+	objects_destroy();
+	mappings_destroy();
+	close(store.fd);
+	free(store.index_path);
+	free(store.path);
+	store.enabled = false;
+}
+
+bool
+object_store_enabled(void)
+{
+	return store.enabled;
+}
+
+/* Does the store still hold the objects from the previous run? */
+bool
+object_store_restored(void)
+{
+	return store.restored;
+}
+
+static int
+pack_write(int fd, unsigned char const *buffer, size_t len, off_t offset)
+{
+	ssize_t written;
+
+	while (len > 0) {
+		written = pwrite(fd, buffer, len, offset);
+		if (written == -1) {
+			if (errno == EINTR)
+				continue;
+			return pr_op_errno(errno,
+			    "Could not write to the object store");
+		}
+		buffer += written;
+		len -= written;
+		offset += written;
+	}
+
+	return 0;
+}
+
+static void
+blob_ref(struct blob *blob)
+{
+	if (blob->refs == 0)
+		store.garbage -= blob->len;
+	blob->refs++;
+}
+
+static void
+blob_unref(struct blob *blob)
+{
+	blob->refs--;
+	if (blob->refs == 0)
+		store.garbage += blob->len;
+}
+
+/* Call with @lock held. The new blob is unreferenced. */
+static int
+blob_append(unsigned char const *sha256, unsigned char const *content,
+    size_t content_len, struct blob **result)
+{
+	struct blob *blob;
+	int error;
+
+	blob = malloc(sizeof(struct blob));
+	if (blob == NULL)
+		return pr_enomem();
+	/* Needed by uthash */
+	memset(blob, 0, sizeof(struct blob));
+
+	error = pack_write(store.fd, content, content_len, store.size);
+	if (error) {
+		free(blob);
+		return error;
+	}
+
+	memcpy(blob->sha256, sha256, SHA256_DIGEST_LENGTH);
+	blob->offset = store.size;
+	blob->len = content_len;
+	blob->refs = 0;
+	blob->data = NULL;
+	store.size += content_len;
+	store.garbage += content_len;
+
+	errno = 0;
+	HASH_ADD(hh, store.blobs, sha256, SHA256_DIGEST_LENGTH, blob);
+	if (errno) {
+		free(blob);
+		return pr_enomem();
+	}
+
+	*result = blob;
+	return 0;
+}
+
+/* Call with @lock held. The new entry doesn't point anywhere yet. */
+static int
+entry_add(char const *path, struct entry **result)
+{
+	struct entry *entry;
+
+	entry = malloc(sizeof(struct entry));
+	if (entry == NULL)
+		return pr_enomem();
+	/* Needed by uthash */
+	memset(entry, 0, sizeof(struct entry));
+
+	entry->path = strdup(path);
+	if (entry->path == NULL) {
+		free(entry);
+		return pr_enomem();
+	}
+	entry->blob = NULL;
+
+	errno = 0;
+	HASH_ADD_KEYPTR(hh, store.entries, entry->path, strlen(entry->path),
+	    entry);
+	if (errno) {
+		entry_destroy(entry);
+		return pr_enomem();
+	}
+
+	*result = entry;
+	return 0;
+}
+
+/*
+ * The index is a text file that remembers the entries between runs. The first
+ * line identifies the pack it describes:
+ *
+ * 	fort-object-store <version> <pack device> <pack inode> <pack size>
+ *
+ * Each of the others is an entry:
+ *
+ * 	<blob offset> <blob length> <blob SHA-256> <path>
+ *
+ * The pack can grow after the index is written (the extra bytes are just
+ * garbage), but a compaction replaces the pack's inode, which invalidates the
+ * index until it's rewritten.
+ */
+
+/* Call with @lock held. */
+static int
+index_load_entry(char const *line, off_t pack_size)
+{
+	char hex[2 * SHA256_DIGEST_LENGTH + 1];
+	unsigned char sha256[SHA256_DIGEST_LENGTH];
+	long long offset;
+	size_t len;
+	int path_start;
+	struct blob *blob;
+	struct entry *entry;
+	unsigned int i;
+	int error;
+
+	path_start = 0;
+	if (sscanf(line, "%lld %zu %64s %n", &offset, &len, hex,
+	    &path_start) != 3 || path_start == 0 || line[path_start] == '\0')
+		return -EINVAL;
+	if (offset < 0 || offset > pack_size || len > pack_size - offset)
+		return -EINVAL;
+	if (strlen(hex) != 2 * SHA256_DIGEST_LENGTH)
+		return -EINVAL;
+	for (i = 0; i < SHA256_DIGEST_LENGTH; i++)
+		if (sscanf(hex + 2 * i, "%2hhx", &sha256[i]) != 1)
+			return -EINVAL;
+
+	HASH_FIND(hh, store.blobs, sha256, SHA256_DIGEST_LENGTH, blob);
+	if (blob == NULL) {
+		blob = malloc(sizeof(struct blob));
+		if (blob == NULL)
+			return pr_enomem();
+		/* Needed by uthash */
+		memset(blob, 0, sizeof(struct blob));
+
+		memcpy(blob->sha256, sha256, SHA256_DIGEST_LENGTH);
+		blob->offset = offset;
+		blob->len = len;
+		blob->refs = 0;
+		blob->data = NULL;
+
+		errno = 0;
+		HASH_ADD(hh, store.blobs, sha256, SHA256_DIGEST_LENGTH, blob);
+		if (errno) {
+			free(blob);
+			return pr_enomem();
+		}
+	} else if (blob->offset != offset || blob->len != len) {
+		return -EINVAL;
+	}
+
+	HASH_FIND_STR(store.entries, line + path_start, entry);
+	if (entry != NULL)
+		return -EINVAL;
+
+	error = entry_add(line + path_start, &entry);
+	if (error)
+		return error;
+
+	blob->refs++;
+	entry->blob = blob;
+	return 0;
+}
+
+/*
+ * Recovers the entries of the previous run. Returns nonzero if they can't be
+ * trusted, in which case the caller should clean up whatever was loaded.
+ */
+static int
+index_load(void)
+{
+	struct line_file *lfile;
+	struct stat meta;
+	struct blob *blob, *tmp;
+	char *line;
+	unsigned int version;
+	unsigned long long dev, ino;
+	long long size;
+	off_t live;
+	int error;
+
+	if (fstat(store.fd, &meta) == -1)
+		return pr_op_errno(errno, "Could not stat '%s'", store.path);
+
+	error = lfile_open(store.index_path, &lfile);
+	if (error)
+		return error;
+
+	error = lfile_read(lfile, &line);
+	if (error)
+		goto end;
+	if (line == NULL || sscanf(line, "fort-object-store %u %llu %llu %lld",
+	    &version, &dev, &ino, &size) != 4 || version != INDEX_VERSION ||
+	    dev != meta.st_dev || ino != meta.st_ino || size > meta.st_size) {
+		pr_op_info("The object store's index doesn't match its pack. Starting from scratch.");
+		free(line);
+		error = -EINVAL;
+		goto end;
+	}
+	free(line);
+
+	do {
+		error = lfile_read(lfile, &line);
+		if (error)
+			goto end;
+		if (line == NULL)
+			break;
+
+		error = index_load_entry(line, size);
+		free(line);
+		if (error) {
+			pr_op_info("The object store's index is corrupted. Starting from scratch.");
+			goto end;
+		}
+	} while (true);
+
+	live = 0;
+	HASH_ITER(hh, store.blobs, blob, tmp)
+		live += blob->len;
+	store.size = meta.st_size;
+	store.garbage = store.size - live;
+
+	pr_op_info("Recovered %u objects from the object store.",
+	    HASH_COUNT(store.entries));
+end:
+	lfile_close(lfile);
+	return error;
+}
+
+static int
+index_write(FILE *file, void *arg)
+{
+	struct stat *meta = arg;
+	struct entry *entry, *tmp;
+	unsigned int i;
+
+	fprintf(file, "fort-object-store %u %llu %llu %lld\n", INDEX_VERSION,
+	    (unsigned long long) meta->st_dev,
+	    (unsigned long long) meta->st_ino, (long long) store.size);
+
+	HASH_ITER(hh, store.entries, entry, tmp) {
+		fprintf(file, "%lld %zu ", (long long) entry->blob->offset,
+		    entry->blob->len);
+		for (i = 0; i < SHA256_DIGEST_LENGTH; i++)
+			fprintf(file, "%02x", entry->blob->sha256[i]);
+		fprintf(file, " %s\n", entry->path);
+	}
+
+	return 0;
+}
+
+/* Call with @lock held. */
+static int
+index_save(void)
+{
+	struct stat meta;
+
+	/* The index must never point to data that didn't make it to disk. */
+	if (fdatasync(store.fd) == -1)
+		return pr_op_errno(errno, "Could not sync '%s'", store.path);
+	if (fstat(store.fd, &meta) == -1)
+		return pr_op_errno(errno, "Could not stat '%s'", store.path);
+
+	return file_write_atomic(store.index_path, index_write, &meta);
+}
+
+int
+object_store_init(void)
+{
+	char const *repository;
+	int error;
+
+	SLIST_INIT(&store.mappings);
+	store.blobs = NULL;
+	store.entries = NULL;
+	store.size = 0;
+	store.garbage = 0;
+
+	store.restored = false;
+	store.enabled = config_get_rrdp_object_store();
+	if (!store.enabled)
+		return 0;
+
+	repository = config_get_local_repository();
+	store.path = malloc(strlen(repository) + strlen(PACK_NAME) + 2);
+	if (store.path == NULL)
+		return pr_enomem();
+	sprintf(store.path, "%s/%s", repository, PACK_NAME);
+
+	store.index_path = malloc(strlen(store.path) +
+	    strlen(INDEX_EXTENSION) + 1);
+	if (store.index_path == NULL) {
+		error = pr_enomem();
+		goto free_path;
+	}
+	sprintf(store.index_path, "%s%s", store.path, INDEX_EXTENSION);
+
+	error = create_dir_recursive(store.path);
+	if (error)
+		goto free_index_path;
+
+	store.fd = open(store.path, O_RDWR | O_CREAT, 0644);
+	if (store.fd == -1) {
+		error = pr_op_errno(errno, "Could not open the object store '%s'",
+		    store.path);
+		goto free_index_path;
+	}
+
+	store.restored = (index_load() == 0);
+	if (!store.restored) {
+		/* Whatever's in the pack is unreachable; start from scratch. */
+		objects_destroy();
+		if (ftruncate(store.fd, 0) == -1) {
+			error = pr_op_errno(errno,
+			    "Could not truncate the object store '%s'",
+			    store.path);
+			close(store.fd);
+			goto free_index_path;
+		}
+		store.size = 0;
+		store.garbage = 0;
+		/* Don't let it describe the new pack if we crash before saving */
+		if (unlink(store.index_path) == -1 && errno != ENOENT)
+			pr_op_warn("Could not delete '%s': %s", store.index_path,
+			    strerror(errno));
+	}
+
+	return 0;
+free_index_path:
+	free(store.index_path);
+free_path:
+	free(store.path);
+	store.enabled = false;
+	return error;
+}
+
+/*
+ * Call with @lock held. Returns the blob whose content is @content, appending
+ * it to the pack if there's none.
+ */
+static int
+blob_get(unsigned char const *sha256, unsigned char const *content,
+    size_t content_len, struct blob **result)
+{
+	HASH_FIND(hh, store.blobs, sha256, SHA256_DIGEST_LENGTH, *result);
+	if (*result != NULL)
+		return 0;
+
+	return blob_append(sha256, content, content_len, result);
+}
+
+/* Call with @lock held. Makes @blob the object located at @path. */
+static int
+entry_set(char const *path, struct blob *blob)
+{
+	struct entry *entry;
+	int error;
+
+	HASH_FIND_STR(store.entries, path, entry);
+	if (entry == NULL) {
+		error = entry_add(path, &entry);
+		if (error)
+			return error;
+	} else if (entry->blob == blob) {
+		return 0;
+	} else {
+		blob_unref(entry->blob);
+	}
+
+	blob_ref(blob);
+	entry->blob = blob;
+	return 0;
+}
+
+/*
+ * Stores @content as the object located at @path, replacing whatever was
+ * there.
+ */
+int
+object_store_put(char const *path, unsigned char const *content,
+    size_t content_len)
+{
+	unsigned char sha256[EVP_MAX_MD_SIZE];
+	unsigned int sha256_len;
+	struct blob *blob;
+	int error;
+
+	error = hash_buffer("sha256", content, content_len, sha256,
+	    &sha256_len);
+	if (error)
+		return error;
+
+	pthread_mutex_lock(&lock);
+	error = blob_get(sha256, content, content_len, &blob);
+	if (!error)
+		error = entry_set(path, blob);
+	pthread_mutex_unlock(&lock);
+
+	return error;
+}
+
+int
+object_store_stage_create(struct staged_objects **result)
+{
+	struct staged_objects *stage;
+
+	stage = malloc(sizeof(struct staged_objects));
+	if (stage == NULL)
+		return pr_enomem();
+
+	STAILQ_INIT(stage);
+	*result = stage;
+	return 0;
+}
+
+/*
+ * Like object_store_put(), except the object stays out of sight until @stage is
+ * committed. Its content is appended to the pack right away, though, so @stage
+ * doesn't need to keep it in memory.
+ */
+int
+object_store_stage(struct staged_objects *stage, char const *path,
+    unsigned char const *content, size_t content_len)
+{
+	unsigned char sha256[EVP_MAX_MD_SIZE];
+	unsigned int sha256_len;
+	struct staged_object *object;
+	int error;
+
+	error = hash_buffer("sha256", content, content_len, sha256,
+	    &sha256_len);
+	if (error)
+		return error;
+
+	object = malloc(sizeof(struct staged_object));
+	if (object == NULL)
+		return pr_enomem();
+	object->path = strdup(path);
+	if (object->path == NULL) {
+		free(object);
+		return pr_enomem();
+	}
+
+	/*
+	 * The blob might remain unreferenced until the commit, but that's fine;
+	 * garbage is only reclaimed between validation cycles.
+	 */
+	pthread_mutex_lock(&lock);
+	error = blob_get(sha256, content, content_len, &object->blob);
+	pthread_mutex_unlock(&lock);
+	if (error) {
+		free(object->path);
+		free(object);
+		return error;
+	}
+
+	STAILQ_INSERT_TAIL(stage, object, next);
+	return 0;
+}
+
+/* Makes @stage's objects visible, in the order they were staged. */
+int
+object_store_commit(struct staged_objects *stage)
+{
+	struct staged_object *object;
+	int error;
+
+	error = 0;
+	pthread_mutex_lock(&lock);
+	STAILQ_FOREACH(object, stage, next) {
+		error = entry_set(object->path, object->blob);
+		if (error)
+			break;
+	}
+	pthread_mutex_unlock(&lock);
+
+	return error;
+}
+
+/*
+ * Releases @stage. If it wasn't committed, its objects are left in the pack as
+ * garbage, for the next compaction.
+ */
+void
+object_store_stage_destroy(struct staged_objects *stage)
+{
+	struct staged_object *object;
+
+	while (!STAILQ_EMPTY(stage)) {
+		object = STAILQ_FIRST(stage);
+		STAILQ_REMOVE_HEAD(stage, next);
+		free(object->path);
+		free(object);
+	}
+	free(stage);
+}
+
+/* Call with @lock held. */
+static int
+mapping_add(struct mapping **result)
+{
+	struct mapping *last;
+	struct mapping *map;
+	off_t start;
+	int error;
+
+	last = SLIST_FIRST(&store.mappings);
+	start = (last != NULL) ? (last->start + last->len) : 0;
+	start -= start % sysconf(_SC_PAGESIZE);
+
+	map = malloc(sizeof(struct mapping));
+	if (map == NULL)
+		return pr_enomem();
+
+	map->start = start;
+	map->len = store.size - start;
+	map->base = mmap(NULL, map->len, PROT_READ, MAP_SHARED, store.fd,
+	    start);
+	if (map->base == MAP_FAILED) {
+		error = pr_op_errno(errno, "Could not map the object store");
+		free(map);
+		return error;
+	}
+
+	SLIST_INSERT_HEAD(&store.mappings, map, next);
+	*result = map;
+	return 0;
+}
+
+/* Call with @lock held. */
+static int
+blob_map(struct blob *blob)
+{
+	struct mapping *map;
+	int error;
+
+	if (blob->len == 0) {
+		blob->data = (unsigned char const *) "";
+		return 0;
+	}
+
+	SLIST_FOREACH(map, &store.mappings, next)
+		if (map->start <= blob->offset &&
+		    blob->offset + blob->len <= map->start + map->len)
+			goto found;
+
+	/* It was appended after the last mapping was created. */
+	error = mapping_add(&map);
+	if (error)
+		return error;
+
+found:
+	blob->data = map->base + (blob->offset - map->start);
+	return 0;
+}
+
+/*
+ * Looks up the object located at @path. Returns -ENOENT if it isn't in the
+ * store (or the store is disabled), in which case the caller should look at
+ * the actual file system.
+ *
+ * The contents of @result remain valid until the next object_store_compact().
+ */
+int
+object_store_get(char const *path, struct stored_object *result)
+{
+	struct entry *entry;
+	int error;
+
+	if (!store.enabled)
+		return -ENOENT;
+
+	pthread_mutex_lock(&lock);
+
+	HASH_FIND_STR(store.entries, path, entry);
+	if (entry == NULL) {
+		error = -ENOENT;
+		goto end;
+	}
+
+	if (entry->blob->data == NULL) {
+		error = blob_map(entry->blob);
+		if (error)
+			goto end;
+	}
+
+	result->content = entry->blob->data;
+	result->content_len = entry->blob->len;
+	result->sha256 = entry->blob->sha256;
+	error = 0;
+
+end:
+	pthread_mutex_unlock(&lock);
+	return error;
+}
+
+/* Call with @lock held. */
+static void
+entry_remove(struct entry *entry)
+{
+	HASH_DEL(store.entries, entry);
+	blob_unref(entry->blob);
+	entry_destroy(entry);
+}
+
+/* Forgets the object located at @path, if there's any. */
+void
+object_store_remove(char const *path)
+{
+	struct entry *entry;
+
+	if (!store.enabled)
+		return;
+
+	pthread_mutex_lock(&lock);
+	HASH_FIND_STR(store.entries, path, entry);
+	if (entry != NULL)
+		entry_remove(entry);
+	pthread_mutex_unlock(&lock);
+}
+
+static void
+root_dirs_destroy(struct root_dir *roots)
+{
+	struct root_dir *root, *tmp;
+
+	HASH_ITER(hh, roots, root, tmp) {
+		HASH_DEL(roots, root);
+		free(root->path);
+		free(root);
+	}
+}
+
+static int
+root_dirs_add(struct root_dir **roots, char const *uri, char const *workspace)
+{
+	struct root_dir *root;
+	size_t len;
+	int error;
+
+	root = malloc(sizeof(struct root_dir));
+	if (root == NULL)
+		return pr_enomem();
+	/* Needed by uthash */
+	memset(root, 0, sizeof(struct root_dir));
+
+	error = map_uri_to_local(uri, "rsync://", workspace, &root->path);
+	if (error) {
+		free(root);
+		return error;
+	}
+
+	len = strlen(root->path);
+	if (len > 0 && root->path[len - 1] == '/')
+		root->path[--len] = '\0';
+
+	errno = 0;
+	HASH_ADD_KEYPTR(hh, *roots, root->path, len, root);
+	if (errno) {
+		free(root->path);
+		free(root);
+		return pr_enomem();
+	}
+
+	return 0;
+}
+
+static bool
+is_under_roots(struct root_dir *roots, char const *path)
+{
+	struct root_dir *root;
+	char const *slash;
+
+	for (slash = strchr(path, '/'); slash != NULL;
+	    slash = strchr(slash + 1, '/')) {
+		HASH_FIND(hh, roots, path, slash - path, root);
+		if (root != NULL)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Forgets all the objects located under the @roots directories (rsync URIs,
+ * at the RRDP @workspace). The store's counterpart of delete_dir_daemon_start().
+ */
+int
+object_store_remove_roots(char **roots, size_t roots_len,
+    char const *workspace)
+{
+	struct root_dir *dirs;
+	struct entry *entry, *tmp;
+	size_t i;
+	int error;
+
+	if (!store.enabled)
+		return 0;
+
+	dirs = NULL;
+	for (i = 0; i < roots_len; i++) {
+		error = root_dirs_add(&dirs, roots[i], workspace);
+		if (error) {
+			root_dirs_destroy(dirs);
+			return error;
+		}
+	}
+
+	pthread_mutex_lock(&lock);
+	HASH_ITER(hh, store.entries, entry, tmp)
+		if (is_under_roots(dirs, entry->path))
+			entry_remove(entry);
+	pthread_mutex_unlock(&lock);
+
+	root_dirs_destroy(dirs);
+	return 0;
+}
+
+/*
+ * Writes the referenced blobs to a new pack, and replaces the old one with it.
+ * Call with @lock held.
+ */
+static int
+pack_rewrite(void)
+{
+	unsigned char *old;
+	off_t old_size;
+	char *tmp_path;
+	struct blob *blob, *tmp;
+	off_t size;
+	int fd;
+	int error;
+
+	old_size = store.size;
+	old = mmap(NULL, old_size, PROT_READ, MAP_SHARED, store.fd, 0);
+	if (old == MAP_FAILED)
+		return pr_op_errno(errno, "Could not map the object store");
+
+	tmp_path = malloc(strlen(store.path) + strlen(".tmp") + 1);
+	if (tmp_path == NULL) {
+		error = pr_enomem();
+		goto unmap;
+	}
+	sprintf(tmp_path, "%s.tmp", store.path);
+
+	fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		error = pr_op_errno(errno, "Could not create '%s'", tmp_path);
+		goto free_path;
+	}
+
+	size = 0;
+	HASH_ITER(hh, store.blobs, blob, tmp) {
+		if (blob->refs == 0)
+			continue;
+		error = pack_write(fd, old + blob->offset, blob->len, size);
+		if (error)
+			goto close_fd;
+		size += blob->len;
+	}
+
+	if (rename(tmp_path, store.path) == -1) {
+		error = pr_op_errno(errno, "Could not rename '%s'", tmp_path);
+		goto close_fd;
+	}
+
+	/* Same iteration order as above, so the offsets match. */
+	mappings_destroy();
+	size = 0;
+	HASH_ITER(hh, store.blobs, blob, tmp) {
+		if (blob->refs == 0) {
+			HASH_DEL(store.blobs, blob);
+			free(blob);
+			continue;
+		}
+		blob->offset = size;
+		blob->data = NULL;
+		size += blob->len;
+	}
+
+	close(store.fd);
+	store.fd = fd;
+	store.size = size;
+	store.garbage = 0;
+
+	free(tmp_path);
+	munmap(old, old_size);
+	return 0;
+
+close_fd:
+	close(fd);
+	unlink(tmp_path);
+free_path:
+	free(tmp_path);
+unmap:
+	munmap(old, old_size);
+	return error;
+}
+
+/*
+ * Reclaims the space of the objects that have been withdrawn or replaced, if
+ * they're wasting at least half of the pack.
+ *
+ * This invalidates every stored_object returned so far, so only call it while
+ * nobody is validating.
+ */
+void
+object_store_compact(void)
+{
+	off_t before;
+
+	if (!store.enabled)
+		return;
+
+	pthread_mutex_lock(&lock);
+	before = store.size;
+	if (store.garbage > 0 && store.garbage >= store.size / 2) {
+		if (pack_rewrite() == 0) {
+			pr_op_debug("Compacted the object store from %lld to %lld bytes.",
+			    (long long) before, (long long) store.size);
+			/* The old index no longer describes the pack. */
+			index_save();
+		}
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Makes the current entries survive a restart. Call at the end of a validation
+ * cycle, before anything that remembers them (db_rrdp_save()).
+ */
+int
+object_store_save(void)
+{
+	int error;
+
+	if (!store.enabled)
+		return 0;
+
+	pthread_mutex_lock(&lock);
+	error = index_save();
+	pthread_mutex_unlock(&lock);
+
+	return error;
+}
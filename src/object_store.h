@@ -0,0 +1,55 @@
+#ifndef SRC_OBJECT_STORE_H_
+#define SRC_OBJECT_STORE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Optional replacement for the one-file-per-object layout of the RRDP
+ * workspaces (--rrdp-object-store).
+ *
+ * The objects published through RRDP are appended to a single pack file, and
+ * indexed by the local path they would otherwise have been written to. Equal
+ * objects are only stored once (the pack is addressed by SHA-256). Readers get
+ * pointers straight into memory mappings of the pack.
+ *
+ * The pack only ever grows during a validation cycle; the space of withdrawn
+ * and replaced objects is reclaimed by object_store_compact(), between cycles.
+ * object_store_save() writes an index next to the pack, so the objects can be
+ * recovered after a restart.
+ *
+ * Objects that can't be trusted yet (such as the contents of a snapshot whose
+ * hash hasn't been validated) can be staged instead: they're appended to the
+ * pack, but nobody can see them until the stage is committed.
+ */
+
+/* An object, as found in the store. */
+struct stored_object {
+	unsigned char const *content;
+	size_t content_len;
+	/* SHA256_DIGEST_LENGTH bytes */
+	unsigned char const *sha256;
+};
+
+int object_store_init(void);
+void object_store_cleanup(void);
+bool object_store_enabled(void);
+bool object_store_restored(void);
+
+int object_store_put(char const *, unsigned char const *, size_t);
+int object_store_get(char const *, struct stored_object *);
+void object_store_remove(char const *);
+int object_store_remove_roots(char **, size_t, char const *);
+
+struct staged_objects;
+
+int object_store_stage_create(struct staged_objects **);
+int object_store_stage(struct staged_objects *, char const *,
+    unsigned char const *, size_t);
+int object_store_commit(struct staged_objects *);
+void object_store_stage_destroy(struct staged_objects *);
+
+void object_store_compact(void);
+int object_store_save(void);
+
+#endif /* SRC_OBJECT_STORE_H_ */
@@ -1,15 +1,23 @@
 #include "rpp.h"
 
+#include <stdatomic.h>
 #include <stdlib.h>
+#include <string.h>
+#include <openssl/evp.h>
 #include "cert_stack.h"
 #include "log.h"
+#include "metrics.h"
+#include "rpp_memo.h"
 #include "thread_var.h"
 #include "uri.h"
+#include "crypto/sig_verifier.h"
+#include "rrdp/db/db_rrdp_uris.h"
 #include "data_structure/array_list.h"
 #include "object/certificate.h"
 #include "object/crl.h"
 #include "object/ghostbusters.h"
 #include "object/roa.h"
+#include "object/signed_object.h"
 
 STATIC_ARRAY_LIST(uris, struct rpki_uri *)
 
@@ -38,16 +46,16 @@ struct rpp {
 	} crl;
 
 	/* The Manifest is not needed for now. */
+	/* Digest of the manifest's file list; see rpp_set_digest(). */
+	unsigned char digest[SHA256_DIGEST_LENGTH];
+	bool digested;
 
 	struct uris roas; /* Route Origin Attestations */
 
 	struct uris ghostbusters;
 
-	/*
-	 * Note that the reference counting functions are not prepared for
-	 * multithreading, because this is not atomic.
-	 */
-	unsigned int references;
+	/* Deferred certificates share this among validation workers. */
+	atomic_uint references;
 };
 
 struct rpp *
@@ -63,9 +71,10 @@ rpp_create(void)
 	result->crl.uri = NULL;
 	result->crl.stack = NULL;
 	result->crl.error = 0;
+	result->digested = false;
 	uris_init(&result->roas);
 	uris_init(&result->ghostbusters);
-	result->references = 1;
+	atomic_init(&result->references, 1);
 
 	return result;
 }
@@ -73,7 +82,7 @@ rpp_create(void)
 void
 rpp_refget(struct rpp *pp)
 {
-	pp->references++;
+	atomic_fetch_add(&pp->references, 1);
 }
 
 static void
@@ -85,8 +94,7 @@ __uri_refput(struct rpki_uri **uri)
 void
 rpp_refput(struct rpp *pp)
 {
-	pp->references--;
-	if (pp->references == 0) {
+	if (atomic_fetch_sub(&pp->references, 1) == 1) {
 		uris_cleanup(&pp->certs, __uri_refput);
 		if (pp->crl.uri != NULL)
 			uri_refput(pp->crl.uri);
@@ -131,6 +139,18 @@ rpp_add_crl(struct rpp *pp, struct rpki_uri *uri)
 	return 0;
 }
 
+/*
+ * @digest is the SHA-256 of the names and hashes of the files listed by the
+ * manifest (the ones that made it to @pp). It identifies the publication
+ * point's content, for the sake of rpp_memo.
+ */
+void
+rpp_set_digest(struct rpp *pp, unsigned char const *digest)
+{
+	memcpy(pp->digest, digest, SHA256_DIGEST_LENGTH);
+	pp->digested = true;
+}
+
 struct rpki_uri *
 rpp_get_crl(struct rpp const *pp)
 {
@@ -200,6 +220,7 @@ rpp_crl(struct rpp *pp, STACK_OF(X509_CRL) **result)
 		return pp->crl.error;
 	}
 	pp->crl.error = add_crl_to_stack(pp, stack);
+	metrics_object(MO_CRL, pp->crl.error);
 	if (pp->crl.error) {
 		sk_X509_CRL_pop_free(stack, X509_CRL_free);
 		return pp->crl.error;
@@ -215,6 +236,7 @@ __cert_traverse(struct rpp *pp)
 {
 	struct validation *state;
 	struct cert_stack *certstack;
+	STACK_OF(X509_CRL) *crls;
 	ssize_t i;
 	struct deferred_cert deferred;
 	int error;
@@ -227,7 +249,16 @@ __cert_traverse(struct rpp *pp)
 		return -EINVAL;
 	certstack = validation_certstack(state);
 
+	/*
+	 * The children might be validated by other workers, so initialize the
+	 * CRL while @pp is still ours alone. (Errors are cached; the children
+	 * will report them.)
+	 */
+	rpp_crl(pp, &crls);
+
 	deferred.pp = pp;
+	deferred.rrdp_workspace = (db_rrdp_uris_workspace_get() != NULL);
+	deferred.fetch = NULL;
 	/*
 	 * The for is inverted, to achieve FIFO behavior since the separator.
 	 * Not really important; it simply makes the traversal order more
@@ -243,6 +274,144 @@ __cert_traverse(struct rpp *pp)
 	return 0;
 }
 
+static void
+batch_signed_objects(struct sig_batch *batch, X509 *issuer, struct uris *uris)
+{
+	struct rpki_uri **uri;
+	array_index i;
+
+	ARRAYLIST_FOREACH(uris, uri, i) {
+		fnstack_push_uri(*uri);
+		signed_object_batch_signatures(*uri, issuer, batch);
+		fnstack_pop();
+	}
+}
+
+/*
+ * Verifies the signatures of @pp's objects in parallel, so the traversal finds
+ * them in the signature cache. (See sig_verifier.h.)
+ *
+ * @signed_objects: Include the ROAs and Ghostbusters?
+ *
+ * Errors are ignored; the traversal will find them again, and report them.
+ */
+static void
+verify_signatures(struct rpp *pp, bool signed_objects)
+{
+	struct validation *state;
+	X509 *issuer;
+	struct sig_batch *batch;
+	STACK_OF(X509_CRL) *crls;
+	struct rpki_uri **uri;
+	array_index i;
+	X509 *cert;
+
+	if (!sig_verifier_enabled())
+		return;
+
+	state = state_retrieve();
+	if (state == NULL)
+		return;
+	issuer = x509stack_peek(validation_certstack(state));
+	if (issuer == NULL)
+		return;
+
+	if (sig_batch_create(&batch) != 0)
+		return;
+
+	if (rpp_crl(pp, &crls) == 0 && sk_X509_CRL_num(crls) == 1)
+		sig_batch_add_crl(batch, issuer, sk_X509_CRL_value(crls, 0));
+
+	ARRAYLIST_FOREACH(&pp->certs, uri, i) {
+		fnstack_push_uri(*uri);
+		if (certificate_load(*uri, &cert) == 0) {
+			sig_batch_add_cert(batch, issuer, cert);
+			X509_free(cert);
+		}
+		fnstack_pop();
+	}
+
+	if (signed_objects) {
+		batch_signed_objects(batch, issuer, &pp->roas);
+		batch_signed_objects(batch, issuer, &pp->ghostbusters);
+	}
+
+	sig_batch_run(batch);
+	sig_batch_destroy(batch);
+}
+
+/*
+ * The memo key of @pp: Its content digest, followed by the certificate chain
+ * it hangs from (which is where its resources and trust come from).
+ */
+static int
+compute_memo_key(struct rpp *pp, unsigned char *key)
+{
+	struct validation *state;
+	STACK_OF(X509) *chain;
+	EVP_MD_CTX *ctx;
+	unsigned char fingerprint[EVP_MAX_MD_SIZE];
+	unsigned int fingerprint_len;
+	int i;
+	int error;
+
+	state = state_retrieve();
+	if (state == NULL)
+		return -EINVAL;
+	chain = certstack_get_x509s(validation_certstack(state));
+
+	ctx = EVP_MD_CTX_new();
+	if (ctx == NULL)
+		return pr_enomem();
+
+	error = -EINVAL;
+	if (!EVP_DigestInit_ex(ctx, EVP_sha256(), NULL))
+		goto end;
+	if (!EVP_DigestUpdate(ctx, pp->digest, SHA256_DIGEST_LENGTH))
+		goto end;
+	for (i = 0; i < sk_X509_num(chain); i++) {
+		/* The SHA-1 fingerprint is cached by libcrypto. */
+		if (!X509_digest(sk_X509_value(chain, i), EVP_sha1(),
+		    fingerprint, &fingerprint_len))
+			goto end;
+		if (!EVP_DigestUpdate(ctx, fingerprint, fingerprint_len))
+			goto end;
+	}
+	if (!EVP_DigestFinal_ex(ctx, key, NULL))
+		goto end;
+
+	error = 0;
+end:
+	EVP_MD_CTX_free(ctx);
+	return error;
+}
+
+/* The results of @pp's ROAs can't outlive its CRL. */
+static int
+record_crl_expiration(struct rpp *pp, struct rpp_memo_recording *recording)
+{
+	STACK_OF(X509_CRL) *crls;
+	ASN1_TIME const *next_update;
+	time_t expiration;
+	int error;
+
+	error = rpp_crl(pp, &crls);
+	if (error)
+		return error;
+	if (crls == NULL || sk_X509_CRL_num(crls) < 1)
+		return -EINVAL;
+
+	next_update = X509_CRL_get0_nextUpdate(sk_X509_CRL_value(crls, 0));
+	if (next_update == NULL)
+		return -EINVAL;
+	error = x509_time_get(next_update, &expiration);
+	if (error)
+		return error;
+
+	rpp_memo_record_expiration(recording, expiration);
+	return 0;
+}
+
 /**
  * Traverses through all of @pp's known files, validating them.
  */
@@ -251,6 +420,12 @@ rpp_traverse(struct rpp *pp)
 {
 	struct rpki_uri **uri;
 	array_index i;
+	unsigned char key[SHA256_DIGEST_LENGTH];
+	struct rpp_memo_recording recording;
+	bool replayed;
+	bool recording_started;
+	bool success;
+	time_t expiration;
 
 	/*
 	 * A subtree should not invalidate the rest of the tree, so error codes
@@ -258,6 +433,23 @@ rpp_traverse(struct rpp *pp)
 	 * (Errors log messages anyway.)
 	 */
 
+	/*
+	 * If nothing changed since the previous cycle, the ROAs would yield the
+	 * same VRPs again.
+	 */
+	replayed = false;
+	recording_started = false;
+	if (rpp_memo_enabled() && pp->digested &&
+	    compute_memo_key(pp, key) == 0) {
+		replayed = rpp_memo_replay(key);
+		if (!replayed)
+			recording_started =
+			    (rpp_memo_record_start(&recording, key) == 0);
+	}
+
+	/* Before the certificates become available to other workers */
+	verify_signatures(pp, !replayed);
+
 	/*
 	 * Certificates cannot be validated now, because then the algorithm
 	 * would be recursive.
@@ -266,14 +458,27 @@ rpp_traverse(struct rpp *pp)
 	 */
 	__cert_traverse(pp);
 
+	if (replayed)
+		return;
+	success = recording_started &&
+	    (record_crl_expiration(pp, &recording) == 0);
+
 	/* Validate ROAs, apply validation_handler on them. */
-	ARRAYLIST_FOREACH(&pp->roas, uri, i)
-		roa_traverse(*uri, pp);
+	ARRAYLIST_FOREACH(&pp->roas, uri, i) {
+		if (roa_traverse(*uri, pp, &expiration) != 0)
+			success = false;
+		else if (recording_started)
+			rpp_memo_record_expiration(&recording, expiration);
+	}
 
 	/*
 	 * We don't do much with the ghostbusters right now.
 	 * Just validate them.
 	 */
 	ARRAYLIST_FOREACH(&pp->ghostbusters, uri, i)
-		ghostbusters_traverse(*uri, pp);
+		if (ghostbusters_traverse(*uri, pp) != 0)
+			success = false;
+
+	if (recording_started)
+		rpp_memo_record_stop(&recording, success);
 }
@@ -0,0 +1,313 @@
+#include "rpp_memo.h"
+
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "common.h"
+#include "log.h"
+#include "thread_var.h"
+#include "data_structure/uthash_nonfatal.h"
+#include "incidence/incidence.h"
+
+DEFINE_ARRAY_LIST_FUNCTIONS(memo_vrps, struct memo_vrp, static)
+
+struct memo_entry {
+	/* key */
+	unsigned char key[SHA256_DIGEST_LENGTH];
+	struct memo_vrp *vrps;
+	size_t vrps_len;
+	/* Validate the publication point again once this moment arrives */
+	time_t expiration;
+	/* Was the entry used during the current validation cycle? */
+	bool used;
+	UT_hash_handle hh;
+	SLIST_ENTRY(memo_entry) next;
+};
+
+/*
+ * Expired entries, which can't be released until the end of the cycle, since
+ * some worker might still be replaying them.
+ */
+SLIST_HEAD(memo_entries, memo_entry);
+
+static struct memo_entry *memo;
+static struct memo_entries retired = SLIST_HEAD_INITIALIZER(retired);
+
+/* Guards @memo and @retired. */
+static pthread_mutex_t memo_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+memo_entry_destroy(struct memo_entry *entry)
+{
+	free(entry->vrps);
+	free(entry);
+}
+
+/*
+ * If the files listed by a manifest are not required to match their hashes,
+ * the manifest can't vouch for their content.
+ */
+bool
+rpp_memo_enabled(void)
+{
+	return incidence_get_action(INID_MFT_FILE_HASH_NOT_MATCH) == INAC_ERROR;
+}
+
+static void
+replay(struct memo_entry *entry)
+{
+	struct memo_vrp *vrp;
+	size_t i;
+
+	for (i = 0; i < entry->vrps_len; i++) {
+		vrp = &entry->vrps[i];
+		if (vrp->family == AF_INET)
+			vhandler_handle_roa_v4(vrp->asn, &vrp->prefix.v4,
+			    vrp->max_length);
+		else
+			vhandler_handle_roa_v6(vrp->asn, &vrp->prefix.v6,
+			    vrp->max_length);
+	}
+}
+
+/*
+ * If the publication point identified by @key was already validated, and
+ * nothing in it has expired since, hands its VRPs to the validation handler
+ * again, and returns true. Otherwise returns false; the publication point has
+ * to be validated.
+ */
+bool
+rpp_memo_replay(unsigned char const *key)
+{
+	struct memo_entry *entry;
+	time_t now;
+
+	if (get_current_time(&now) != 0)
+		return false;
+
+	pthread_mutex_lock(&memo_lock);
+	HASH_FIND(hh, memo, key, SHA256_DIGEST_LENGTH, entry);
+	if (entry != NULL && entry->expiration <= now) {
+		HASH_DEL(memo, entry);
+		SLIST_INSERT_HEAD(&retired, entry, next);
+		entry = NULL;
+	}
+	if (entry != NULL)
+		entry->used = true;
+	pthread_mutex_unlock(&memo_lock);
+
+	if (entry == NULL)
+		return false;
+
+	/* Entries are immutable, and only released between cycles. */
+	pr_val_debug("Reusing the %zu VRPs of the previous cycle.",
+	    entry->vrps_len);
+	replay(entry);
+	return true;
+}
+
+static int
+record_vrp(struct rpp_memo_recording *recording, struct memo_vrp *vrp)
+{
+	if (memo_vrps_add(&recording->vrps, vrp) != 0)
+		recording->failed = true;
+	return 0;
+}
+
+static int
+record_roa_v4(uint32_t as, struct ipv4_prefix const *prefix,
+    uint8_t max_length, void *arg)
+{
+	struct rpp_memo_recording *recording = arg;
+	struct memo_vrp vrp;
+	int error;
+
+	if (recording->original.handle_roa_v4 != NULL) {
+		error = recording->original.handle_roa_v4(as, prefix,
+		    max_length, recording->original.arg);
+		if (error) {
+			recording->failed = true;
+			return error;
+		}
+	}
+
+	memset(&vrp, 0, sizeof(vrp));
+	vrp.asn = as;
+	vrp.family = AF_INET;
+	vrp.max_length = max_length;
+	vrp.prefix.v4 = *prefix;
+	return record_vrp(recording, &vrp);
+}
+
+static int
+record_roa_v6(uint32_t as, struct ipv6_prefix const *prefix,
+    uint8_t max_length, void *arg)
+{
+	struct rpp_memo_recording *recording = arg;
+	struct memo_vrp vrp;
+	int error;
+
+	if (recording->original.handle_roa_v6 != NULL) {
+		error = recording->original.handle_roa_v6(as, prefix,
+		    max_length, recording->original.arg);
+		if (error) {
+			recording->failed = true;
+			return error;
+		}
+	}
+
+	memset(&vrp, 0, sizeof(vrp));
+	vrp.asn = as;
+	vrp.family = AF_INET6;
+	vrp.max_length = max_length;
+	vrp.prefix.v6 = *prefix;
+	return record_vrp(recording, &vrp);
+}
+
+static int
+record_router_key(unsigned char const *ski, uint32_t as,
+    unsigned char const *spk, void *arg)
+{
+	struct rpp_memo_recording *recording = arg;
+
+	/* Router keys come from certificates, which are never replayed. */
+	if (recording->original.handle_router_key == NULL)
+		return 0;
+	return recording->original.handle_router_key(ski, as, spk,
+	    recording->original.arg);
+}
+
+/*
+ * Starts intercepting the VRPs the current thread hands to its validation
+ * handler, so they can be remembered under @key.
+ *
+ * Must be followed by rpp_memo_record_stop().
+ */
+int
+rpp_memo_record_start(struct rpp_memo_recording *recording,
+    unsigned char const *key)
+{
+	struct validation *state;
+	struct validation_handler handler;
+
+	state = state_retrieve();
+	if (state == NULL)
+		return -EINVAL;
+
+	memcpy(recording->key, key, SHA256_DIGEST_LENGTH);
+	recording->original = *validation_get_validation_handler(state);
+	memo_vrps_init(&recording->vrps);
+	recording->expiration = 0;
+	recording->failed = false;
+
+	handler.handle_roa_v4 = record_roa_v4;
+	handler.handle_roa_v6 = record_roa_v6;
+	handler.handle_router_key = record_router_key;
+	handler.arg = recording;
+	validation_set_validation_handler(state, &handler);
+
+	return 0;
+}
+
+/* Notes that the recorded results stop being valid at @expiration. */
+void
+rpp_memo_record_expiration(struct rpp_memo_recording *recording,
+    time_t expiration)
+{
+	if (recording->expiration == 0 || expiration < recording->expiration)
+		recording->expiration = expiration;
+}
+
+/*
+ * Stops the recording, and remembers its VRPs if @success (ie. every object
+ * validated successfully).
+ */
+void
+rpp_memo_record_stop(struct rpp_memo_recording *recording, bool success)
+{
+	struct validation *state;
+	struct memo_entry *entry, *old;
+	time_t now;
+
+	state = state_retrieve();
+	if (state != NULL)
+		validation_set_validation_handler(state, &recording->original);
+
+	if (!success || recording->failed || recording->expiration == 0)
+		goto discard;
+	if (get_current_time(&now) != 0 || recording->expiration <= now)
+		goto discard;
+
+	entry = malloc(sizeof(struct memo_entry));
+	if (entry == NULL)
+		goto discard;
+	/* Needed by uthash */
+	memset(entry, 0, sizeof(struct memo_entry));
+
+	memcpy(entry->key, recording->key, SHA256_DIGEST_LENGTH);
+	entry->vrps = recording->vrps.array; /* Ownership transferred */
+	entry->vrps_len = recording->vrps.len;
+	entry->expiration = recording->expiration;
+	entry->used = true;
+
+	pthread_mutex_lock(&memo_lock);
+	HASH_FIND(hh, memo, entry->key, SHA256_DIGEST_LENGTH, old);
+	if (old == NULL) {
+		errno = 0;
+		HASH_ADD(hh, memo, key, SHA256_DIGEST_LENGTH, entry);
+		if (errno)
+			old = entry; /* Just drop it */
+	} else {
+		/* Someone else got there first; theirs might be in use. */
+		old = entry;
+	}
+	pthread_mutex_unlock(&memo_lock);
+
+	if (old == entry)
+		memo_entry_destroy(entry);
+	return;
+
+discard:
+	memo_vrps_cleanup(&recording->vrps, NULL);
+}
+
+/*
+ * Forgets the publication points that weren't seen during the last validation
+ * cycle. Call between cycles.
+ */
+void
+rpp_memo_sweep(void)
+{
+	struct memo_entry *entry, *tmp;
+
+	pthread_mutex_lock(&memo_lock);
+	HASH_ITER(hh, memo, entry, tmp) {
+		if (entry->used) {
+			entry->used = false;
+		} else {
+			HASH_DEL(memo, entry);
+			memo_entry_destroy(entry);
+		}
+	}
+	while (!SLIST_EMPTY(&retired)) {
+		entry = SLIST_FIRST(&retired);
+		SLIST_REMOVE_HEAD(&retired, next);
+		memo_entry_destroy(entry);
+	}
+	pthread_mutex_unlock(&memo_lock);
+}
+
+void
+rpp_memo_cleanup(void)
+{
+	struct memo_entry *entry, *tmp;
+
+	rpp_memo_sweep();
+	HASH_ITER(hh, memo, entry, tmp) {
+		HASH_DEL(memo, entry);
+		memo_entry_destroy(entry);
+	}
+}
@@ -0,0 +1,59 @@
+#ifndef SRC_RPP_MEMO_H_
+#define SRC_RPP_MEMO_H_
+
+#include <stdbool.h>
+#include <time.h>
+#include <openssl/sha.h>
+
+#include "validation_handler.h"
+#include "data_structure/array_list.h"
+
+/*
+ * Remembers the VRPs yielded by the ROAs of each publication point, so they
+ * don't need to be validated again while nothing they depend on changes.
+ *
+ * A publication point is identified by a key that digests its manifest's file
+ * list (names and hashes), and the certificate chain it hangs from. The ROAs
+ * are only validated again when the key changes, or when one of them (or the
+ * CRL) expires.
+ *
+ * Only publication points whose objects all validated successfully are
+ * remembered. Entries that don't get used during a validation cycle are
+ * dropped by rpp_memo_sweep().
+ */
+
+struct memo_vrp {
+	uint32_t asn;
+	uint8_t family; /* AF_INET or AF_INET6 */
+	uint8_t max_length;
+	union {
+		struct ipv4_prefix v4;
+		struct ipv6_prefix v6;
+	} prefix;
+};
+
+DEFINE_ARRAY_LIST_STRUCT(memo_vrps, struct memo_vrp);
+
+/* The VRPs of a publication point, as they're being validated. */
+struct rpp_memo_recording {
+	unsigned char key[SHA256_DIGEST_LENGTH];
+	struct validation_handler original;
+	struct memo_vrps vrps;
+	/* Soonest moment one of the recorded objects expires */
+	time_t expiration;
+	/* Did the handler (or the recording itself) fail? */
+	bool failed;
+};
+
+bool rpp_memo_enabled(void);
+bool rpp_memo_replay(unsigned char const *);
+
+int rpp_memo_record_start(struct rpp_memo_recording *,
+    unsigned char const *);
+void rpp_memo_record_expiration(struct rpp_memo_recording *, time_t);
+void rpp_memo_record_stop(struct rpp_memo_recording *, bool);
+
+void rpp_memo_sweep(void);
+void rpp_memo_cleanup(void);
+
+#endif /* SRC_RPP_MEMO_H_ */
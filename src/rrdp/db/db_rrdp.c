@@ -1,271 +1,265 @@
 #include "rrdp/db/db_rrdp.h"
 
-#include <sys/queue.h>
-#include <pthread.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <stdbool.h>
 #include <string.h>
-#include "crypto/hash.h"
-#include "common.h"
+#include "config.h"
+#include "file.h"
+#include "line_file.h"
 #include "log.h"
+#include "object_store.h"
 
-struct tal_elem {
-	char *file_name;
-	struct db_rrdp_uri *uris;
-	char *workspace;
-	bool visited;
-	SLIST_ENTRY(tal_elem) next;
-};
+#define JOURNAL_NAME "rrdp.journal"
+#define JOURNAL_VERSION 2
 
-SLIST_HEAD(tal_list, tal_elem);
-
-struct db_rrdp {
-	struct tal_list tals;
-};
-
-static struct db_rrdp db;
+/*
+ * Where the RRDP objects are written, relative to --local-repository. (So they
+ * don't mix with the rsync'd ones.)
+ */
+#define WORKSPACE "rrdp/"
 
-/** Read/write lock, which protects @db. */
-static pthread_rwlock_t lock;
+/*
+ * The notifications of all the TALs. Two TALs that reach the same repository
+ * (which happens, for example, with NIR delegations and hosted CAs) share its
+ * files and its state, so it's only downloaded once per cycle: whoever asks
+ * for it second waits for the first one's load (see db_rrdp_uris_claim()),
+ * and then finds it visited.
+ */
+static struct db_rrdp_uri *uris;
 
 /*
- * Creates an ID for the RRDP local workspace.
+ * The journal remembers the session ID and serial of every notification
+ * between runs, so a restart only needs to download their deltas. It's a text
+ * file, found at <local-repository>/rrdp.journal:
  *
- * The ID is generated using the hash (sha-1) of @base. The first 4 bytes of
- * the hash are "stringified" (8 chars) and a '/' is added at the end to
- * (later) facilitate the concatenation of the ID at --local-repository.
- * 
- * The ID is allocated at @result.
+ * 	fort-rrdp-journal <version>
+ * 	store <whether the objects are in the object store: 0 or 1>
+ * 	notification <last update> <serial> <session ID> <notification URI>
+ * 	mft <visited manifest URI>
+ * 	mft <visited manifest URI>
+ * 	...
+ *
+ * Each manifest belongs to the last notification above it.
  */
 static int
-get_workspace_path(char const *base, char **result)
+get_journal_path(char **result)
 {
-/* SHA1 produces 20 bytes */
-#define HASH_LEN 20
-/* We'll use the first 4 bytes (8 chars) */
-#define OUT_LEN   8
-	unsigned char *hash;
-	unsigned int hash_len;
-	unsigned int i;
-	char *tmp;
-	char *ptr;
-	int error;
-
-	hash = malloc(HASH_LEN * sizeof(unsigned char));
-	if (hash == NULL)
-		return pr_enomem();
-
-	hash_len = 0;
-	error = hash_str("sha1", base, hash, &hash_len);
-	if (error) {
-		free(hash);
-		return error;
-	}
+	char const *repository;
+	char *path;
 
-	/* Get the first bytes + one slash + NUL char */
-	tmp = malloc(OUT_LEN + 2);
-	if (tmp == NULL) {
-		free(hash);
+	repository = config_get_local_repository();
+	path = malloc(strlen(repository) + strlen(JOURNAL_NAME) + 2);
+	if (path == NULL)
 		return pr_enomem();
-	}
-
-	ptr = tmp;
-	for (i = 0; i < OUT_LEN / 2; i++) {
-		sprintf(ptr, "%02X", hash[i]);
-		ptr += 2;
-	}
-	tmp[OUT_LEN] = '/';
-	tmp[OUT_LEN + 1] = '\0';
+	sprintf(path, "%s/%s", repository, JOURNAL_NAME);
 
-	free(hash);
-	*result = tmp;
+	*result = path;
 	return 0;
 }
 
 static int
-tal_elem_create(struct tal_elem **elem, char const *name)
+load_notification(char const *line, struct visited_uris **visited)
 {
-	struct tal_elem *tmp;
-	struct db_rrdp_uri *tmp_uris;
+	char session_id[256];
+	long last_update;
+	unsigned long serial;
+	int uri_start;
 	int error;
 
-	tmp = malloc(sizeof(struct tal_elem));
-	if (tmp == NULL)
-		return pr_enomem();
+	uri_start = 0;
+	if (sscanf(line, "%ld %lu %255s %n", &last_update, &serial, session_id,
+	    &uri_start) != 3 || uri_start == 0 || line[uri_start] == '\0')
+		return -EINVAL;
 
-	tmp_uris = NULL;
-	error = db_rrdp_uris_create(&tmp_uris);
+	error = visited_uris_create(visited);
 	if (error)
-		goto end1;
-	tmp->uris = tmp_uris;
-
-	tmp->visited = true;
-	tmp->file_name = strdup(name);
-	if (tmp->file_name == NULL) {
-		error = pr_enomem();
-		goto end2;
-	}
+		return error;
 
-	error = get_workspace_path(name, &tmp->workspace);
+	error = db_rrdp_uris_restore(uris, line + uri_start, session_id,
+	    serial, last_update, *visited);
 	if (error)
-		goto end3;
+		visited_uris_refput(*visited);
 
-	*elem = tmp;
-	return 0;
-end3:
-	free(tmp->file_name);
-end2:
-	db_rrdp_uris_destroy(tmp->uris);
-end1:
-	free(tmp);
 	return error;
 }
 
-static void
-tal_elem_destroy(struct tal_elem *elem, bool remove_local)
+static int
+load_journal_line(char const *line, struct visited_uris **visited)
 {
-	if (remove_local)
-		db_rrdp_uris_remove_all_local(elem->uris, elem->workspace);
-	db_rrdp_uris_destroy(elem->uris);
-	free(elem->file_name);
-	free(elem->workspace);
-	free(elem);
+	if (strncmp(line, "notification ", strlen("notification ")) == 0)
+		return load_notification(line + strlen("notification "),
+		    visited);
+
+	if (strncmp(line, "mft ", strlen("mft ")) == 0)
+		return (*visited != NULL)
+		    ? visited_uris_add(*visited, line + strlen("mft "))
+		    : -EINVAL;
+
+	return -EINVAL;
 }
 
-int
-db_rrdp_init(void)
+/*
+ * Recovers the state of the previous run. Returns nonzero if there's nothing
+ * (trustworthy) to recover; the caller should then start from scratch.
+ */
+static int
+load_journal(char const *path)
 {
+	struct line_file *lfile;
+	struct visited_uris *visited;
+	char *line;
+	unsigned int version;
+	unsigned int store;
 	int error;
 
-	error = pthread_rwlock_init(&lock, NULL);
+	error = lfile_open(path, &lfile);
 	if (error)
-		return pr_op_errno(error, "DB RRDP pthread_rwlock_init() errored");
-
-	SLIST_INIT(&db.tals);
-	return 0;
-}
-
-void
-db_rrdp_cleanup(void)
-{
-	struct tal_elem *elem;
+		return error;
 
-	while (!SLIST_EMPTY(&db.tals)) {
-		elem = db.tals.slh_first;
-		SLIST_REMOVE_HEAD(&db.tals, next);
-		tal_elem_destroy(elem, false);
+	error = lfile_read(lfile, &line);
+	if (error)
+		goto end;
+	if (line == NULL || sscanf(line, "fort-rrdp-journal %u", &version) != 1
+	    || version != JOURNAL_VERSION) {
+		pr_op_info("Unknown RRDP journal format. Ignoring it.");
+		free(line);
+		error = -EINVAL;
+		goto end;
 	}
-	pthread_rwlock_destroy(&lock);
-}
+	free(line);
 
-static struct tal_elem *
-db_rrdp_find_tal(char const *tal_name)
-{
-	struct tal_elem *found;
+	error = lfile_read(lfile, &line);
+	if (error)
+		goto end;
+	if (line == NULL || sscanf(line, "store %u", &store) != 1) {
+		pr_op_info("The RRDP journal is corrupted. Ignoring it.");
+		free(line);
+		error = -EINVAL;
+		goto end;
+	}
+	free(line);
+
+	/* The RRDP objects have to be where the journal says they are */
+	if ((store != 0) != object_store_enabled() ||
+	    (store != 0 && !object_store_restored())) {
+		pr_op_info("The RRDP objects of the previous run were stored elsewhere. Ignoring the RRDP journal.");
+		error = -EINVAL;
+		goto end;
+	}
 
-	rwlock_read_lock(&lock);
-	SLIST_FOREACH(found, &db.tals, next) {
-		if (strcmp(tal_name, found->file_name) == 0) {
-			rwlock_unlock(&lock);
-			return found;
+	visited = NULL;
+	do {
+		error = lfile_read(lfile, &line);
+		if (error)
+			goto end;
+		if (line == NULL)
+			break;
+
+		error = load_journal_line(line, &visited);
+		free(line);
+		if (error) {
+			pr_op_info("The RRDP journal is corrupted. Ignoring it.");
+			goto end;
 		}
-	}
-	rwlock_unlock(&lock);
+	} while (true);
 
-	return NULL;
+	pr_op_info("Recovered the RRDP state of the previous run.");
+end:
+	lfile_close(lfile);
+	return error;
 }
 
 int
-db_rrdp_add_tal(char const *tal_name)
+db_rrdp_init(void)
 {
-	struct tal_elem *elem, *found;
+	char *journal;
 	int error;
 
-	/* Element exists, no need to create it again */
-	found = db_rrdp_find_tal(tal_name);
-	if (found != NULL) {
-		found->visited = true;
-		return 0;
-	}
-
-	error = tal_elem_create(&elem, tal_name);
+	error = db_rrdp_uris_create(&uris);
 	if (error)
 		return error;
 
-	rwlock_write_lock(&lock);
-	SLIST_INSERT_HEAD(&db.tals, elem, next);
-	rwlock_unlock(&lock);
+	error = get_journal_path(&journal);
+	if (error) {
+		db_rrdp_uris_destroy(uris);
+		return error;
+	}
 
-	return 0;
+	/* Not fatal; the notifications will simply be loaded from scratch */
+	if (load_journal(journal) != 0) {
+		db_rrdp_uris_destroy(uris);
+		error = db_rrdp_uris_create(&uris);
+	}
+
+	free(journal);
+	return error;
 }
 
 void
-db_rrdp_rem_tal(char const *tal_name)
+db_rrdp_cleanup(void)
 {
-	struct tal_elem *found;
-
-	found = db_rrdp_find_tal(tal_name);
-	if (found == NULL)
-		return;
-
-	rwlock_write_lock(&lock);
-	SLIST_REMOVE(&db.tals, found, tal_elem, next);
-	rwlock_unlock(&lock);
-
-	tal_elem_destroy(found, true);
+	db_rrdp_uris_destroy(uris);
 }
 
-/* Returns the reference to RRDP URIs of a TAL */
-struct db_rrdp_uri *
-db_rrdp_get_uris(char const *tal_name)
+static int
+write_journal(FILE *file, void *arg)
 {
-	struct tal_elem *found;
-
-	found = db_rrdp_find_tal(tal_name);
-	if (found == NULL)
-		pr_crit("db_rrdp_find_tal() returned NULL, means it hasn't been initialized");
-
-	return found->uris;
+	fprintf(file, "fort-rrdp-journal %u\n", JOURNAL_VERSION);
+	fprintf(file, "store %u\n", object_store_enabled() ? 1 : 0);
+	return db_rrdp_uris_save(uris, file);
 }
 
-char const *
-db_rrdp_get_workspace(char const *tal_name)
+/*
+ * Writes the journal, so the next run can resume from the current state.
+ * Call between validation cycles, after object_store_save().
+ */
+int
+db_rrdp_save(void)
 {
-	struct tal_elem *found;
+	char *journal;
+	int error;
+
+	error = get_journal_path(&journal);
+	if (error)
+		return error;
 
-	found = db_rrdp_find_tal(tal_name);
-	if (found == NULL)
-		pr_crit("db_rrdp_find_tal() returned NULL, means it hasn't been initialized");
+	error = file_write_atomic(journal, write_journal, NULL);
 
-	return found->workspace;
+	free(journal);
+	return error;
 }
 
-/* Set all tals to non-visited */
+/*
+ * Forgets which notifications were loaded during the previous cycle, so all of
+ * them are requested again (to check if there are updates).
+ */
 void
-db_rrdp_reset_visited_tals(void)
+db_rrdp_reset_visited(void)
 {
-	struct tal_elem *found;
-
-	rwlock_write_lock(&lock);
-	SLIST_FOREACH(found, &db.tals, next)
-		found->visited = false;
+	db_rrdp_uris_set_all_unvisited(uris);
+}
 
-	rwlock_unlock(&lock);
+/*
+ * Removes the notifications that weren't requested during the cycle that just
+ * ended, along with their local files. (Otherwise, the repositories of removed
+ * TALs and CAs would linger forever.) Call only if the whole cycle succeeded;
+ * a tree that was cut short did not request everything it still needs.
+ */
+int
+db_rrdp_rem_nonvisited(void)
+{
+	return db_rrdp_uris_rem_unvisited(uris, WORKSPACE);
 }
 
-/* Remove non-visited tals */
-void
-db_rrdp_rem_nonvisited_tals(void)
+struct db_rrdp_uri *
+db_rrdp_get_uris(void)
 {
-	struct tal_elem *found;
+	return uris;
+}
 
-	rwlock_write_lock(&lock);
-	SLIST_FOREACH(found, &db.tals, next) {
-		if (!found->visited) {
-			SLIST_REMOVE(&db.tals, found, tal_elem, next);
-			tal_elem_destroy(found, true);
-		}
-	}
-	rwlock_unlock(&lock);
+char const *
+db_rrdp_get_workspace(void)
+{
+	return WORKSPACE;
 }
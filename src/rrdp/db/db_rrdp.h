@@ -5,14 +5,12 @@
 
 int db_rrdp_init(void);
 void db_rrdp_cleanup(void);
+int db_rrdp_save(void);
 
-int db_rrdp_add_tal(char const *);
-void db_rrdp_rem_tal(char const *);
+void db_rrdp_reset_visited(void);
+int db_rrdp_rem_nonvisited(void);
 
-struct db_rrdp_uri *db_rrdp_get_uris(char const *);
-char const *db_rrdp_get_workspace(char const *);
-
-void db_rrdp_reset_visited_tals(void);
-void db_rrdp_rem_nonvisited_tals(void);
+struct db_rrdp_uri *db_rrdp_get_uris(void);
+char const *db_rrdp_get_workspace(void);
 
 #endif /* SRC_RRDP_DB_DB_RRDP_H_ */
@@ -1,8 +1,10 @@
 #include "rrdp/db/db_rrdp_uris.h"
 
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <sys/queue.h>
 #include "data_structure/uthash_nonfatal.h"
 #include "common.h"
 #include "log.h"
@@ -22,9 +24,25 @@ struct uris_table {
 	UT_hash_handle hh;
 };
 
+/* An update notification URI some worker is currently loading. */
+struct uri_claim {
+	char *uri;
+	pthread_t owner;
+	SLIST_ENTRY(uri_claim) next;
+};
+
+SLIST_HEAD(uri_claims, uri_claim);
+
+/*
+ * All the TAL threads (and their workers) share this, and they might load
+ * different notifications at the same time. @lock protects everything.
+ */
 struct db_rrdp_uri {
 	struct uris_table *table;
-	char const *current_workspace;
+	struct uri_claims claims;
+	pthread_mutex_t lock;
+	/* Signaled whenever a claim is released. */
+	pthread_cond_t cond;
 };
 
 static int
@@ -84,10 +102,17 @@ find_rrdp_uri(struct db_rrdp_uri *uris, const char *search)
 	return found;
 }
 
-#define RET_NOT_FOUND_URI(uris, search, found)				\
-	found = find_rrdp_uri(uris, search);				\
-	if (found == NULL)						\
-		return -ENOENT;
+static struct uri_claim *
+find_claim(struct db_rrdp_uri *uris, char const *search)
+{
+	struct uri_claim *claim;
+
+	SLIST_FOREACH(claim, &uris->claims, next)
+		if (strcmp(claim->uri, search) == 0)
+			return claim;
+
+	return NULL;
+}
 
 static void
 add_rrdp_uri(struct db_rrdp_uri *uris, struct uris_table *new_uri)
@@ -116,30 +141,30 @@ get_thread_rrdp_uris(struct db_rrdp_uri **result)
 	return 0;
 }
 
-static int
-get_thread_rrdp_workspace(char const **result)
-{
-	struct validation *state;
-
-	state = state_retrieve();
-	if (state == NULL)
-		return pr_val_err("No state related to this thread");
-
-	*result = validation_get_rrdp_workspace(state);
-	return 0;
-}
-
 int
 db_rrdp_uris_create(struct db_rrdp_uri **uris)
 {
 	struct db_rrdp_uri *tmp;
+	int error;
 
 	tmp = malloc(sizeof(struct db_rrdp_uri));
 	if (tmp == NULL)
 		return pr_enomem();
 
 	tmp->table = NULL;
-	tmp->current_workspace = NULL;
+	SLIST_INIT(&tmp->claims);
+
+	error = pthread_mutex_init(&tmp->lock, NULL);
+	if (error) {
+		free(tmp);
+		return -pr_op_errno(error, "pthread_mutex_init() errored");
+	}
+	error = pthread_cond_init(&tmp->cond, NULL);
+	if (error) {
+		pthread_mutex_destroy(&tmp->lock);
+		free(tmp);
+		return -pr_op_errno(error, "pthread_cond_init() errored");
+	}
 
 	*uris = tmp;
 	return 0;
@@ -154,9 +179,71 @@ db_rrdp_uris_destroy(struct db_rrdp_uri *uris)
 		HASH_DEL(uris->table, uri_node);
 		uris_table_destroy(uri_node);
 	}
+	pthread_mutex_destroy(&uris->lock);
+	pthread_cond_destroy(&uris->cond);
 	free(uris);
 }
 
+/**
+ * Reserves @uri for the calling thread, so it can load the notification
+ * without interference. If some other thread (of any TAL) is already loading
+ * it, waits for it to finish first.
+ *
+ * Release with db_rrdp_uris_release().
+ */
+int
+db_rrdp_uris_claim(char const *uri)
+{
+	struct db_rrdp_uri *uris;
+	struct uri_claim *claim;
+	int error;
+
+	uris = NULL;
+	error = get_thread_rrdp_uris(&uris);
+	if (error)
+		return error;
+
+	claim = malloc(sizeof(struct uri_claim));
+	if (claim == NULL)
+		return pr_enomem();
+
+	claim->uri = strdup(uri);
+	if (claim->uri == NULL) {
+		free(claim);
+		return pr_enomem();
+	}
+	claim->owner = pthread_self();
+
+	pthread_mutex_lock(&uris->lock);
+	while (find_claim(uris, uri) != NULL)
+		pthread_cond_wait(&uris->cond, &uris->lock);
+	SLIST_INSERT_HEAD(&uris->claims, claim, next);
+	pthread_mutex_unlock(&uris->lock);
+
+	return 0;
+}
+
+void
+db_rrdp_uris_release(char const *uri)
+{
+	struct db_rrdp_uri *uris;
+	struct uri_claim *claim;
+
+	uris = NULL;
+	if (get_thread_rrdp_uris(&uris) != 0)
+		return;
+
+	pthread_mutex_lock(&uris->lock);
+	claim = find_claim(uris, uri);
+	if (claim != NULL) {
+		SLIST_REMOVE(&uris->claims, claim, uri_claim, next);
+		free(claim->uri);
+		free(claim);
+	}
+	pthread_cond_broadcast(&uris->cond);
+	pthread_mutex_unlock(&uris->lock);
+}
+
 int
 db_rrdp_uris_cmp(char const *uri, char const *session_id, unsigned long serial,
     rrdp_uri_cmp_result_t *result)
@@ -170,23 +257,18 @@ db_rrdp_uris_cmp(char const *uri, char const *session_id, unsigned long serial,
 	if (error)
 		return error;
 
+	pthread_mutex_lock(&uris->lock);
 	found = find_rrdp_uri(uris, uri);
-	if (found == NULL) {
+	if (found == NULL)
 		*result = RRDP_URI_NOTFOUND;
-		return 0;
-	}
-
-	if (strcmp(session_id, found->data.session_id) != 0) {
+	else if (strcmp(session_id, found->data.session_id) != 0)
 		*result = RRDP_URI_DIFF_SESSION;
-		return 0;
-	}
-
-	if (serial != found->data.serial) {
+	else if (serial != found->data.serial)
 		*result = RRDP_URI_DIFF_SERIAL;
-		return 0;
-	}
+	else
+		*result = RRDP_URI_EQUAL;
+	pthread_mutex_unlock(&uris->lock);
 
-	*result = RRDP_URI_EQUAL;
 	return 0;
 }
 
@@ -212,7 +294,9 @@ db_rrdp_uris_update(char const *uri, char const *session_id,
 	/* Ownership transfered */
 	db_uri->visited_uris = visited_uris;
 
+	pthread_mutex_lock(&uris->lock);
 	add_rrdp_uri(uris, db_uri);
+	pthread_mutex_unlock(&uris->lock);
 
 	return 0;
 }
@@ -229,9 +313,13 @@ db_rrdp_uris_get_serial(char const *uri, unsigned long *serial)
 	if (error)
 		return error;
 
-	RET_NOT_FOUND_URI(uris, uri, found)
-	*serial = found->data.serial;
-	return 0;
+	pthread_mutex_lock(&uris->lock);
+	found = find_rrdp_uri(uris, uri);
+	if (found != NULL)
+		*serial = found->data.serial;
+	pthread_mutex_unlock(&uris->lock);
+
+	return (found != NULL) ? 0 : -ENOENT;
 }
 
 int
@@ -246,9 +334,13 @@ db_rrdp_uris_get_last_update(char const *uri, long *date)
 	if (error)
 		return error;
 
-	RET_NOT_FOUND_URI(uris, uri, found)
-	*date = found->last_update;
-	return 0;
+	pthread_mutex_lock(&uris->lock);
+	found = find_rrdp_uri(uris, uri);
+	if (found != NULL)
+		*date = found->last_update;
+	pthread_mutex_unlock(&uris->lock);
+
+	return (found != NULL) ? 0 : -ENOENT;
 }
 
 /* Set the last update to now */
@@ -265,22 +357,32 @@ db_rrdp_uris_set_last_update(char const *uri)
 	if (error)
 		return error;
 
-	RET_NOT_FOUND_URI(uris, uri, found)
-
 	now = 0;
 	error = get_current_time(&now);
 	if (error)
 		return error;
 
-	found->last_update = (long)now;
-	return 0;
+	pthread_mutex_lock(&uris->lock);
+	found = find_rrdp_uri(uris, uri);
+	if (found != NULL)
+		found->last_update = (long)now;
+	pthread_mutex_unlock(&uris->lock);
+
+	return (found != NULL) ? 0 : -ENOENT;
 }
 
+/*
+ * While some other worker is loading @uri (see db_rrdp_uris_claim()), its
+ * status is in flux, so this reports RRDP_URI_REQ_UNVISITED. Whoever intends to
+ * use the notification's files should therefore try to load it, which will
+ * wait for the other worker.
+ */
 int
 db_rrdp_uris_get_request_status(char const *uri, rrdp_req_status_t *result)
 {
 	struct db_rrdp_uri *uris;
 	struct uris_table *found;
+	struct uri_claim *claim;
 	int error;
 
 	uris = NULL;
@@ -288,9 +390,18 @@ db_rrdp_uris_get_request_status(char const *uri, rrdp_req_status_t *result)
 	if (error)
 		return error;
 
-	RET_NOT_FOUND_URI(uris, uri, found)
-	*result = found->request_status;
-	return 0;
+	pthread_mutex_lock(&uris->lock);
+	found = find_rrdp_uri(uris, uri);
+	if (found != NULL) {
+		claim = find_claim(uris, uri);
+		*result = (claim == NULL || pthread_equal(claim->owner,
+		    pthread_self()))
+		    ? found->request_status
+		    : RRDP_URI_REQ_UNVISITED;
+	}
+	pthread_mutex_unlock(&uris->lock);
+
+	return (found != NULL) ? 0 : -ENOENT;
 }
 
 int
@@ -305,32 +416,32 @@ db_rrdp_uris_set_request_status(char const *uri, rrdp_req_status_t value)
 	if (error)
 		return error;
 
-	RET_NOT_FOUND_URI(uris, uri, found)
-	found->request_status = value;
-	return 0;
+	pthread_mutex_lock(&uris->lock);
+	found = find_rrdp_uri(uris, uri);
+	if (found != NULL)
+		found->request_status = value;
+	pthread_mutex_unlock(&uris->lock);
+
+	return (found != NULL) ? 0 : -ENOENT;
 }
 
-int
-db_rrdp_uris_set_all_unvisited(void)
+void
+db_rrdp_uris_set_all_unvisited(struct db_rrdp_uri *uris)
 {
-	struct db_rrdp_uri *uris;
 	struct uris_table *uri_node, *uri_tmp;
-	int error;
-
-	uris = NULL;
-	error = get_thread_rrdp_uris(&uris);
-	if (error)
-		return error;
 
+	pthread_mutex_lock(&uris->lock);
 	HASH_ITER(hh, uris->table, uri_node, uri_tmp)
 		uri_node->request_status = RRDP_URI_REQ_UNVISITED;
-
-	return 0;
+	pthread_mutex_unlock(&uris->lock);
 }
 
 /*
  * Returns a pointer (set in @result) to the visited_uris of the current
  * thread.
+ *
+ * The pointer remains valid until the next db_rrdp_uris_update() of @uri, so
+ * only use it while you hold @uri's claim.
  */
 int
 db_rrdp_uris_get_visited_uris(char const *uri, struct visited_uris **result)
@@ -344,67 +455,152 @@ db_rrdp_uris_get_visited_uris(char const *uri, struct visited_uris **result)
 	if (error)
 		return error;
 
-	RET_NOT_FOUND_URI(uris, uri, found)
-	*result = found->visited_uris;
-	return 0;
+	pthread_mutex_lock(&uris->lock);
+	found = find_rrdp_uri(uris, uri);
+	if (found != NULL)
+		*result = found->visited_uris;
+	pthread_mutex_unlock(&uris->lock);
+
+	return (found != NULL) ? 0 : -ENOENT;
 }
 
+/*
+ * Forgets the notifications nobody requested during the current cycle (their
+ * CAs, or their whole TALs, are gone), and deletes their files from
+ * @workspace.
+ */
 int
-db_rrdp_uris_remove_all_local(struct db_rrdp_uri *uris, char const *workspace)
+db_rrdp_uris_rem_unvisited(struct db_rrdp_uri *uris, char const *workspace)
 {
 	struct uris_table *uri_node, *uri_tmp;
 	int error;
 
-	/* Remove each 'visited_uris' from all the table */
+	error = 0;
+
+	pthread_mutex_lock(&uris->lock);
 	HASH_ITER(hh, uris->table, uri_node, uri_tmp) {
+		if (uri_node->request_status != RRDP_URI_REQ_UNVISITED)
+			continue;
 		error = visited_uris_delete_local(uri_node->visited_uris,
 		    workspace);
 		if (error)
-			return error;
+			break;
+		HASH_DEL(uris->table, uri_node);
+		uris_table_destroy(uri_node);
 	}
+	pthread_mutex_unlock(&uris->lock);
+
+	return error;
+}
 
+static int
+save_visited_uri(char const *uri, void *arg)
+{
+	fprintf(arg, "mft %s\n", uri);
 	return 0;
 }
 
-char const *
-db_rrdp_uris_workspace_get(void)
+/*
+ * Writes the state of every notification in @uris to @file, in the format
+ * of the RRDP journal (see db_rrdp.c).
+ */
+int
+db_rrdp_uris_save(struct db_rrdp_uri *uris, FILE *file)
 {
-	struct db_rrdp_uri *uris;
+	struct uris_table *uri_node, *uri_tmp;
 	int error;
 
-	uris = NULL;
-	error = get_thread_rrdp_uris(&uris);
-	if (error)
-		return NULL;
+	error = 0;
 
-	return uris->current_workspace;
+	pthread_mutex_lock(&uris->lock);
+	HASH_ITER(hh, uris->table, uri_node, uri_tmp) {
+		/* Errored notifications have no state worth keeping */
+		if (uri_node->request_status == RRDP_URI_REQ_ERROR)
+			continue;
+
+		fprintf(file, "notification %ld %lu %s %s\n",
+		    uri_node->last_update, uri_node->data.serial,
+		    uri_node->data.session_id, uri_node->uri);
+		error = visited_uris_foreach(uri_node->visited_uris,
+		    save_visited_uri, file);
+		if (error)
+			break;
+	}
+	pthread_mutex_unlock(&uris->lock);
+
+	return error;
 }
 
+/*
+ * Adds a notification recovered from a previous run. It will be requested
+ * again (as unvisited), but only its changes will be downloaded.
+ *
+ * Takes ownership of @visited_uris on success.
+ */
 int
-db_rrdp_uris_workspace_enable(void)
+db_rrdp_uris_restore(struct db_rrdp_uri *uris, char const *uri,
+    char const *session_id, unsigned long serial, long last_update,
+    struct visited_uris *visited_uris)
 {
-	struct db_rrdp_uri *uris;
+	struct uris_table *db_uri;
 	int error;
 
-	uris = NULL;
-	error = get_thread_rrdp_uris(&uris);
+	db_uri = NULL;
+	error = uris_table_create(uri, session_id, serial,
+	    RRDP_URI_REQ_UNVISITED, &db_uri);
 	if (error)
 		return error;
 
-	return get_thread_rrdp_workspace(&uris->current_workspace);
+	db_uri->last_update = last_update;
+	db_uri->visited_uris = visited_uris;
+
+	pthread_mutex_lock(&uris->lock);
+	add_rrdp_uri(uris, db_uri);
+	pthread_mutex_unlock(&uris->lock);
+
+	return 0;
+}
+
+/*
+ * The workspace switch is part of the thread's validation state, since the
+ * workers of a tree might be looking at different repositories.
+ */
+char const *
+db_rrdp_uris_workspace_get(void)
+{
+	struct validation *state;
+
+	state = state_retrieve();
+	if (state == NULL)
+		return NULL;
+
+	return validation_rrdp_workspace_enabled(state)
+	    ? validation_get_rrdp_workspace(state)
+	    : NULL;
+}
+
+int
+db_rrdp_uris_workspace_enable(void)
+{
+	struct validation *state;
+
+	state = state_retrieve();
+	if (state == NULL)
+		return pr_val_err("No state related to this thread");
+
+	validation_set_rrdp_workspace_enabled(state, true);
+	return 0;
 }
 
 int
 db_rrdp_uris_workspace_disable(void)
 {
-	struct db_rrdp_uri *uris;
-	int error;
+	struct validation *state;
 
-	uris = NULL;
-	error = get_thread_rrdp_uris(&uris);
-	if (error)
-		return error;
+	state = state_retrieve();
+	if (state == NULL)
+		return pr_val_err("No state related to this thread");
 
-	uris->current_workspace = NULL;
+	validation_set_rrdp_workspace_enabled(state, false);
 	return 0;
 }
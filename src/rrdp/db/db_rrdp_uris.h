@@ -2,6 +2,7 @@
 #define SRC_RRDP_DB_DB_RRDP_URIS_H_
 
 #include <stdbool.h>
+#include <stdio.h>
 #include "rrdp/rrdp_objects.h"
 #include "visited_uris.h"
 
@@ -12,15 +13,18 @@ typedef enum {
 } rrdp_req_status_t;
 
 /*
- * RRDP URI fetched from 'rpkiNotify' OID at a CA certificate, each TAL thread
- * may have a reference to one of these (it holds information such as update
- * notification URI, session ID, serial, visited mft uris).
+ * RRDP URIs fetched from 'rpkiNotify' OID at CA certificates. All the TAL
+ * threads share one of these (see db_rrdp.c); it holds information such as
+ * update notification URI, session ID, serial, visited mft uris.
  */
 struct db_rrdp_uri;
 
 int db_rrdp_uris_create(struct db_rrdp_uri **);
 void db_rrdp_uris_destroy(struct db_rrdp_uri *);
 
+int db_rrdp_uris_claim(char const *);
+void db_rrdp_uris_release(char const *);
+
 int db_rrdp_uris_cmp(char const *, char const *, unsigned long,
     rrdp_uri_cmp_result_t *);
 int db_rrdp_uris_update(char const *, char const *session_id, unsigned long,
@@ -32,11 +36,14 @@ int db_rrdp_uris_set_last_update(char const *);
 
 int db_rrdp_uris_get_request_status(char const *, rrdp_req_status_t *);
 int db_rrdp_uris_set_request_status(char const *, rrdp_req_status_t);
-int db_rrdp_uris_set_all_unvisited(void);
+void db_rrdp_uris_set_all_unvisited(struct db_rrdp_uri *);
 
 int db_rrdp_uris_get_visited_uris(char const *, struct visited_uris **);
+int db_rrdp_uris_rem_unvisited(struct db_rrdp_uri *, char const *);
 
-int db_rrdp_uris_remove_all_local(struct db_rrdp_uri *, char const *);
+int db_rrdp_uris_save(struct db_rrdp_uri *, FILE *);
+int db_rrdp_uris_restore(struct db_rrdp_uri *, char const *, char const *,
+    unsigned long, long, struct visited_uris *);
 
 char const *db_rrdp_uris_workspace_get(void);
 int db_rrdp_uris_workspace_enable(void);
@@ -7,8 +7,10 @@
 #include "common.h"
 #include "config.h"
 #include "log.h"
+#include "metrics.h"
 #include "reqs_errors.h"
 #include "thread_var.h"
+#include "trace.h"
 #include "visited_uris.h"
 
 /* Fetch and process the deltas from the @notification */
@@ -110,13 +112,16 @@ process_diff_session(struct update_notification *notification,
 }
 
 static int
-__rrdp_load(struct rpki_uri *uri, bool force_snapshot, bool *data_updated)
+__rrdp_load(struct rpki_uri *uri, struct rpki_uri *repository,
+    bool force_snapshot, bool *data_updated)
 {
 	struct update_notification *upd_notification;
 	struct visited_uris *visited;
 	rrdp_req_status_t requested;
 	rrdp_uri_cmp_result_t res;
 	bool log_operation;
+	double start;
+	size_t received;
 	int error, upd_error;
 
 	(*data_updated) = false;
@@ -151,6 +156,9 @@ __rrdp_load(struct rpki_uri *uri, bool force_snapshot, bool *data_updated)
 		}
 	}
 
+	start = metrics_now();
+	received = metrics_http_received_total();
+
 	log_operation = reqs_errors_log_uri(uri_get_global(uri));
 	error = rrdp_parse_notification(uri, log_operation, force_snapshot,
 	    &upd_notification);
@@ -237,6 +245,10 @@ upd_destroy:
 		fnstack_pop(); /* Pop from rrdp_parse_notification */
 	}
 upd_end:
+	metrics_fetch(MP_RRDP, uri_get_global(uri), uri_get_global_len(uri),
+	    metrics_now() - start, metrics_http_received_total() - received,
+	    error);
+
 	/* Just return on success */
 	if (!error) {
 		/* The repository URI is the notification file URI */
@@ -250,8 +262,8 @@ upd_end:
 		if (upd_error)
 			return upd_error;
 	} else {
-		/* Reset RSYNC visited URIs, this may force the update */
-		reset_downloaded();
+		/* Forget the repository's rsync, this may force the update */
+		reset_downloaded(repository);
 	}
 
 	upd_error = mark_rrdp_uri_request_err(uri_get_global(uri));
@@ -261,12 +273,38 @@ upd_end:
 	return error;
 }
 
+/*
+ * Workers, of the same TAL or not, can ask for the same notification at the
+ * same time; only one of them loads it, and the rest wait for it. (And then
+ * find it already visited.)
+ */
+static int
+claim_and_load(struct rpki_uri *uri, struct rpki_uri *repository,
+    bool force_snapshot, bool *data_updated)
+{
+	int error;
+
+	if (!config_get_http_enabled())
+		return __rrdp_load(uri, repository, force_snapshot,
+		    data_updated);
+
+	error = db_rrdp_uris_claim(uri_get_global(uri));
+	if (error)
+		return error;
+
+	error = __rrdp_load(uri, repository, force_snapshot, data_updated);
+
+	db_rrdp_uris_release(uri_get_global(uri));
+	return error;
+}
+
 /*
  * Try to get RRDP Update Notification file and process it accordingly.
  *
  * If there's an error that could lead to an inconsistent local repository
  * state, marks the @uri as error'd so that it won't be requested again during
- * the same validation cycle.
+ * the same validation cycle. (And forgets that @repository, its rsync
+ * counterpart, was already rsync'd, so the fallback fetches it again.)
  *
  * If there are no errors, updates the local DB and marks the @uri as visited.
  *
@@ -279,9 +317,17 @@ upd_end:
  * - @uri was already visited at this cycle
  */
 int
-rrdp_load(struct rpki_uri *uri, bool *data_updated)
+rrdp_load(struct rpki_uri *uri, struct rpki_uri *repository,
+    bool *data_updated)
 {
-	return __rrdp_load(uri, false, data_updated);
+	struct trace_span span;
+	int error;
+
+	trace_begin(&span, "rrdp_load");
+	error = claim_and_load(uri, repository, false, data_updated);
+	trace_end(&span, uri_val_get_printable(uri));
+
+	return error;
 }
 
 /*
@@ -292,10 +338,10 @@ rrdp_load(struct rpki_uri *uri, bool *data_updated)
  * still the check is done.
  */
 int
-rrdp_reload_snapshot(struct rpki_uri *uri)
+rrdp_reload_snapshot(struct rpki_uri *uri, struct rpki_uri *repository)
 {
 	bool tmp;
 
 	tmp = false;
-	return __rrdp_load(uri, true, &tmp);
+	return claim_and_load(uri, repository, true, &tmp);
 }
@@ -204,6 +204,13 @@ deltas_head_values_set(struct deltas_head *deltas)
 	return deltas->len == deltas->capacity;
 }
 
+/* Number of deltas the notification lists */
+size_t
+deltas_head_size(struct deltas_head *deltas)
+{
+	return deltas->capacity;
+}
+
 /* Do the @cb to the delta head elements from @from_serial to @max_serial */
 int
 deltas_head_for_each(struct deltas_head *deltas, unsigned long max_serial,
@@ -219,6 +226,13 @@ deltas_head_for_each(struct deltas_head *deltas, unsigned long max_serial,
 		return -ENOENT;
 	}
 
+	/* Same; the oldest delta doesn't follow the local serial */
+	if (max_serial - from_serial > deltas->capacity) {
+		pr_val_warn("The deltas listed don't reach back to serial %lu.",
+		    from_serial);
+		return -ENOENT;
+	}
+
 	pr_val_debug("Getting RRDP deltas from serial %lu to %lu.", from_serial,
 	    max_serial);
 	from = deltas->capacity - (max_serial - from_serial);
@@ -46,7 +46,8 @@ struct withdraw {
 
 /*
  * Delta file content.
- * Publish/withdraw list aren't remember, they are processed ASAP.
+ * Publish/withdraw list is kept by the parser, until all the pending deltas
+ * can be applied at once.
  */
 struct delta {
 	struct global_data global_data;
@@ -97,6 +98,7 @@ int deltas_head_add(struct deltas_head *, unsigned long, unsigned long, char *,
 
 int deltas_head_set_size(struct deltas_head *, size_t);
 bool deltas_head_values_set(struct deltas_head *);
+size_t deltas_head_size(struct deltas_head *);
 
 int snapshot_create(struct snapshot **);
 void snapshot_destroy(struct snapshot *);
@@ -3,8 +3,8 @@
 #include <libxml/xmlreader.h>
 #include <openssl/evp.h>
 #include <sys/stat.h>
-#include <ctype.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -12,12 +12,16 @@
 #include "rrdp/db/db_rrdp_uris.h"
 #include "crypto/base64.h"
 #include "crypto/hash.h"
+#include "crypto/hash_cache.h"
 #include "http/http.h"
 #include "xml/relax_ng.h"
 #include "common.h"
+#include "config.h"
 #include "file.h"
 #include "log.h"
+#include "object_store.h"
 #include "thread_var.h"
+#include "data_structure/uthash_nonfatal.h"
 
 /* XML Common Namespace of files */
 #define RRDP_NAMESPACE		"http://www.ripe.net/rpki/rrdp"
@@ -40,6 +44,15 @@
 DEFINE_ARRAY_LIST_STRUCT(deltas_parsed, struct delta_head *);
 DEFINE_ARRAY_LIST_FUNCTIONS(deltas_parsed, struct delta_head *, static)
 
+/* A <publish> or <withdraw> read from a delta. Exactly one of them is set. */
+struct delta_change {
+	struct publish *publish;
+	struct withdraw *withdraw;
+};
+
+DEFINE_ARRAY_LIST_STRUCT(delta_changes, struct delta_change);
+DEFINE_ARRAY_LIST_FUNCTIONS(delta_changes, struct delta_change, static)
+
 /* Context while reading an update notification */
 struct rdr_notification_ctx {
 	/* Data being parsed */
@@ -54,8 +67,8 @@ struct rdr_snapshot_ctx {
 	struct snapshot *snapshot;
 	/* Parent data to validate session ID and serial */
 	struct update_notification *parent;
-	/* Visited URIs related to this thread */
-	struct visited_uris *visited_uris;
+	/* Where the published objects go until the hash is validated */
+	struct snapshot_stage *stage;
 };
 
 /* Context while reading a delta */
@@ -66,8 +79,8 @@ struct rdr_delta_ctx {
 	struct update_notification *parent;
 	/* Current serial loaded from update notification deltas list */
 	unsigned long expected_serial;
-	/* Visited URIs related to this thread */
-	struct visited_uris *visited_uris;
+	/* The delta's publishes and withdraws, in document order */
+	struct delta_changes *changes;
 };
 
 /* Args to send on update (snapshot/delta) files parsing */
@@ -133,137 +146,39 @@ download_file(struct rpki_uri *uri, long last_update, bool log_operation)
 	return error;
 }
 
-/* Left trim @from, setting the result at @result pointer */
-static int
-ltrim(char *from, char **result, size_t *result_size)
-{
-	char *start;
-	size_t tmp_size;
-
-	start = from;
-	tmp_size = strlen(from);
-	while (isspace(*start)) {
-		start++;
-		tmp_size--;
-	}
-	if (*start == '\0')
-		return pr_val_err("Invalid base64 encoded string (seems to be empty or full of spaces).");
-
-	*result = start;
-	*result_size = tmp_size;
-	return 0;
-}
-
 /*
- * Get the base64 chars from @content and allocate to @out with lines no greater
- * than 65 chars (including line feed).
- *
- * Why? LibreSSL doesn't like lines greater than 80 chars, so use a common
- * length per line.
+ * Decodes the text of a <publish> element. @content is still owned by the XML
+ * reader; it's decoded in place (whitespace and all) into a fresh buffer.
  */
 static int
-base64_sanitize(char *content, char **out)
+base64_read(xmlChar const *content, unsigned char **out, size_t *out_len)
 {
-#define BUF_SIZE 65
-	char *result;
-	char *tmp;
-	size_t original_size, new_size;
-	size_t offset, buf_len;
-	int error;
-
-	original_size = 0;
-	error = ltrim(content, &tmp, &original_size);
-	if (error)
-		return error;
-
-	if (original_size <= BUF_SIZE) {
-		result = malloc(original_size + 1);
-		if (result == NULL)
-			return pr_enomem();
-		result[original_size] = '\0';
-		*out = result;
-		return 0;
-	}
-
-	new_size = original_size + (original_size / BUF_SIZE);
-	result = malloc(new_size + 1);
-	if (result == NULL)
-		return pr_enomem();
-
-	offset = 0;
-	while (original_size > 0){
-		buf_len = original_size > BUF_SIZE ? BUF_SIZE : original_size;
-		memcpy(&result[offset], tmp, buf_len);
-		tmp += buf_len;
-		offset += buf_len;
-		original_size -= buf_len;
-
-		if (original_size <= 0)
-			break;
-		result[offset] = '\n';
-		offset++;
-	}
-
-	/* Reallocate to exact size and add nul char */
-	if (offset != new_size + 1) {
-		tmp = realloc(result, offset + 1);
-		if (tmp == NULL) {
-			free(result);
-			return pr_enomem();
-		}
-		result = tmp;
-	}
-
-	result[offset] = '\0';
-	*out = result;
-	return 0;
-#undef BUF_SIZE
-}
-
-static int
-base64_read(char *content, unsigned char **out, size_t *out_len)
-{
-	BIO *encoded; /* base64 encoded. */
 	unsigned char *result;
-	char *sanitized;
-	size_t alloc_size;
+	size_t content_len;
 	size_t result_len;
 	int error;
 
-	sanitized = NULL;
-	error = base64_sanitize(content, &sanitized);
-	if (error)
-		return error;
-
-	encoded = BIO_new_mem_buf(sanitized, -1);
-	if (encoded == NULL) {
-		error = val_crypto_err("BIO_new_mem_buf() returned NULL");
-		goto release_sanitized;
-	}
+	content_len = xmlStrlen(content);
+	result = malloc(content_len / 4 * 3 + 1);
+	if (result == NULL)
+		return pr_enomem();
 
-	alloc_size = EVP_DECODE_LENGTH(strlen(content));
-	result = malloc(alloc_size);
-	if (result == NULL) {
-		error = pr_enomem();
-		goto release_bio;
+	error = base64_decode_str((char const *) content, content_len, result,
+	    &result_len);
+	if (error) {
+		error = pr_val_err("Invalid base64 encoded string.");
+		goto release_result;
 	}
-
-	error = base64_decode(encoded, result, true, alloc_size, &result_len);
-	if (error)
+	if (result_len == 0) {
+		error = pr_val_err("Invalid base64 encoded string (seems to be empty or full of spaces).");
 		goto release_result;
-
-	free(sanitized);
-	BIO_free(encoded);
+	}
 
 	*out = result;
 	(*out_len) = result_len;
 	return 0;
 release_result:
 	free(result);
-release_bio:
-	BIO_free(encoded);
-release_sanitized:
-	free(sanitized);
 	return error;
 }
 
@@ -329,7 +244,7 @@ parse_hex_string(xmlTextReaderPtr reader, bool required, char const *attr,
 	xmlChar *xml_value;
 	unsigned char *tmp, *ptr;
 	char *xml_cur;
-	char buf[2];
+	char buf[3];
 	size_t tmp_len;
 
 	xml_value = xmlTextReaderGetAttribute(reader, BAD_CAST attr);
@@ -355,6 +270,7 @@ parse_hex_string(xmlTextReaderPtr reader, bool required, char const *attr,
 
 	ptr = tmp;
 	xml_cur = (char *) xml_value;
+	buf[2] = '\0';
 	while (ptr - tmp < tmp_len) {
 		memcpy(buf, xml_cur, 2);
 		*ptr = strtol(buf, NULL, 16);
@@ -491,8 +407,7 @@ parse_publish(xmlTextReaderPtr reader, bool parse_hash, bool hash_required,
     struct publish **publish)
 {
 	struct publish *tmp;
-	struct rpki_uri *uri;
-	char *base64_str;
+	xmlChar const *base64_str;
 	int error;
 
 	error = publish_create(&tmp);
@@ -511,39 +426,19 @@ parse_publish(xmlTextReaderPtr reader, bool parse_hash, bool hash_required,
 		goto release_tmp;
 	}
 
-	error = parse_string(reader, NULL, &base64_str);
-	if (error)
+	base64_str = xmlTextReaderConstValue(reader);
+	if (base64_str == NULL) {
+		error = pr_val_err("RRDP file: Couldn't find string content from '%s'",
+		    xmlTextReaderConstLocalName(reader));
 		goto release_tmp;
+	}
 
 	error = base64_read(base64_str, &tmp->content, &tmp->content_len);
 	if (error)
-		goto release_base64;
-
-	/* rfc8181#section-2.2 but considering optional hash */
-	uri = NULL;
-	if (tmp->doc_data.hash_len > 0) {
-		/* Get the current file from the uri */
-		error = uri_create_rsync_str_rrdp(&uri, tmp->doc_data.uri,
-		    strlen(tmp->doc_data.uri));
-		if (error)
-			goto release_base64;
-
-		error = hash_validate_file("sha256", uri, tmp->doc_data.hash,
-		    tmp->doc_data.hash_len);
-		uri_refput(uri);
-		if (error != 0) {
-			pr_val_info("Hash of base64 decoded element from URI '%s' doesn't match <publish> element hash",
-			    tmp->doc_data.uri);
-			error = EINVAL;
-			goto release_base64;
-		}
-	}
+		goto release_tmp;
 
-	free(base64_str);
 	*publish = tmp;
 	return 0;
-release_base64:
-	free(base64_str);
 release_tmp:
 	publish_destroy(tmp);
 	return error;
@@ -553,7 +448,6 @@ static int
 parse_withdraw(xmlTextReaderPtr reader, struct withdraw **withdraw)
 {
 	struct withdraw *tmp;
-	struct rpki_uri *uri;
 	int error;
 
 	error = withdraw_create(&tmp);
@@ -561,28 +455,46 @@ parse_withdraw(xmlTextReaderPtr reader, struct withdraw **withdraw)
 		return error;
 
 	error = parse_doc_data(reader, true, true, &tmp->doc_data);
-	if (error)
-		goto release_tmp;
+	if (error) {
+		withdraw_destroy(tmp);
+		return error;
+	}
 
-	/* rfc8181#section-2.2, get the file from the uri */
-	error = uri_create_rsync_str_rrdp(&uri, tmp->doc_data.uri,
-	    strlen(tmp->doc_data.uri));
+	*withdraw = tmp;
+	return 0;
+}
+
+/* Writes @content to @path, and returns the new file's metadata in @meta. */
+static int
+write_file(char const *path, unsigned char *content, size_t content_len,
+    struct stat *meta)
+{
+	FILE *out;
+	size_t written;
+	int error;
+
+	error = create_dir_recursive(path);
 	if (error)
-		goto release_tmp;
+		return error;
 
-	error = hash_validate_file("sha256", uri,
-	    tmp->doc_data.hash, tmp->doc_data.hash_len);
+	error = file_write(path, &out, meta);
 	if (error)
-		goto release_uri;
+		return error;
 
-	uri_refput(uri);
-	*withdraw = tmp;
+	written = fwrite(content, sizeof(unsigned char), content_len, out);
+	if (written != content_len) {
+		file_close(out);
+		return pr_val_err("Couldn't write bytes to file %s", path);
+	}
+
+	if (fflush(out) != 0 || fstat(fileno(out), meta) != 0) {
+		error = pr_val_errno(errno, "Couldn't write file %s", path);
+		file_close(out);
+		return error;
+	}
+
+	file_close(out);
 	return 0;
-release_uri:
-	uri_refput(uri);
-release_tmp:
-	withdraw_destroy(tmp);
-	return error;
 }
 
 static int
@@ -590,9 +502,9 @@ write_from_uri(char const *location, unsigned char *content, size_t content_len,
     struct visited_uris *visited_uris)
 {
 	struct rpki_uri *uri;
-	struct stat stat;
-	FILE *out;
-	size_t written;
+	struct stat meta;
+	unsigned char sha256[EVP_MAX_MD_SIZE];
+	unsigned int sha256_len;
 	int error;
 
 	/* rfc8181#section-2.2 must be an rsync URI */
@@ -600,36 +512,179 @@ write_from_uri(char const *location, unsigned char *content, size_t content_len,
 	if (error)
 		return error;
 
-	error = create_dir_recursive(uri_get_local(uri));
-	if (error) {
+	if (object_store_enabled()) {
+		error = object_store_put(uri_get_local(uri), content,
+		    content_len);
+		if (!error)
+			error = add_mft_to_list(visited_uris,
+			    uri_get_global(uri));
 		uri_refput(uri);
 		return error;
 	}
 
-	error = file_write(uri_get_local(uri), &out, &stat);
+	error = write_file(uri_get_local(uri), content, content_len, &meta);
 	if (error) {
 		uri_refput(uri);
 		return error;
 	}
 
-	written = fwrite(content, sizeof(unsigned char), content_len, out);
-	if (written != content_len) {
-		uri_refput(uri);
-		file_close(out);
-		return pr_val_err("Couldn't write bytes to file %s",
-		    uri_get_local(uri));
-	}
+	/* The manifest will want its hash; spare it from reading the file. */
+	if (hash_buffer("sha256", content, content_len, sha256, &sha256_len) == 0)
+		hash_cache_put(uri_get_local(uri), &meta, sha256);
 
 	error = add_mft_to_list(visited_uris, uri_get_global(uri));
-	if (error) {
-		uri_refput(uri);
-		file_close(out);
+	uri_refput(uri);
+	return error;
+}
+
+/*
+ * A snapshot object, set aside until the snapshot's hash is validated.
+ *
+ * With the object store, the content is staged in the store. Otherwise, it's
+ * written next to the object's actual location, with the ".tmp" extension.
+ */
+struct staged_file {
+	struct rpki_uri *uri;
+	/* NULL if the content is in the object store */
+	char *tmp_path;
+	/* The metadata and hash of @tmp_path, for the hash cache */
+	struct stat meta;
+	unsigned char sha256[EVP_MAX_MD_SIZE];
+	bool hashed;
+};
+
+DEFINE_ARRAY_LIST_STRUCT(staged_files, struct staged_file);
+DEFINE_ARRAY_LIST_FUNCTIONS(staged_files, struct staged_file, static)
+
+/* The snapshot's objects, as they're being set aside. */
+struct snapshot_stage {
+	struct staged_files files;
+	/* NULL if the object store is disabled */
+	struct staged_objects *objects;
+};
+
+static int
+snapshot_stage_init(struct snapshot_stage *stage)
+{
+	staged_files_init(&stage->files);
+	stage->objects = NULL;
+	return object_store_enabled()
+	    ? object_store_stage_create(&stage->objects)
+	    : 0;
+}
+
+static void
+staged_file_cleanup(struct staged_file *file)
+{
+	uri_refput(file->uri);
+	free(file->tmp_path);
+}
+
+/* Deletes @file's temporary copy, along with its directories (if empty). */
+static void
+staged_file_discard(struct staged_file *file)
+{
+	delete_dir_recursive_bottom_up(file->tmp_path);
+}
+
+/*
+ * Releases @stage. If @commit, its objects are moved to their actual locations
+ * first. Otherwise, they're thrown away.
+ */
+static int
+snapshot_stage_cleanup(struct snapshot_stage *stage,
+    struct visited_uris *visited_uris, bool commit)
+{
+	struct staged_file *file;
+	char const *path;
+	array_index i;
+	int error;
+
+	error = 0;
+	if (commit && stage->objects != NULL)
+		error = object_store_commit(stage->objects);
+
+	ARRAYLIST_FOREACH(&stage->files, file, i) {
+		if (!commit || error) {
+			if (file->tmp_path != NULL)
+				staged_file_discard(file);
+			continue;
+		}
+
+		path = uri_get_local(file->uri);
+		if (file->tmp_path != NULL) {
+			if (rename(file->tmp_path, path) != 0) {
+				error = pr_val_errno(errno,
+				    "Couldn't rename %s", file->tmp_path);
+				staged_file_discard(file);
+				continue;
+			}
+			/* rename() preserves the inode and the mtime. */
+			if (file->hashed)
+				hash_cache_put(path, &file->meta, file->sha256);
+		}
+
+		error = add_mft_to_list(visited_uris,
+		    uri_get_global(file->uri));
+	}
+
+	staged_files_cleanup(&stage->files, staged_file_cleanup);
+	if (stage->objects != NULL)
+		object_store_stage_destroy(stage->objects);
+	return error;
+}
+
+static int
+stage_from_uri(char const *location, unsigned char *content,
+    size_t content_len, struct snapshot_stage *stage)
+{
+	struct staged_file file;
+	unsigned int sha256_len;
+	int error;
+
+	/* rfc8181#section-2.2 must be an rsync URI */
+	error = uri_create_rsync_str_rrdp(&file.uri, location,
+	    strlen(location));
+	if (error)
 		return error;
+	file.tmp_path = NULL;
+	file.hashed = false;
+
+	if (stage->objects != NULL) {
+		error = object_store_stage(stage->objects,
+		    uri_get_local(file.uri), content, content_len);
+		if (error)
+			goto fail;
+		goto add;
 	}
 
-	uri_refput(uri);
-	file_close(out);
+	file.tmp_path = malloc(strlen(uri_get_local(file.uri)) + strlen(".tmp")
+	    + 1);
+	if (file.tmp_path == NULL) {
+		error = pr_enomem();
+		goto fail;
+	}
+	sprintf(file.tmp_path, "%s.tmp", uri_get_local(file.uri));
+
+	error = write_file(file.tmp_path, content, content_len, &file.meta);
+	if (error)
+		goto fail;
+
+	file.hashed = hash_buffer("sha256", content, content_len, file.sha256,
+	    &sha256_len) == 0;
+
+add:
+	error = staged_files_add(&stage->files, &file);
+	if (error) {
+		if (file.tmp_path != NULL)
+			staged_file_discard(&file);
+		goto fail;
+	}
 	return 0;
+
+fail:
+	staged_file_cleanup(&file);
+	return error;
 }
 
 /* Remove a local file and its directory tree (if empty) */
@@ -644,6 +699,17 @@ delete_from_uri(struct rpki_uri *uri, struct visited_uris *visited_uris)
 			return error;
 	}
 
+	/*
+	 * With the object store, nothing else keeps the workspace directories
+	 * alive; removing them would race with the other fetches' mkdirs.
+	 */
+	if (object_store_enabled()) {
+		if (remove(uri_get_local(uri)) != 0)
+			return pr_val_errno(errno, "Couldn't delete %s",
+			    uri_get_local(uri));
+		return 0;
+	}
+
 	/* Delete parent dirs only if empty. */
 	return delete_dir_recursive_bottom_up(uri_get_local(uri));
 }
@@ -659,7 +725,12 @@ __delete_from_uri(char const *location, struct visited_uris *visited_uris)
 	if (error)
 		return error;
 
-	error = delete_from_uri(uri, visited_uris);
+	if (object_store_enabled()) {
+		error = rem_mft_from_list(visited_uris, uri_get_global(uri));
+		object_store_remove(uri_get_local(uri));
+	} else {
+		error = delete_from_uri(uri, visited_uris);
+	}
 
 	/* Error 0 is ok */
 	uri_refput(uri);
@@ -671,19 +742,18 @@ __delete_from_uri(char const *location, struct visited_uris *visited_uris)
  * other type at the caller.
  */
 static int
-parse_publish_elem(xmlTextReaderPtr reader, bool parse_hash, bool hash_required,
-    struct visited_uris *visited_uris)
+parse_publish_elem(xmlTextReaderPtr reader, struct snapshot_stage *stage)
 {
 	struct publish *tmp;
 	int error;
 
 	tmp = NULL;
-	error = parse_publish(reader, parse_hash, hash_required, &tmp);
+	error = parse_publish(reader, false, false, &tmp);
 	if (error)
 		return error;
 
-	error = write_from_uri(tmp->doc_data.uri, tmp->content,
-	    tmp->content_len, visited_uris);
+	error = stage_from_uri(tmp->doc_data.uri, tmp->content,
+	    tmp->content_len, stage);
 	publish_destroy(tmp);
 	if (error)
 		return error;
@@ -691,28 +761,6 @@ parse_publish_elem(xmlTextReaderPtr reader, bool parse_hash, bool hash_required,
 	return 0;
 }
 
-/*
- * This function will call 'xmlTextReaderRead' so there's no need to expect any
- * other type at the caller.
- */
-static int
-parse_withdraw_elem(xmlTextReaderPtr reader, struct visited_uris *visited_uris)
-{
-	struct withdraw *tmp;
-	int error;
-
-	error = parse_withdraw(reader, &tmp);
-	if (error)
-		return error;
-
-	error = __delete_from_uri(tmp->doc_data.uri, visited_uris);
-	withdraw_destroy(tmp);
-	if (error)
-		return error;
-
-	return 0;
-}
-
 static int
 rdr_notification_ctx_init(struct rdr_notification_ctx *ctx)
 {
@@ -902,8 +950,7 @@ xml_read_snapshot(xmlTextReaderPtr reader, void *arg)
 	switch (type) {
 	case XML_READER_TYPE_ELEMENT:
 		if (xmlStrEqual(name, BAD_CAST RRDP_ELEM_PUBLISH))
-			error = parse_publish_elem(reader, false, false,
-			    ctx->visited_uris);
+			error = parse_publish_elem(reader, ctx->stage);
 		else if (xmlStrEqual(name, BAD_CAST RRDP_ELEM_SNAPSHOT))
 			error = parse_global_data(reader,
 			    &ctx->snapshot->global_data,
@@ -922,40 +969,175 @@ xml_read_snapshot(xmlTextReaderPtr reader, void *arg)
 	return 0;
 }
 
+/* A snapshot, as it's being downloaded. */
+struct snapshot_stream {
+	struct http_stream *http;
+	/* Hash of everything read so far */
+	EVP_MD_CTX *md;
+};
+
+/* Hands the snapshot over to the parser, hashing it on the way. */
+static int
+snapshot_stream_read(void *arg, char *buffer, int len)
+{
+	struct snapshot_stream *stream = arg;
+	int read;
+
+	read = http_stream_read(stream->http, (unsigned char *) buffer, len);
+	if (read < 0)
+		return -1;
+	if (read > 0 && !EVP_DigestUpdate(stream->md, buffer, read))
+		return -1;
+
+	return read;
+}
+
+/* Hashes whatever the parser didn't need. (Trailing whitespace, normally.) */
+static int
+snapshot_stream_drain(struct snapshot_stream *stream)
+{
+	char buffer[1024];
+	int read;
+
+	do {
+		read = snapshot_stream_read(stream, buffer, sizeof(buffer));
+	} while (read > 0);
+
+	return (read < 0) ? -EIO : 0;
+}
+
+static int
+snapshot_stream_validate_hash(struct snapshot_stream *stream,
+    struct rpki_uri *uri, struct doc_data *expected)
+{
+	unsigned char actual[EVP_MAX_MD_SIZE];
+	unsigned int actual_len;
+
+	if (!EVP_DigestFinal_ex(stream->md, actual, &actual_len))
+		return val_crypto_err("EVP_DigestFinal_ex() failed");
+
+	if (expected->hash_len != actual_len ||
+	    memcmp(expected->hash, actual, actual_len) != 0)
+		return pr_val_err("File '%s' does not match its expected hash.",
+		    uri_val_get_printable(uri));
+
+	return 0;
+}
+
+/*
+ * Downloads and parses the snapshot at the same time, so it never needs to be
+ * stored. The catch is that the hash can only be validated at the end, so the
+ * objects are staged until then, and only land in the repository if it matches.
+ */
 static int
 parse_snapshot(struct rpki_uri *uri, struct proc_upd_args *args)
 {
 	struct rdr_snapshot_ctx ctx;
+	struct snapshot_stream stream;
+	struct snapshot_stage stage;
 	struct snapshot *snapshot;
+	int http_error;
 	int error;
 
 	fnstack_push_uri(uri);
-	/* Hash validation */
-	error = hash_validate_file("sha256", uri, args->parent->snapshot.hash,
-	    args->parent->snapshot.hash_len);
-	if (error)
+
+	stream.md = EVP_MD_CTX_new();
+	if (stream.md == NULL) {
+		error = pr_enomem();
 		goto pop;
+	}
+	if (!EVP_DigestInit_ex(stream.md, EVP_sha256(), NULL)) {
+		error = val_crypto_err("EVP_DigestInit_ex() failed");
+		goto free_md;
+	}
 
 	error = snapshot_create(&snapshot);
 	if (error)
-		goto pop;
+		goto free_md;
+
+	error = snapshot_stage_init(&stage);
+	if (error)
+		goto destroy_snapshot;
+
+	error = http_stream_open(uri, args->log_operation, &stream.http);
+	if (error) {
+		snapshot_stage_cleanup(&stage, args->visited_uris, false);
+		goto destroy_snapshot;
+	}
 
 	ctx.snapshot = snapshot;
 	ctx.parent = args->parent;
-	ctx.visited_uris = args->visited_uris;
-	error = relax_ng_parse(uri_get_local(uri), xml_read_snapshot, &ctx);
+	ctx.stage = &stage;
+	error = relax_ng_parse_io(uri_get_global(uri), snapshot_stream_read,
+	    &stream, xml_read_snapshot, &ctx);
+	if (!error)
+		error = snapshot_stream_drain(&stream);
+
+	/* A failed download also breaks the parsing; report the actual cause */
+	http_error = http_stream_close(stream.http);
+	if (http_error == -EREQFAILED)
+		error = EREQFAILED;
+	else if (http_error)
+		error = http_error;
+
+	if (!error)
+		error = snapshot_stream_validate_hash(&stream, uri,
+		    &args->parent->snapshot);
 
-	/* Error 0 is ok */
+	if (error)
+		snapshot_stage_cleanup(&stage, args->visited_uris, false);
+	else
+		error = snapshot_stage_cleanup(&stage, args->visited_uris,
+		    true);
+
+destroy_snapshot:
 	snapshot_destroy(snapshot);
+free_md:
+	EVP_MD_CTX_free(stream.md);
 pop:
 	fnstack_pop();
 	return error;
 }
 
+static int
+add_delta_change(struct delta_changes *changes, struct publish *publish,
+    struct withdraw *withdraw)
+{
+	struct delta_change change;
+	int error;
+
+	change.publish = publish;
+	change.withdraw = withdraw;
+	error = delta_changes_add(changes, &change);
+	if (error) {
+		if (publish != NULL)
+			publish_destroy(publish);
+		if (withdraw != NULL)
+			withdraw_destroy(withdraw);
+	}
+
+	return error;
+}
+
+static void
+delta_change_cleanup(struct delta_change *change)
+{
+	if (change->publish != NULL)
+		publish_destroy(change->publish);
+	if (change->withdraw != NULL)
+		withdraw_destroy(change->withdraw);
+}
+
+/*
+ * The elements are only collected here; they can't be checked against the
+ * local files until the previous deltas have been accounted for.
+ */
 static int
 xml_read_delta(xmlTextReaderPtr reader, void *arg)
 {
 	struct rdr_delta_ctx *ctx = arg;
+	struct publish *publish;
+	struct withdraw *withdraw;
 	xmlReaderTypes type;
 	xmlChar const *name;
 	int error;
@@ -964,12 +1146,17 @@ xml_read_delta(xmlTextReaderPtr reader, void *arg)
 	type = xmlTextReaderNodeType(reader);
 	switch (type) {
 	case XML_READER_TYPE_ELEMENT:
-		if (xmlStrEqual(name, BAD_CAST RRDP_ELEM_PUBLISH))
-			error = parse_publish_elem(reader, true, false,
-			    ctx->visited_uris);
-		else if (xmlStrEqual(name, BAD_CAST RRDP_ELEM_WITHDRAW))
-			error = parse_withdraw_elem(reader, ctx->visited_uris);
-		else if (xmlStrEqual(name, BAD_CAST RRDP_ELEM_DELTA))
+		if (xmlStrEqual(name, BAD_CAST RRDP_ELEM_PUBLISH)) {
+			error = parse_publish(reader, true, false, &publish);
+			if (!error)
+				error = add_delta_change(ctx->changes, publish,
+				    NULL);
+		} else if (xmlStrEqual(name, BAD_CAST RRDP_ELEM_WITHDRAW)) {
+			error = parse_withdraw(reader, &withdraw);
+			if (!error)
+				error = add_delta_change(ctx->changes, NULL,
+				    withdraw);
+		} else if (xmlStrEqual(name, BAD_CAST RRDP_ELEM_DELTA))
 			error = parse_global_data(reader,
 			    &ctx->delta->global_data,
 			    ctx->parent->global_data.session_id,
@@ -989,7 +1176,7 @@ xml_read_delta(xmlTextReaderPtr reader, void *arg)
 
 static int
 parse_delta(struct rpki_uri *uri, struct delta_head *parents_data,
-    struct proc_upd_args *args)
+    struct update_notification *parent, struct delta_changes *changes)
 {
 	struct rdr_delta_ctx ctx;
 	struct delta *delta;
@@ -1009,8 +1196,8 @@ parse_delta(struct rpki_uri *uri, struct delta_head *parents_data,
 		goto pop_fnstack;
 
 	ctx.delta = delta;
-	ctx.parent = args->parent;
-	ctx.visited_uris = args->visited_uris;
+	ctx.parent = parent;
+	ctx.changes = changes;
 	ctx.expected_serial = parents_data->serial;
 	error = relax_ng_parse(uri_get_local(uri), xml_read_delta, &ctx);
 
@@ -1021,32 +1208,375 @@ pop_fnstack:
 	return error;
 }
 
+/* The deltas a notification still needs to apply, in serial order. */
+struct pending_deltas {
+	struct delta_head **heads;
+	struct rpki_uri **uris;
+	/* What each delta says, once parsed */
+	struct delta_changes *changes;
+	size_t count;
+	struct update_notification *parent;
+
+	/* Parsing state, shared by the parser threads */
+	pthread_mutex_t lock;
+	/* Next delta nobody has claimed yet */
+	size_t next;
+	/* First error any parser ran into */
+	int error;
+};
+
 static int
-process_delta(struct delta_head *delta_head, void *arg)
+pending_deltas_add(struct delta_head *delta_head, void *arg)
 {
-	struct proc_upd_args *args = arg;
-	struct rpki_uri *uri;
+	struct pending_deltas *pending = arg;
 	struct doc_data *head_data;
 	int error;
 
 	head_data = &delta_head->doc_data;
+	error = uri_create_https_str_rrdp(&pending->uris[pending->count],
+	    head_data->uri, strlen(head_data->uri));
+	if (error)
+		return error;
+
+	pending->heads[pending->count] = delta_head;
+	delta_changes_init(&pending->changes[pending->count]);
+	pending->count++;
+	return 0;
+}
+
+static void
+pending_deltas_cleanup(struct pending_deltas *pending)
+{
+	size_t i;
+
+	for (i = 0; i < pending->count; i++) {
+		uri_refput(pending->uris[i]);
+		delta_changes_cleanup(&pending->changes[i],
+		    delta_change_cleanup);
+	}
+	free(pending->changes);
+	free(pending->uris);
+	free(pending->heads);
+}
+
+/* Parses deltas until there are none left, or one of them fails. */
+static void
+parse_pending_deltas(struct pending_deltas *pending)
+{
+	size_t i;
+	int error;
+
+	do {
+		pthread_mutex_lock(&pending->lock);
+		i = pending->next;
+		if (pending->error == 0 && i < pending->count)
+			pending->next++;
+		else
+			i = pending->count;
+		pthread_mutex_unlock(&pending->lock);
+
+		if (i == pending->count)
+			return;
+
+		pr_val_debug("Processing delta '%s'.",
+		    pending->heads[i]->doc_data.uri);
+		error = parse_delta(pending->uris[i], pending->heads[i],
+		    pending->parent, &pending->changes[i]);
+		if (error) {
+			pthread_mutex_lock(&pending->lock);
+			if (pending->error == 0)
+				pending->error = error;
+			pthread_mutex_unlock(&pending->lock);
+		}
+	} while (true);
+}
+
+static void *
+delta_parser_run(void *arg)
+{
+	fnstack_init();
+	parse_pending_deltas(arg);
+	fnstack_cleanup();
+	return NULL;
+}
+
+/*
+ * Parses all the deltas, in the current thread and up to
+ * --maximum-fetches-per-host - 1 more.
+ */
+static int
+parse_deltas(struct pending_deltas *pending)
+{
+	pthread_t *threads;
+	unsigned int count;
+	unsigned int i;
+	int error;
+
+	if (pending->count == 0)
+		return 0;
+
+	/* Helpers, besides the current thread */
+	count = config_get_max_fetches_per_host();
+	if (count > pending->count)
+		count = pending->count;
+	count--;
+
+	threads = NULL;
+	if (count > 0) {
+		threads = calloc(count, sizeof(pthread_t));
+		if (threads == NULL)
+			return pr_enomem();
+	}
+
+	pending->next = 0;
+	pending->error = 0;
+	error = pthread_mutex_init(&pending->lock, NULL);
+	if (error) {
+		free(threads);
+		return pr_op_errno(error, "Could not create the delta lock");
+	}
+
+	for (i = 0; i < count; i++) {
+		errno = pthread_create(&threads[i], NULL, delta_parser_run,
+		    pending);
+		if (errno) {
+			/* The rest of us will pick up the slack. */
+			pr_op_errno(errno, "Could not spawn a delta parser");
+			break;
+		}
+	}
+	count = i;
+
+	parse_pending_deltas(pending);
+
+	for (i = 0; i < count; i++) {
+		error = pthread_join(threads[i], NULL);
+		if (error)
+			pr_crit("pthread_join() threw %d on a delta parser.",
+			    error);
+	}
+
+	pthread_mutex_destroy(&pending->lock);
+	free(threads);
+	return pending->error;
+}
+
+/* The net effect all the deltas have on one object. */
+struct net_change {
+	/* key; points to the first change's URI */
+	char const *uri;
+	/* Last change that applies to the object; it supersedes the others */
+	struct delta_change *last;
+	/* Did the object exist before the deltas? */
+	bool existed;
+	UT_hash_handle hh;
+};
+
+static void
+net_changes_destroy(struct net_change *changes)
+{
+	struct net_change *change, *tmp;
 
-	pr_val_debug("Processing delta '%s'.", delta_head->doc_data.uri);
-	error = uri_create_https_str_rrdp(&uri, head_data->uri,
-	    strlen(head_data->uri));
+	HASH_ITER(hh, changes, change, tmp) {
+		HASH_DEL(changes, change);
+		free(change);
+	}
+}
+
+static struct doc_data *
+delta_change_doc_data(struct delta_change *change)
+{
+	return (change->publish != NULL)
+	    ? &change->publish->doc_data
+	    : &change->withdraw->doc_data;
+}
+
+/*
+ * rfc8182#section-3.5.3: The hash of a <publish> (if any) or <withdraw> has to
+ * match the object as it stands after the previous elements. @net is the
+ * current state of the object, or NULL if the deltas haven't touched it yet.
+ */
+static int
+check_replaced_hash(struct net_change *net, struct doc_data *data)
+{
+	struct rpki_uri *uri;
+	unsigned char hash[EVP_MAX_MD_SIZE];
+	unsigned int hash_len;
+	struct publish *publish;
+	int error;
+
+	if (net == NULL) {
+		/* Still the local file */
+		error = uri_create_rsync_str_rrdp(&uri, data->uri,
+		    strlen(data->uri));
+		if (error)
+			return error;
+		error = hash_validate_file("sha256", uri, data->hash,
+		    data->hash_len);
+		uri_refput(uri);
+		return error;
+	}
+
+	publish = net->last->publish;
+	if (publish == NULL)
+		return pr_val_err("File '%s' was withdrawn by a previous delta.",
+		    data->uri);
+
+	error = hash_buffer("sha256", publish->content, publish->content_len,
+	    hash, &hash_len);
 	if (error)
 		return error;
 
-	error = download_file(uri, 0, args->log_operation);
+	if (data->hash_len != hash_len ||
+	    memcmp(data->hash, hash, hash_len) != 0)
+		return pr_val_err("File '%s' does not match its expected hash.",
+		    data->uri);
+
+	return 0;
+}
+
+/* Adds @change to the @net changes, superseding the ones it replaces. */
+static int
+net_changes_add(struct net_change **net, struct delta_change *change)
+{
+	struct doc_data *data;
+	struct net_change *node;
+	int error;
+
+	data = delta_change_doc_data(change);
+	HASH_FIND_STR(*net, data->uri, node);
+
+	if (data->hash_len > 0) {
+		error = check_replaced_hash(node, data);
+		if (error) {
+			if (change->publish != NULL) {
+				pr_val_info("Hash of base64 decoded element from URI '%s' doesn't match <publish> element hash",
+				    data->uri);
+				return EINVAL;
+			}
+			return error;
+		}
+	}
+
+	if (node == NULL) {
+		node = malloc(sizeof(struct net_change));
+		if (node == NULL)
+			return pr_enomem();
+		/* Needed by uthash */
+		memset(node, 0, sizeof(struct net_change));
+
+		node->uri = data->uri;
+		node->existed = (data->hash_len > 0);
+
+		errno = 0;
+		HASH_ADD_KEYPTR(hh, *net, node->uri, strlen(node->uri), node);
+		if (errno) {
+			free(node);
+			return pr_enomem();
+		}
+	}
+
+	node->last = change;
+	return 0;
+}
+
+/* Was there an object at @location before the deltas? */
+static bool
+local_object_exists(char const *location)
+{
+	struct rpki_uri *uri;
+	struct stored_object object;
+	bool exists;
+
+	if (uri_create_rsync_str_rrdp(&uri, location, strlen(location)) != 0)
+		return false;
+	exists = object_store_get(uri_get_local(uri), &object) == 0 ||
+	    valid_file_or_dir(uri_get_local(uri), true, false, NULL);
+	uri_refput(uri);
+
+	return exists;
+}
+
+static int
+net_change_apply(struct net_change *net, struct visited_uris *visited_uris)
+{
+	struct publish *publish;
+
+	publish = net->last->publish;
+	if (publish != NULL)
+		return write_from_uri(publish->doc_data.uri, publish->content,
+		    publish->content_len, visited_uris);
+
+	/* Published and withdrawn by the deltas; nothing to clean up. */
+	if (!net->existed && !local_object_exists(net->uri))
+		return 0;
+
+	return __delete_from_uri(net->uri, visited_uris);
+}
+
+/*
+ * Collapses the parsed deltas into one set of changes, so the intermediate
+ * versions of the objects never hit the disk, and applies it.
+ */
+static int
+apply_deltas(struct pending_deltas *pending, struct visited_uris *visited_uris)
+{
+	struct net_change *net, *node, *tmp;
+	struct delta_changes *changes;
+	size_t d, c;
+	int error;
+
+	net = NULL;
+	error = 0;
+	for (d = 0; d < pending->count; d++) {
+		changes = &pending->changes[d];
+		fnstack_push_uri(pending->uris[d]);
+		for (c = 0; c < changes->len; c++) {
+			error = net_changes_add(&net, &changes->array[c]);
+			if (error) {
+				fnstack_pop();
+				goto end;
+			}
+		}
+		fnstack_pop();
+	}
+
+	HASH_ITER(hh, net, node, tmp) {
+		error = net_change_apply(node, visited_uris);
+		if (error)
+			goto end;
+	}
+
+end:
+	net_changes_destroy(net);
+	return error;
+}
+
+/*
+ * The deltas are independent files, so download and parse all of them at
+ * once. Their changes are then applied in one go.
+ */
+static int
+process_deltas(struct pending_deltas *pending, struct proc_upd_args *args)
+{
+	size_t i;
+	int error;
+
+	error = http_download_files(pending->uris, pending->count, write_local,
+	    args->log_operation);
+	if (error == -EREQFAILED)
+		return EREQFAILED;
 	if (error)
-		goto release_uri;
+		return error;
 
-	error = parse_delta(uri, delta_head, args);
+	error = parse_deltas(pending);
+	if (!error)
+		error = apply_deltas(pending, args->visited_uris);
 
-	delete_from_uri(uri, NULL);
 	/* Error 0 its ok */
-release_uri:
-	uri_refput(uri);
+	for (i = 0; i < pending->count; i++)
+		delete_from_uri(pending->uris[i], NULL);
+
 	return error;
 }
 
@@ -1125,6 +1655,7 @@ rrdp_parse_snapshot(struct update_notification *parent,
 
 	args.parent = parent;
 	args.visited_uris = visited_uris;
+	args.log_operation = log_operation;
 
 	pr_val_debug("Processing snapshot '%s'.", parent->snapshot.uri);
 	error = uri_create_https_str_rrdp(&uri, parent->snapshot.uri,
@@ -1132,15 +1663,8 @@ rrdp_parse_snapshot(struct update_notification *parent,
 	if (error)
 		return error;
 
-	error = download_file(uri, 0, log_operation);
-	if (error)
-		goto release_uri;
-
 	error = parse_snapshot(uri, &args);
 
-	delete_from_uri(uri, NULL);
-	/* Error 0 is ok */
-release_uri:
 	uri_refput(uri);
 	return error;
 }
@@ -1151,11 +1675,46 @@ rrdp_process_deltas(struct update_notification *parent,
     bool log_operation)
 {
 	struct proc_upd_args args;
+	struct pending_deltas pending;
+	size_t max;
+	int error;
 
 	args.parent = parent;
 	args.visited_uris = visited_uris;
 	args.log_operation = log_operation;
 
-	return deltas_head_for_each(parent->deltas_list,
-	    parent->global_data.serial, cur_serial, process_delta, &args);
+	if (parent->global_data.serial <= cur_serial)
+		return pr_val_err("The notification's serial (%lu) isn't newer than the local one (%lu).",
+		    parent->global_data.serial, cur_serial);
+
+	/*
+	 * The notification controls the serials, so the gap can be anything.
+	 * Only the listed deltas can be applied; the snapshot covers the rest.
+	 */
+	max = parent->global_data.serial - cur_serial;
+	if (max > deltas_head_size(parent->deltas_list))
+		return pr_val_err("The notification's deltas don't reach back to the local serial (%lu).",
+		    cur_serial);
+
+	pending.heads = calloc(max, sizeof(struct delta_head *));
+	pending.uris = calloc(max, sizeof(struct rpki_uri *));
+	pending.changes = calloc(max, sizeof(struct delta_changes));
+	pending.count = 0;
+	pending.parent = parent;
+	if (pending.heads == NULL || pending.uris == NULL ||
+	    pending.changes == NULL) {
+		error = pr_enomem();
+		goto end;
+	}
+
+	error = deltas_head_for_each(parent->deltas_list,
+	    parent->global_data.serial, cur_serial, pending_deltas_add,
+	    &pending);
+	if (error)
+		goto end;
+
+	error = process_deltas(&pending, &args);
+end:
+	pending_deltas_cleanup(&pending);
+	return error;
 }
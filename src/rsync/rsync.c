@@ -1,6 +1,7 @@
 #include "rsync.h"
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <signal.h> /* SIGINT, SIGQUIT, etc */
@@ -11,17 +12,56 @@
 #include "common.h"
 #include "config.h"
 #include "log.h"
+#include "metrics.h"
 #include "reqs_errors.h"
 #include "str_token.h"
 #include "thread_var.h"
+#include "trace.h"
+#include "data_structure/uthash_nonfatal.h"
 
 struct uri {
 	struct rpki_uri *uri;
 	SLIST_ENTRY(uri) next;
 };
 
-/** URIs that we have already downloaded. */
-SLIST_HEAD(uri_list, uri);
+SLIST_HEAD(uri_slist, uri);
+
+/*
+ * A node of the trie of downloaded URIs. Each node is one component of a URI's
+ * path ("rsync:", the host, the module, and so on); empty components are
+ * skipped, as in is_path_prefix().
+ */
+struct uri_node {
+	/* Key of @hh. NULL in the root. */
+	char *component;
+	/* The path that leads to this node was rsync'd. */
+	bool downloaded;
+	/* Hash table, indexed by component */
+	struct uri_node *children;
+	UT_hash_handle hh;
+};
+
+/*
+ * URIs that we have already downloaded (or are downloading) during the current
+ * validation run. Shared by all the TAL threads, and their workers, so a
+ * repository reached from several trees is only rsync'd once.
+ */
+struct uri_list {
+	/*
+	 * Indexed by path component, so finding whether some ancestor of a
+	 * URI has already been downloaded costs O(depth of the URI), rather
+	 * than O(downloaded URIs).
+	 */
+	struct uri_node downloaded;
+	/*
+	 * rsyncs currently running. Anyone who needs one of them waits for it
+	 * instead of spawning another rsync over the same directory.
+	 */
+	struct uri_slist downloading;
+	pthread_mutex_t lock;
+	/* Signaled whenever something leaves @downloading. */
+	pthread_cond_t cond;
+};
 
 /* static char const *const RSYNC_PREFIX = "rsync://"; */
 
@@ -29,19 +69,33 @@ int
 rsync_create(struct uri_list **result)
 {
 	struct uri_list *visited_uris;
+	int error;
 
 	visited_uris = malloc(sizeof(struct uri_list));
 	if (visited_uris == NULL)
 		return pr_enomem();
 
-	SLIST_INIT(visited_uris);
+	memset(&visited_uris->downloaded, 0, sizeof(struct uri_node));
+	SLIST_INIT(&visited_uris->downloading);
+
+	error = pthread_mutex_init(&visited_uris->lock, NULL);
+	if (error) {
+		free(visited_uris);
+		return -pr_op_errno(error, "pthread_mutex_init() errored");
+	}
+	error = pthread_cond_init(&visited_uris->cond, NULL);
+	if (error) {
+		pthread_mutex_destroy(&visited_uris->lock);
+		free(visited_uris);
+		return -pr_op_errno(error, "pthread_cond_init() errored");
+	}
 
 	*result = visited_uris;
 	return 0;
 }
 
-void
-rsync_destroy(struct uri_list *list)
+static void
+uri_slist_cleanup(struct uri_slist *list)
 {
 	struct uri *uri;
 
@@ -51,15 +105,40 @@ rsync_destroy(struct uri_list *list)
 		uri_refput(uri->uri);
 		free(uri);
 	}
+}
+
+/* Deletes @node's descendants, and unmarks @node. */
+static void
+uri_node_cleanup(struct uri_node *node)
+{
+	struct uri_node *child, *tmp;
+
+	HASH_ITER(hh, node->children, child, tmp) {
+		HASH_DEL(node->children, child);
+		uri_node_cleanup(child);
+		free(child->component);
+		free(child);
+	}
+
+	node->downloaded = false;
+}
+
+void
+rsync_destroy(struct uri_list *list)
+{
+	uri_node_cleanup(&list->downloaded);
+	uri_slist_cleanup(&list->downloading);
+	pthread_mutex_destroy(&list->lock);
+	pthread_cond_destroy(&list->cond);
 	free(list);
 }
 
 /*
- * Returns true if @ancestor an ancestor of @descendant, or @descendant itself.
- * Returns false otherwise.
+ * Returns true if @ancestor's path is a prefix of @descendant's path, or both
+ * are the same.
  */
 static bool
-is_descendant(struct rpki_uri *ancestor, struct rpki_uri *descendant)
+is_path_prefix(struct rpki_uri *ancestor, struct rpki_uri *descendant)
 {
 	struct string_tokenizer ancestor_tokenizer;
 	struct string_tokenizer descendant_tokenizer;
@@ -69,10 +148,6 @@ is_descendant(struct rpki_uri *ancestor, struct rpki_uri *descendant)
 	string_tokenizer_init(&descendant_tokenizer, uri_get_global(descendant),
 	    uri_get_global_len(descendant), '/');
 
-	if (config_get_rsync_strategy() == RSYNC_STRICT)
-		return strcmp(uri_get_global(ancestor),
-		    uri_get_global(descendant)) == 0;
-
 	do {
 		if (!string_tokenizer_next(&ancestor_tokenizer))
 			return true;
@@ -83,25 +158,72 @@ is_descendant(struct rpki_uri *ancestor, struct rpki_uri *descendant)
 	} while (true);
 }
 
+/*
+ * Returns true if @ancestor an ancestor of @descendant, or @descendant itself.
+ * Returns false otherwise.
+ */
+static bool
+is_descendant(struct rpki_uri *ancestor, struct rpki_uri *descendant)
+{
+	if (config_get_rsync_strategy() == RSYNC_STRICT)
+		return strcmp(uri_get_global(ancestor),
+		    uri_get_global(descendant)) == 0;
+
+	return is_path_prefix(ancestor, descendant);
+}
+
 /*
  * Returns whether @uri has already been rsync'd during the current validation
- * run.
+ * run. Call with @visited_uris->lock held.
+ *
+ * Same as is_descendant() against every downloaded URI, except RSYNC_STRICT
+ * doesn't tell "rsync://a/b" and "rsync://a/b/" apart. (They're the same
+ * directory.)
  */
 static bool
 is_already_downloaded(struct rpki_uri *uri, struct uri_list *visited_uris)
+{
+	struct string_tokenizer tokenizer;
+	struct uri_node *node, *child;
+	bool strict;
+
+	strict = config_get_rsync_strategy() == RSYNC_STRICT;
+	node = &visited_uris->downloaded;
+
+	string_tokenizer_init(&tokenizer, uri_get_global(uri),
+	    uri_get_global_len(uri), '/');
+	while (string_tokenizer_next(&tokenizer)) {
+		if (!strict && node->downloaded)
+			return true;
+		HASH_FIND(hh, node->children, tokenizer.str + tokenizer.start,
+		    tokenizer.end - tokenizer.start, child);
+		if (child == NULL)
+			return false;
+		node = child;
+	}
+
+	return node->downloaded;
+}
+
+/*
+ * Returns whether some other worker is currently rsync'ing a directory that
+ * contains, or is contained by, @uri's. Call with @visited_uris->lock held.
+ */
+static bool
+is_being_downloaded(struct rpki_uri *uri, struct uri_list *visited_uris)
 {
 	struct uri *cursor;
 
-	/* TODO (next iteration) this is begging for a radix trie. */
-	SLIST_FOREACH(cursor, visited_uris, next)
-		if (is_descendant(cursor->uri, uri))
+	SLIST_FOREACH(cursor, &visited_uris->downloading, next)
+		if (is_path_prefix(cursor->uri, uri)
+		    || is_path_prefix(uri, cursor->uri))
 			return true;
 
 	return false;
 }
 
 static int
-mark_as_downloaded(struct rpki_uri *uri, struct uri_list *visited_uris)
+uri_slist_add(struct uri_slist *list, struct rpki_uri *uri)
 {
 	struct uri *node;
 
@@ -112,11 +234,129 @@ mark_as_downloaded(struct rpki_uri *uri, struct uri_list *visited_uris)
 	node->uri = uri;
 	uri_refget(uri);
 
-	SLIST_INSERT_HEAD(visited_uris, node, next);
+	SLIST_INSERT_HEAD(list, node, next);
+
+	return 0;
+}
+
+static int
+uri_node_add_child(struct uri_node *parent, char const *component, size_t len,
+    struct uri_node **result)
+{
+	struct uri_node *child;
+
+	child = malloc(sizeof(struct uri_node));
+	if (child == NULL)
+		return pr_enomem();
+
+	child->component = malloc(len + 1);
+	if (child->component == NULL) {
+		free(child);
+		return pr_enomem();
+	}
+	memcpy(child->component, component, len);
+	child->component[len] = '\0';
+	child->downloaded = false;
+	child->children = NULL;
+
+	errno = 0;
+	HASH_ADD_KEYPTR(hh, parent->children, child->component, len, child);
+	if (errno) {
+		free(child->component);
+		free(child);
+		return pr_enomem();
+	}
+
+	*result = child;
+	return 0;
+}
+
+static int
+mark_as_downloaded(struct rpki_uri *uri, struct uri_list *visited_uris)
+{
+	struct string_tokenizer tokenizer;
+	struct uri_node *node, *child;
+	char const *component;
+	size_t len;
+	int error;
+
+	node = &visited_uris->downloaded;
+
+	string_tokenizer_init(&tokenizer, uri_get_global(uri),
+	    uri_get_global_len(uri), '/');
+	while (string_tokenizer_next(&tokenizer)) {
+		component = tokenizer.str + tokenizer.start;
+		len = tokenizer.end - tokenizer.start;
+
+		HASH_FIND(hh, node->children, component, len, child);
+		if (child == NULL) {
+			error = uri_node_add_child(node, component, len,
+			    &child);
+			if (error)
+				return error;
+		}
+		node = child;
+	}
 
+	node->downloaded = true;
 	return 0;
 }
 
+/*
+ * Forgets that @uri, and everything below it, was rsync'd. Unless the strategy
+ * is RSYNC_STRICT, the ancestors that contain it are forgotten as well, since
+ * they would otherwise still count as having downloaded @uri.
+ */
+static void
+unmark_as_downloaded(struct rpki_uri *uri, struct uri_list *visited_uris)
+{
+	struct string_tokenizer tokenizer;
+	struct uri_node *parent, *node;
+	bool strict;
+
+	strict = config_get_rsync_strategy() == RSYNC_STRICT;
+	parent = NULL;
+	node = &visited_uris->downloaded;
+
+	string_tokenizer_init(&tokenizer, uri_get_global(uri),
+	    uri_get_global_len(uri), '/');
+	while (string_tokenizer_next(&tokenizer)) {
+		if (!strict)
+			node->downloaded = false;
+		parent = node;
+		HASH_FIND(hh, parent->children, tokenizer.str + tokenizer.start,
+		    tokenizer.end - tokenizer.start, node);
+		if (node == NULL)
+			return;
+	}
+
+	uri_node_cleanup(node);
+	if (parent != NULL) {
+		HASH_DEL(parent->children, node);
+		free(node->component);
+		free(node);
+	}
+}
+
+/* Removes @uri from the running rsyncs, and wakes up whoever waits for it. */
+static void
+unmark_as_downloading(struct rpki_uri *uri, struct uri_list *visited_uris)
+{
+	struct uri *cursor;
+
+	SLIST_FOREACH(cursor, &visited_uris->downloading, next) {
+		if (cursor->uri == uri) {
+			SLIST_REMOVE(&visited_uris->downloading, cursor, uri,
+			    next);
+			uri_refput(cursor->uri);
+			free(cursor);
+			break;
+		}
+	}
+
+	pthread_cond_broadcast(&visited_uris->cond);
+}
+
 static int
 handle_strict_strategy(struct rpki_uri *requested_uri,
     struct rpki_uri **rsync_uri)
@@ -126,26 +366,40 @@ handle_strict_strategy(struct rpki_uri *requested_uri,
 	return 0;
 }
 
-static int
-handle_root_strategy(struct rpki_uri *src, struct rpki_uri **dst)
+/* Returns the length of the "rsync://<host>/<module>" prefix of @uri. */
+static size_t
+get_module_len(struct rpki_uri *uri)
 {
 	char const *global;
 	size_t global_len;
 	unsigned int slashes;
 	size_t i;
 
-	global = uri_get_global(src);
-	global_len = uri_get_global_len(src);
+	global = uri_get_global(uri);
+	global_len = uri_get_global_len(uri);
 	slashes = 0;
 
 	for (i = 0; i < global_len; i++) {
 		if (global[i] == '/') {
 			slashes++;
 			if (slashes == 4)
-				return uri_create_rsync_str(dst, global, i);
+				return i;
 		}
 	}
 
+	return global_len;
+}
+
+static int
+handle_root_strategy(struct rpki_uri *src, struct rpki_uri **dst)
+{
+	size_t module_len;
+
+	module_len = get_module_len(src);
+	if (module_len < uri_get_global_len(src))
+		return uri_create_rsync_str(dst, uri_get_global(src),
+		    module_len);
+
 	*dst = src;
 	uri_refget(src);
 	return 0;
@@ -546,15 +800,8 @@ check_ancestor_error(struct rpki_uri *requested_uri)
 	return 0;
 }
 
-/**
- * @is_ta: Are we rsync'ing the TA?
- * The TA rsync will not be recursive, and will force SYNC_STRICT
- * (unless the strategy has been set to SYNC_OFF.)
- * Why? Because we should probably not trust the repository until we've
- * validated the TA's public key.
- */
-int
-download_files(struct rpki_uri *requested_uri, bool is_ta, bool force)
+static int
+__download_files(struct rpki_uri *requested_uri, bool is_ta, bool force)
 {
 	/**
 	 * Note:
@@ -566,6 +813,7 @@ download_files(struct rpki_uri *requested_uri, bool is_ta, bool force)
 	struct uri_list *visited_uris;
 	struct rpki_uri *rsync_uri;
 	bool to_op_log;
+	double start;
 	int error;
 
 	if (!config_get_rsync_enabled())
@@ -577,12 +825,6 @@ download_files(struct rpki_uri *requested_uri, bool is_ta, bool force)
 
 	visited_uris = validation_rsync_visited_uris(state);
 
-	if (!force && is_already_downloaded(requested_uri, visited_uris)) {
-		pr_val_debug("No need to redownload '%s'.",
-		    uri_val_get_printable(requested_uri));
-		return check_ancestor_error(requested_uri);
-	}
-
 	if (!force)
 		error = get_rsync_uri(requested_uri, is_ta, &rsync_uri);
 	else {
@@ -595,10 +837,37 @@ download_files(struct rpki_uri *requested_uri, bool is_ta, bool force)
 	if (error)
 		return error;
 
+	pthread_mutex_lock(&visited_uris->lock);
+	do {
+		if (!force && is_already_downloaded(requested_uri,
+		    visited_uris)) {
+			pthread_mutex_unlock(&visited_uris->lock);
+			uri_refput(rsync_uri);
+			pr_val_debug("No need to redownload '%s'.",
+			    uri_val_get_printable(requested_uri));
+			return check_ancestor_error(requested_uri);
+		}
+		if (!is_being_downloaded(rsync_uri, visited_uris))
+			break;
+		pthread_cond_wait(&visited_uris->cond, &visited_uris->lock);
+	} while (true);
+
+	error = uri_slist_add(&visited_uris->downloading, rsync_uri);
+	pthread_mutex_unlock(&visited_uris->lock);
+	if (error) {
+		uri_refput(rsync_uri);
+		return error;
+	}
+
 	pr_val_debug("Going to RSYNC '%s'.", uri_val_get_printable(rsync_uri));
 
 	to_op_log = reqs_errors_log_uri(uri_get_global(rsync_uri));
+	start = metrics_now();
 	error = do_rsync(rsync_uri, is_ta, to_op_log);
+	metrics_fetch(MP_RSYNC, uri_get_global(rsync_uri),
+	    get_module_len(rsync_uri), metrics_now() - start, 0, error);
+
+	pthread_mutex_lock(&visited_uris->lock);
 	switch(error) {
 	case 0:
 		/* Don't store when "force" and if its already downloaded */
@@ -619,17 +888,47 @@ download_files(struct rpki_uri *requested_uri, bool is_ta, bool force)
 	default:
 		break;
 	}
+	unmark_as_downloading(rsync_uri, visited_uris);
+	pthread_mutex_unlock(&visited_uris->lock);
 
 	uri_refput(rsync_uri);
 	return error;
 }
 
+/**
+ * @is_ta: Are we rsync'ing the TA?
+ * The TA rsync will not be recursive, and will force SYNC_STRICT
+ * (unless the strategy has been set to SYNC_OFF.)
+ * Why? Because we should probably not trust the repository until we've
+ * validated the TA's public key.
+ *
+ * Several threads (of the same TAL or not) can call this at the same time. If
+ * one of them is already rsync'ing the requested directory (or an overlapping
+ * one), the others wait for it to finish rather than fetching it again.
+ */
+int
+download_files(struct rpki_uri *requested_uri, bool is_ta, bool force)
+{
+	struct trace_span span;
+	int error;
+
+	trace_begin(&span, "download_files");
+	error = __download_files(requested_uri, is_ta, force);
+	trace_end(&span, uri_val_get_printable(requested_uri));
+
+	return error;
+}
+
+/*
+ * Forgets that the repository @uri was rsync'd during the current validation
+ * run, so falling back to it fetches it again. Other repositories are left
+ * alone; they are shared by all the TALs.
+ */
 void
-reset_downloaded(void)
+reset_downloaded(struct rpki_uri *uri)
 {
 	struct validation *state;
 	struct uri_list *list;
-	struct uri *uri;
 
 	state = state_retrieve();
 	if (state == NULL)
@@ -637,10 +936,31 @@ reset_downloaded(void)
 
 	list = validation_rsync_visited_uris(state);
 
-	while (!SLIST_EMPTY(list)) {
-		uri = SLIST_FIRST(list);
-		SLIST_REMOVE_HEAD(list, next);
-		uri_refput(uri->uri);
-		free(uri);
-	}
+	pthread_mutex_lock(&list->lock);
+	unmark_as_downloaded(uri, list);
+	pthread_mutex_unlock(&list->lock);
+}
+
+/*
+ * Returns whether @uri has already been rsync'd during the current validation
+ * run. (If it's still being rsync'd, it hasn't.)
+ */
+bool
+rsync_is_downloaded(struct rpki_uri *uri)
+{
+	struct validation *state;
+	struct uri_list *list;
+	bool result;
+
+	state = state_retrieve();
+	if (state == NULL)
+		return false;
+
+	list = validation_rsync_visited_uris(state);
+
+	pthread_mutex_lock(&list->lock);
+	result = is_already_downloaded(uri, list);
+	pthread_mutex_unlock(&list->lock);
+
+	return result;
 }
@@ -10,6 +10,7 @@ int download_files(struct rpki_uri *, bool, bool);
 int rsync_create(struct uri_list **);
 void rsync_destroy(struct uri_list *);
 
-void reset_downloaded(void);
+void reset_downloaded(struct rpki_uri *);
+bool rsync_is_downloaded(struct rpki_uri *);
 
 #endif /* SRC_RSYNC_RSYNC_H_ */
@@ -1,190 +1,506 @@
 #include "rtr/db/db_table.h"
 
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/types.h> /* AF_INET, AF_INET6 (needed in OpenBSD) */
 #include <sys/socket.h> /* AF_INET, AF_INET6 (needed in OpenBSD) */
-#include "data_structure/uthash_nonfatal.h"
+#include "log.h"
 
-struct hashable_roa {
-	struct vrp data;
-	UT_hash_handle hh;
-};
-
-struct hashable_key {
-	struct router_key data;
-	UT_hash_handle hh;
+/*
+ * Open addressing hash table of fixed-size entries.
+ *
+ * The entries themselves live in a dense array (@entries), so they can be
+ * iterated and copied without chasing pointers. @slots is the index: linear
+ * probing, power of two size, each slot holding an entry index plus one (zero
+ * means empty).
+ *
+ * Entries are hashed and compared as raw bytes, so they need to be canonical:
+ * padding and unused bytes must be zero.
+ *
+ * Append-only tables have no index: ft_add() just appends, so they can contain
+ * duplicates. They're meant to be merged by db_table_join().
+ */
+struct flat_table {
+	unsigned char *entries;
+	size_t entry_size;
+	unsigned int count;
+	unsigned int capacity; /* Of @entries */
+	uint32_t *slots;
+	unsigned int slot_count; /* Zero, or a power of two */
+	/* Are @entries in canonical order? (See db_table_sort().) */
+	bool sorted;
+	bool append_only;
 };
 
 struct db_table {
-	struct hashable_roa *roas;
-	struct hashable_key *router_keys;
+	struct flat_table roas; /* struct vrp */
+	struct flat_table router_keys; /* struct router_key */
+	/*
+	 * If @roas is sorted, this is the number of IPv4 VRPs. They precede
+	 * the IPv6 ones.
+	 */
+	unsigned int roas_v4;
 };
 
-struct db_table *
-db_table_create(void)
+/*
+ * Tables smaller than this are sorted and compared in a single thread; the
+ * second one wouldn't pay for itself.
+ */
+#define PARALLEL_THRESHOLD 16384
+
+#define FT_MIN_SLOTS 16
+
+static void
+ft_init(struct flat_table *table, size_t entry_size)
 {
-	struct db_table *table;
+	table->entries = NULL;
+	table->entry_size = entry_size;
+	table->count = 0;
+	table->capacity = 0;
+	table->slots = NULL;
+	table->slot_count = 0;
+	table->sorted = true;
+	table->append_only = false;
+}
 
-	table = malloc(sizeof(struct db_table));
-	if (table == NULL)
-		return NULL;
+static void
+ft_cleanup(struct flat_table *table)
+{
+	free(table->entries);
+	free(table->slots);
+}
 
-	table->roas = NULL;
-	table->router_keys = NULL;
-	return table;
+static void *
+ft_entry(struct flat_table const *table, unsigned int index)
+{
+	return table->entries + index * table->entry_size;
 }
 
-void
-db_table_destroy(struct db_table *table)
+/* FNV-1a, plus a final mix, because only the lowest bits are used. */
+static uint32_t
+ft_hash(struct flat_table const *table, void const *entry)
 {
-	struct hashable_roa *node;
-	struct hashable_roa *tmp;
-	struct hashable_key *node_key;
-	struct hashable_key *tmp_key;
+	unsigned char const *bytes = entry;
+	uint32_t hash;
+	size_t i;
+
+	hash = 2166136261u;
+	for (i = 0; i < table->entry_size; i++)
+		hash = (hash ^ bytes[i]) * 16777619u;
+
+	hash ^= hash >> 16;
+	hash *= 0x85EBCA6Bu;
+	hash ^= hash >> 13;
+	hash *= 0xC2B2AE35u;
+	hash ^= hash >> 16;
+	return hash;
+}
 
-	HASH_ITER(hh, table->roas, node, tmp) {
-		HASH_DEL(table->roas, node);
-		free(node);
+/*
+ * Returns the slot where @entry is indexed, or the empty slot where it would
+ * be indexed if it were added.
+ * @table->slot_count must not be zero.
+ */
+static unsigned int
+ft_find_slot(struct flat_table const *table, void const *entry)
+{
+	unsigned int mask;
+	unsigned int slot;
+
+	mask = table->slot_count - 1;
+	slot = ft_hash(table, entry) & mask;
+	while (table->slots[slot] != 0) {
+		if (memcmp(ft_entry(table, table->slots[slot] - 1), entry,
+		    table->entry_size) == 0)
+			break;
+		slot = (slot + 1) & mask;
 	}
 
-	HASH_ITER(hh, table->router_keys, node_key, tmp_key) {
-		HASH_DEL(table->router_keys, node_key);
-		free(node_key);
+	return slot;
+}
+
+/* @slots must be zeroed. */
+static void
+ft_index(struct flat_table const *table, uint32_t *slots,
+    unsigned int slot_count)
+{
+	unsigned int mask;
+	unsigned int slot;
+	unsigned int i;
+
+	/* The entries are already known to be unique; no comparisons needed */
+	mask = slot_count - 1;
+	for (i = 0; i < table->count; i++) {
+		slot = ft_hash(table, ft_entry(table, i)) & mask;
+		while (slots[slot] != 0)
+			slot = (slot + 1) & mask;
+		slots[slot] = i + 1;
 	}
+}
 
-	free(table);
+static int
+ft_resize_slots(struct flat_table *table, unsigned int slot_count)
+{
+	uint32_t *slots;
+
+	slots = calloc(slot_count, sizeof(uint32_t));
+	if (slots == NULL)
+		return pr_enomem();
+
+	ft_index(table, slots, slot_count);
+
+	free(table->slots);
+	table->slots = slots;
+	table->slot_count = slot_count;
+	return 0;
 }
 
-int
-db_table_foreach_roa(struct db_table *table, vrp_foreach_cb cb, void *arg)
+/* Rebuilds the index, after the entries were moved around. */
+static void
+ft_reindex(struct flat_table *table)
+{
+	if (table->slot_count == 0)
+		return;
+
+	memset(table->slots, 0, table->slot_count * sizeof(uint32_t));
+	ft_index(table, table->slots, table->slot_count);
+}
+
+static int
+ft_reserve(struct flat_table *table, unsigned int capacity)
+{
+	unsigned char *entries;
+
+	if (capacity <= table->capacity)
+		return 0;
+
+	entries = realloc(table->entries, capacity * table->entry_size);
+	if (entries == NULL)
+		return pr_enomem();
+
+	table->entries = entries;
+	table->capacity = capacity;
+	return 0;
+}
+
+/* Adds a copy of @entry to the end of @table->entries, without indexing it. */
+static int
+ft_append(struct flat_table *table, void const *entry)
 {
-	struct hashable_roa *node, *tmp;
 	int error;
 
-	HASH_ITER(hh, table->roas, node, tmp) {
-		error = cb(&node->data, arg);
+	if (table->count == table->capacity) {
+		error = ft_reserve(table,
+		    (table->capacity != 0) ? (2 * table->capacity) : 8);
 		if (error)
 			return error;
 	}
 
+	memcpy(ft_entry(table, table->count), entry, table->entry_size);
+	table->count++;
+	table->sorted = false;
 	return 0;
 }
 
-int
-db_table_foreach_router_key(struct db_table *table, router_key_foreach_cb cb,
-    void *arg)
+/*
+ * Adds a copy of @entry to @table, unless it's already there.
+ * (Append-only tables don't check.)
+ */
+static int
+ft_add(struct flat_table *table, void const *entry)
 {
-	struct hashable_key *node, *tmp;
+	unsigned int slot;
 	int error;
 
-	HASH_ITER(hh, table->router_keys, node, tmp) {
-		error = cb(&node->data, arg);
+	if (table->append_only)
+		return ft_append(table, entry);
+
+	/* Keep the load factor below 3/4; probe sequences get long after that */
+	if (4 * (table->count + 1) > 3 * table->slot_count) {
+		error = ft_resize_slots(table, (table->slot_count != 0)
+		    ? (2 * table->slot_count)
+		    : FT_MIN_SLOTS);
 		if (error)
 			return error;
 	}
 
+	slot = ft_find_slot(table, entry);
+	if (table->slots[slot] != 0)
+		return 0;
+
+	error = ft_append(table, entry);
+	if (error)
+		return error;
+
+	table->slots[slot] = table->count;
 	return 0;
 }
 
-static struct hashable_roa *
-create_roa(uint32_t asn, uint8_t max_length)
+/* Appends the entries of @src to @dst, which needs to have room for them. */
+static void
+ft_concat(struct flat_table *dst, struct flat_table const *src)
 {
-	struct hashable_roa *roa;
+	if (src->count == 0)
+		return;
 
-	roa = malloc(sizeof(struct hashable_roa));
-	if (roa == NULL)
-		return NULL;
-	/* Needed by uthash */
-	memset(roa, 0, sizeof(struct hashable_roa));
-
-	roa->data.asn = asn;
-	roa->data.max_prefix_length = max_length;
-
-	return roa;
+	memcpy(ft_entry(dst, dst->count), src->entries,
+	    src->count * src->entry_size);
+	dst->count += src->count;
+	dst->sorted = false;
 }
 
+/* Indexes the entries of a table that has no index yet. */
 static int
-add_roa(struct db_table *table, struct hashable_roa *new)
+ft_build_index(struct flat_table *table)
 {
-	struct hashable_roa *old;
+	unsigned int slot_count;
 
-	errno = 0;
-	HASH_REPLACE(hh, table->roas, data, sizeof(new->data), new, old);
-	if (errno)
-		return -pr_val_errno(errno, "ROA couldn't be added to hash table");
-	if (old != NULL)
-		free(old);
+	slot_count = FT_MIN_SLOTS;
+	while (4 * table->count > 3 * slot_count)
+		slot_count *= 2;
 
-	return 0;
+	return ft_resize_slots(table, slot_count);
 }
 
+/*
+ * Removes @entry from @table, if it's there.
+ *
+ * The last entry is moved into the hole, so iterations that want to remove the
+ * current entry must run backwards.
+ */
+static void
+ft_remove(struct flat_table *table, void const *entry)
+{
+	unsigned int mask;
+	unsigned int hole;
+	unsigned int slot;
+	unsigned int home;
+	unsigned int index;
+	unsigned int last;
+
+	if (table->count == 0)
+		return;
+
+	hole = ft_find_slot(table, entry);
+	if (table->slots[hole] == 0)
+		return;
+	index = table->slots[hole] - 1;
+
+	/*
+	 * Backward shift deletion: pull back the following entries of the
+	 * probe sequence, so no tombstones are needed.
+	 */
+	mask = table->slot_count - 1;
+	slot = hole;
+	while (true) {
+		slot = (slot + 1) & mask;
+		if (table->slots[slot] == 0)
+			break;
+		home = ft_hash(table, ft_entry(table, table->slots[slot] - 1))
+		    & mask;
+		/* Can't move it if its home is cyclically within (hole, slot] */
+		if ((hole < slot) ? (hole < home && home <= slot)
+		                  : (hole < home || home <= slot))
+			continue;
+		table->slots[hole] = table->slots[slot];
+		hole = slot;
+	}
+	table->slots[hole] = 0;
+
+	/* Now fill the hole in the dense array with the last entry */
+	last = table->count - 1;
+	if (index != last) {
+		slot = ft_find_slot(table, ft_entry(table, last));
+		table->slots[slot] = index + 1;
+		memcpy(ft_entry(table, index), ft_entry(table, last),
+		    table->entry_size);
+	}
+	table->count--;
+	/*
+	 * Even if the order survived, whatever was computed out of it (such as
+	 * db_table's @roas_v4) didn't.
+	 */
+	table->sorted = false;
+}
+
+/* Adds the entries from @src that are not already in @dst. */
 static int
-add_router_key(struct db_table *table, struct hashable_key *new)
+ft_merge(struct flat_table *dst, struct flat_table const *src)
 {
-	struct hashable_key *old;
+	unsigned int i;
+	int error;
 
-	errno = 0;
-	HASH_REPLACE(hh, table->router_keys, data, sizeof(new->data), new, old);
-	if (errno)
-		return -pr_val_errno(errno, "Router Key couldn't be added to hash table");
-	if (old != NULL)
-		free(old);
+	if (src->count == 0)
+		return 0;
+
+	/* Short circuit: an empty table can simply become a copy of @src */
+	if (dst->count == 0) {
+		ft_cleanup(dst);
+		ft_init(dst, src->entry_size);
+
+		dst->entries = malloc(src->count * src->entry_size);
+		if (dst->entries == NULL)
+			return pr_enomem();
+		dst->slots = malloc(src->slot_count * sizeof(uint32_t));
+		if (dst->slots == NULL) {
+			free(dst->entries);
+			dst->entries = NULL;
+			return pr_enomem();
+		}
+
+		memcpy(dst->entries, src->entries,
+		    src->count * src->entry_size);
+		memcpy(dst->slots, src->slots,
+		    src->slot_count * sizeof(uint32_t));
+		dst->count = src->count;
+		dst->capacity = src->count;
+		dst->slot_count = src->slot_count;
+		dst->sorted = src->sorted;
+		return 0;
+	}
+
+	for (i = 0; i < src->count; i++) {
+		error = ft_add(dst, ft_entry(src, i));
+		if (error)
+			return error;
+	}
 
 	return 0;
 }
 
-static int
-duplicate_roa(struct db_table *dst, struct hashable_roa *new)
+/* Copies @vrp into @key, leaving the bytes it doesn't use clean. */
+static void
+vrp_canonicalize(struct vrp const *vrp, struct vrp *key)
 {
-	struct vrp vrp;
-	struct ipv4_prefix prefix4;
-	struct ipv6_prefix prefix6;
-
-	vrp = new->data;
-	switch (vrp.addr_fam) {
+	memset(key, 0, sizeof(*key));
+	key->asn = vrp->asn;
+	switch (vrp->addr_fam) {
 	case AF_INET:
-		prefix4.addr = vrp.prefix.v4;
-		prefix4.len = vrp.prefix_length;
-		return rtrhandler_handle_roa_v4(dst, vrp.asn, &prefix4,
-		    vrp.max_prefix_length);
+		key->prefix.v4 = vrp->prefix.v4;
+		break;
 	case AF_INET6:
-		prefix6.addr = vrp.prefix.v6;
-		prefix6.len = vrp.prefix_length;
-		return rtrhandler_handle_roa_v6(dst, vrp.asn, &prefix6,
-		    vrp.max_prefix_length);
+		key->prefix.v6 = vrp->prefix.v6;
+		break;
 	}
+	key->prefix_length = vrp->prefix_length;
+	key->max_prefix_length = vrp->max_prefix_length;
+	key->addr_fam = vrp->addr_fam;
+}
 
-	pr_crit("Unknown address family: %d", vrp.addr_fam);
+static void
+router_key_canonicalize(struct router_key const *router_key,
+    struct router_key *key)
+{
+	memset(key, 0, sizeof(*key));
+	router_key_init(key, router_key->ski, router_key->as, router_key->spk);
 }
 
-static int
-duplicate_key(struct db_table *dst, struct hashable_key *new)
-{
-	return rtrhandler_handle_router_key(dst, new->data.ski, new->data.as,
-	    new->data.spk);
-}
-
-#define MERGE_ITER(table_prop, name, err_var)				\
-	struct hashable_##name *node_##name, *tmp_##name, *found_##name;\
-	HASH_ITER(hh, src->table_prop, node_##name, tmp_##name) {	\
-		HASH_FIND(hh, dst->table_prop, &node_##name->data,	\
-			sizeof(node_##name->data), found_##name);	\
-		if (found_##name != NULL)				\
-			continue;					\
-		err_var = duplicate_##name(dst, node_##name);		\
-		if (err_var)						\
-			return err_var;					\
+struct db_table *
+db_table_create(void)
+{
+	struct db_table *table;
+
+	table = malloc(sizeof(struct db_table));
+	if (table == NULL)
+		return NULL;
+
+	ft_init(&table->roas, sizeof(struct vrp));
+	ft_init(&table->router_keys, sizeof(struct router_key));
+	table->roas_v4 = 0;
+	return table;
+}
+
+/*
+ * Creates an append-only table: it doesn't look for duplicates, so adding to it
+ * is cheap. It can only be iterated, or merged into a proper table by
+ * db_table_join().
+ */
+struct db_table *
+db_table_create_buffer(void)
+{
+	struct db_table *table;
+
+	table = db_table_create();
+	if (table == NULL)
+		return NULL;
+
+	table->roas.append_only = true;
+	table->router_keys.append_only = true;
+	return table;
+}
+
+void
+db_table_destroy(struct db_table *table)
+{
+	ft_cleanup(&table->roas);
+	ft_cleanup(&table->router_keys);
+	free(table);
+}
+
+/*
+ * @cb is allowed to remove the VRP it receives from @table.
+ * (Which is why this iterates backwards.)
+ */
+int
+db_table_foreach_roa(struct db_table *table, vrp_foreach_cb cb, void *arg)
+{
+	unsigned int i;
+	int error;
+
+	for (i = table->roas.count; i > 0; i--) {
+		error = cb(ft_entry(&table->roas, i - 1), arg);
+		if (error)
+			return error;
+	}
+
+	return 0;
+}
+
+/* Same as db_table_foreach_roa(). */
+int
+db_table_foreach_router_key(struct db_table *table, router_key_foreach_cb cb,
+    void *arg)
+{
+	unsigned int i;
+	int error;
+
+	for (i = table->router_keys.count; i > 0; i--) {
+		error = cb(ft_entry(&table->router_keys, i - 1), arg);
+		if (error)
+			return error;
 	}
 
+	return 0;
+}
+
+/* Assumes @roas is sorted. */
+static unsigned int
+count_roas_v4(struct flat_table const *roas)
+{
+	struct vrp const *vrps;
+	unsigned int i;
+
+	vrps = (struct vrp const *)roas->entries;
+	for (i = 0; i < roas->count; i++)
+		if (vrps[i].addr_fam != AF_INET)
+			break;
+
+	return i;
+}
+
 static int
 db_table_merge(struct db_table *dst, struct db_table *src)
 {
 	int error;
 
-	/** Must look for elements due to the new mem allocation */
-	MERGE_ITER(roas, roa, error)
-	MERGE_ITER(router_keys, key, error)
+	error = ft_merge(&dst->roas, &src->roas);
+	if (error)
+		return error;
+	dst->roas_v4 = dst->roas.sorted ? count_roas_v4(&dst->roas) : 0;
 
-	return 0;
+	return ft_merge(&dst->router_keys, &src->router_keys);
 }
 
 int
@@ -210,212 +526,467 @@ db_table_clone(struct db_table **dst, struct db_table *src)
 unsigned int
 db_table_roa_count(struct db_table *table)
 {
-	return HASH_COUNT(table->roas);
+	return table->roas.count;
 }
 
 unsigned int
 db_table_router_key_count(struct db_table *table)
 {
-	return HASH_COUNT(table->router_keys);
+	return table->router_keys.count;
 }
 
 void
 db_table_remove_roa(struct db_table *table, struct vrp const *del)
 {
-	struct hashable_roa *ptr;
+	struct vrp key;
 
-	HASH_FIND(hh, table->roas, del, sizeof(*del), ptr);
-	if (ptr != NULL) {
-		HASH_DELETE(hh, table->roas, ptr);
-		free(ptr);
-	}
+	vrp_canonicalize(del, &key);
+	ft_remove(&table->roas, &key);
 }
 
 void
 db_table_remove_router_key(struct db_table *table,
     struct router_key const *del)
 {
-	struct hashable_key *ptr;
+	struct router_key key;
 
-	HASH_FIND(hh, table->router_keys, del, sizeof(*del), ptr);
-	if (ptr != NULL) {
-		HASH_DELETE(hh, table->router_keys, ptr);
-		free(ptr);
-	}
+	router_key_canonicalize(del, &key);
+	ft_remove(&table->router_keys, &key);
 }
 
 int
 rtrhandler_handle_roa_v4(struct db_table *table, uint32_t asn,
     struct ipv4_prefix const *prefix4, uint8_t max_length)
 {
-	struct hashable_roa *roa;
-	int error;
+	struct vrp roa;
 
-	roa = create_roa(asn, max_length);
-	if (roa == NULL)
-		return pr_enomem();
-	roa->data.prefix.v4 = prefix4->addr;
-	roa->data.prefix_length = prefix4->len;
-	roa->data.addr_fam = AF_INET;
+	memset(&roa, 0, sizeof(roa));
+	roa.asn = asn;
+	roa.prefix.v4 = prefix4->addr;
+	roa.prefix_length = prefix4->len;
+	roa.max_prefix_length = max_length;
+	roa.addr_fam = AF_INET;
 
-	error = add_roa(table, roa);
-	if (error)
-		free(roa);
-	return error;
+	return ft_add(&table->roas, &roa);
 }
 
 int
 rtrhandler_handle_roa_v6(struct db_table *table, uint32_t asn,
     struct ipv6_prefix const *prefix6, uint8_t max_length)
 {
-	struct hashable_roa *roa;
-	int error;
+	struct vrp roa;
 
-	roa = create_roa(asn, max_length);
-	if (roa == NULL)
-		return pr_enomem();
-	roa->data.prefix.v6 = prefix6->addr;
-	roa->data.prefix_length = prefix6->len;
-	roa->data.addr_fam = AF_INET6;
+	memset(&roa, 0, sizeof(roa));
+	roa.asn = asn;
+	roa.prefix.v6 = prefix6->addr;
+	roa.prefix_length = prefix6->len;
+	roa.max_prefix_length = max_length;
+	roa.addr_fam = AF_INET6;
 
-	error = add_roa(table, roa);
-	if (error)
-		free(roa);
-	return error;
+	return ft_add(&table->roas, &roa);
 }
 
 int
 rtrhandler_handle_router_key(struct db_table *table,
     unsigned char const *ski, uint32_t as, unsigned char const *spk)
 {
-	struct hashable_key *key;
+	struct router_key key;
+
+	memset(&key, 0, sizeof(key));
+	router_key_init(&key, ski, as, spk);
+
+	return ft_add(&table->router_keys, &key);
+}
+
+/* Canonical order. Any will do, as long as everyone agrees. */
+static int
+vrp_cmp(void const *a, void const *b)
+{
+	return memcmp(a, b, sizeof(struct vrp));
+}
+
+static int
+router_key_cmp(void const *a, void const *b)
+{
+	return memcmp(a, b, sizeof(struct router_key));
+}
+
+/*
+ * Runs @cb(@arg1) in a new thread, and @cb(@arg2) in the current one.
+ * Both run in the current thread if the new one can't be created.
+ */
+static void
+run_in_parallel(void *(*cb)(void *), void *arg1, void *arg2)
+{
+	pthread_t thread;
 	int error;
 
-	key = malloc(sizeof(struct hashable_key));
-	if (key == NULL)
+	error = pthread_create(&thread, NULL, cb, arg1);
+	if (error) {
+		pr_op_debug("Could not spawn a thread (%s); working sequentially.",
+		    strerror(error));
+		cb(arg1);
+		cb(arg2);
+		return;
+	}
+
+	cb(arg2);
+
+	error = pthread_join(thread, NULL);
+	if (error)
+		pr_crit("pthread_join() threw %d: %s", error, strerror(error));
+}
+
+/*
+ * Removes the duplicates from the sorted array @entries, which has @len
+ * elements of @size bytes. Returns the new length.
+ */
+static unsigned int
+remove_duplicates(unsigned char *entries, unsigned int len, size_t size)
+{
+	unsigned int last;
+	unsigned int i;
+
+	if (len == 0)
+		return 0;
+
+	last = 0;
+	for (i = 1; i < len; i++) {
+		if (memcmp(entries + last * size, entries + i * size, size) == 0)
+			continue;
+		last++;
+		if (last != i)
+			memcpy(entries + last * size, entries + i * size, size);
+	}
+
+	return last + 1;
+}
+
+struct vrp_range {
+	struct vrp *vrps;
+	unsigned int len;
+	/* Remove the duplicates after sorting? (Updates @len.) */
+	bool unique;
+};
+
+static void *
+sort_vrp_range(void *arg)
+{
+	struct vrp_range *range = arg;
+
+	qsort(range->vrps, range->len, sizeof(struct vrp), vrp_cmp);
+	if (range->unique)
+		range->len = remove_duplicates((unsigned char *)range->vrps,
+		    range->len, sizeof(struct vrp));
+
+	return NULL;
+}
+
+/* Moves the IPv4 VRPs to the beginning. Returns how many there are. */
+static unsigned int
+partition_roas(struct flat_table *roas)
+{
+	struct vrp *vrps;
+	struct vrp tmp;
+	unsigned int left;
+	unsigned int right;
+
+	vrps = (struct vrp *)roas->entries;
+	left = 0;
+	right = roas->count;
+	while (true) {
+		while (left < right && vrps[left].addr_fam == AF_INET)
+			left++;
+		while (left < right && vrps[right - 1].addr_fam != AF_INET)
+			right--;
+		if (left >= right)
+			return left;
+
+		tmp = vrps[left];
+		vrps[left] = vrps[right - 1];
+		vrps[right - 1] = tmp;
+	}
+}
+
+/* See db_table_sort(). If @unique, also removes the duplicates. */
+static void
+sort_table(struct db_table *table, bool unique)
+{
+	struct vrp_range v4, v6;
+
+	if (!table->roas.sorted) {
+		table->roas_v4 = partition_roas(&table->roas);
+
+		v4.vrps = (struct vrp *)table->roas.entries;
+		v4.len = table->roas_v4;
+		v4.unique = unique;
+		v6.vrps = v4.vrps + v4.len;
+		v6.len = table->roas.count - v4.len;
+		v6.unique = unique;
+
+		if (table->roas.count >= PARALLEL_THRESHOLD) {
+			run_in_parallel(sort_vrp_range, &v6, &v4);
+		} else {
+			sort_vrp_range(&v4);
+			sort_vrp_range(&v6);
+		}
+
+		/* Close the gap left by the IPv4 duplicates */
+		if (v4.len != table->roas_v4)
+			memmove(v4.vrps + v4.len, v6.vrps,
+			    v6.len * sizeof(struct vrp));
+		table->roas_v4 = v4.len;
+		table->roas.count = v4.len + v6.len;
+
+		ft_reindex(&table->roas);
+		table->roas.sorted = true;
+	}
+
+	if (!table->router_keys.sorted) {
+		qsort(table->router_keys.entries, table->router_keys.count,
+		    sizeof(struct router_key), router_key_cmp);
+		if (unique)
+			table->router_keys.count = remove_duplicates(
+			    table->router_keys.entries,
+			    table->router_keys.count,
+			    sizeof(struct router_key));
+		ft_reindex(&table->router_keys);
+		table->router_keys.sorted = true;
+	}
+}
+
+/*
+ * Puts the table's entries in canonical order: IPv4 VRPs, then IPv6 VRPs, each
+ * group sorted bytewise. (Router Keys are sorted separately.)
+ *
+ * The iteration order is the only visible effect, so the tables that are shared
+ * with other threads are expected to be sorted before being published.
+ */
+void
+db_table_sort(struct db_table *table)
+{
+	sort_table(table, false);
+}
+
+/*
+ * Merges the append-only @buffers (see db_table_create_buffer()) into a new
+ * table, which will be sorted and free of duplicates.
+ *
+ * Sorting the concatenation is cheaper than hashing every entry into a single
+ * table, and the IPv4 and IPv6 halves are sorted in parallel.
+ */
+int
+db_table_join(struct db_table **buffers, unsigned int count,
+    struct db_table **result)
+{
+	struct db_table *table;
+	unsigned int roas;
+	unsigned int router_keys;
+	unsigned int i;
+	int error;
+
+	table = db_table_create();
+	if (table == NULL)
 		return pr_enomem();
-	/* Needed by uthash */
-	memset(key, 0, sizeof(struct hashable_key));
 
-	router_key_init(&key->data, ski, as, spk);
+	roas = 0;
+	router_keys = 0;
+	for (i = 0; i < count; i++) {
+		roas += buffers[i]->roas.count;
+		router_keys += buffers[i]->router_keys.count;
+	}
 
-	error = add_router_key(table, key);
+	error = ft_reserve(&table->roas, roas);
+	if (error)
+		goto fail;
+	error = ft_reserve(&table->router_keys, router_keys);
 	if (error)
-		free(key);
+		goto fail;
 
+	for (i = 0; i < count; i++) {
+		ft_concat(&table->roas, &buffers[i]->roas);
+		ft_concat(&table->router_keys, &buffers[i]->router_keys);
+	}
+
+	sort_table(table, true);
+
+	error = ft_build_index(&table->roas);
+	if (error)
+		goto fail;
+	error = ft_build_index(&table->router_keys);
+	if (error)
+		goto fail;
+
+	*result = table;
+	return 0;
+
+fail:
+	db_table_destroy(table);
 	return error;
 }
 
 static int
-add_roa_delta(struct deltas *deltas, struct hashable_roa *roa, int op)
+add_roa_delta(struct deltas *deltas, struct vrp const *roa, int op)
 {
 	union {
 		struct v4_address v4;
 		struct v6_address v6;
 	} addr;
 
-	switch (roa->data.addr_fam) {
+	switch (roa->addr_fam) {
 	case AF_INET:
-		addr.v4.prefix.addr = roa->data.prefix.v4;
-		addr.v4.prefix.len = roa->data.prefix_length;
-		addr.v4.max_length = roa->data.max_prefix_length;
-		return deltas_add_roa_v4(deltas, roa->data.asn, &addr.v4, op);
+		addr.v4.prefix.addr = roa->prefix.v4;
+		addr.v4.prefix.len = roa->prefix_length;
+		addr.v4.max_length = roa->max_prefix_length;
+		return deltas_add_roa_v4(deltas, roa->asn, &addr.v4, op);
 	case AF_INET6:
-		addr.v6.prefix.addr = roa->data.prefix.v6;
-		addr.v6.prefix.len = roa->data.prefix_length;
-		addr.v6.max_length = roa->data.max_prefix_length;
-		return deltas_add_roa_v6(deltas, roa->data.asn, &addr.v6, op);
+		addr.v6.prefix.addr = roa->prefix.v6;
+		addr.v6.prefix.len = roa->prefix_length;
+		addr.v6.max_length = roa->max_prefix_length;
+		return deltas_add_roa_v6(deltas, roa->asn, &addr.v6, op);
 	}
 
-	pr_crit("Unknown address family: %d", roa->data.addr_fam);
+	pr_crit("Unknown address family: %d", roa->addr_fam);
 }
 
 /*
- * Copies `@roas1 - roas2` into @deltas.
- *
- * (Places the ROAs that exist in @roas1 but not in @roas2 in @deltas.)
+ * The VRPs of one address family, from both generations.
+ * IPv4 and IPv6 deltas are stored in separate arrays, so both families can be
+ * merged at the same time.
  */
-static int
-add_roa_deltas(struct hashable_roa *roas1, struct hashable_roa *roas2,
-    struct deltas *deltas, int op)
+struct roa_merge {
+	struct vrp_range old;
+	struct vrp_range new;
+	struct deltas *deltas;
+	int error;
+};
+
+/*
+ * Sorted merge: whatever is only in @old was withdrawn, and whatever is only in
+ * @new was announced.
+ */
+static void *
+merge_roas(void *arg)
 {
-	struct hashable_roa *n1; /* A node from @roas1 */
-	struct hashable_roa *n2; /* A node from @roas2 */
+	struct roa_merge *merge = arg;
+	struct vrp const *old = merge->old.vrps;
+	struct vrp const *new = merge->new.vrps;
+	unsigned int o, n;
+	int cmp;
 	int error;
 
-	for (n1 = roas1; n1 != NULL; n1 = n1->hh.next) {
-		HASH_FIND(hh, roas2, &n1->data, sizeof(n1->data), n2);
-		if (n2 == NULL) {
-			error = add_roa_delta(deltas, n1, op);
-			if (error)
-				return error;
+	o = 0;
+	n = 0;
+	error = 0;
+	while (!error && (o < merge->old.len || n < merge->new.len)) {
+		if (o == merge->old.len)
+			cmp = 1;
+		else if (n == merge->new.len)
+			cmp = -1;
+		else
+			cmp = vrp_cmp(&old[o], &new[n]);
+
+		if (cmp < 0) {
+			error = add_roa_delta(merge->deltas, &old[o++],
+			    FLAG_WITHDRAWAL);
+		} else if (cmp > 0) {
+			error = add_roa_delta(merge->deltas, &new[n++],
+			    FLAG_ANNOUNCEMENT);
+		} else {
+			o++;
+			n++;
 		}
 	}
 
-	return 0;
-}
-
-static int
-add_router_key_delta(struct deltas *deltas, struct hashable_key *key, int op)
-{
-	return deltas_add_router_key(deltas, &key->data, op);
+	merge->error = error;
+	return NULL;
 }
 
-/*
- * Copies `@keys1 - keys2` into @deltas.
- *
- * (Places the Router Keys that exist in @keys1 but not in @key2 in @deltas.)
- */
 static int
-add_router_key_deltas(struct hashable_key *keys1, struct hashable_key *keys2,
-    struct deltas *deltas, int op)
+merge_router_keys(struct flat_table *old, struct flat_table *new,
+    struct deltas *deltas)
 {
-	struct hashable_key *n1; /* A node from @keys1 */
-	struct hashable_key *n2; /* A node from @keys2 */
+	struct router_key *old_keys = (struct router_key *)old->entries;
+	struct router_key *new_keys = (struct router_key *)new->entries;
+	unsigned int o, n;
+	int cmp;
 	int error;
 
-	for (n1 = keys1; n1 != NULL; n1 = n1->hh.next) {
-		HASH_FIND(hh, keys2, &n1->data, sizeof(n1->data), n2);
-		if (n2 == NULL) {
-			error = add_router_key_delta(deltas, n1, op);
-			if (error)
-				return error;
+	o = 0;
+	n = 0;
+	error = 0;
+	while (!error && (o < old->count || n < new->count)) {
+		if (o == old->count)
+			cmp = 1;
+		else if (n == new->count)
+			cmp = -1;
+		else
+			cmp = router_key_cmp(&old_keys[o], &new_keys[n]);
+
+		if (cmp < 0) {
+			error = deltas_add_router_key(deltas, &old_keys[o++],
+			    FLAG_WITHDRAWAL);
+		} else if (cmp > 0) {
+			error = deltas_add_router_key(deltas, &new_keys[n++],
+			    FLAG_ANNOUNCEMENT);
+		} else {
+			o++;
+			n++;
 		}
 	}
 
-	return 0;
+	return error;
 }
 
+/*
+ * Both tables need to be sorted (see db_table_sort()). They will be sorted
+ * here otherwise, so don't hand over unsorted tables other threads might be
+ * reading.
+ */
 int
 compute_deltas(struct db_table *old, struct db_table *new,
     struct deltas **result)
 {
+	struct roa_merge v4, v6;
 	struct deltas *deltas;
 	int error;
 
+	db_table_sort(old);
+	db_table_sort(new);
+
 	error = deltas_create(&deltas);
 	if (error)
 		return error;
 
-	error = add_roa_deltas(new->roas, old->roas, deltas, FLAG_ANNOUNCEMENT);
-	if (error)
-		goto fail;
-	error = add_roa_deltas(old->roas, new->roas, deltas, FLAG_WITHDRAWAL);
-	if (error)
-		goto fail;
-	error = add_router_key_deltas(new->router_keys, old->router_keys,
-	    deltas, FLAG_ANNOUNCEMENT);
-	if (error)
-		goto fail;
-	error = add_router_key_deltas(old->router_keys, new->router_keys,
-	    deltas, FLAG_WITHDRAWAL);
-	if (error)
-		goto fail;
+	v4.old.vrps = (struct vrp *)old->roas.entries;
+	v4.old.len = old->roas_v4;
+	v4.new.vrps = (struct vrp *)new->roas.entries;
+	v4.new.len = new->roas_v4;
+	v4.deltas = deltas;
+	v6.old.vrps = v4.old.vrps + v4.old.len;
+	v6.old.len = old->roas.count - v4.old.len;
+	v6.new.vrps = v4.new.vrps + v4.new.len;
+	v6.new.len = new->roas.count - v4.new.len;
+	v6.deltas = deltas;
+
+	if (old->roas.count + new->roas.count >= PARALLEL_THRESHOLD) {
+		run_in_parallel(merge_roas, &v6, &v4);
+	} else {
+		merge_roas(&v4);
+		merge_roas(&v6);
+	}
+
+	error = v4.error;
+	if (!error)
+		error = v6.error;
+	if (!error)
+		error = merge_router_keys(&old->router_keys,
+		    &new->router_keys, deltas);
+	if (error) {
+		deltas_refput(deltas);
+		return error;
+	}
 
 	*result = deltas;
 	return 0;
-
-fail:
-	deltas_refput(deltas);
-	return error;
 }
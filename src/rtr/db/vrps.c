@@ -1,16 +1,26 @@
 #include "vrps.h"
 
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <string.h>
 #include <time.h>
 #include <sys/queue.h>
+#include <sys/types.h> /* AF_INET, AF_INET6 (needed in OpenBSD) */
+#include <sys/socket.h> /* AF_INET, AF_INET6 (needed in OpenBSD) */
 #include "clients.h"
 #include "common.h"
+#include "config.h"
+#include "metrics.h"
 #include "output_printer.h"
+#include "trace.h"
 #include "validation_handler.h"
 #include "data_structure/array_list.h"
 #include "object/router_key.h"
 #include "object/tal.h"
+#include "rtr/pdu.h"
+#include "rtr/pdu_stream.h"
+#include "data_structure/uthash_nonfatal.h"
 #include "rtr/db/db_table.h"
 #include "slurm/slurm_loader.h"
 
@@ -24,51 +34,122 @@
 DEFINE_ARRAY_LIST_FUNCTIONS(deltas_db, struct delta_group, )
 
 struct vrp_node {
+	/* @delta.vrp, without garbage in the unused bytes. Hash table key. */
+	struct vrp key;
 	struct delta_vrp delta;
-	SLIST_ENTRY(vrp_node) next;
+	UT_hash_handle hh;
 };
 
 struct rk_node {
+	/* Same as above. */
+	struct router_key key;
 	struct delta_router_key delta;
-	SLIST_ENTRY(rk_node) next;
+	UT_hash_handle hh;
 };
 
-/** Sorted list to filter deltas */
-SLIST_HEAD(vrp_slist, vrp_node);
-SLIST_HEAD(rk_slist, rk_node);
+/** Hash tables to filter deltas */
+struct filtered_deltas {
+	struct vrp_node *prefixes;
+	struct rk_node *router_keys;
+};
+
+/**
+ * The deltas from serial @from to serial @to, already filtered and serialized
+ * for RTR version @version.
+ */
+struct delta_pdus {
+	serial_t from;
+	serial_t to;
+	uint8_t version;
+	struct pdu_stream *stream;
+	SLIST_ENTRY(delta_pdus) next;
+};
+
+/*
+ * There are at most two entries (one per RTR version) per serial the routers
+ * are known to be lagging behind at, so a list is good enough.
+ */
+SLIST_HEAD(delta_pdus_cache, delta_pdus);
+
+/*
+ * Everything the RTR server needs to know about one serial. Immutable once
+ * published (except for @delta_pdus, which has its own lock), so readers don't
+ * need to lock anything; they just hold a reference while they work.
+ */
+struct generation {
+	/** All the valid ROAs and Router Keys of @serial. */
+	struct db_table *base;
+	serial_t serial;
+	/**
+	 * DB changes over time, up to @serial. Only the ones some router might
+	 * still need. (The deltas themselves are shared with the previous
+	 * generations.)
+	 */
+	struct deltas_db deltas;
+	/**
+	 * @base, already serialized as Prefix and Router Key PDUs. One per RTR
+	 * version, indexed by version number.
+	 */
+	struct pdu_stream *base_pdus[RTR_V1 + 1];
+	/**
+	 * Serial Query responses that have already been built. Filled lazily.
+	 * (They all lead to @serial, so they die with the generation.)
+	 */
+	struct delta_pdus_cache delta_pdus;
+	pthread_mutex_t delta_pdus_lock;
 
-struct sorted_lists {
-	struct vrp_slist prefixes;
-	struct rk_slist router_keys;
+	atomic_uint references;
 };
 
 struct state {
 	/**
-	 * All the current valid ROAs.
+	 * The current generation. Replaced as a whole on every update.
 	 *
 	 * Can be NULL, so handle gracefully.
-	 * (We use this to know we're supposed to generate a @deltas entry
-	 * during the current iteration.)
+	 * (Meaning the first validation hasn't finished yet.)
 	 */
-	struct db_table *base;
-	/** DB changes to @base over time. */
-	struct deltas_db deltas;
+	struct generation *_Atomic generation;
+	/**
+	 * Number of readers between their load of @generation and their
+	 * reference to it. The updater can't drop the old generation until
+	 * this goes down to zero.
+	 */
+	atomic_uint pinning;
 
-	/* Last valid SLURM applied to base */
+	/* Last valid SLURM applied to base. Only used by the updater. */
 	struct db_slurm *slurm;
 
-	serial_t next_serial;
+	/* Set during initialization, constant afterwards */
 	uint16_t v0_session_id;
 	uint16_t v1_session_id;
 };
 
 static struct state state;
 
-/** Read/write lock, which protects @state and its inhabitants. */
-static pthread_rwlock_t state_lock;
+/*
+ * The VRPs and Router Keys found during a validation cycle.
+ *
+ * Each validation thread appends the ones it finds to an append-only table of
+ * its own, so the threads never wait for each other. The tables are merged (and
+ * deduplicated) once the cycle ends.
+ */
+struct vrp_collector {
+	/* Tells this cycle's collector apart from the previous ones' */
+	unsigned int id;
+	/* One per thread */
+	struct db_table **buffers;
+	unsigned int count;
+	unsigned int capacity;
+	/* Guards @buffers; taken once per thread per cycle. */
+	pthread_mutex_t lock;
+};
+
+/* Last vrp_collector.id handed out */
+static unsigned int last_collector_id;
 
-/** Lock to protect ROA table during construction. */
-static pthread_rwlock_t table_lock;
+/* The calling thread's buffer, and the vrp_collector.id it belongs to. */
+static _Thread_local struct db_table *thread_buffer;
+static _Thread_local unsigned int thread_collector;
 
 void
 deltagroup_cleanup(struct delta_group *group)
@@ -82,22 +163,14 @@ vrps_init(void)
 	time_t now;
 	int error;
 
-	state.base = NULL;
-
-	deltas_db_init(&state.deltas);
-
-	/*
-	 * Use the same start serial, the session ID will avoid
-	 * "desynchronization" (more at RFC 6810 'Glossary' and
-	 * 'Fields of a PDU')
-	 */
-	state.next_serial = START_SERIAL;
+	atomic_init(&state.generation, NULL);
+	atomic_init(&state.pinning, 0);
 
 	/* Get the bits that'll fit in session_id */
 	now = 0;
 	error = get_current_time(&now);
 	if (error)
-		goto release_deltas;
+		return error;
 	state.v0_session_id = now & 0xFFFF;
 
 	/* Minus 1 to prevent same ID */
@@ -107,267 +180,441 @@ vrps_init(void)
 
 	state.slurm = NULL;
 
-	error = pthread_rwlock_init(&state_lock, NULL);
-	if (error) {
-		error = pr_op_errno(error, "state pthread_rwlock_init() errored");
-		goto release_deltas;
+	return 0;
+}
+
+static void
+base_pdus_release(struct pdu_stream **base_pdus)
+{
+	uint8_t version;
+
+	for (version = RTR_V0; version <= RTR_V1; version++) {
+		if (base_pdus[version] != NULL)
+			pdu_stream_refput(base_pdus[version]);
+		base_pdus[version] = NULL;
 	}
+}
+
+static void
+delta_pdus_flush(struct delta_pdus_cache *cache)
+{
+	struct delta_pdus *entry;
+
+	while (!SLIST_EMPTY(cache)) {
+		entry = SLIST_FIRST(cache);
+		SLIST_REMOVE_HEAD(cache, next);
+		pdu_stream_refput(entry->stream);
+		free(entry);
+	}
+}
+
+/* Takes ownership of @base. */
+static int
+generation_create(struct db_table *base, serial_t serial,
+    struct generation **result)
+{
+	struct generation *gen;
+	int error;
 
-	error = pthread_rwlock_init(&table_lock, NULL);
+	gen = malloc(sizeof(struct generation));
+	if (gen == NULL)
+		return pr_enomem();
+
+	error = pthread_mutex_init(&gen->delta_pdus_lock, NULL);
 	if (error) {
-		error = pr_op_errno(error, "table pthread_rwlock_init() errored");
-		goto release_state_lock;
+		free(gen);
+		return pr_op_errno(error, "pthread_mutex_init() errored");
 	}
 
+	gen->base = base;
+	gen->serial = serial;
+	deltas_db_init(&gen->deltas);
+	gen->base_pdus[RTR_V0] = NULL;
+	gen->base_pdus[RTR_V1] = NULL;
+	SLIST_INIT(&gen->delta_pdus);
+	atomic_init(&gen->references, 1);
+
+	*result = gen;
 	return 0;
-release_state_lock:
-	pthread_rwlock_destroy(&state_lock);
-release_deltas:
-	deltas_db_cleanup(&state.deltas, deltagroup_cleanup);
-	return error;
+}
+
+static void
+generation_refget(struct generation *gen)
+{
+	atomic_fetch_add(&gen->references, 1);
+}
+
+static void
+generation_refput(struct generation *gen)
+{
+	if (atomic_fetch_sub(&gen->references, 1) == 1) {
+		db_table_destroy(gen->base);
+		deltas_db_cleanup(&gen->deltas, deltagroup_cleanup);
+		base_pdus_release(gen->base_pdus);
+		delta_pdus_flush(&gen->delta_pdus);
+		pthread_mutex_destroy(&gen->delta_pdus_lock);
+		free(gen);
+	}
+}
+
+/*
+ * Returns the current generation, referenced. Release it with
+ * generation_refput().
+ * Returns NULL if there's no generation yet.
+ *
+ * Never blocks.
+ */
+static struct generation *
+generation_pin(void)
+{
+	struct generation *gen;
+
+	atomic_fetch_add(&state.pinning, 1);
+	gen = atomic_load(&state.generation);
+	if (gen != NULL)
+		generation_refget(gen);
+	atomic_fetch_sub(&state.pinning, 1);
+
+	return gen;
+}
+
+/*
+ * Makes @gen the current generation, and drops the previous one. (Which will
+ * survive until its last reader is done with it.)
+ * Only the update thread can call this.
+ */
+static void
+generation_publish(struct generation *gen)
+{
+	struct generation *old;
+
+	old = atomic_exchange(&state.generation, gen);
+	if (old == NULL)
+		return;
+
+	/*
+	 * Some readers might have loaded @old, but not referenced it yet.
+	 * They're a couple of instructions away from doing so, so just wait.
+	 * (Readers that load the pointer from now on will see @gen.)
+	 */
+	while (atomic_load(&state.pinning) != 0)
+		sched_yield();
+
+	generation_refput(old);
 }
 
 void
 vrps_destroy(void)
 {
-	if (state.base != NULL)
-		db_table_destroy(state.base);
+	generation_publish(NULL);
 	if (state.slurm != NULL)
 		db_slurm_destroy(state.slurm);
-	deltas_db_cleanup(&state.deltas, deltagroup_cleanup);
-	/* Nothing to do with error codes from now on */
-	pthread_rwlock_destroy(&state_lock);
-	pthread_rwlock_destroy(&table_lock);
 }
 
-#define WLOCK_HANDLER(lock, cb)						\
-	int error;							\
-	rwlock_write_lock(lock);					\
-	error = cb;							\
-	rwlock_unlock(lock);						\
-	return error;
+/* Returns the calling thread's buffer, registering a new one if needed. */
+static struct db_table *
+get_buffer(struct vrp_collector *collector)
+{
+	struct db_table *buffer;
+	struct db_table **tmp;
+	unsigned int capacity;
+
+	if (thread_buffer != NULL && thread_collector == collector->id)
+		return thread_buffer;
+
+	buffer = db_table_create_buffer();
+	if (buffer == NULL)
+		return NULL;
+
+	pthread_mutex_lock(&collector->lock);
+	if (collector->count == collector->capacity) {
+		capacity = (collector->capacity != 0)
+		    ? (2 * collector->capacity)
+		    : 8;
+		tmp = realloc(collector->buffers,
+		    capacity * sizeof(struct db_table *));
+		if (tmp == NULL) {
+			pthread_mutex_unlock(&collector->lock);
+			db_table_destroy(buffer);
+			return NULL;
+		}
+		collector->buffers = tmp;
+		collector->capacity = capacity;
+	}
+	collector->buffers[collector->count++] = buffer;
+	pthread_mutex_unlock(&collector->lock);
 
-#define RLOCK_HANDLER(lock, cb)						\
-	int error;							\
-	rwlock_read_lock(lock);						\
-	error = cb;							\
-	rwlock_unlock(lock);						\
-	return error;
+	thread_buffer = buffer;
+	thread_collector = collector->id;
+	return buffer;
+}
 
 int
 handle_roa_v4(uint32_t as, struct ipv4_prefix const *prefix,
     uint8_t max_length, void *arg)
 {
-	WLOCK_HANDLER(&table_lock,
-	    rtrhandler_handle_roa_v4(arg, as, prefix, max_length))
+	struct db_table *buffer;
+
+	buffer = get_buffer(arg);
+	if (buffer == NULL)
+		return pr_enomem();
+
+	return rtrhandler_handle_roa_v4(buffer, as, prefix, max_length);
 }
 
 int
 handle_roa_v6(uint32_t as, struct ipv6_prefix const * prefix,
     uint8_t max_length, void *arg)
 {
-	WLOCK_HANDLER(&table_lock,
-	    rtrhandler_handle_roa_v6(arg, as, prefix, max_length))
+	struct db_table *buffer;
+
+	buffer = get_buffer(arg);
+	if (buffer == NULL)
+		return pr_enomem();
+
+	return rtrhandler_handle_roa_v6(buffer, as, prefix, max_length);
 }
 
 int
 handle_router_key(unsigned char const *ski, uint32_t as,
     unsigned char const *spk, void *arg)
 {
-	WLOCK_HANDLER(&table_lock,
-	    rtrhandler_handle_router_key(arg, ski, as, spk))
+	struct db_table *buffer;
+
+	buffer = get_buffer(arg);
+	if (buffer == NULL)
+		return pr_enomem();
+
+	return rtrhandler_handle_router_key(buffer, ski, as, spk);
 }
 
 static int
 __perform_standalone_validation(struct db_table **result)
 {
-	struct db_table *db;
+	struct vrp_collector collector;
+	unsigned int i;
 	int error;
 
-	db = db_table_create();
-	if (db == NULL)
-		return pr_enomem();
+	collector.id = ++last_collector_id;
+	collector.buffers = NULL;
+	collector.count = 0;
+	collector.capacity = 0;
+	error = pthread_mutex_init(&collector.lock, NULL);
+	if (error)
+		return -pr_op_errno(error, "pthread_mutex_init() errored");
 
-	error = perform_standalone_validation(db);
-	if (error) {
-		db_table_destroy(db);
-		return error;
-	}
+	error = perform_standalone_validation(&collector);
+	if (!error)
+		error = db_table_join(collector.buffers, collector.count,
+		    result);
 
-	*result = db;
-	return 0;
+	for (i = 0; i < collector.count; i++)
+		db_table_destroy(collector.buffers[i]);
+	free(collector.buffers);
+	pthread_mutex_destroy(&collector.lock);
+	return error;
 }
 
 /*
- * Make an empty dummy delta array.
+ * Fills @gen->deltas with the ones from @prev some router might still need,
+ * followed by @deltas.
+ * (If nobody needs them, it adds an empty dummy delta array instead.
  * It's annoying, but temporary. (Until it expires.) Otherwise, it'd be a pain
- * to have to check NULL delta_group.deltas all the time.
+ * to have to check NULL delta_group.deltas all the time.)
  */
 static int
-create_empty_delta(struct deltas **deltas)
+build_delta_history(struct generation *gen, struct generation *prev,
+    struct deltas *deltas)
 {
-	struct delta_group deltas_node;
+	struct delta_group *group;
+	struct delta_group node;
+	array_index i;
+	serial_t min_serial;
 	int error;
 
-	error = deltas_create(deltas);
-	if (error)
+	node.serial = gen->serial;
+
+	if (prev == NULL || clients_get_min_serial(&min_serial) != 0) {
+		/* Nobody will need deltas, just leave an empty one */
+		error = deltas_create(&node.deltas);
+		if (error)
+			return error;
+		error = deltas_db_add(&gen->deltas, &node);
+		if (error)
+			deltas_refput(node.deltas);
 		return error;
+	}
+
+	/* Assume its ordered by serial, and skip the ones nobody needs */
+	ARRAYLIST_FOREACH(&prev->deltas, group, i) {
+		if (group->serial < min_serial)
+			continue;
+		error = deltas_db_add(&gen->deltas, group);
+		if (error)
+			return error;
+		deltas_refget(group->deltas);
+	}
 
-	deltas_node.serial = state.next_serial;
-	deltas_node.deltas = *deltas;
-	error = deltas_db_add(&state.deltas, &deltas_node);
+	node.deltas = deltas;
+	error = deltas_db_add(&gen->deltas, &node);
 	if (error)
-		deltas_refput(*deltas);
-	return error;
+		return error;
+	deltas_refget(deltas);
+
+	return 0;
 }
 
-/**
- * Reallocate the array of @db starting at @start, the length and capacity are
- * calculated according to the new start.
- */
+struct base_pdus_args {
+	struct pdu_stream *stream;
+	uint8_t version;
+};
+
 static int
-resize_deltas_db(struct deltas_db *db, struct delta_group *start)
+add_base_roa(struct vrp const *vrp, void *arg)
 {
-	struct delta_group *tmp, *ptr;
-
-	db->len -= (start - db->array);
-	while (db->len < db->capacity / 2)
-		db->capacity /= 2;
-	tmp = malloc(sizeof(struct delta_group) * db->capacity);
-	if (tmp == NULL)
-		return pr_enomem();
-
-	memcpy(tmp, start, db->len * sizeof(struct delta_group));
-	/* Release memory allocated */
-	for (ptr = db->array; ptr < start; ptr++)
-		deltas_refput(ptr->deltas);
-	free(db->array);
-	db->array = tmp;
+	struct base_pdus_args *args = arg;
+	return pdu_stream_add_prefix(args->stream, args->version, vrp,
+	    FLAG_ANNOUNCEMENT);
+}
 
-	return 0;
+static int
+add_base_router_key(struct router_key const *key, void *arg)
+{
+	struct base_pdus_args *args = arg;
+	return pdu_stream_add_router_key(args->stream, args->version, key,
+	    FLAG_ANNOUNCEMENT);
 }
 
 /*
- * Lock must be requested before calling this function
+ * Serializes @base once per RTR version, so Reset Queries don't need to do it
+ * once per client.
  */
 static int
-vrps_purge(struct deltas **deltas)
+serialize_base(struct db_table *base, struct pdu_stream **result)
 {
-	struct delta_group *group;
-	array_index i;
-	serial_t min_serial;
+	struct base_pdus_args args;
+	uint8_t version;
+	int error;
 
-	if (clients_get_min_serial(&min_serial) != 0) {
-		/* Nobody will need deltas, just leave an empty one */
-		deltas_refput(*deltas);
-		deltas_db_cleanup(&state.deltas, deltagroup_cleanup);
-		deltas_db_init(&state.deltas);
-		return create_empty_delta(deltas);
-	}
+	result[RTR_V0] = NULL;
+	result[RTR_V1] = NULL;
 
-	/* Assume its ordered by serial, so get the new initial pointer */
-	ARRAYLIST_FOREACH(&state.deltas, group, i)
-		if (group->serial >= min_serial)
-			break;
+	for (version = RTR_V0; version <= RTR_V1; version++) {
+		error = pdu_stream_create(&result[version]);
+		if (error)
+			goto fail;
 
-	/* Its the first element or reached end, nothing to purge */
-	if (group == state.deltas.array ||
-	    (group - state.deltas.array) == state.deltas.len)
-		return 0;
+		args.stream = result[version];
+		args.version = version;
+		error = db_table_foreach_roa(base, add_base_roa, &args);
+		if (error)
+			goto fail;
+		error = db_table_foreach_router_key(base, add_base_router_key,
+		    &args);
+		if (error)
+			goto fail;
+
+		pdu_stream_seal(result[version]);
+	}
 
-	return resize_deltas_db(&state.deltas, group);
+	return 0;
+
+fail:
+	base_pdus_release(result);
+	return error;
 }
 
 static int
 __vrps_update(bool *changed)
 {
-	struct db_table *old_base;
+	struct generation *prev;
+	struct generation *gen;
 	struct db_table *new_base;
 	struct deltas *deltas; /* Deltas in raw form */
-	struct delta_group deltas_node; /* Deltas in database node form */
-	serial_t min_serial;
+	struct trace_span span;
+	double phase_start;
 	int error;
 
 	*changed = false;
-	old_base = NULL;
+	gen = NULL;
 	new_base = NULL;
+	deltas = NULL;
 
+	phase_start = metrics_now();
 	error = __perform_standalone_validation(&new_base);
+	phase_start = metrics_phase_end(MPH_VALIDATION, phase_start);
 	if (error)
 		return error;
 
+	trace_begin(&span, "slurm_apply");
 	error = slurm_apply(&new_base, &state.slurm);
+	trace_end(&span, config_get_slurm());
+	phase_start = metrics_phase_end(MPH_SLURM, phase_start);
 	if (error)
 		goto revert_base;
 
-	rwlock_write_lock(&state_lock);
+	/*
+	 * Sorted tables can be diffed in a single pass. Do it now, because
+	 * compute_deltas() will need @new_base sorted next time as well, and
+	 * by then, other threads will be reading it.
+	 */
+	db_table_sort(new_base);
 
-	if (state.base != NULL) {
-		error = compute_deltas(state.base, new_base, &deltas);
-		if (error) {
-			rwlock_unlock(&state_lock);
+	/*
+	 * This is the only thread that ever replaces the generation, so it
+	 * doesn't need to be pinned.
+	 */
+	prev = atomic_load(&state.generation);
+	if (prev != NULL) {
+		trace_begin(&span, "compute_deltas");
+		error = compute_deltas(prev->base, new_base, &deltas);
+		trace_end(&span, NULL);
+		if (error)
 			goto revert_base;
-		}
 
-		if (deltas_is_empty(deltas)) {
-			rwlock_unlock(&state_lock);
+		if (deltas_is_empty(deltas))
 			goto revert_deltas; /* error == 0 is good */
-		}
-
-		/* Just store deltas if someone will care about it */
-		if (clients_get_min_serial(&min_serial) == 0) {
-			deltas_node.serial = state.next_serial;
-			deltas_node.deltas = deltas;
-			error = deltas_db_add(&state.deltas, &deltas_node);
-			if (error) {
-				rwlock_unlock(&state_lock);
-				goto revert_deltas;
-			}
-		}
-
-		/*
-		 * Postpone destruction of the old database,
-		 * to release the lock ASAP.
-		 */
-		old_base = state.base;
-
-		/* Remove unnecessary deltas */
-		error = vrps_purge(&deltas);
-		if (error) {
-			rwlock_unlock(&state_lock);
-			goto revert_base;
-		}
-	} else {
+	} else if (db_table_roa_count(new_base) +
+	    db_table_router_key_count(new_base) == 0) {
 		/* There's also an empty base, don't alter state */
-		if (db_table_roa_count(new_base) +
-		    db_table_router_key_count(new_base) == 0) {
-			rwlock_unlock(&state_lock);
-			error = 0; /* OK (said explicitly) */
-			goto revert_base;
-		}
-		error = create_empty_delta(&deltas);
-		if (error) {
-			rwlock_unlock(&state_lock);
-			goto revert_base;
-		}
+		goto revert_base; /* error == 0 is good */
 	}
 
-	*changed = true;
-	state.base = new_base;
-	state.next_serial++;
+	phase_start = metrics_phase_end(MPH_DELTAS, phase_start);
 
-	rwlock_unlock(&state_lock);
+	error = generation_create(new_base,
+	    (prev != NULL) ? (prev->serial + 1) : START_SERIAL, &gen);
+	if (error)
+		goto revert_deltas;
 
-	if (old_base != NULL)
-		db_table_destroy(old_base);
+	error = build_delta_history(gen, prev, deltas);
+	if (error)
+		goto revert_generation;
+	error = serialize_base(new_base, gen->base_pdus);
+	if (error)
+		goto revert_generation;
+
+	generation_publish(gen);
+	*changed = true;
+	metrics_phase_end(MPH_PUBLICATION, phase_start);
 
 	/* Print after validation to avoid duplicated info */
 	output_print_data(new_base);
 
+	if (deltas != NULL)
+		deltas_refput(deltas);
 	return 0;
 
+revert_generation:
+	/* Print info that was already validated */
+	output_print_data(new_base);
+	generation_refput(gen); /* Also destroys @new_base */
+	if (deltas != NULL)
+		deltas_refput(deltas);
+	return error;
 revert_deltas:
-	deltas_refput(deltas);
+	if (deltas != NULL)
+		deltas_refput(deltas);
 revert_base:
 	/* Print info that was already validated */
 	output_print_data(new_base);
@@ -378,6 +625,7 @@ revert_base:
 int
 vrps_update(bool *changed)
 {
+	struct generation *gen;
 	time_t start, finish;
 	long int exec_time;
 	serial_t serial;
@@ -404,27 +652,23 @@ vrps_update(bool *changed)
 	exec_time = finish - start;
 
 	pr_op_info("Validation finished:");
-	rwlock_read_lock(&state_lock);
-	do {
-		if (state.base == NULL) {
-			rwlock_unlock(&state_lock);
-			pr_op_info("- Valid Prefixes: 0");
-			pr_op_info("- Valid Router Keys: 0");
-			if (config_get_mode() == SERVER)
-				pr_op_info("- No serial number.");
-			break;
-		}
-
-		pr_op_info("- Valid Prefixes: %u", db_table_roa_count(state.base));
+	gen = generation_pin();
+	if (gen != NULL) {
+		pr_op_info("- Valid Prefixes: %u", db_table_roa_count(gen->base));
 		pr_op_info("- Valid Router Keys: %u",
-		    db_table_router_key_count(state.base));
+		    db_table_router_key_count(gen->base));
 		if (config_get_mode() == SERVER) {
 			pr_op_info("- %s serial number is %u.",
-			    serial == state.next_serial - 1 ? "Current" : "New",
-			    state.next_serial - 1);
+			    serial == gen->serial ? "Current" : "New",
+			    gen->serial);
 		}
-		rwlock_unlock(&state_lock);
-	} while(0);
+		generation_refput(gen);
+	} else {
+		pr_op_info("- Valid Prefixes: 0");
+		pr_op_info("- Valid Router Keys: 0");
+		if (config_get_mode() == SERVER)
+			pr_op_info("- No serial number.");
+	}
 	pr_op_info("- Real execution time: %ld secs.", exec_time);
 
 	return error;
@@ -438,26 +682,49 @@ vrps_update(bool *changed)
 int
 vrps_foreach_base(vrp_foreach_cb cb_roa, router_key_foreach_cb cb_rk, void *arg)
 {
+	struct generation *gen;
 	int error;
 
-	error = rwlock_read_lock(&state_lock);
-	if (error)
-		return error;
-
-	if (state.base != NULL) {
-		error = db_table_foreach_roa(state.base, cb_roa, arg);
-		if (error)
-			goto unlock;
-		error = db_table_foreach_router_key(state.base, cb_rk, arg);
-	} else
-		error = -EAGAIN;
+	gen = generation_pin();
+	if (gen == NULL)
+		return -EAGAIN;
 
-unlock:
-	rwlock_unlock(&state_lock);
+	error = db_table_foreach_roa(gen->base, cb_roa, arg);
+	if (!error)
+		error = db_table_foreach_router_key(gen->base, cb_rk, arg);
 
+	generation_refput(gen);
 	return error;
 }
 
+static void
+vrp_hash_key(struct vrp const *vrp, struct vrp *key)
+{
+	memset(key, 0, sizeof(*key));
+	key->asn = vrp->asn;
+	switch (vrp->addr_fam) {
+	case AF_INET:
+		key->prefix.v4 = vrp->prefix.v4;
+		break;
+	case AF_INET6:
+		key->prefix.v6 = vrp->prefix.v6;
+		break;
+	}
+	key->prefix_length = vrp->prefix_length;
+	key->max_prefix_length = vrp->max_prefix_length;
+	key->addr_fam = vrp->addr_fam;
+}
+
+static void
+router_key_hash_key(struct router_key const *router_key,
+    struct router_key *key)
+{
+	memset(key, 0, sizeof(*key));
+	memcpy(key->ski, router_key->ski, RK_SKI_LEN);
+	key->as = router_key->as;
+	memcpy(key->spk, router_key->spk, RK_SPKI_LEN);
+}
+
 /*
  * Remove the announcements/withdrawals that override each other.
  *
@@ -467,56 +734,68 @@ unlock:
 static int
 vrp_ovrd_remove(struct delta_vrp const *delta, void *arg)
 {
-	struct sorted_lists *lists = arg;
-	struct vrp_node *ptr;
-	struct vrp_slist *filtered_vrps;
-
-	filtered_vrps = &lists->prefixes;
-	SLIST_FOREACH(ptr, filtered_vrps, next)
-		if (VRP_EQ(&delta->vrp, &ptr->delta.vrp) &&
-		    delta->flags != ptr->delta.flags) {
-			SLIST_REMOVE(filtered_vrps, ptr, vrp_node, next);
-			free(ptr);
-			return 0;
+	struct filtered_deltas *filtered = arg;
+	struct vrp_node *node;
+	struct vrp key;
+
+	vrp_hash_key(&delta->vrp, &key);
+	HASH_FIND(hh, filtered->prefixes, &key, sizeof(key), node);
+	if (node != NULL) {
+		if (delta->flags != node->delta.flags) {
+			HASH_DEL(filtered->prefixes, node);
+			free(node);
 		}
+		return 0;
+	}
 
-	ptr = malloc(sizeof(struct vrp_node));
-	if (ptr == NULL)
+	node = malloc(sizeof(struct vrp_node));
+	if (node == NULL)
 		return pr_enomem();
 
-	ptr->delta = *delta;
-	SLIST_INSERT_HEAD(filtered_vrps, ptr, next);
+	memcpy(&node->key, &key, sizeof(key));
+	node->delta = *delta;
+
+	errno = 0;
+	HASH_ADD(hh, filtered->prefixes, key, sizeof(node->key), node);
+	if (errno) {
+		free(node);
+		return pr_enomem();
+	}
+
 	return 0;
 }
 
 static int
 router_key_ovrd_remove(struct delta_router_key const *delta, void *arg)
 {
-	struct sorted_lists *lists = arg;
-	struct rk_node *ptr;
-	struct rk_slist *filtered_keys;
-	struct router_key const *key;
-
-	filtered_keys = &lists->router_keys;
-	SLIST_FOREACH(ptr, filtered_keys, next) {
-		key = &delta->router_key;
-		if (key->as == ptr->delta.router_key.as &&
-		    memcmp(key->ski, ptr->delta.router_key.ski, RK_SKI_LEN) == 0
-		    && memcmp(key->spk, ptr->delta.router_key.spk,
-		    RK_SPKI_LEN) == 0 &&
-		    delta->flags != ptr->delta.flags) {
-			SLIST_REMOVE(filtered_keys, ptr, rk_node, next);
-			free(ptr);
-			return 0;
+	struct filtered_deltas *filtered = arg;
+	struct rk_node *node;
+	struct router_key key;
+
+	router_key_hash_key(&delta->router_key, &key);
+	HASH_FIND(hh, filtered->router_keys, &key, sizeof(key), node);
+	if (node != NULL) {
+		if (delta->flags != node->delta.flags) {
+			HASH_DEL(filtered->router_keys, node);
+			free(node);
 		}
+		return 0;
 	}
 
-	ptr = malloc(sizeof(struct rk_node));
-	if (ptr == NULL)
+	node = malloc(sizeof(struct rk_node));
+	if (node == NULL)
 		return pr_enomem();
 
-	ptr->delta = *delta;
-	SLIST_INSERT_HEAD(filtered_keys, ptr, next);
+	memcpy(&node->key, &key, sizeof(key));
+	node->delta = *delta;
+
+	errno = 0;
+	HASH_ADD(hh, filtered->router_keys, key, sizeof(node->key), node);
+	if (errno) {
+		free(node);
+		return pr_enomem();
+	}
+
 	return 0;
 }
 
@@ -529,48 +808,46 @@ vrps_foreach_filtered_delta(struct deltas_db *deltas,
     delta_vrp_foreach_cb cb_prefix, delta_router_key_foreach_cb cb_rk,
     void *arg)
 {
-	struct sorted_lists filtered_lists;
+	struct filtered_deltas filtered;
 	struct delta_group *group;
-	struct vrp_node *vnode;
-	struct rk_node *rnode;
+	struct vrp_node *vnode, *vtmp;
+	struct rk_node *rnode, *rtmp;
 	array_index i;
 	int error = 0;
 
 	/*
 	 * Filter: Remove entries that cancel each other.
-	 * (We'll have to build a separate list because the database nodes
+	 * (We'll have to build separate tables because the database nodes
 	 * are immutable.)
 	 */
-	SLIST_INIT(&filtered_lists.prefixes);
-	SLIST_INIT(&filtered_lists.router_keys);
+	filtered.prefixes = NULL;
+	filtered.router_keys = NULL;
 	ARRAYLIST_FOREACH(deltas, group, i) {
 		error = deltas_foreach(group->serial, group->deltas,
-		    vrp_ovrd_remove, router_key_ovrd_remove, &filtered_lists);
+		    vrp_ovrd_remove, router_key_ovrd_remove, &filtered);
 		if (error)
-			goto release_list;
+			goto release_tables;
 	}
 
 	/* Now do the corresponding callback on the filtered deltas */
-	SLIST_FOREACH(vnode, &filtered_lists.prefixes, next) {
+	HASH_ITER(hh, filtered.prefixes, vnode, vtmp) {
 		error = cb_prefix(&vnode->delta, arg);
 		if (error)
-			break;
+			goto release_tables;
 	}
-	SLIST_FOREACH(rnode, &filtered_lists.router_keys, next) {
+	HASH_ITER(hh, filtered.router_keys, rnode, rtmp) {
 		error = cb_rk(&rnode->delta, arg);
 		if (error)
-			break;
+			goto release_tables;
 	}
 
-release_list:
-	while (!SLIST_EMPTY(&filtered_lists.prefixes)) {
-		vnode = filtered_lists.prefixes.slh_first;
-		SLIST_REMOVE_HEAD(&filtered_lists.prefixes, next);
+release_tables:
+	HASH_ITER(hh, filtered.prefixes, vnode, vtmp) {
+		HASH_DEL(filtered.prefixes, vnode);
 		free(vnode);
 	}
-	while (!SLIST_EMPTY(&filtered_lists.router_keys)) {
-		rnode = filtered_lists.router_keys.slh_first;
-		SLIST_REMOVE_HEAD(&filtered_lists.router_keys, next);
+	HASH_ITER(hh, filtered.router_keys, rnode, rtmp) {
+		HASH_DEL(filtered.router_keys, rnode);
 		free(rnode);
 	}
 
@@ -590,8 +867,9 @@ release_list:
  * (But note that @result is supposed to be already initialized, so caller will
  * have to clean it up regardless of error.)
  */
-int
-vrps_get_deltas_from(serial_t from, serial_t *to, struct deltas_db *result)
+static int
+get_deltas_from(struct generation *gen, serial_t from, serial_t *to,
+    struct deltas_db *result)
 {
 	struct delta_group *group;
 	array_index i;
@@ -600,16 +878,7 @@ vrps_get_deltas_from(serial_t from, serial_t *to, struct deltas_db *result)
 
 	from_found = false;
 
-	error = rwlock_read_lock(&state_lock);
-	if (error)
-		return error;
-
-	if (state.base == NULL) {
-		rwlock_unlock(&state_lock);
-		return -EAGAIN;
-	}
-
-	ARRAYLIST_FOREACH(&state.deltas, group, i) {
+	ARRAYLIST_FOREACH(&gen->deltas, group, i) {
 		if (!from_found) {
 			if (group->serial == from) {
 				from_found = true;
@@ -619,38 +888,259 @@ vrps_get_deltas_from(serial_t from, serial_t *to, struct deltas_db *result)
 		}
 
 		error = deltas_db_add(result, group);
-		if (error) {
-			rwlock_unlock(&state_lock);
+		if (error)
 			return error;
-		}
 
 		deltas_refget(group->deltas);
 		*to = group->serial;
 	}
 
-	rwlock_unlock(&state_lock);
 	return from_found ? 0 : -ESRCH;
 }
 
 int
-get_last_serial_number(serial_t *result)
+vrps_get_deltas_from(serial_t from, serial_t *to, struct deltas_db *result)
 {
+	struct generation *gen;
 	int error;
 
-	error = rwlock_read_lock(&state_lock);
+	gen = generation_pin();
+	if (gen == NULL)
+		return -EAGAIN;
+
+	error = get_deltas_from(gen, from, to, result);
+
+	generation_refput(gen);
+	return error;
+}
+
+struct delta_pdus_args {
+	struct pdu_stream *stream;
+	uint8_t version;
+};
+
+static int
+add_delta_vrp(struct delta_vrp const *delta, void *arg)
+{
+	struct delta_pdus_args *args = arg;
+	return pdu_stream_add_prefix(args->stream, args->version, &delta->vrp,
+	    delta->flags);
+}
+
+static int
+add_delta_router_key(struct delta_router_key const *delta, void *arg)
+{
+	struct delta_pdus_args *args = arg;
+	return pdu_stream_add_router_key(args->stream, args->version,
+	    &delta->router_key, delta->flags);
+}
+
+static int
+serialize_deltas(struct deltas_db *deltas, uint8_t version,
+    struct pdu_stream **result)
+{
+	struct delta_pdus_args args;
+	int error;
+
+	error = pdu_stream_create(&args.stream);
 	if (error)
 		return error;
+	args.version = version;
 
-	if (state.base != NULL)
-		*result = state.next_serial - 1;
+	/*
+	 * Short circuit: Entries that share serial are already guaranteed to
+	 * not contradict each other, so no filtering required.
+	 */
+	if (deltas->len == 1)
+		error = deltas_foreach(deltas->array[0].serial,
+		    deltas->array[0].deltas, add_delta_vrp,
+		    add_delta_router_key, &args);
 	else
-		error = -EAGAIN;
+		error = vrps_foreach_filtered_delta(deltas, add_delta_vrp,
+		    add_delta_router_key, &args);
+	if (error) {
+		pdu_stream_refput(args.stream);
+		return error;
+	}
+
+	pdu_stream_seal(args.stream);
+	*result = args.stream;
+	return 0;
+}
+
+/* @gen->delta_pdus_lock must be held. */
+static struct delta_pdus *
+delta_pdus_find(struct generation *gen, serial_t from, uint8_t version)
+{
+	struct delta_pdus *entry;
+
+	SLIST_FOREACH(entry, &gen->delta_pdus, next)
+		if (entry->from == from && entry->version == version)
+			return entry;
+
+	return NULL;
+}
+
+/*
+ * Caches @stream as the response from @from, unless some other thread got
+ * there first. In that case, @stream is replaced by the other thread's, so only
+ * one of them survives.
+ */
+static void
+delta_pdus_cache(struct generation *gen, serial_t from, uint8_t version,
+    struct pdu_stream **stream)
+{
+	struct delta_pdus *entry;
+
+	pthread_mutex_lock(&gen->delta_pdus_lock);
+
+	entry = delta_pdus_find(gen, from, version);
+	if (entry != NULL) {
+		pdu_stream_refput(*stream);
+		*stream = entry->stream;
+		pdu_stream_refget(*stream);
+	} else {
+		/* Failure is fine; the next query will simply try again. */
+		entry = malloc(sizeof(struct delta_pdus));
+		if (entry != NULL) {
+			entry->from = from;
+			entry->to = gen->serial;
+			entry->version = version;
+			entry->stream = *stream;
+			pdu_stream_refget(entry->stream);
+			SLIST_INSERT_HEAD(&gen->delta_pdus, entry, next);
+		}
+	}
+
+	pthread_mutex_unlock(&gen->delta_pdus_lock);
+}
+
+/**
+ * Returns (in @result) the deltas whose serial > @from, already filtered and
+ * serialized for RTR version @version, as well as (in @to) the serial they
+ * lead to.
+ * Release @result with pdu_stream_refput() when you're done.
+ *
+ * The result is cached, so routers asking for the same serial only cost one
+ * serialization per update.
+ *
+ * Error codes are the same as vrps_get_deltas_from()'s.
+ */
+int
+vrps_get_delta_pdus(serial_t from, uint8_t version, struct pdu_stream **result,
+    serial_t *to)
+{
+	struct generation *gen;
+	struct deltas_db deltas;
+	struct delta_pdus *entry;
+	struct pdu_stream *stream;
+	int error;
+
+	if (version > RTR_V1)
+		return -EINVAL;
+
+	gen = generation_pin();
+	if (gen == NULL)
+		return -EAGAIN;
 
-	rwlock_unlock(&state_lock);
+	stream = NULL;
+	pthread_mutex_lock(&gen->delta_pdus_lock);
+	entry = delta_pdus_find(gen, from, version);
+	if (entry != NULL) {
+		stream = entry->stream;
+		pdu_stream_refget(stream);
+		*to = entry->to;
+	}
+	pthread_mutex_unlock(&gen->delta_pdus_lock);
 
+	if (stream != NULL) {
+		*result = stream;
+		generation_refput(gen);
+		return 0;
+	}
+
+	/* Not cached yet; build it without holding the lock. */
+	deltas_db_init(&deltas);
+	error = get_deltas_from(gen, from, to, &deltas);
+	if (error)
+		goto end;
+	error = serialize_deltas(&deltas, version, &stream);
+	if (error)
+		goto end;
+
+	delta_pdus_cache(gen, from, version, &stream);
+	*result = stream;
+
+end:
+	deltas_db_cleanup(&deltas, deltagroup_cleanup);
+	generation_refput(gen);
 	return error;
 }
 
+/**
+ * Returns (in @result) the current base, serialized for RTR version @version,
+ * as well as (in @serial) the serial it corresponds to.
+ * Release @result with pdu_stream_refput() when you're done.
+ *
+ * Please keep in mind that there is at least one errcode-aware caller. The most
+ * important ones are
+ * 1. 0: No errors.
+ * 2. -EAGAIN: No data available; database still under construction.
+ */
+int
+vrps_get_base_pdus(uint8_t version, struct pdu_stream **result,
+    serial_t *serial)
+{
+	struct generation *gen;
+
+	if (version > RTR_V1)
+		return -EINVAL;
+
+	gen = generation_pin();
+	if (gen == NULL)
+		return -EAGAIN;
+
+	*result = gen->base_pdus[version];
+	pdu_stream_refget(*result);
+	*serial = gen->serial;
+
+	generation_refput(gen);
+	return 0;
+}
+
+int
+get_last_serial_number(serial_t *result)
+{
+	struct generation *gen;
+
+	gen = generation_pin();
+	if (gen == NULL)
+		return -EAGAIN;
+
+	*result = gen->serial;
+
+	generation_refput(gen);
+	return 0;
+}
+
+int
+vrps_get_summary(struct vrps_summary *result)
+{
+	struct generation *gen;
+
+	gen = generation_pin();
+	if (gen == NULL)
+		return -EAGAIN;
+
+	result->serial = gen->serial;
+	result->deltas = gen->deltas.len;
+	result->prefixes = db_table_roa_count(gen->base);
+	result->router_keys = db_table_router_key_count(gen->base);
+
+	generation_refput(gen);
+	return 0;
+}
+
 uint16_t
 get_current_session_id(uint8_t rtr_version)
 {
@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include "data_structure/array_list.h"
+#include "rtr/pdu_stream.h"
 #include "rtr/db/delta.h"
 
 /*
@@ -18,24 +19,42 @@ void deltagroup_cleanup(struct delta_group *);
 DEFINE_ARRAY_LIST_STRUCT(deltas_db, struct delta_group);
 DECLARE_ARRAY_LIST_FUNCTIONS(deltas_db, struct delta_group)
 
+/* A glance at the current serial, for the metrics. */
+struct vrps_summary {
+	serial_t serial;
+	/* Serials in the delta history, including the current one */
+	unsigned int deltas;
+	unsigned int prefixes;
+	unsigned int router_keys;
+};
+
 int vrps_init(void);
 void vrps_destroy(void);
 
 int vrps_update(bool *);
 
 /*
- * The following three functions return -EAGAIN when vrps_update() has never
+ * The following six functions return -EAGAIN when vrps_update() has never
  * been called, or while it's still building the database.
  * Handle gracefully.
  */
 
 int vrps_foreach_base(vrp_foreach_cb, router_key_foreach_cb, void *);
+int vrps_get_base_pdus(uint8_t, struct pdu_stream **, serial_t *);
 int vrps_get_deltas_from(serial_t, serial_t *, struct deltas_db *);
+int vrps_get_delta_pdus(serial_t, uint8_t, struct pdu_stream **, serial_t *);
 int get_last_serial_number(serial_t *);
+int vrps_get_summary(struct vrps_summary *);
 
 int vrps_foreach_filtered_delta(struct deltas_db *, delta_vrp_foreach_cb,
     delta_router_key_foreach_cb, void *);
 
+/*
+ * Validation handlers. Their argument is the vrp_collector that was handed to
+ * perform_standalone_validation().
+ */
+struct vrp_collector;
+
 int handle_roa_v4(uint32_t, struct ipv4_prefix const *, uint8_t, void *);
 int handle_roa_v6(uint32_t, struct ipv6_prefix const *, uint8_t, void *);
 int handle_router_key(unsigned char const *, uint32_t, unsigned char const *,
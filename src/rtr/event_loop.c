@@ -0,0 +1,973 @@
+#include "rtr/event_loop.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/queue.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+#include "address.h"
+#include "clients.h"
+#include "config.h"
+#include "log.h"
+#include "metrics.h"
+#include "rtr/out_queue.h"
+#include "rtr/pdu.h"
+#include "rtr/pdu_sender.h"
+
+/* Incoming bytes a connection can hold. Must fit at least one whole PDU. */
+#define CONN_INBUF_LEN		(4 * RTRPDU_MAX_INCOMING_LEN)
+/* Events handled per poller_wait() */
+#define POLLER_MAX_EVENTS	64
+
+#define POLLER_IN		(1 << 0)
+#define POLLER_OUT		(1 << 1)
+
+struct poller_event {
+	/* NULL means the loop's wake pipe. */
+	void *ptr;
+	unsigned int events;
+};
+
+/*
+ * Kernel interface that tells us which connections are ready.
+ * epoll(7) where available, poll(2) everywhere else.
+ */
+#ifdef __linux__
+
+struct poller {
+	int fd;
+	struct epoll_event events[POLLER_MAX_EVENTS];
+};
+
+static int
+poller_init(struct poller *poller)
+{
+	poller->fd = epoll_create1(EPOLL_CLOEXEC);
+	if (poller->fd == -1)
+		return -pr_op_errno(errno, "epoll_create1() failed");
+	return 0;
+}
+
+static void
+poller_cleanup(struct poller *poller)
+{
+	close(poller->fd);
+}
+
+static int
+poller_ctl(struct poller *poller, int op, int fd, void *ptr,
+    unsigned int interest)
+{
+	struct epoll_event event;
+
+	memset(&event, 0, sizeof(event));
+	if (interest & POLLER_IN)
+		event.events |= EPOLLIN;
+	if (interest & POLLER_OUT)
+		event.events |= EPOLLOUT;
+	event.data.ptr = ptr;
+
+	if (epoll_ctl(poller->fd, op, fd, &event) == -1)
+		return -pr_op_errno(errno, "epoll_ctl() failed on FD %d", fd);
+	return 0;
+}
+
+static int
+poller_add(struct poller *poller, int fd, void *ptr, unsigned int interest)
+{
+	return poller_ctl(poller, EPOLL_CTL_ADD, fd, ptr, interest);
+}
+
+static int
+poller_mod(struct poller *poller, int fd, void *ptr, unsigned int interest)
+{
+	return poller_ctl(poller, EPOLL_CTL_MOD, fd, ptr, interest);
+}
+
+static void
+poller_del(struct poller *poller, int fd)
+{
+	/* Non-NULL event because of old kernels. */
+	struct epoll_event event;
+	epoll_ctl(poller->fd, EPOLL_CTL_DEL, fd, &event);
+}
+
+/* Returns the number of events written to @result, or a negative errno. */
+static int
+poller_wait(struct poller *poller, struct poller_event *result)
+{
+	int n;
+	int i;
+
+	n = epoll_wait(poller->fd, poller->events, POLLER_MAX_EVENTS, -1);
+	if (n == -1)
+		return -errno;
+
+	for (i = 0; i < n; i++) {
+		result[i].ptr = poller->events[i].data.ptr;
+		result[i].events = 0;
+		if (poller->events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+			result[i].events |= POLLER_IN;
+		if (poller->events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+			result[i].events |= POLLER_OUT;
+	}
+
+	return n;
+}
+
+#else /* __linux__ */
+
+struct poller {
+	struct pollfd *fds;
+	void **ptrs;
+	size_t len;
+	size_t capacity;
+};
+
+static int
+poller_init(struct poller *poller)
+{
+	poller->fds = NULL;
+	poller->ptrs = NULL;
+	poller->len = 0;
+	poller->capacity = 0;
+	return 0;
+}
+
+static void
+poller_cleanup(struct poller *poller)
+{
+	free(poller->fds);
+	free(poller->ptrs);
+}
+
+static short
+interest2events(unsigned int interest)
+{
+	short events = 0;
+	if (interest & POLLER_IN)
+		events |= POLLIN;
+	if (interest & POLLER_OUT)
+		events |= POLLOUT;
+	return events;
+}
+
+static int
+poller_add(struct poller *poller, int fd, void *ptr, unsigned int interest)
+{
+	struct pollfd *fds;
+	void **ptrs;
+	size_t capacity;
+
+	if (poller->len == poller->capacity) {
+		capacity = (poller->capacity != 0) ? (2 * poller->capacity) : 8;
+		fds = realloc(poller->fds, capacity * sizeof(struct pollfd));
+		if (fds == NULL)
+			return pr_enomem();
+		poller->fds = fds;
+		ptrs = realloc(poller->ptrs, capacity * sizeof(void *));
+		if (ptrs == NULL)
+			return pr_enomem();
+		poller->ptrs = ptrs;
+		poller->capacity = capacity;
+	}
+
+	poller->fds[poller->len].fd = fd;
+	poller->fds[poller->len].events = interest2events(interest);
+	poller->fds[poller->len].revents = 0;
+	poller->ptrs[poller->len] = ptr;
+	poller->len++;
+	return 0;
+}
+
+static int
+poller_mod(struct poller *poller, int fd, void *ptr, unsigned int interest)
+{
+	size_t i;
+
+	for (i = 0; i < poller->len; i++) {
+		if (poller->fds[i].fd == fd) {
+			poller->fds[i].events = interest2events(interest);
+			return 0;
+		}
+	}
+
+	return pr_op_err("FD %d is not being polled.", fd);
+}
+
+static void
+poller_del(struct poller *poller, int fd)
+{
+	size_t i;
+
+	for (i = 0; i < poller->len; i++) {
+		if (poller->fds[i].fd == fd) {
+			poller->len--;
+			poller->fds[i] = poller->fds[poller->len];
+			poller->ptrs[i] = poller->ptrs[poller->len];
+			return;
+		}
+	}
+}
+
+/* Returns the number of events written to @result, or a negative errno. */
+static int
+poller_wait(struct poller *poller, struct poller_event *result)
+{
+	short revents;
+	size_t i;
+	int n;
+
+	if (poll(poller->fds, poller->len, -1) == -1)
+		return -errno;
+
+	/* Level-triggered; whatever doesn't fit will be reported again. */
+	n = 0;
+	for (i = 0; i < poller->len && n < POLLER_MAX_EVENTS; i++) {
+		revents = poller->fds[i].revents;
+		if (revents == 0)
+			continue;
+
+		result[n].ptr = poller->ptrs[i];
+		result[n].events = 0;
+		if (revents & (POLLIN | POLLERR | POLLHUP | POLLNVAL))
+			result[n].events |= POLLER_IN;
+		if (revents & (POLLOUT | POLLERR | POLLHUP | POLLNVAL))
+			result[n].events |= POLLER_OUT;
+		n++;
+	}
+
+	return n;
+}
+
+#endif /* __linux__ */
+
+struct rtr_conn {
+	int fd;
+	struct sockaddr_storage addr;
+	struct event_loop *loop;
+
+	unsigned char in[CONN_INBUF_LEN];
+	size_t in_len;
+
+	/* Sent PDUs the socket hasn't taken yet */
+	struct out_queue out;
+	/* POLLER_* flags currently registered in the poller */
+	unsigned int interest;
+	/* Stop handling requests; close once the output queue drains. */
+	bool closing;
+
+	/* Debug stats of the response in progress */
+	struct {
+		/* Request being answered; NULL if there's none. */
+		char const *request;
+		size_t bytes;
+		unsigned int syscalls;
+	} response;
+
+	LIST_ENTRY(rtr_conn) next;
+};
+
+/* A freshly accepted client, on its way to its loop. */
+struct new_client {
+	int fd;
+	struct sockaddr_storage addr;
+	STAILQ_ENTRY(new_client) next;
+};
+
+struct event_loop {
+	pthread_t thread;
+	struct poller poller;
+	/* Other threads write here to interrupt poller_wait(). */
+	int wake[2];
+
+	/* Protects the "mailbox" fields below. */
+	pthread_mutex_t lock;
+	STAILQ_HEAD(, new_client) new_clients;
+	bool notify;
+	serial_t notify_serial;
+	bool stop;
+
+	/* Only touched by @thread. */
+	LIST_HEAD(, rtr_conn) conns;
+};
+
+static struct event_loop *loops;
+static unsigned int loops_len;
+/* Next loop that will receive a client. Only touched by the accept thread. */
+static unsigned int next_loop;
+/* Queued bytes that trigger a write while a response is being built */
+static size_t flush_threshold;
+
+/* The connection whose loop is currently running on this thread, if any. */
+static pthread_key_t serving_key;
+
+static void
+print_client_addr(struct sockaddr_storage *addr, char const *action, int fd)
+{
+	char buffer[INET6_ADDRSTRLEN];
+	pr_op_info("Client %s [ID %d]: %s", action, fd,
+	    sockaddr2str(addr, buffer));
+}
+
+static int
+set_nonblocking(int fd)
+{
+	int flags;
+
+	flags = fcntl(fd, F_GETFL);
+	if (flags == -1)
+		return -pr_op_errno(errno, "fcntl() to get flags failed");
+	if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+		return -pr_op_errno(errno, "fcntl() to set flags failed");
+	return 0;
+}
+
+static void
+conn_response_start(struct rtr_conn *conn, struct rtr_request *request)
+{
+	conn->response.request = pdutype2str(
+	    pdu_get_header(request->pdu)->pdu_type);
+	conn->response.bytes = 0;
+	conn->response.syscalls = 0;
+}
+
+/* To be called once the response has been entirely handed to the kernel. */
+static void
+conn_response_end(struct rtr_conn *conn)
+{
+	if (conn->response.request == NULL)
+		return;
+
+	pr_op_debug("Answered %s of client [ID %d]: %zu bytes, %u write syscalls.",
+	    conn->response.request, conn->fd, conn->response.bytes,
+	    conn->response.syscalls);
+	conn->response.request = NULL;
+}
+
+/*
+ * Writes as much of @conn's output queue as the socket will take.
+ * Returns 0 or an errno.
+ */
+static int
+conn_flush(struct rtr_conn *conn)
+{
+	int error;
+
+	error = outq_flush(&conn->out, conn->fd, &conn->response.syscalls);
+	if (error)
+		return error;
+
+	if (outq_empty(&conn->out))
+		conn_response_end(conn);
+	return 0;
+}
+
+static void
+clean_request(struct rtr_request *request, const struct pdu_metadata *meta)
+{
+	free(request->bytes);
+	meta->destructor(request->pdu);
+}
+
+/*
+ * Handles every complete PDU sitting in @conn's input buffer.
+ *
+ * Stops early if responses start piling up in the output queue, so a client
+ * that doesn't read cannot make us buffer unbounded amounts of data. The
+ * remaining requests are picked up once the queue drains.
+ */
+static int
+conn_handle_requests(struct rtr_conn *conn)
+{
+	struct pdu_metadata const *meta;
+	struct rtr_request request;
+	size_t offset;
+	size_t available;
+	int error;
+
+	offset = 0;
+	error = 0;
+
+	while (!conn->closing && outq_empty(&conn->out)) {
+		available = conn->in_len - offset;
+		if (available < pdu_bytes_needed(conn->in + offset, available))
+			break;
+
+		error = pdu_load(conn->fd, &conn->addr, conn->in + offset,
+		    available, &request, &meta);
+		if (error) {
+			/* The error response (if any) still needs to go out. */
+			conn->closing = true;
+			error = 0;
+			break;
+		}
+		offset += request.bytes_len;
+
+		conn_response_start(conn, &request);
+		error = meta->handle(conn->fd, &request);
+		clean_request(&request, meta);
+		if (error)
+			conn->closing = true;
+
+		/* Whatever's left from the response below the threshold */
+		error = conn_flush(conn);
+		if (error) {
+			pr_op_errno(error, "Error sending PDUs to client");
+			break;
+		}
+	}
+
+	if (offset > 0) {
+		memmove(conn->in, conn->in + offset, conn->in_len - offset);
+		conn->in_len -= offset;
+	}
+
+	return error;
+}
+
+/*
+ * Reads whatever the client sent, and handles it.
+ * Nonzero result means the connection is over.
+ */
+static int
+conn_read(struct rtr_conn *conn)
+{
+	ssize_t nread;
+	int error;
+
+	/*
+	 * A zero-length read() would look like EOF, so make room first.
+	 * The buffer can only fill up with requests that were held back while
+	 * the output queue drained.
+	 */
+	if (conn->in_len == CONN_INBUF_LEN) {
+		error = conn_handle_requests(conn);
+		if (error)
+			return error;
+		if (conn->in_len == CONN_INBUF_LEN) {
+			/* Responses pending; the rest waits for POLLER_OUT. */
+			if (!outq_empty(&conn->out) || conn->closing)
+				return 0;
+			pr_op_warn("Client [ID %d] sent a PDU that doesn't fit in the input buffer.",
+			    conn->fd);
+			return EMSGSIZE;
+		}
+	}
+
+	do {
+		nread = read(conn->fd, conn->in + conn->in_len,
+		    CONN_INBUF_LEN - conn->in_len);
+	} while (nread == -1 && errno == EINTR);
+
+	if (nread == -1) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return 0;
+		return pr_op_errno(errno, "Client socket read interrupted");
+	}
+	if (nread == 0) {
+		if (conn->in_len > 0)
+			pr_op_warn("Stream ended mid-PDU.");
+		return EPIPE;
+	}
+
+	conn->in_len += nread;
+	return conn_handle_requests(conn);
+}
+
+static void
+conn_destroy(struct rtr_conn *conn, char const *action)
+{
+	poller_del(&conn->loop->poller, conn->fd);
+	LIST_REMOVE(conn, next);
+
+	/* Before close(), since the FD number can be recycled right after. */
+	clients_forget(conn->fd);
+	print_client_addr(&conn->addr, action, conn->fd);
+	if (close(conn->fd) != 0)
+		pr_op_errno(errno, "close() failed on socket of client [ID %d]",
+		    conn->fd);
+
+	outq_cleanup(&conn->out);
+	free(conn);
+}
+
+/*
+ * Registers the events @conn currently cares about, or gets rid of it if it's
+ * done.
+ */
+static void
+conn_settle(struct rtr_conn *conn)
+{
+	unsigned int interest;
+
+	if (outq_empty(&conn->out)) {
+		if (conn->closing) {
+			conn_destroy(conn, "closed");
+			return;
+		}
+		interest = POLLER_IN;
+	} else {
+		/* Stop reading until the client catches up. */
+		interest = POLLER_OUT;
+	}
+
+	if (interest == conn->interest)
+		return;
+
+	if (poller_mod(&conn->loop->poller, conn->fd, conn, interest) != 0) {
+		conn_destroy(conn, "closed");
+		return;
+	}
+	conn->interest = interest;
+}
+
+static void
+conn_handle_events(struct rtr_conn *conn, unsigned int events)
+{
+	int error;
+
+	error = 0;
+	pthread_setspecific(serving_key, conn);
+
+	if (events & POLLER_OUT) {
+		error = conn_flush(conn);
+		if (error)
+			pr_op_errno(error, "Error sending queued PDUs to client");
+	}
+
+	if (!error && outq_empty(&conn->out) && !conn->closing) {
+		if (events & POLLER_IN)
+			error = conn_read(conn);
+		else if (conn->in_len > 0)
+			/* Requests held back while the output queue drained */
+			error = conn_handle_requests(conn);
+	}
+
+	pthread_setspecific(serving_key, NULL);
+
+	if (error)
+		conn_destroy(conn, "closed");
+	else
+		conn_settle(conn);
+}
+
+static void
+loop_adopt_client(struct event_loop *loop, struct new_client *client)
+{
+	struct rtr_conn *conn;
+
+	print_client_addr(&client->addr, "accepted", client->fd);
+
+	conn = malloc(sizeof(struct rtr_conn));
+	if (conn == NULL) {
+		pr_enomem();
+		goto fail;
+	}
+
+	conn->fd = client->fd;
+	conn->addr = client->addr;
+	conn->loop = loop;
+	conn->in_len = 0;
+	outq_init(&conn->out);
+	conn->interest = POLLER_IN;
+	conn->closing = false;
+	conn->response.request = NULL;
+
+	if (clients_add(conn->fd, conn->addr) != 0)
+		goto fail_conn;
+	if (poller_add(&loop->poller, conn->fd, conn, conn->interest) != 0) {
+		clients_forget(conn->fd);
+		goto fail_conn;
+	}
+
+	LIST_INSERT_HEAD(&loop->conns, conn, next);
+	return;
+
+fail_conn:
+	free(conn);
+fail:
+	close(client->fd);
+}
+
+static void
+loop_notify(struct event_loop *loop, serial_t serial)
+{
+	struct rtr_conn *conn, *tmp;
+	uint8_t version;
+	bool version_set;
+
+	for (conn = LIST_FIRST(&loop->conns); conn != NULL; conn = tmp) {
+		tmp = LIST_NEXT(conn, next);
+		if (conn->closing)
+			continue;
+		if (clients_get_rtr_version_set(conn->fd, &version_set,
+		    &version) != 0)
+			continue;
+
+		pthread_setspecific(serving_key, conn);
+		/* Errors already logged; don't interrupt the other clients */
+		if (send_serial_notify_pdu(conn->fd, version, serial) != 0
+		    || conn_flush(conn) != 0)
+			conn->closing = true;
+		pthread_setspecific(serving_key, NULL);
+
+		conn_settle(conn);
+	}
+}
+
+static void
+drain_wake_pipe(struct event_loop *loop)
+{
+	unsigned char buffer[64];
+	while (read(loop->wake[0], buffer, sizeof(buffer)) > 0)
+		;
+}
+
+/* Returns true if the loop was asked to stop. */
+static bool
+loop_check_mailbox(struct event_loop *loop)
+{
+	STAILQ_HEAD(, new_client) new_clients;
+	struct new_client *client;
+	serial_t serial;
+	bool notify;
+	bool stop;
+
+	drain_wake_pipe(loop);
+
+	pthread_mutex_lock(&loop->lock);
+	STAILQ_INIT(&new_clients);
+	STAILQ_CONCAT(&new_clients, &loop->new_clients);
+	notify = loop->notify;
+	serial = loop->notify_serial;
+	loop->notify = false;
+	stop = loop->stop;
+	pthread_mutex_unlock(&loop->lock);
+
+	while (!STAILQ_EMPTY(&new_clients)) {
+		client = STAILQ_FIRST(&new_clients);
+		STAILQ_REMOVE_HEAD(&new_clients, next);
+		if (stop)
+			close(client->fd);
+		else
+			loop_adopt_client(loop, client);
+		free(client);
+	}
+
+	if (notify && !stop)
+		loop_notify(loop, serial);
+
+	return stop;
+}
+
+static void *
+event_loop_run(void *arg)
+{
+	struct event_loop *loop = arg;
+	struct poller_event events[POLLER_MAX_EVENTS];
+	bool mailbox;
+	int n;
+	int i;
+
+	while (true) {
+		n = poller_wait(&loop->poller, events);
+		if (n < 0) {
+			if (n == -EINTR)
+				continue;
+			pr_op_errno(-n, "Waiting for client events failed");
+			break;
+		}
+
+		mailbox = false;
+		for (i = 0; i < n; i++) {
+			if (events[i].ptr == NULL)
+				mailbox = true;
+			else
+				conn_handle_events(events[i].ptr,
+				    events[i].events);
+		}
+
+		if (mailbox && loop_check_mailbox(loop))
+			break;
+	}
+
+	while (!LIST_EMPTY(&loop->conns))
+		conn_destroy(LIST_FIRST(&loop->conns), "terminated");
+
+	return NULL;
+}
+
+static void
+wake_loop(struct event_loop *loop)
+{
+	unsigned char byte = 0;
+	/* If the pipe is full, the loop already has a pending wake up. */
+	if (write(loop->wake[1], &byte, 1) == -1 && errno != EAGAIN)
+		pr_op_errno(errno, "Could not wake up a client loop");
+}
+
+static int
+loop_init(struct event_loop *loop)
+{
+	int error;
+
+	STAILQ_INIT(&loop->new_clients);
+	LIST_INIT(&loop->conns);
+	loop->notify = false;
+	loop->stop = false;
+
+	error = poller_init(&loop->poller);
+	if (error)
+		return error;
+
+	if (pipe(loop->wake) == -1) {
+		error = -pr_op_errno(errno, "Could not create a wake up pipe");
+		goto revert_poller;
+	}
+	error = set_nonblocking(loop->wake[0]);
+	if (error)
+		goto revert_pipe;
+	error = set_nonblocking(loop->wake[1]);
+	if (error)
+		goto revert_pipe;
+	error = poller_add(&loop->poller, loop->wake[0], NULL, POLLER_IN);
+	if (error)
+		goto revert_pipe;
+
+	error = pthread_mutex_init(&loop->lock, NULL);
+	if (error) {
+		error = -pr_op_errno(error, "pthread_mutex_init() errored");
+		goto revert_pipe;
+	}
+
+	error = pthread_create(&loop->thread, NULL, event_loop_run, loop);
+	if (error) {
+		error = -pr_op_errno(error, "Could not spawn a client loop");
+		goto revert_mutex;
+	}
+
+	return 0;
+
+revert_mutex:
+	pthread_mutex_destroy(&loop->lock);
+revert_pipe:
+	close(loop->wake[0]);
+	close(loop->wake[1]);
+revert_poller:
+	poller_cleanup(&loop->poller);
+	return error;
+}
+
+static void
+loop_cleanup(struct event_loop *loop)
+{
+	struct new_client *client;
+
+	pthread_mutex_lock(&loop->lock);
+	loop->stop = true;
+	pthread_mutex_unlock(&loop->lock);
+	wake_loop(loop);
+
+	/* Not cancelled, so the loop can say goodbye to its clients. */
+	pthread_join(loop->thread, NULL);
+
+	/* Clients handed over after the loop's last look at its mailbox */
+	while (!STAILQ_EMPTY(&loop->new_clients)) {
+		client = STAILQ_FIRST(&loop->new_clients);
+		STAILQ_REMOVE_HEAD(&loop->new_clients, next);
+		close(client->fd);
+		free(client);
+	}
+
+	pthread_mutex_destroy(&loop->lock);
+	close(loop->wake[0]);
+	close(loop->wake[1]);
+	poller_cleanup(&loop->poller);
+}
+
+int
+event_loops_start(void)
+{
+	unsigned int i;
+	int error;
+
+	error = pthread_key_create(&serving_key, NULL);
+	if (error)
+		return -pr_op_errno(error, "pthread_key_create() errored");
+
+	loops_len = config_get_server_workers();
+	loops = calloc(loops_len, sizeof(struct event_loop));
+	if (loops == NULL) {
+		error = pr_enomem();
+		goto revert_key;
+	}
+
+	for (i = 0; i < loops_len; i++) {
+		error = loop_init(&loops[i]);
+		if (error)
+			goto revert_loops;
+	}
+
+	next_loop = 0;
+	flush_threshold = config_get_server_flush_threshold();
+	pr_op_debug("Spawned %u RTR client loops.", loops_len);
+	return 0;
+
+revert_loops:
+	while (i > 0)
+		loop_cleanup(&loops[--i]);
+	free(loops);
+	loops = NULL;
+revert_key:
+	pthread_key_delete(serving_key);
+	return error;
+}
+
+/*
+ * Terminates all the client connections, and the threads that were serving
+ * them.
+ */
+void
+event_loops_stop(void)
+{
+	unsigned int i;
+
+	if (loops == NULL)
+		return;
+
+	for (i = 0; i < loops_len; i++)
+		loop_cleanup(&loops[i]);
+
+	free(loops);
+	loops = NULL;
+	pthread_key_delete(serving_key);
+}
+
+/*
+ * Hands the recently accepted connection @fd over to one of the loops.
+ * On success, the loop becomes the owner of @fd. On failure, the caller
+ * retains it.
+ */
+int
+event_loop_add_client(int fd, struct sockaddr_storage *addr)
+{
+	struct event_loop *loop;
+	struct new_client *client;
+	int error;
+
+	error = set_nonblocking(fd);
+	if (error)
+		return error;
+
+	client = malloc(sizeof(struct new_client));
+	if (client == NULL)
+		return pr_enomem();
+	client->fd = fd;
+	client->addr = *addr;
+
+	loop = &loops[next_loop];
+	next_loop = (next_loop + 1) % loops_len;
+
+	pthread_mutex_lock(&loop->lock);
+	STAILQ_INSERT_TAIL(&loop->new_clients, client, next);
+	pthread_mutex_unlock(&loop->lock);
+
+	wake_loop(loop);
+	return 0;
+}
+
+/* Asks every loop to send a Serial Notify to all of its clients. */
+void
+event_loops_notify(serial_t serial)
+{
+	unsigned int i;
+
+	if (loops == NULL)
+		return;
+
+	for (i = 0; i < loops_len; i++) {
+		pthread_mutex_lock(&loops[i].lock);
+		loops[i].notify = true;
+		loops[i].notify_serial = serial;
+		pthread_mutex_unlock(&loops[i].lock);
+		wake_loop(&loops[i]);
+	}
+}
+
+/*
+ * Sends @data to client @fd.
+ *
+ * If @fd is the connection being served by the current thread, @data is queued,
+ * and only written once enough bytes have piled up (or the response ends). The
+ * socket is non-blocking, so whatever it doesn't take stays queued until the
+ * client is ready to receive it. Otherwise, this is a plain write().
+ *
+ * Returns 0 or an errno.
+ */
+int
+event_loop_send(int fd, unsigned char const *data, size_t len)
+{
+	struct rtr_conn *conn;
+	int error;
+
+	conn = (loops != NULL) ? pthread_getspecific(serving_key) : NULL;
+	if (conn == NULL || conn->fd != fd) {
+		if (write(fd, data, len) < 0)
+			return errno;
+		metrics_rtr_sent(len);
+		return 0;
+	}
+
+	error = outq_push(&conn->out, data, len);
+	if (error)
+		return error;
+	conn->response.bytes += len;
+	metrics_rtr_sent(len);
+
+	/* Not conn_flush(); the response isn't over. */
+	return (conn->out.len >= flush_threshold)
+	    ? outq_flush(&conn->out, fd, &conn->response.syscalls)
+	    : 0;
+}
+
+/*
+ * Like event_loop_send(), except @data is queued by reference. It will not be
+ * copied, and must remain valid until @release(@arg) is called. (Which is
+ * guaranteed to happen, even on failure.)
+ */
+int
+event_loop_send_ref(int fd, unsigned char const *data, size_t len,
+    out_release_cb release, void *arg)
+{
+	struct rtr_conn *conn;
+	int error;
+
+	conn = (loops != NULL) ? pthread_getspecific(serving_key) : NULL;
+	if (conn == NULL || conn->fd != fd) {
+		error = event_loop_send(fd, data, len);
+		release(arg);
+		return error;
+	}
+
+	error = outq_push_ref(&conn->out, data, len, release, arg);
+	if (error)
+		return error;
+	conn->response.bytes += len;
+	metrics_rtr_sent(len);
+
+	return (conn->out.len >= flush_threshold)
+	    ? outq_flush(&conn->out, fd, &conn->response.syscalls)
+	    : 0;
+}
@@ -0,0 +1,27 @@
+#ifndef SRC_RTR_EVENT_LOOP_H_
+#define SRC_RTR_EVENT_LOOP_H_
+
+#include <stddef.h>
+#include <sys/socket.h>
+
+#include "rtr/out_queue.h"
+#include "rtr/db/vrp.h"
+
+/*
+ * A fixed pool of threads (see --server.workers) that multiplex the RTR client
+ * connections. Each thread owns a share of the connections for their entire
+ * lifetime: reads, PDU handling, writes and closing all happen on the same
+ * thread, so the connections need no locking.
+ */
+
+int event_loops_start(void);
+void event_loops_stop(void);
+
+int event_loop_add_client(int, struct sockaddr_storage *);
+void event_loops_notify(serial_t);
+
+int event_loop_send(int, unsigned char const *, size_t);
+int event_loop_send_ref(int, unsigned char const *, size_t, out_release_cb,
+    void *);
+
+#endif /* SRC_RTR_EVENT_LOOP_H_ */
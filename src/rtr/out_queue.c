@@ -0,0 +1,210 @@
+#include "rtr/out_queue.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+/* Coalesced PDUs are gathered in chunks of (at least) this size. */
+#define CHUNK_LEN		16384
+/* Chunks handed to a single writev() */
+#define FLUSH_IOV_LEN		64
+
+void
+outq_init(struct out_queue *queue)
+{
+	TAILQ_INIT(&queue->chunks);
+	queue->len = 0;
+}
+
+static void
+chunk_destroy(struct out_chunk *chunk)
+{
+	if (chunk->release != NULL)
+		chunk->release(chunk->release_arg);
+	else
+		free(chunk->data);
+	free(chunk);
+}
+
+void
+outq_cleanup(struct out_queue *queue)
+{
+	struct out_chunk *chunk;
+
+	while (!TAILQ_EMPTY(&queue->chunks)) {
+		chunk = TAILQ_FIRST(&queue->chunks);
+		TAILQ_REMOVE(&queue->chunks, chunk, next);
+		chunk_destroy(chunk);
+	}
+	queue->len = 0;
+}
+
+bool
+outq_empty(struct out_queue const *queue)
+{
+	return queue->len == 0;
+}
+
+static struct out_chunk *
+chunk_create(size_t capacity)
+{
+	struct out_chunk *chunk;
+
+	chunk = malloc(sizeof(struct out_chunk));
+	if (chunk == NULL)
+		return NULL;
+
+	chunk->data = malloc(capacity);
+	if (chunk->data == NULL) {
+		free(chunk);
+		return NULL;
+	}
+	chunk->start = 0;
+	chunk->end = 0;
+	chunk->capacity = capacity;
+	chunk->release = NULL;
+	chunk->release_arg = NULL;
+	return chunk;
+}
+
+/*
+ * Appends a copy of @data to the end of @queue.
+ * Returns 0 or ENOMEM.
+ */
+int
+outq_push(struct out_queue *queue, unsigned char const *data, size_t len)
+{
+	struct out_chunk *chunk;
+	size_t room;
+
+	chunk = TAILQ_LAST(&queue->chunks, out_chunks);
+	if (chunk != NULL && chunk->release == NULL) {
+		room = chunk->capacity - chunk->end;
+		if (room > len)
+			room = len;
+		memcpy(chunk->data + chunk->end, data, room);
+		chunk->end += room;
+		queue->len += room;
+		data += room;
+		len -= room;
+	}
+
+	if (len == 0)
+		return 0;
+
+	chunk = chunk_create((len > CHUNK_LEN) ? len : CHUNK_LEN);
+	if (chunk == NULL)
+		return ENOMEM;
+	memcpy(chunk->data, data, len);
+	chunk->end = len;
+	queue->len += len;
+	TAILQ_INSERT_TAIL(&queue->chunks, chunk, next);
+	return 0;
+}
+
+/*
+ * Appends @data to the end of @queue, without copying it. @data must remain
+ * valid until @queue calls @release(@arg), which it will do even on failure.
+ *
+ * Returns 0 or ENOMEM.
+ */
+int
+outq_push_ref(struct out_queue *queue, unsigned char const *data, size_t len,
+    out_release_cb release, void *arg)
+{
+	struct out_chunk *chunk;
+
+	if (len == 0) {
+		release(arg);
+		return 0;
+	}
+
+	chunk = malloc(sizeof(struct out_chunk));
+	if (chunk == NULL) {
+		release(arg);
+		return ENOMEM;
+	}
+
+	/* Not actually modified; see out_chunk.release. */
+	chunk->data = (unsigned char *)data;
+	chunk->start = 0;
+	chunk->end = len;
+	chunk->capacity = len;
+	chunk->release = release;
+	chunk->release_arg = arg;
+
+	queue->len += len;
+	TAILQ_INSERT_TAIL(&queue->chunks, chunk, next);
+	return 0;
+}
+
+/* Forgets the first @written bytes of @queue. */
+static void
+consume(struct out_queue *queue, size_t written)
+{
+	struct out_chunk *chunk;
+	size_t pending;
+
+	queue->len -= written;
+
+	while (written > 0) {
+		chunk = TAILQ_FIRST(&queue->chunks);
+		pending = chunk->end - chunk->start;
+		if (written < pending) {
+			chunk->start += written;
+			return;
+		}
+
+		written -= pending;
+		if (TAILQ_NEXT(chunk, next) == NULL && chunk->release == NULL) {
+			/* Keep the last one around for the next response. */
+			chunk->start = 0;
+			chunk->end = 0;
+			return;
+		}
+		TAILQ_REMOVE(&queue->chunks, chunk, next);
+		chunk_destroy(chunk);
+	}
+}
+
+/*
+ * Writes as much of @queue into @fd as the latter will take.
+ * Every write syscall is tallied in @syscalls.
+ *
+ * Returns 0 (whether the queue was drained or the socket is full) or an errno.
+ */
+int
+outq_flush(struct out_queue *queue, int fd, unsigned int *syscalls)
+{
+	struct iovec iov[FLUSH_IOV_LEN];
+	struct out_chunk *chunk;
+	ssize_t written;
+	int iovcnt;
+
+	while (!outq_empty(queue)) {
+		iovcnt = 0;
+		TAILQ_FOREACH(chunk, &queue->chunks, next) {
+			if (chunk->start == chunk->end)
+				continue;
+			iov[iovcnt].iov_base = chunk->data + chunk->start;
+			iov[iovcnt].iov_len = chunk->end - chunk->start;
+			if (++iovcnt == FLUSH_IOV_LEN)
+				break;
+		}
+
+		written = writev(fd, iov, iovcnt);
+		(*syscalls)++;
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			return errno;
+		}
+
+		consume(queue, written);
+	}
+
+	return 0;
+}
@@ -0,0 +1,49 @@
+#ifndef SRC_RTR_OUT_QUEUE_H_
+#define SRC_RTR_OUT_QUEUE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/queue.h>
+
+/*
+ * Bytes on their way to an RTR client.
+ *
+ * Small PDUs are coalesced into a few large chunks, which are then handed to
+ * the kernel with a single writev() each time the socket is ready. Large
+ * pre-serialized buffers are queued by reference instead; they are never
+ * copied in userspace.
+ */
+
+typedef void (*out_release_cb)(void *);
+
+struct out_chunk {
+	unsigned char *data;
+	/* Pending bytes are data[start, end). */
+	size_t start;
+	size_t end;
+	size_t capacity;
+	/*
+	 * If not NULL, @data belongs to someone else (and is read-only);
+	 * release(@release_arg) is called once it's no longer needed.
+	 */
+	out_release_cb release;
+	void *release_arg;
+	TAILQ_ENTRY(out_chunk) next;
+};
+
+struct out_queue {
+	TAILQ_HEAD(out_chunks, out_chunk) chunks;
+	/* Total pending bytes */
+	size_t len;
+};
+
+void outq_init(struct out_queue *);
+void outq_cleanup(struct out_queue *);
+
+bool outq_empty(struct out_queue const *);
+int outq_push(struct out_queue *, unsigned char const *, size_t);
+int outq_push_ref(struct out_queue *, unsigned char const *, size_t,
+    out_release_cb, void *);
+int outq_flush(struct out_queue *, int, unsigned int *);
+
+#endif /* SRC_RTR_OUT_QUEUE_H_ */
@@ -104,22 +104,51 @@ validate_rtr_version(int fd, struct pdu_header *header,
 	return clients_set_rtr_version(fd, header->protocol_version);
 }
 
+size_t
+pdu_bytes_needed(unsigned char const *bytes, size_t bytes_len)
+{
+	uint32_t length;
+
+	if (bytes_len < RTRPDU_HDR_LEN)
+		return RTRPDU_HDR_LEN;
+
+	length = (((uint32_t)bytes[4]) << 24)
+	    | (((uint32_t)bytes[5]) << 16)
+	    | (((uint32_t)bytes[6]) << 8)
+	    | ((uint32_t)bytes[7]);
+
+	/* Bogus lengths are rejected by pdu_load() after the header alone. */
+	if (length < RTRPDU_HDR_LEN || length > RTRPDU_MAX_INCOMING_LEN)
+		return RTRPDU_HDR_LEN;
+
+	return length;
+}
+
+/*
+ * Parses the PDU that starts at @bytes.
+ *
+ * @bytes_len must be at least pdu_bytes_needed(@bytes, @bytes_len). On
+ * success, the PDU spans the first @request->bytes_len bytes of @bytes, and
+ * the caller owns @request's memory. (Release it with the metadata's
+ * destructor.)
+ */
 int
-pdu_load(int fd, struct sockaddr_storage *client_addr,
-    struct rtr_request *request, struct pdu_metadata const **metadata)
+pdu_load(int fd, struct sockaddr_storage *client_addr, unsigned char *bytes,
+    size_t bytes_len, struct rtr_request *request,
+    struct pdu_metadata const **metadata)
 {
-	unsigned char hdr_bytes[RTRPDU_HDR_LEN];
+	unsigned char *hdr_bytes;
 	struct pdu_reader reader;
 	struct pdu_header header;
 	struct pdu_metadata const *meta;
 	uint8_t version;
 	int error;
 
-	/* Read the header into its buffer. */
-	error = pdu_reader_init(&reader, fd, hdr_bytes, RTRPDU_HDR_LEN, true);
-	if (error)
-		/* Communication interrupted; omit error response */
-		return error;
+	if (bytes_len < pdu_bytes_needed(bytes, bytes_len))
+		pr_crit("PDU parse requested before the PDU was fully read.");
+
+	hdr_bytes = bytes;
+	pdu_reader_wrap(&reader, hdr_bytes, RTRPDU_HDR_LEN);
 	error = pdu_header_from_reader(&reader, &header);
 	if (error)
 		/* No error response because the PDU might have been an error */
@@ -158,25 +187,20 @@ pdu_load(int fd, struct sockaddr_storage *client_addr,
 	 * Most error messages are bound to be two phrases tops.
 	 * (Warning: I'm assuming english tho.)
 	 */
-	if (header.length > 512)
+	if (header.length > RTRPDU_MAX_INCOMING_LEN)
 		return RESPOND_ERROR(err_pdu_send_invalid_request_truncated(fd,
 		    version, hdr_bytes, "PDU is too large. (> 512 bytes)"));
 
-	/* Read the rest of the PDU into its buffer. */
+	/* Copy the PDU into its own buffer; @bytes will be recycled. */
 	request->bytes_len = header.length;
 	request->bytes = malloc(header.length);
 	if (request->bytes == NULL)
 		/* No error report PDU on allocation failures. */
 		return pr_enomem();
 
-	memcpy(request->bytes, hdr_bytes, RTRPDU_HDR_LEN);
-	error = pdu_reader_init(&reader, fd,
-	    request->bytes + RTRPDU_HDR_LEN,
-	    header.length - RTRPDU_HDR_LEN,
-	    false);
-	if (error)
-		/* Communication interrupted; no error PDU. */
-		goto revert_bytes;
+	memcpy(request->bytes, bytes, header.length);
+	pdu_reader_wrap(&reader, request->bytes + RTRPDU_HDR_LEN,
+	    header.length - RTRPDU_HDR_LEN);
 
 	/* Deserialize the PDU. */
 	meta = pdu_get_metadata(header.pdu_type);
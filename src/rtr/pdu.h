@@ -59,6 +59,8 @@ char const *pdutype2str(enum pdu_type);
 /* Ignores Error Report PDUs, which is fine. */
 #define RTRPDU_MAX_LEN			RTRPDU_IPV6_PREFIX_LEN
 #define RTRPDU_ERR_MAX_LEN		256
+/* Largest PDU we're willing to receive. See pdu_load(). */
+#define RTRPDU_MAX_INCOMING_LEN		512
 
 struct pdu_header {
 	uint8_t	protocol_version;
@@ -157,8 +159,9 @@ struct pdu_metadata {
 	void	(*destructor)(void *);
 };
 
-int pdu_load(int, struct sockaddr_storage *, struct rtr_request *,
-    struct pdu_metadata const **);
+size_t pdu_bytes_needed(unsigned char const *, size_t);
+int pdu_load(int, struct sockaddr_storage *, unsigned char *, size_t,
+    struct rtr_request *, struct pdu_metadata const **);
 struct pdu_metadata const *pdu_get_metadata(uint8_t);
 struct pdu_header *pdu_get_header(void *);
 
@@ -26,7 +26,7 @@ int
 handle_serial_query_pdu(int fd, struct rtr_request const *request)
 {
 	struct serial_query_pdu *query = request->pdu;
-	struct deltas_db deltas;
+	struct pdu_stream *delta_pdus;
 	serial_t final_serial;
 	uint8_t version;
 	int error;
@@ -45,37 +45,30 @@ handle_serial_query_pdu(int fd, struct rtr_request const *request)
 		    "Session ID doesn't match.");
 
 	/*
-	 * For the record, there are two reasons why we want to work on a
-	 * (shallow) copy of the deltas (as opposed to eg. a foreach):
-	 * 1. We need to remove deltas that cancel each other.
-	 *    (Which can't be done directly on the DB.)
-	 * 2. It's probably best not to hold the VRPS read lock while writing
-	 *    PDUs, to minimize writer stagnation.
+	 * The deltas are filtered (announcements and withdrawals that cancel
+	 * each other are removed) and serialized only once per serial range,
+	 * and then shared by every router that asks for that range.
 	 */
 
-	deltas_db_init(&deltas);
-	error = vrps_get_deltas_from(query->serial_number, &final_serial,
-	    &deltas);
+	error = vrps_get_delta_pdus(query->serial_number, version, &delta_pdus,
+	    &final_serial);
 	switch (error) {
 	case 0:
 		break;
 	case -EAGAIN: /* Database still under construction */
-		error = err_pdu_send_no_data_available(fd, version);
-		goto end;
+		return err_pdu_send_no_data_available(fd, version);
 	case -ESRCH: /* Invalid serial */
 		/* https://tools.ietf.org/html/rfc6810#section-6.3 */
-		error = send_cache_reset_pdu(fd, version);
-		goto end;
+		return send_cache_reset_pdu(fd, version);
 	case -ENOMEM: /* Memory allocation failure */
-		goto end;
+		return error;
 	case EAGAIN: /* Too many threads */
 		/*
 		 * I think this should be more of a "try again" thing, but
 		 * RTR does not provide a code for that. Just fall through.
 		 */
 	default:
-		error = err_pdu_send_internal_error(fd, version);
-		goto end;
+		return err_pdu_send_internal_error(fd, version);
 	}
 
 	/*
@@ -86,112 +79,49 @@ handle_serial_query_pdu(int fd, struct rtr_request const *request)
 	 */
 
 	error = send_cache_response_pdu(fd, version);
+	if (!error)
+		error = send_pdu_stream(fd, delta_pdus);
+	pdu_stream_refput(delta_pdus);
 	if (error)
-		goto end;
-	error = send_delta_pdus(fd, version, &deltas);
-	if (error)
-		goto end;
-	error = send_end_of_data_pdu(fd, version, final_serial);
-
-end:
-	deltas_db_cleanup(&deltas, deltagroup_cleanup);
-	return error;
-}
-
-struct base_roa_args {
-	bool started;
-	int fd;
-	uint8_t version;
-};
-
-static int
-send_base_roa(struct vrp const *vrp, void *arg)
-{
-	struct base_roa_args *args = arg;
-	int error;
-
-	if (!args->started) {
-		error = send_cache_response_pdu(args->fd, args->version);
-		if (error)
-			return error;
-		args->started = true;
-	}
-
-	return send_prefix_pdu(args->fd, args->version, vrp, FLAG_ANNOUNCEMENT);
-}
-
-
-
-static int
-send_base_router_key(struct router_key const *key, void *arg)
-{
-	struct base_roa_args *args = arg;
-	int error;
-
-	if (!args->started) {
-		error = send_cache_response_pdu(args->fd, args->version);
-		if (error)
-			return error;
-		args->started = true;
-	}
+		return error;
 
-	return send_router_key_pdu(args->fd, args->version, key,
-	    FLAG_ANNOUNCEMENT);
+	return send_end_of_data_pdu(fd, version, final_serial);
 }
 
 int
 handle_reset_query_pdu(int fd, struct rtr_request const *request)
 {
 	struct reset_query_pdu *pdu = request->pdu;
-	struct base_roa_args args;
+	struct pdu_stream *base_pdus;
 	serial_t current_serial;
+	uint8_t version;
 	int error;
 
-	args.started = false;
-	args.fd = fd;
-	args.version = pdu->header.protocol_version;
-
-	error = get_last_serial_number(&current_serial);
-	switch (error) {
-	case 0:
-		break;
-	case -EAGAIN:
-		return err_pdu_send_no_data_available(fd, args.version);
-	default:
-		err_pdu_send_internal_error(fd, args.version);
-		return error;
-	}
+	version = pdu->header.protocol_version;
 
 	/*
-	 * It's probably best not to work on a copy, because the tree is large.
-	 * Unfortunately, this means we'll have to encourage writer stagnation,
-	 * but thankfully, most clients are supposed to request far more serial
-	 * queries than reset queries.
+	 * The base was already serialized by vrps_update(), so every client
+	 * shares the same bytes, and the serial is guaranteed to match them.
 	 */
-
-	error = vrps_foreach_base(send_base_roa, send_base_router_key, &args);
-
-	/* See handle_serial_query_pdu() for some comments. */
+	error = vrps_get_base_pdus(version, &base_pdus, &current_serial);
 	switch (error) {
 	case 0:
-		/* Assure that cache response is (or was) sent */
-		if (args.started)
-			break;
-		error = send_cache_response_pdu(fd, args.version);
-		if (error)
-			return error;
 		break;
 	case -EAGAIN:
-		return err_pdu_send_no_data_available(fd, args.version);
-	case EAGAIN:
-		err_pdu_send_internal_error(fd, args.version);
-		return error;
+		return err_pdu_send_no_data_available(fd, version);
 	default:
-		/* Any other error must stop sending more PDUs */
+		err_pdu_send_internal_error(fd, version);
 		return error;
 	}
 
-	return send_end_of_data_pdu(fd, args.version, current_serial);
+	error = send_cache_response_pdu(fd, version);
+	if (!error)
+		error = send_pdu_stream(fd, base_pdus);
+	pdu_stream_refput(base_pdus);
+	if (error)
+		return error;
+
+	return send_end_of_data_pdu(fd, version, current_serial);
 }
 
 int
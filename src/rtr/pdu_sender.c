@@ -11,6 +11,7 @@
 #include "common.h"
 #include "config.h"
 #include "log.h"
+#include "rtr/event_loop.h"
 #include "rtr/pdu_serializer.h"
 #include "rtr/db/vrps.h"
 
@@ -33,9 +34,9 @@ send_response(int fd, uint8_t pdu_type, unsigned char *data, size_t data_len)
 
 	pr_op_debug("Sending %s to client.", pdutype2str(pdu_type));
 
-	error = write(fd, data, data_len);
-	if (error < 0)
-		return pr_op_errno(errno, "Error sending %s to client.",
+	error = event_loop_send(fd, data, data_len);
+	if (error)
+		return pr_op_errno(error, "Error sending %s to client.",
 		    pdutype2str(pdu_type));
 
 	return 0;
@@ -99,167 +100,31 @@ send_cache_response_pdu(int fd, uint8_t version)
 }
 
 static void
-pr_debug_prefix4(struct ipv4_prefix_pdu *pdu)
-{
-	char buffer[INET_ADDRSTRLEN];
-
-	pr_op_debug("Encoded prefix %s/%u into a PDU.",
-	    addr2str4(&pdu->ipv4_prefix, buffer), pdu->prefix_length);
-}
-
-static int
-send_ipv4_prefix_pdu(int fd, uint8_t version, struct vrp const *vrp,
-    uint8_t flags)
-{
-	struct ipv4_prefix_pdu pdu;
-	unsigned char data[RTRPDU_IPV4_PREFIX_LEN];
-	size_t len;
-
-	set_header_values(&pdu.header, version, PDU_TYPE_IPV4_PREFIX, 0);
-	pdu.header.length = RTRPDU_IPV4_PREFIX_LEN;
-
-	pdu.flags = flags;
-	pdu.prefix_length = vrp->prefix_length;
-	pdu.max_length = vrp->max_prefix_length;
-	pdu.zero = 0;
-	pdu.ipv4_prefix = vrp->prefix.v4;
-	pdu.asn = vrp->asn;
-
-	len = serialize_ipv4_prefix_pdu(&pdu, data);
-	if (len != RTRPDU_IPV4_PREFIX_LEN)
-		pr_crit("Serialized IPv4 Prefix is %zu bytes.", len);
-	if (log_op_debug_enabled())
-		pr_debug_prefix4(&pdu);
-
-	return send_response(fd, pdu.header.pdu_type, data, len);
-}
-
-static void
-pr_debug_prefix6(struct ipv6_prefix_pdu *pdu)
-{
-	char buffer[INET6_ADDRSTRLEN];
-
-	pr_op_debug("Encoded prefix %s/%u into a PDU.",
-	    addr2str6(&pdu->ipv6_prefix, buffer), pdu->prefix_length);
-}
-
-static int
-send_ipv6_prefix_pdu(int fd, uint8_t version, struct vrp const *vrp,
-    uint8_t flags)
-{
-	struct ipv6_prefix_pdu pdu;
-	unsigned char data[RTRPDU_IPV6_PREFIX_LEN];
-	size_t len;
-
-	set_header_values(&pdu.header, version, PDU_TYPE_IPV6_PREFIX, 0);
-	pdu.header.length = RTRPDU_IPV6_PREFIX_LEN;
-
-	pdu.flags = flags;
-	pdu.prefix_length = vrp->prefix_length;
-	pdu.max_length = vrp->max_prefix_length;
-	pdu.zero = 0;
-	pdu.ipv6_prefix = vrp->prefix.v6;
-	pdu.asn = vrp->asn;
-
-	len = serialize_ipv6_prefix_pdu(&pdu, data);
-	if (len != RTRPDU_IPV6_PREFIX_LEN)
-		pr_crit("Serialized IPv6 Prefix is %zu bytes.", len);
-	if (log_op_debug_enabled())
-		pr_debug_prefix6(&pdu);
-
-	return send_response(fd, pdu.header.pdu_type, data, len);
-}
-
-int
-send_prefix_pdu(int fd, uint8_t version, struct vrp const *vrp, uint8_t flags)
+release_pdu_stream(void *stream)
 {
-	switch (vrp->addr_fam) {
-	case AF_INET:
-		return send_ipv4_prefix_pdu(fd, version, vrp, flags);
-	case AF_INET6:
-		return send_ipv6_prefix_pdu(fd, version, vrp, flags);
-	}
-
-	return -EINVAL;
+	pdu_stream_refput(stream);
 }
 
+/*
+ * Queues the already serialized PDUs from @stream, without copying them.
+ * The stream stays referenced until the client has received all of them.
+ */
 int
-send_router_key_pdu(int fd, uint8_t version,
-    struct router_key const *router_key, uint8_t flags)
-{
-	struct router_key_pdu pdu;
-	unsigned char data[RTRPDU_ROUTER_KEY_LEN];
-	size_t len;
-	uint16_t reserved;
-
-	/* Sanity check: this can't be sent on RTRv0 */
-	if (version == RTR_V0)
-		return 0;
-
-	reserved = 0;
-	/* Set the flags at the first 8 bits of reserved field */
-	reserved += (flags << 8);
-	set_header_values(&pdu.header, version, PDU_TYPE_ROUTER_KEY, reserved);
-	pdu.header.length = RTRPDU_ROUTER_KEY_LEN;
-
-	memcpy(pdu.ski, router_key->ski, RK_SKI_LEN);
-	pdu.ski_len = RK_SKI_LEN;
-	pdu.asn = router_key->as;
-	memcpy(pdu.spki, router_key->spk, RK_SPKI_LEN);
-	pdu.spki_len = RK_SPKI_LEN;
-
-	len = serialize_router_key_pdu(&pdu, data);
-	if (len != RTRPDU_ROUTER_KEY_LEN)
-		pr_crit("Serialized Router Key PDU is %zu bytes, not the expected %u.",
-		    len, pdu.header.length);
-
-	return send_response(fd, pdu.header.pdu_type, data, len);
-}
-
-struct simple_param {
-	int	fd;
-	uint8_t	version;
-};
-
-static int
-vrp_simply_send(struct delta_vrp const *delta, void *arg)
-{
-	struct simple_param *param = arg;
-
-	return send_prefix_pdu(param->fd, param->version, &delta->vrp,
-	    delta->flags);
-}
-
-static int
-router_key_simply_send(struct delta_router_key const *delta, void *arg)
+send_pdu_stream(int fd, struct pdu_stream *stream)
 {
-	struct simple_param *param = arg;
+	int error;
 
-	return send_router_key_pdu(param->fd, param->version,
-	    &delta->router_key, delta->flags);
-}
+	pr_op_debug("Sending %zu bytes of pre-serialized PDUs to client.",
+	    stream->len);
 
-int
-send_delta_pdus(int fd, uint8_t version, struct deltas_db *deltas)
-{
-	struct delta_group *group;
-	struct simple_param param;
-
-	param.fd = fd;
-	param.version = version;
-
-	/*
-	 * Short circuit: Entries that share serial are already guaranteed to
-	 * not contradict each other, so no filtering required.
-	 */
-	if (deltas->len == 1) {
-		group = &deltas->array[0];
-		return deltas_foreach(group->serial, group->deltas,
-		    vrp_simply_send, router_key_simply_send, &param);
-	}
+	pdu_stream_refget(stream);
+	error = event_loop_send_ref(fd, stream->bytes, stream->len,
+	    release_pdu_stream, stream);
+	if (error)
+		return pr_op_errno(error,
+		    "Error sending pre-serialized PDUs to client.");
 
-	return vrps_foreach_filtered_delta(deltas, vrp_simply_send,
-	    router_key_simply_send, &param);
+	return 0;
 }
 
 #define GET_END_OF_DATA_LENGTH(version)					\
@@ -3,14 +3,13 @@
 
 #include "pdu.h"
 #include "object/router_key.h"
+#include "rtr/pdu_stream.h"
 #include "rtr/db/vrps.h"
 
 int send_serial_notify_pdu(int, uint8_t, serial_t);
 int send_cache_reset_pdu(int, uint8_t);
 int send_cache_response_pdu(int, uint8_t);
-int send_prefix_pdu(int, uint8_t, struct vrp const *, uint8_t);
-int send_router_key_pdu(int, uint8_t, struct router_key const *, uint8_t);
-int send_delta_pdus(int, uint8_t, struct deltas_db *);
+int send_pdu_stream(int, struct pdu_stream *);
 int send_end_of_data_pdu(int, uint8_t, serial_t);
 int send_error_report_pdu(int, uint8_t, uint16_t, struct rtr_request const *,
     char *);
@@ -2,6 +2,8 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h> /* AF_INET, AF_INET6 (needed in OpenBSD) */
+#include <sys/socket.h> /* AF_INET, AF_INET6 (needed in OpenBSD) */
 #include "primitive_writer.h"
 
 static size_t
@@ -161,3 +163,75 @@ serialize_error_report_pdu(struct error_report_pdu *pdu, unsigned char *buf)
 
 	return ptr - buf;
 }
+
+/*
+ * Serializes @vrp as an IPv4 or IPv6 Prefix PDU, depending on its address
+ * family. @buf must be at least RTRPDU_MAX_LEN bytes long.
+ *
+ * Returns the length of the PDU, or 0 if @vrp's address family is unknown.
+ */
+size_t
+serialize_prefix(uint8_t version, struct vrp const *vrp, uint8_t flags,
+    unsigned char *buf)
+{
+	struct ipv4_prefix_pdu pdu4;
+	struct ipv6_prefix_pdu pdu6;
+
+	switch (vrp->addr_fam) {
+	case AF_INET:
+		pdu4.header.protocol_version = version;
+		pdu4.header.pdu_type = PDU_TYPE_IPV4_PREFIX;
+		pdu4.header.m.reserved = 0;
+		pdu4.header.length = RTRPDU_IPV4_PREFIX_LEN;
+		pdu4.flags = flags;
+		pdu4.prefix_length = vrp->prefix_length;
+		pdu4.max_length = vrp->max_prefix_length;
+		pdu4.zero = 0;
+		pdu4.ipv4_prefix = vrp->prefix.v4;
+		pdu4.asn = vrp->asn;
+		return serialize_ipv4_prefix_pdu(&pdu4, buf);
+
+	case AF_INET6:
+		pdu6.header.protocol_version = version;
+		pdu6.header.pdu_type = PDU_TYPE_IPV6_PREFIX;
+		pdu6.header.m.reserved = 0;
+		pdu6.header.length = RTRPDU_IPV6_PREFIX_LEN;
+		pdu6.flags = flags;
+		pdu6.prefix_length = vrp->prefix_length;
+		pdu6.max_length = vrp->max_prefix_length;
+		pdu6.zero = 0;
+		pdu6.ipv6_prefix = vrp->prefix.v6;
+		pdu6.asn = vrp->asn;
+		return serialize_ipv6_prefix_pdu(&pdu6, buf);
+	}
+
+	return 0;
+}
+
+/*
+ * Serializes @key as a Router Key PDU. @buf must be at least
+ * RTRPDU_ROUTER_KEY_LEN bytes long.
+ *
+ * Returns the length of the PDU, which is 0 on RTRv0. (Router Keys don't exist
+ * in that version.)
+ */
+size_t
+serialize_router_key(uint8_t version, struct router_key const *key,
+    uint8_t flags, unsigned char *buf)
+{
+	struct router_key_pdu pdu;
+
+	pdu.header.protocol_version = version;
+	pdu.header.pdu_type = PDU_TYPE_ROUTER_KEY;
+	/* Set the flags at the first 8 bits of reserved field */
+	pdu.header.m.reserved = flags << 8;
+	pdu.header.length = RTRPDU_ROUTER_KEY_LEN;
+
+	memcpy(pdu.ski, key->ski, RK_SKI_LEN);
+	pdu.ski_len = RK_SKI_LEN;
+	pdu.asn = key->as;
+	memcpy(pdu.spki, key->spk, RK_SPKI_LEN);
+	pdu.spki_len = RK_SPKI_LEN;
+
+	return serialize_router_key_pdu(&pdu, buf);
+}
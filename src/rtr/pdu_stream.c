@@ -0,0 +1,127 @@
+#include "rtr/pdu_stream.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include "log.h"
+#include "rtr/pdu.h"
+#include "rtr/pdu_serializer.h"
+
+/* Initial capacity; grows geometrically. */
+#define STREAM_INITIAL_LEN	4096
+
+int
+pdu_stream_create(struct pdu_stream **result)
+{
+	struct pdu_stream *stream;
+
+	stream = malloc(sizeof(struct pdu_stream));
+	if (stream == NULL)
+		return pr_enomem();
+
+	stream->bytes = NULL;
+	stream->len = 0;
+	stream->capacity = 0;
+	atomic_init(&stream->references, 1);
+
+	*result = stream;
+	return 0;
+}
+
+void
+pdu_stream_refget(struct pdu_stream *stream)
+{
+	atomic_fetch_add(&stream->references, 1);
+}
+
+void
+pdu_stream_refput(struct pdu_stream *stream)
+{
+	/*
+	 * Reminder: atomic_fetch_sub() returns the previous value, not the
+	 * resulting one.
+	 */
+	if (atomic_fetch_sub(&stream->references, 1) == 1) {
+		free(stream->bytes);
+		free(stream);
+	}
+}
+
+/* Makes sure there's room for at least @len more bytes. */
+static int
+reserve(struct pdu_stream *stream, size_t len)
+{
+	unsigned char *tmp;
+	size_t capacity;
+
+	if (stream->capacity - stream->len >= len)
+		return 0;
+
+	capacity = (stream->capacity != 0)
+	    ? stream->capacity
+	    : STREAM_INITIAL_LEN;
+	while (capacity - stream->len < len)
+		capacity <<= 1;
+
+	tmp = realloc(stream->bytes, capacity);
+	if (tmp == NULL)
+		return pr_enomem();
+
+	stream->bytes = tmp;
+	stream->capacity = capacity;
+	return 0;
+}
+
+int
+pdu_stream_add_prefix(struct pdu_stream *stream, uint8_t version,
+    struct vrp const *vrp, uint8_t flags)
+{
+	size_t len;
+	int error;
+
+	error = reserve(stream, RTRPDU_MAX_LEN);
+	if (error)
+		return error;
+
+	len = serialize_prefix(version, vrp, flags, stream->bytes + stream->len);
+	if (len == 0)
+		return -EINVAL;
+
+	stream->len += len;
+	return 0;
+}
+
+/* Router Keys don't exist in RTRv0, so they're skipped in that version. */
+int
+pdu_stream_add_router_key(struct pdu_stream *stream, uint8_t version,
+    struct router_key const *key, uint8_t flags)
+{
+	int error;
+
+	if (version == RTR_V0)
+		return 0;
+
+	error = reserve(stream, RTRPDU_ROUTER_KEY_LEN);
+	if (error)
+		return error;
+
+	stream->len += serialize_router_key(version, key, flags,
+	    stream->bytes + stream->len);
+	return 0;
+}
+
+/* Done adding PDUs; gives back the unused memory. */
+void
+pdu_stream_seal(struct pdu_stream *stream)
+{
+	unsigned char *tmp;
+
+	if (stream->len == stream->capacity || stream->len == 0)
+		return;
+
+	tmp = realloc(stream->bytes, stream->len);
+	if (tmp == NULL)
+		return; /* Fine; keep the larger buffer. */
+
+	stream->bytes = tmp;
+	stream->capacity = stream->len;
+}
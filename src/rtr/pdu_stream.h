@@ -0,0 +1,32 @@
+#ifndef SRC_RTR_PDU_STREAM_H_
+#define SRC_RTR_PDU_STREAM_H_
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include "rtr/db/vrp.h"
+
+/*
+ * A sequence of PDUs, already serialized, which can be shared by every client
+ * that needs to receive it.
+ *
+ * Built once, then immutable (so it can be read without locking); released
+ * once its last reference is dropped.
+ */
+struct pdu_stream {
+	unsigned char *bytes;
+	size_t len;
+	size_t capacity;
+	atomic_uint references;
+};
+
+int pdu_stream_create(struct pdu_stream **);
+void pdu_stream_refget(struct pdu_stream *);
+void pdu_stream_refput(struct pdu_stream *);
+
+int pdu_stream_add_prefix(struct pdu_stream *, uint8_t, struct vrp const *,
+    uint8_t);
+int pdu_stream_add_router_key(struct pdu_stream *, uint8_t,
+    struct router_key const *, uint8_t);
+void pdu_stream_seal(struct pdu_stream *);
+
+#endif /* SRC_RTR_PDU_STREAM_H_ */
@@ -60,6 +60,14 @@ pdu_reader_init(struct pdu_reader *reader, int fd, unsigned char *buffer,
 	return read_exact(fd, reader->buffer, size, allow_eof);
 }
 
+/* Like pdu_reader_init(), except @buffer has already been read. */
+void
+pdu_reader_wrap(struct pdu_reader *reader, unsigned char *buffer, size_t size)
+{
+	reader->buffer = buffer;
+	reader->size = size;
+}
+
 static int
 insufficient_bytes(void)
 {
@@ -15,6 +15,7 @@ struct pdu_reader {
 
 int pdu_reader_init(struct pdu_reader *, int, unsigned char *, size_t size,
     bool);
+void pdu_reader_wrap(struct pdu_reader *, unsigned char *, size_t);
 
 int read_int8(struct pdu_reader *, uint8_t *);
 int read_int16(struct pdu_reader *, uint16_t *);
@@ -3,7 +3,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <netdb.h>
-#include <pthread.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -16,18 +16,13 @@
 #include "config.h"
 #include "clients.h"
 #include "log.h"
+#include "metrics.h"
 #include "updates_daemon.h"
 #include "rtr/err_pdu.h"
+#include "rtr/event_loop.h"
 #include "rtr/pdu.h"
 #include "rtr/db/vrps.h"
 
-/* Parameters for each thread that handles client connections */
-struct thread_param {
-	int fd;
-	pthread_t tid;
-	struct sockaddr_storage addr;
-};
-
 /* Parameters for each file descriptor that binds to a server address/socket */
 struct fd_node {
 	int id;
@@ -371,111 +366,20 @@ retry:
 	return VERDICT_RETRY;
 }
 
-static void
-clean_request(struct rtr_request *request, const struct pdu_metadata *meta)
-{
-	free(request->bytes);
-	meta->destructor(request->pdu);
-}
-
-static void
-print_close_failure(int error, int fd)
-{
-	struct sockaddr_storage sockaddr;
-	char buffer[INET6_ADDRSTRLEN];
-	char const *addr_str;
-
-	addr_str = (clients_get_addr(fd, &sockaddr) == 0)
-	    ? sockaddr2str(&sockaddr, buffer)
-	    : "(unknown)";
-
-	pr_op_errno(error, "close() failed on socket of client %s", addr_str);
-}
-
-static void
-end_client(int fd)
-{
-	if (close(fd) != 0)
-		print_close_failure(errno, fd);
-}
-
-static void
-print_client_addr(struct sockaddr_storage *addr, char const *action, int fd)
-{
-	char buffer[INET6_ADDRSTRLEN];
-	pr_op_info("Client %s [ID %d]: %s", action, fd,
-	    sockaddr2str(addr, buffer));
-}
-
-/*
- * The client socket threads' entry routine.
- * @arg must be released.
- */
-static void *
-client_thread_cb(void *arg)
-{
-	struct pdu_metadata const *meta;
-	struct rtr_request request;
-	struct thread_param param;
-	int error;
-
-	memcpy(&param, arg, sizeof(param));
-	free(arg);
-
-	error = clients_add(param.fd, param.addr, param.tid);
-	if (error) {
-		close(param.fd);
-		return NULL;
-	}
-
-	while (true) { /* For each PDU... */
-		error = pdu_load(param.fd, &param.addr, &request, &meta);
-		if (error)
-			break;
-
-		error = meta->handle(param.fd, &request);
-		clean_request(&request, meta);
-		if (error)
-			break;
-	}
-
-	print_client_addr(&param.addr, "closed", param.fd);
-	end_client(param.fd);
-	clients_forget(param.fd);
-
-	/* Release to avoid the wait till the parent tries to join */
-	pthread_detach(param.tid);
-
-	return NULL;
-}
-
-static void
-init_fdset(struct server_fds *fds, fd_set *fdset)
-{
-	struct fd_node *node;
-
-	FD_ZERO (fdset);
-	SLIST_FOREACH(node, fds, next)
-		FD_SET (node->id, fdset);
-
-}
-
 /*
- * Waits for client connections and spawns threads to handle them.
+ * Waits for client connections and hands them over to the event loops.
  */
 static int
 handle_client_connections(struct server_fds *fds)
 {
-	struct fd_node *head_node;
+	struct fd_node *node;
 	struct sigaction ign;
 	struct sockaddr_storage client_addr;
-	struct thread_param *param;
-	struct timeval select_time;
+	struct pollfd *pollfds;
 	socklen_t sizeof_client_addr;
-	fd_set readfds;
-	int last_server_fd;
+	unsigned int nfds;
+	unsigned int i;
 	int client_fd;
-	int fd;
 	int error;
 
 	/* Ignore SIGPIPES, they're handled apart */
@@ -484,38 +388,43 @@ handle_client_connections(struct server_fds *fds)
 	sigemptyset(&ign.sa_mask);
 	sigaction(SIGPIPE, &ign, NULL);
 
-	head_node = SLIST_FIRST(fds);
-	last_server_fd = head_node->id;
-
-	SLIST_FOREACH(head_node, fds, next) {
-		error = listen(head_node->id, config_get_server_queue());
+	nfds = 0;
+	SLIST_FOREACH(node, fds, next) {
+		error = listen(node->id, config_get_server_queue());
 		if (error)
 			return pr_op_errno(errno,
 			    "Couldn't listen on server socket.");
+		nfds++;
 	}
 
-	sizeof_client_addr = sizeof(client_addr);
+	pollfds = calloc(nfds, sizeof(struct pollfd));
+	if (pollfds == NULL)
+		return pr_enomem();
+
+	i = 0;
+	SLIST_FOREACH(node, fds, next) {
+		pollfds[i].fd = node->id;
+		pollfds[i].events = POLLIN;
+		i++;
+	}
 
 	pr_op_debug("Waiting for client connections at server...");
 	do {
-		/* Look for connections every .2 seconds*/
-		select_time.tv_sec = 0;
-		select_time.tv_usec = 200000;
-
-		init_fdset(fds, &readfds);
-
-		if (select(last_server_fd + 1, &readfds, NULL, NULL,
-		    &select_time) == -1) {
-			pr_op_errno(errno, "Monitoring server sockets");
+		/* No timeout; there's nothing else to do in this thread. */
+		if (poll(pollfds, nfds, -1) == -1) {
+			if (errno != EINTR)
+				pr_op_errno(errno, "Monitoring server sockets");
 			continue;
 		}
 
-		for (fd = 0; fd < (last_server_fd + 1); fd++) {
-			if (!FD_ISSET (fd, &readfds))
+		for (i = 0; i < nfds; i++) {
+			if (!(pollfds[i].revents & POLLIN))
 				continue;
 
 			/* Accept the connection */
-			client_fd = accept(fd, (struct sockaddr *) &client_addr,
+			sizeof_client_addr = sizeof(client_addr);
+			client_fd = accept(pollfds[i].fd,
+			    (struct sockaddr *) &client_addr,
 			    &sizeof_client_addr);
 			switch (handle_accept_result(client_fd, errno)) {
 			case VERDICT_SUCCESS:
@@ -523,71 +432,30 @@ handle_client_connections(struct server_fds *fds)
 			case VERDICT_RETRY:
 				continue;
 			case VERDICT_EXIT:
+				free(pollfds);
 				return -EINVAL;
 			}
 
-			print_client_addr(&client_addr, "accepted", client_fd);
-
 			/*
 			 * Note: My gut says that errors from now on (even the
 			 * unknown ones) should be treated as temporary; maybe
 			 * the next accept() will work.
-			 * So don't interrupt the thread when this happens.
+			 * So don't interrupt the loop when this happens.
 			 */
 
-			param = malloc(sizeof(struct thread_param));
-			if (param == NULL) {
-				/* No error PDU on memory allocation. */
-				pr_enomem();
-				close(client_fd);
-				continue;
-			}
-			param->fd = client_fd;
-			param->addr = client_addr;
-
-			error = pthread_create(&param->tid, NULL,
-			    client_thread_cb, param);
-			if (error && error != EAGAIN)
+			error = event_loop_add_client(client_fd, &client_addr);
+			if (error) {
 				/* Error with min RTR version */
 				err_pdu_send_internal_error(client_fd, RTR_V0);
-			if (error) {
-				pr_op_errno(error,
-				    "Could not spawn the client's thread");
 				close(client_fd);
-				free(param);
 			}
 		}
 	} while (true);
 
+	free(pollfds);
 	return 0; /* Unreachable. */
 }
 
-/*
- * Receive @arg to be called as a clients_foreach_cb
- */
-static int
-kill_client(struct client *client, void *arg)
-{
-	end_client(client->fd);
-	print_client_addr(&(client->addr), "terminated", client->fd);
-	/* Don't call clients_forget to avoid deadlock! */
-	return 0;
-}
-
-static void
-end_clients(void)
-{
-	clients_foreach(kill_client, NULL);
-	/* Let the clients be deleted when clients DB is destroyed */
-}
-
-static int
-join_thread(pthread_t tid, void *arg)
-{
-	close_thread(tid, "Client");
-	return 0;
-}
-
 /*
  * Starts the server, using the current thread to listen for RTR client
  * requests. If configuration parameter 'mode' is STANDALONE, then the
@@ -607,30 +475,41 @@ rtr_listen(void)
 	if (error)
 		return error;
 
+	error = metrics_start();
+	if (error)
+		goto revert_clients_db;
+
 	if (config_get_mode() == STANDALONE) {
 		error = vrps_update(&changed);
 		if (error)
 			pr_op_err("Error %d while trying to update the ROA database.",
 			    error);
-		goto revert_clients_db; /* Error 0 it's ok */
+		goto revert_metrics; /* Error 0 it's ok */
 	}
 
 	SLIST_INIT(&fds);
 	error = create_server_sockets(&fds);
 	if (error)
-		goto revert_clients_db;
+		goto revert_metrics;
 
-	error = updates_daemon_start();
+	error = event_loops_start();
 	if (error)
 		goto revert_server_sockets;
 
+	error = updates_daemon_start();
+	if (error)
+		goto revert_event_loops;
+
 	error = handle_client_connections(&fds);
 
-	end_clients();
 	updates_daemon_destroy();
+revert_event_loops:
+	event_loops_stop();
 revert_server_sockets:
 	server_fd_cleanup(&fds);
+revert_metrics:
+	metrics_stop();
 revert_clients_db:
-	clients_db_destroy(join_thread, NULL);
+	clients_db_destroy();
 	return error;
 }
@@ -11,10 +11,18 @@
  * It is one of the core objects in this project. Every time a trust anchor
  * triggers a validation cycle, the validator creates one of these objects and
  * uses it to traverse the tree and keep track of validated data.
+ *
+ * Every additional worker that traverses the same tree gets one as well. Its
+ * certificate stack and buffers are its own. The repository data (what has
+ * already been downloaded during the cycle) is shared by all the TALs, so a
+ * repository reached from several trees is only fetched once.
  */
 struct validation {
 	struct tal *tal;
 
+	/* The TAL thread's state, if this is a worker's. NULL otherwise. */
+	struct validation *parent;
+
 	struct x509_data {
 		/** https://www.openssl.org/docs/man1.1.1/man3/X509_STORE_load_locations.html */
 		X509_STORE *store;
@@ -23,13 +31,25 @@ struct validation {
 
 	struct cert_stack *certstack;
 
+	/* Shared by all the TALs */
 	struct uri_list *rsync_visited_uris;
 
 	/* Local RRDP workspace path */
 	char const *rrdp_workspace;
 
-	/* Shallow copy of RRDP URIs and its corresponding visited uris */
+	/*
+	 * Shallow copy of RRDP URIs and its corresponding visited uris. Also
+	 * shared by all the TALs.
+	 */
 	struct db_rrdp_uri *rrdp_uris;
+	/* Are local files currently looked up in @rrdp_workspace? */
+	bool rrdp_workspace_enabled;
+
+	/*
+	 * Runs the repository fetches of the tree in the background. NULL if
+	 * they have to be done synchronously. Only the TAL thread's is used.
+	 */
+	struct fetch_scheduler *fetches;
 
 	/* Did the TAL's public key match the root certificate's public key? */
 	enum pubkey_state pubkey_state;
@@ -82,16 +102,38 @@ cb(int ok, X509_STORE_CTX *ctx)
 	return (error == X509_V_ERR_UNHANDLED_CRITICAL_EXTENSION) ? 1 : ok;
 }
 
+static int
+init_x509_data(struct x509_data *data)
+{
+	data->store = X509_STORE_new();
+	if (!data->store)
+		return val_crypto_err("X509_STORE_new() returned NULL");
+
+	data->params = X509_VERIFY_PARAM_new();
+	if (data->params == NULL) {
+		X509_STORE_free(data->store);
+		return pr_enomem();
+	}
+
+	X509_VERIFY_PARAM_set_flags(data->params, X509_V_FLAG_CRL_CHECK);
+	X509_STORE_set1_param(data->store, data->params);
+	X509_STORE_set_verify_cb(data->store, cb);
+	return 0;
+}
+
 /**
  * Creates a struct validation, puts it in thread local, and (incidentally)
  * returns it.
+ *
+ * @rsync_visited_uris is shared by all the TALs of the cycle, and it's not
+ * destroyed along with the state.
  */
 int
 validation_prepare(struct validation **out, struct tal *tal,
+    struct uri_list *rsync_visited_uris,
     struct validation_handler *validation_handler)
 {
 	struct validation *result;
-	X509_VERIFY_PARAM *params;
 	int error;
 
 	result = malloc(sizeof(struct validation));
@@ -104,44 +146,74 @@ validation_prepare(struct validation **out, struct tal *tal,
 
 	result->tal = tal;
 
-	result->x509_data.store = X509_STORE_new();
-	if (!result->x509_data.store) {
-		error = val_crypto_err("X509_STORE_new() returned NULL");
+	error = init_x509_data(&result->x509_data);
+	if (error)
 		goto abort1;
-	}
 
-	params = X509_VERIFY_PARAM_new();
-	if (params == NULL) {
-		error = pr_enomem();
+	error = certstack_create(&result->certstack);
+	if (error)
 		goto abort2;
-	}
 
-	X509_VERIFY_PARAM_set_flags(params, X509_V_FLAG_CRL_CHECK);
-	X509_STORE_set1_param(result->x509_data.store, params);
-	X509_STORE_set_verify_cb(result->x509_data.store, cb);
+	result->rsync_visited_uris = rsync_visited_uris;
+	result->rrdp_uris = db_rrdp_get_uris();
+	result->rrdp_workspace = db_rrdp_get_workspace();
+	result->rrdp_workspace_enabled = false;
+	result->fetches = NULL;
 
-	error = certstack_create(&result->certstack);
+	result->parent = NULL;
+	result->pubkey_state = PKS_UNTESTED;
+	result->validation_handler = *validation_handler;
+
+	*out = result;
+	return 0;
+abort2:
+	X509_VERIFY_PARAM_free(result->x509_data.params);
+	X509_STORE_free(result->x509_data.store);
+abort1:
+	free(result);
+	return error;
+}
+
+/**
+ * Creates the state of an additional worker that will help @parent's thread
+ * traverse its tree, and puts it in thread local.
+ */
+int
+validation_prepare_worker(struct validation **out, struct validation *parent)
+{
+	struct validation *result;
+	int error;
+
+	result = malloc(sizeof(struct validation));
+	if (!result)
+		return pr_enomem();
+
+	error = state_store(result);
 	if (error)
-		goto abort3;
+		goto abort1;
 
-	error = rsync_create(&result->rsync_visited_uris);
+	error = init_x509_data(&result->x509_data);
 	if (error)
-		goto abort4;
+		goto abort1;
 
-	result->rrdp_uris = db_rrdp_get_uris(tal_get_file_name(tal));
-	result->rrdp_workspace = db_rrdp_get_workspace(tal_get_file_name(tal));
+	error = certstack_create_worker(parent->certstack, &result->certstack);
+	if (error)
+		goto abort2;
 
-	result->pubkey_state = PKS_UNTESTED;
-	result->validation_handler = *validation_handler;
-	result->x509_data.params = params; /* Ownership transfered */
+	result->tal = parent->tal;
+	result->parent = parent;
+	result->rsync_visited_uris = parent->rsync_visited_uris;
+	result->rrdp_uris = parent->rrdp_uris;
+	result->rrdp_workspace = parent->rrdp_workspace;
+	result->rrdp_workspace_enabled = false;
+	result->fetches = NULL;
+	result->pubkey_state = parent->pubkey_state;
+	result->validation_handler = parent->validation_handler;
 
 	*out = result;
 	return 0;
-abort4:
-	certstack_destroy(result->certstack);
-abort3:
-	X509_VERIFY_PARAM_free(params);
 abort2:
+	X509_VERIFY_PARAM_free(result->x509_data.params);
 	X509_STORE_free(result->x509_data.store);
 abort1:
 	free(result);
@@ -154,7 +226,6 @@ validation_destroy(struct validation *state)
 	X509_VERIFY_PARAM_free(state->x509_data.params);
 	X509_STORE_free(state->x509_data.store);
 	certstack_destroy(state->certstack);
-	rsync_destroy(state->rsync_visited_uris);
 	free(state);
 }
 
@@ -218,6 +289,13 @@ validation_get_validation_handler(struct validation *state)
 	return &state->validation_handler;
 }
 
+void
+validation_set_validation_handler(struct validation *state,
+    struct validation_handler const *handler)
+{
+	state->validation_handler = *handler;
+}
+
 struct db_rrdp_uri *
 validation_get_rrdp_uris(struct validation *state)
 {
@@ -229,3 +307,30 @@ validation_get_rrdp_workspace(struct validation *state)
 {
 	return state->rrdp_workspace;
 }
+
+bool
+validation_rrdp_workspace_enabled(struct validation *state)
+{
+	return state->rrdp_workspace_enabled;
+}
+
+void
+validation_set_rrdp_workspace_enabled(struct validation *state, bool enabled)
+{
+	state->rrdp_workspace_enabled = enabled;
+}
+
+struct fetch_scheduler *
+validation_fetch_scheduler(struct validation *state)
+{
+	if (state->parent != NULL)
+		state = state->parent;
+	return state->fetches;
+}
+
+void
+validation_set_fetch_scheduler(struct validation *state,
+    struct fetch_scheduler *fetches)
+{
+	state->fetches = fetches;
+}
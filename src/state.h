@@ -3,6 +3,7 @@
 
 #include <openssl/x509.h>
 #include "cert_stack.h"
+#include "fetch_scheduler.h"
 #include "validation_handler.h"
 #include "object/tal.h"
 #include "rsync/rsync.h"
@@ -10,8 +11,9 @@
 
 struct validation;
 
-int validation_prepare(struct validation **, struct tal *,
+int validation_prepare(struct validation **, struct tal *, struct uri_list *,
     struct validation_handler *);
+int validation_prepare_worker(struct validation **, struct validation *);
 void validation_destroy(struct validation *);
 
 struct tal *validation_tal(struct validation *);
@@ -34,8 +36,16 @@ char *validation_get_ip_buffer2(struct validation *);
 
 struct validation_handler const *
 validation_get_validation_handler(struct validation *);
+void validation_set_validation_handler(struct validation *,
+    struct validation_handler const *);
 
 struct db_rrdp_uri *validation_get_rrdp_uris(struct validation *);
 char const *validation_get_rrdp_workspace(struct validation *);
+bool validation_rrdp_workspace_enabled(struct validation *);
+void validation_set_rrdp_workspace_enabled(struct validation *, bool);
+
+struct fetch_scheduler *validation_fetch_scheduler(struct validation *);
+void validation_set_fetch_scheduler(struct validation *,
+    struct fetch_scheduler *);
 
 #endif /* SRC_STATE_H_ */
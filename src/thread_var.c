@@ -275,17 +275,30 @@ working_repo_push(char const *location)
  * repository.
  *
  * The level "calculation" must be done by the caller.
+ *
+ * Returns the level that was current until now, so a caller that borrows the
+ * thread can hand it back to working_repo_pop_level().
  */
-void
+unsigned int
 working_repo_push_level(unsigned int level)
 {
 	struct working_repo *repo;
+	unsigned int previous;
 
 	repo = pthread_getspecific(repository_key);
 	if (repo == NULL)
-		return;
+		return 0;
 
+	previous = repo->level;
 	repo->level = level;
+	return previous;
+}
+
+/* Reverts a working_repo_push_level() that returned @previous. */
+void
+working_repo_pop_level(unsigned int previous)
+{
+	working_repo_push_level(previous);
 }
 
 char const *
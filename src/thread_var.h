@@ -20,7 +20,8 @@ void working_repo_init(void);
 void working_repo_cleanup(void);
 
 void working_repo_push(char const *);
-void working_repo_push_level(unsigned int);
+unsigned int working_repo_push_level(unsigned int);
+void working_repo_pop_level(unsigned int);
 char const *working_repo_peek(void);
 unsigned int working_repo_peek_level(void);
 void working_repo_pop(void);
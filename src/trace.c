@@ -0,0 +1,320 @@
+#include "trace.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/queue.h>
+
+#include "config.h"
+#include "log.h"
+
+struct span {
+	/* NULL if the slot hasn't been written yet */
+	char const *name;
+	unsigned int tid;
+	uint64_t start;
+	uint64_t duration;
+	/*
+	 * Owned by the slot. Reused (and grown when needed) every time the ring
+	 * wraps around, so spans normally don't allocate.
+	 */
+	char *uri;
+	size_t uri_size;
+	bool has_uri;
+};
+
+/*
+ * The ring of one thread. When the thread dies, the buffer (and the spans it
+ * recorded) stays around, and is handed over to the next new thread.
+ */
+struct trace_buffer {
+	/* Of the thread that currently owns the buffer */
+	unsigned int tid;
+	bool claimed;
+
+	/* @capacity slots */
+	struct span *spans;
+	/* Index of the slot the next span will overwrite */
+	unsigned int next;
+
+	/* Only contended while trace_print() is reading the spans */
+	pthread_mutex_t lock;
+	SLIST_ENTRY(trace_buffer) next_buffer;
+};
+
+SLIST_HEAD(trace_buffer_list, trace_buffer);
+
+/* Spans each thread remembers; zero disables tracing */
+static unsigned int capacity;
+
+static struct trace_buffer_list buffers = SLIST_HEAD_INITIALIZER(buffers);
+/* Last thread ID handed out */
+static unsigned int last_tid;
+/* Guards @buffers, @last_tid and the buffers' @tid and @claimed. */
+static pthread_mutex_t buffers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Only used to release the buffer when the thread dies */
+static pthread_key_t buffer_key;
+static _Thread_local struct trace_buffer *buffer;
+
+static uint64_t
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void
+release_buffer(void *arg)
+{
+	struct trace_buffer *released = arg;
+
+	pthread_mutex_lock(&buffers_lock);
+	released->claimed = false;
+	pthread_mutex_unlock(&buffers_lock);
+}
+
+int
+trace_init(void)
+{
+	int error;
+
+	capacity = config_get_metrics_trace_spans();
+	if (capacity == 0)
+		return 0;
+
+	if (config_get_metrics_address() == NULL)
+		pr_op_warn("Tracing is enabled, but the spans will not be exported because the metrics server is disabled.");
+
+	error = pthread_key_create(&buffer_key, release_buffer);
+	if (error)
+		return -pr_op_errno(error, "pthread_key_create() errored");
+
+	return 0;
+}
+
+/* Assumes the tracing threads are dead. */
+void
+trace_cleanup(void)
+{
+	struct trace_buffer *victim;
+	unsigned int i;
+
+	if (capacity == 0)
+		return;
+
+	while (!SLIST_EMPTY(&buffers)) {
+		victim = SLIST_FIRST(&buffers);
+		SLIST_REMOVE_HEAD(&buffers, next_buffer);
+		for (i = 0; i < capacity; i++)
+			free(victim->spans[i].uri);
+		free(victim->spans);
+		pthread_mutex_destroy(&victim->lock);
+		free(victim);
+	}
+
+	buffer = NULL;
+	last_tid = 0;
+	pthread_key_delete(buffer_key);
+	capacity = 0;
+}
+
+static struct trace_buffer *
+create_buffer(void)
+{
+	struct trace_buffer *result;
+	int error;
+
+	result = malloc(sizeof(struct trace_buffer));
+	if (result == NULL)
+		return NULL;
+
+	result->spans = calloc(capacity, sizeof(struct span));
+	if (result->spans == NULL) {
+		free(result);
+		return NULL;
+	}
+	result->next = 0;
+
+	error = pthread_mutex_init(&result->lock, NULL);
+	if (error) {
+		free(result->spans);
+		free(result);
+		return NULL;
+	}
+
+	return result;
+}
+
+/* Returns the calling thread's buffer, claiming one if necessary. */
+static struct trace_buffer *
+get_buffer(void)
+{
+	struct trace_buffer *result;
+
+	if (buffer != NULL)
+		return buffer;
+
+	pthread_mutex_lock(&buffers_lock);
+
+	SLIST_FOREACH(result, &buffers, next_buffer)
+		if (!result->claimed)
+			break;
+	if (result == NULL) {
+		result = create_buffer();
+		if (result == NULL) {
+			pthread_mutex_unlock(&buffers_lock);
+			pr_enomem();
+			return NULL;
+		}
+		SLIST_INSERT_HEAD(&buffers, result, next_buffer);
+	}
+
+	result->claimed = true;
+	result->tid = ++last_tid;
+
+	pthread_mutex_unlock(&buffers_lock);
+
+	pthread_setspecific(buffer_key, result);
+	buffer = result;
+	return result;
+}
+
+void
+trace_begin(struct trace_span *span, char const *name)
+{
+	if (capacity == 0) {
+		span->name = NULL;
+		return;
+	}
+
+	span->name = name;
+	span->start = now();
+}
+
+static void
+set_uri(struct span *slot, char const *uri)
+{
+	size_t size;
+	char *tmp;
+
+	slot->has_uri = false;
+	if (uri == NULL)
+		return;
+
+	size = strlen(uri) + 1;
+	if (size > slot->uri_size) {
+		tmp = realloc(slot->uri, size);
+		if (tmp == NULL)
+			return; /* Not worth complaining about */
+		slot->uri = tmp;
+		slot->uri_size = size;
+	}
+
+	memcpy(slot->uri, uri, size);
+	slot->has_uri = true;
+}
+
+void
+trace_end(struct trace_span *span, char const *uri)
+{
+	struct trace_buffer *ring;
+	struct span *slot;
+	uint64_t end;
+
+	if (span->name == NULL)
+		return;
+
+	end = now();
+	ring = get_buffer();
+	if (ring == NULL)
+		return;
+
+	pthread_mutex_lock(&ring->lock);
+	slot = &ring->spans[ring->next];
+	slot->name = span->name;
+	slot->tid = ring->tid;
+	slot->start = span->start;
+	slot->duration = end - span->start;
+	set_uri(slot, uri);
+	ring->next = (ring->next + 1) % capacity;
+	pthread_mutex_unlock(&ring->lock);
+}
+
+static void
+print_json_string(FILE *out, char const *str)
+{
+	fputc('"', out);
+	for (; *str != '\0'; str++) {
+		switch (*str) {
+		case '"':
+			fputs("\\\"", out);
+			break;
+		case '\\':
+			fputs("\\\\", out);
+			break;
+		default:
+			if ((unsigned char) *str < 0x20)
+				fprintf(out, "\\u%04x", (unsigned char) *str);
+			else
+				fputc(*str, out);
+		}
+	}
+	fputc('"', out);
+}
+
+static void
+print_span(FILE *out, struct span *span, bool *first)
+{
+	fputs(*first ? "\n" : ",\n", out);
+	*first = false;
+
+	fputs("{\"name\":", out);
+	print_json_string(out, span->name);
+	fprintf(out, ",\"cat\":\"fort\",\"ph\":\"X\",\"pid\":%ld,\"tid\":%u,\"ts\":%llu,\"dur\":%llu",
+	    (long) getpid(), span->tid, (unsigned long long) span->start,
+	    (unsigned long long) span->duration);
+	if (span->has_uri) {
+		fputs(",\"args\":{\"uri\":", out);
+		print_json_string(out, span->uri);
+		fputc('}', out);
+	}
+	fputc('}', out);
+}
+
+/*
+ * Prints the spans of all the threads, in the Chrome trace event format
+ * ("JSON Object Format").
+ */
+void
+trace_print(FILE *out)
+{
+	struct trace_buffer *ring;
+	struct span *span;
+	unsigned int i;
+	bool first;
+
+	first = true;
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", out);
+
+	pthread_mutex_lock(&buffers_lock);
+	SLIST_FOREACH(ring, &buffers, next_buffer) {
+		pthread_mutex_lock(&ring->lock);
+		/* Oldest first */
+		for (i = 0; i < capacity; i++) {
+			span = &ring->spans[(ring->next + i) % capacity];
+			if (span->name != NULL)
+				print_span(out, span, &first);
+		}
+		pthread_mutex_unlock(&ring->lock);
+	}
+	pthread_mutex_unlock(&buffers_lock);
+
+	fputs("\n]}\n", out);
+}
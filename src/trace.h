@@ -0,0 +1,42 @@
+#ifndef SRC_TRACE_H_
+#define SRC_TRACE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Timing spans around the expensive steps of the validation.
+ *
+ * Each thread records its most recent --metrics.trace-spans spans in a ring
+ * buffer of its own, and the metrics server exports all of them as a Chrome
+ * trace (which Perfetto and chrome://tracing can open) at /trace.
+ *
+ * Usage:
+ *
+ * 	struct trace_span span;
+ *
+ * 	trace_begin(&span, "handle_manifest");
+ * 	...
+ * 	trace_end(&span, uri_val_get_printable(uri));
+ *
+ * Both are no-ops if tracing is disabled.
+ */
+
+struct trace_span {
+	/* NULL if tracing was disabled when the span began */
+	char const *name;
+	/* Microseconds, CLOCK_MONOTONIC */
+	uint64_t start;
+};
+
+int trace_init(void);
+void trace_cleanup(void);
+
+/* @name is not cloned; it's expected to be a literal. */
+void trace_begin(struct trace_span *, char const *);
+/* @uri (which can be NULL) is cloned. */
+void trace_end(struct trace_span *, char const *);
+
+void trace_print(FILE *);
+
+#endif /* SRC_TRACE_H_ */
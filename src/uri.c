@@ -1,6 +1,7 @@
 #include "uri.h"
 
 #include <errno.h>
+#include <stdatomic.h>
 #include <strings.h>
 #include "rrdp/db/db_rrdp_uris.h"
 #include "common.h"
@@ -68,7 +69,8 @@ struct rpki_uri {
 	/* Type, currently rysnc and https are valid */
 	enum rpki_uri_type type;
 
-	unsigned int references;
+	/* Validation workers share URIs, so this needs to be atomic. */
+	atomic_uint references;
 };
 
 /*
@@ -350,7 +352,7 @@ uri_create(struct rpki_uri **result, uint8_t flags, void const *guri,
 		return error;
 	}
 
-	uri->references = 1;
+	atomic_init(&uri->references, 1);
 	*result = uri;
 	return 0;
 }
@@ -421,7 +423,7 @@ uri_create_mft(struct rpki_uri **result, struct rpki_uri *mft, IA5String_t *ia5,
 		return error;
 	}
 
-	uri->references = 1;
+	atomic_init(&uri->references, 1);
 	*result = uri;
 	return 0;
 }
@@ -481,14 +483,13 @@ uri_create_ad(struct rpki_uri **uri, ACCESS_DESCRIPTION *ad, int flags)
 void
 uri_refget(struct rpki_uri *uri)
 {
-	uri->references++;
+	atomic_fetch_add(&uri->references, 1);
 }
 
 void
 uri_refput(struct rpki_uri *uri)
 {
-	uri->references--;
-	if (uri->references == 0) {
+	if (atomic_fetch_sub(&uri->references, 1) == 1) {
 		free(uri->global);
 		free(uri->local);
 		free(uri);
@@ -5,6 +5,7 @@
 #include <string.h>
 #include "log.h"
 #include "delete_dir_daemon.h"
+#include "object_store.h"
 #include "data_structure/array_list.h"
 #include "data_structure/uthash_nonfatal.h"
 
@@ -135,6 +136,21 @@ visited_uris_remove(struct visited_uris *uris, char const *uri)
 	return 0;
 }
 
+int
+visited_uris_foreach(struct visited_uris *uris, visited_uri_cb cb, void *arg)
+{
+	struct visited_elem *elem;
+	int error;
+
+	for (elem = uris->table; elem != NULL; elem = elem->hh.next) {
+		error = cb(elem->uri, arg);
+		if (error)
+			return error;
+	}
+
+	return 0;
+}
+
 static int
 visited_uris_to_arr(struct visited_uris *uris, struct uris_roots *roots)
 {
@@ -180,6 +196,10 @@ visited_uris_delete_local(struct visited_uris *uris, char const *workspace)
 	if (roots.len == 0)
 		goto success;
 
+	error = object_store_remove_roots(roots.array, roots.len, workspace);
+	if (error)
+		goto err;
+
 	error = delete_dir_daemon_start(roots.array, roots.len, workspace);
 	if (error)
 		goto err;
@@ -11,4 +11,7 @@ int visited_uris_add(struct visited_uris *, char const *);
 int visited_uris_remove(struct visited_uris *, char const *);
 int visited_uris_delete_local(struct visited_uris *, char const *);
 
+typedef int (*visited_uri_cb)(char const *, void *);
+int visited_uris_foreach(struct visited_uris *, visited_uri_cb, void *);
+
 #endif /* SRC_VISITED_URIS_H_ */
@@ -79,21 +79,17 @@ cleanup_parser:
 }
 
 /*
- * Validate file at @path against globally loaded schema. The file must be
- * parsed using @cb (will receive @arg as argument).
+ * Validate the document @reader reads against globally loaded schema. The
+ * document must be parsed using @cb (will receive @arg as argument). Releases
+ * @reader.
  */
-int
-relax_ng_parse(const char *path, xml_read_cb cb, void *arg)
+static int
+relax_ng_read(xmlTextReaderPtr reader, xml_read_cb cb, void *arg)
 {
-	xmlTextReaderPtr reader;
 	xmlRelaxNGValidCtxtPtr rngvalidctx;
 	int read;
 	int error;
 
-	reader = xmlNewTextReaderFilename(path);
-	if (reader == NULL)
-		return pr_val_err("Couldn't get XML '%s' file.", path);
-
 	error = xmlTextReaderRelaxNGSetSchema(reader, schema);
 	if (error) {
 		error = pr_val_err("Couldn't set Relax NG schema.");
@@ -149,6 +145,40 @@ free_reader:
 	return error;
 }
 
+/*
+ * Validate file at @path against globally loaded schema. The file must be
+ * parsed using @cb (will receive @arg as argument).
+ */
+int
+relax_ng_parse(const char *path, xml_read_cb cb, void *arg)
+{
+	xmlTextReaderPtr reader;
+
+	reader = xmlNewTextReaderFilename(path);
+	if (reader == NULL)
+		return pr_val_err("Couldn't get XML '%s' file.", path);
+
+	return relax_ng_read(reader, cb, arg);
+}
+
+/*
+ * Same as relax_ng_parse(), except the document named @name is pulled from
+ * @read (which will receive @ctx) as the parser needs it, so it doesn't need to
+ * be stored anywhere first.
+ */
+int
+relax_ng_parse_io(char const *name, xmlInputReadCallback read, void *ctx,
+    xml_read_cb cb, void *arg)
+{
+	xmlTextReaderPtr reader;
+
+	reader = xmlReaderForIO(read, NULL, ctx, name, NULL, 0);
+	if (reader == NULL)
+		return pr_val_err("Couldn't start parsing XML '%s'.", name);
+
+	return relax_ng_read(reader, cb, arg);
+}
+
 void
 relax_ng_cleanup(void)
 {
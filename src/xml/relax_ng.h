@@ -168,5 +168,7 @@ void relax_ng_cleanup(void);
 
 typedef int (*xml_read_cb)(xmlTextReaderPtr, void *);
 int relax_ng_parse(const char *, xml_read_cb cb, void *);
+int relax_ng_parse_io(char const *, xmlInputReadCallback, void *, xml_read_cb,
+    void *);
 
 #endif /* SRC_XML_RELAX_NG_H_ */
@@ -0,0 +1,143 @@
+/*
+ * Compares base64_decode_str() against the BIO-based base64_decode(), on a
+ * typical RRDP <publish> payload.
+ *
+ * Not part of `make check`. Build and run it with
+ *
+ * 	make base64.bench && ./base64.bench [<decoded size> [<line length>]]
+ *
+ * <line length> 0 (the default) means no line breaks.
+ */
+
+#include <stdlib.h>
+#include <time.h>
+#include <openssl/evp.h>
+
+#include "log.c"
+#include "impersonator.c"
+#include "crypto/base64.c"
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+report(char const *name, double seconds, unsigned int rounds, size_t len)
+{
+	printf("%-28s %8.3f ms/round %10.1f MB/s\n", name,
+	    1000 * seconds / rounds, rounds * len / seconds / 1e6);
+}
+
+/* base64_decode_str(), minus the vectorized paths. */
+static int
+decode_scalar(char const *in, size_t in_len, unsigned char *out,
+    size_t *out_written)
+{
+	unsigned char const *cur;
+	unsigned char const *end;
+	unsigned char *dst;
+	int result;
+
+	cur = (unsigned char const *) in;
+	end = cur + in_len;
+	dst = out;
+	do {
+		result = decode_quantum(&cur, end, &dst);
+	} while (result > 0);
+
+	*out_written = dst - out;
+	return result;
+}
+
+/* Splits @in into lines of @line_len characters. */
+static char *
+wrap(unsigned char const *in, size_t in_len, size_t line_len, size_t *out_len)
+{
+	char *out;
+	size_t i, o;
+
+	out = malloc(2 * in_len + 1);
+	if (out == NULL)
+		exit(1);
+
+	for (i = 0, o = 0; i < in_len; i++) {
+		if (line_len > 0 && i > 0 && i % line_len == 0)
+			out[o++] = '\n';
+		out[o++] = in[i];
+	}
+	out[o] = '\0';
+
+	*out_len = o;
+	return out;
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned char *raw, *encoded, *decoded;
+	char *text;
+	size_t raw_len, line_len, encoded_len, text_len, decoded_len;
+	unsigned int rounds, r;
+	BIO *bio;
+	double start;
+	size_t i;
+
+	raw_len = (argc > 1) ? strtoul(argv[1], NULL, 10) : 2048;
+	line_len = (argc > 2) ? strtoul(argv[2], NULL, 10) : 0;
+	rounds = 1 + (256u << 20) / (raw_len + 1);
+
+	raw = malloc(raw_len);
+	encoded = malloc(4 * (raw_len / 3 + 1) + 1);
+	decoded = malloc(EVP_DECODE_LENGTH(2 * raw_len + 4));
+	if (raw == NULL || encoded == NULL || decoded == NULL)
+		return 1;
+	for (i = 0; i < raw_len; i++)
+		raw[i] = rand();
+	encoded_len = EVP_EncodeBlock(encoded, raw, raw_len);
+
+	printf("%zu bytes, %zu base64 characters, %u rounds\n", raw_len,
+	    encoded_len, rounds);
+
+	/* Same thing RRDP did before: 64-character lines through a BIO. */
+	text = wrap(encoded, encoded_len, 64, &text_len);
+	start = now();
+	for (r = 0; r < rounds; r++) {
+		bio = BIO_new_mem_buf(text, text_len);
+		if (base64_decode(bio, decoded, true,
+		    EVP_DECODE_LENGTH(text_len), &decoded_len) != 0)
+			return 1;
+		BIO_free(bio);
+	}
+	report("base64_decode() (BIO)", now() - start, rounds, raw_len);
+	if (decoded_len != raw_len || memcmp(raw, decoded, raw_len) != 0)
+		return 1;
+
+	free(text);
+	text = wrap(encoded, encoded_len, line_len, &text_len);
+
+	start = now();
+	for (r = 0; r < rounds; r++)
+		if (decode_scalar(text, text_len, decoded, &decoded_len) != 0)
+			return 1;
+	report("base64_decode_str() (scalar)", now() - start, rounds, raw_len);
+	if (decoded_len != raw_len || memcmp(raw, decoded, raw_len) != 0)
+		return 1;
+
+	start = now();
+	for (r = 0; r < rounds; r++)
+		if (base64_decode_str(text, text_len, decoded, &decoded_len) != 0)
+			return 1;
+	report("base64_decode_str()", now() - start, rounds, raw_len);
+	if (decoded_len != raw_len || memcmp(raw, decoded, raw_len) != 0)
+		return 1;
+
+	free(text);
+	free(decoded);
+	free(encoded);
+	free(raw);
+	return 0;
+}
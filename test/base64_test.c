@@ -0,0 +1,125 @@
+#include <check.h>
+#include <stdlib.h>
+#include <openssl/evp.h>
+
+#include "log.c"
+#include "impersonator.c"
+#include "crypto/base64.c"
+
+static void
+check_decode(char const *encoded, char const *expected)
+{
+	unsigned char out[128];
+	size_t out_len;
+
+	printf("- '%s'\n", encoded);
+	ck_assert_int_eq(0, base64_decode_str(encoded, strlen(encoded), out,
+	    &out_len));
+	ck_assert_uint_eq(strlen(expected), out_len);
+	ck_assert_int_eq(0, memcmp(expected, out, out_len));
+}
+
+static void
+check_error(char const *encoded)
+{
+	unsigned char out[128];
+	size_t out_len;
+
+	printf("- '%s'\n", encoded);
+	ck_assert_int_eq(-EINVAL, base64_decode_str(encoded, strlen(encoded),
+	    out, &out_len));
+}
+
+START_TEST(base64_decode_rfc4648)
+{
+	check_decode("", "");
+	check_decode("Zg==", "f");
+	check_decode("Zm8=", "fo");
+	check_decode("Zm9v", "foo");
+	check_decode("Zm9vYg==", "foob");
+	check_decode("Zm9vYmE=", "fooba");
+	check_decode("Zm9vYmFy", "foobar");
+}
+END_TEST
+
+START_TEST(base64_decode_whitespace)
+{
+	check_decode("  \n\tZm9v\r\nYmFy\n  ", "foobar");
+	check_decode("Z m 9 v Y g = =", "foob");
+	check_decode("Zm9vYmE=\n\n", "fooba");
+}
+END_TEST
+
+START_TEST(base64_decode_invalid)
+{
+	check_error("Z");
+	check_error("Zg");
+	check_error("Zg=");
+	check_error("Z===");
+	check_error("=Zg=");
+	check_error("Zg==Zg==");
+	check_error("Zm9v!mFy");
+	check_error("Zm9v-mFy");
+	check_error("Zm9vYmFyZm9vYmFyZm9vYmFyZm9vYmFyZm9vYmFy\xffm9vYmFy");
+}
+END_TEST
+
+/* Long enough strings for the vectorized paths to kick in. */
+START_TEST(base64_decode_long)
+{
+	unsigned char raw[1000];
+	unsigned char encoded[2 * sizeof(raw)];
+	unsigned char decoded[sizeof(raw)];
+	size_t raw_len, encoded_len, decoded_len, i;
+
+	for (i = 0; i < sizeof(raw); i++)
+		raw[i] = rand();
+
+	for (raw_len = 0; raw_len < sizeof(raw); raw_len += 7) {
+		encoded_len = EVP_EncodeBlock(encoded, raw, raw_len);
+		ck_assert_int_eq(0, base64_decode_str((char *) encoded,
+		    encoded_len, decoded, &decoded_len));
+		ck_assert_uint_eq(raw_len, decoded_len);
+		ck_assert_int_eq(0, memcmp(raw, decoded, raw_len));
+
+		/* Break it in the middle of a block */
+		if (encoded_len < 50)
+			continue;
+		encoded[37] = '*';
+		ck_assert_int_eq(-EINVAL, base64_decode_str((char *) encoded,
+		    encoded_len, decoded, &decoded_len));
+	}
+}
+END_TEST
+
+Suite *base64_suite(void)
+{
+	Suite *suite;
+	TCase *core;
+
+	core = tcase_create("Core");
+	tcase_add_test(core, base64_decode_rfc4648);
+	tcase_add_test(core, base64_decode_whitespace);
+	tcase_add_test(core, base64_decode_invalid);
+	tcase_add_test(core, base64_decode_long);
+
+	suite = suite_create("base64");
+	suite_add_tcase(suite, core);
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite;
+	SRunner *runner;
+	int tests_failed;
+
+	suite = base64_suite();
+
+	runner = srunner_create(suite);
+	srunner_run_all(runner, CK_NORMAL);
+	tests_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+
+	return (tests_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,313 @@
+#include <check.h>
+#include <stdlib.h>
+
+#include "common.c"
+#include "file.c"
+#include "impersonator.c"
+#include "line_file.c"
+#include "log.c"
+#include "visited_uris.c"
+#include "rrdp/db/db_rrdp.c"
+/* impersonator.c already has one */
+#define db_rrdp_uris_workspace_get db_rrdp_uris_workspace_get_unused
+#include "rrdp/db/db_rrdp_uris.c"
+#undef db_rrdp_uris_workspace_get
+
+#define JOURNAL_PATH "repository/" JOURNAL_NAME
+
+#define NOTIF1 "https://host1/notification.xml"
+#define NOTIF2 "https://host2/notification.xml"
+#define NOTIF3 "https://host3/notification.xml"
+
+/* Any non-NULL value will do; the stubs below don't look at it. */
+static int dummy_state;
+static bool store_enabled;
+static unsigned int deleted_roots;
+
+struct validation *
+state_retrieve(void)
+{
+	return (struct validation *) &dummy_state;
+}
+
+struct db_rrdp_uri *
+validation_get_rrdp_uris(struct validation *state)
+{
+	return db_rrdp_get_uris();
+}
+
+char const *
+validation_get_rrdp_workspace(struct validation *state)
+{
+	return db_rrdp_get_workspace();
+}
+
+bool
+validation_rrdp_workspace_enabled(struct validation *state)
+{
+	return false;
+}
+
+void
+validation_set_rrdp_workspace_enabled(struct validation *state, bool enabled)
+{
+	/* Empty */
+}
+
+bool
+object_store_enabled(void)
+{
+	return store_enabled;
+}
+
+bool
+object_store_restored(void)
+{
+	return store_enabled;
+}
+
+int
+object_store_remove_roots(char **roots, size_t roots_len,
+    char const *workspace)
+{
+	return 0;
+}
+
+int
+delete_dir_daemon_start(char **roots, size_t roots_len, char const *workspace)
+{
+	deleted_roots += roots_len;
+	return 0;
+}
+
+static int
+count_uri(char const *uri, void *arg)
+{
+	(*(unsigned int *) arg)++;
+	return 0;
+}
+
+static void
+add_notification(char const *uri, char const *session, unsigned long serial,
+    char const *mft)
+{
+	struct visited_uris *visited;
+
+	ck_assert_int_eq(0, visited_uris_create(&visited));
+	if (mft != NULL)
+		ck_assert_int_eq(0, visited_uris_add(visited, mft));
+	ck_assert_int_eq(0, db_rrdp_uris_update(uri, session, serial,
+	    RRDP_URI_REQ_VISITED, visited));
+}
+
+static void
+check_notification(char const *uri, char const *session, unsigned long serial,
+    unsigned int mfts)
+{
+	rrdp_uri_cmp_result_t cmp;
+	rrdp_req_status_t status;
+	struct visited_uris *visited;
+	unsigned int count;
+
+	ck_assert_int_eq(0, db_rrdp_uris_cmp(uri, session, serial, &cmp));
+	ck_assert_int_eq(RRDP_URI_EQUAL, cmp);
+	/* It has to be requested again, to find out if there are updates */
+	ck_assert_int_eq(0, db_rrdp_uris_get_request_status(uri, &status));
+	ck_assert_int_eq(RRDP_URI_REQ_UNVISITED, status);
+
+	ck_assert_int_eq(0, db_rrdp_uris_get_visited_uris(uri, &visited));
+	count = 0;
+	ck_assert_int_eq(0, visited_uris_foreach(visited, count_uri, &count));
+	ck_assert_uint_eq(mfts, count);
+}
+
+static void
+check_missing(char const *uri)
+{
+	unsigned long serial;
+
+	ck_assert_int_eq(-ENOENT, db_rrdp_uris_get_serial(uri, &serial));
+}
+
+/* Replaces the journal with @content. */
+static void
+write_journal_file(char const *content)
+{
+	FILE *file;
+
+	file = fopen(JOURNAL_PATH, "wb");
+	ck_assert_ptr_ne(NULL, file);
+	ck_assert_int_ne(EOF, fputs(content, file));
+	fclose(file);
+}
+
+/* Loads @content, which is expected to be rejected as a whole. */
+static void
+check_rejected(char const *content)
+{
+	write_journal_file(content);
+	ck_assert_int_eq(0, db_rrdp_init());
+	check_missing(NOTIF1);
+	check_missing(NOTIF2);
+	db_rrdp_cleanup();
+}
+
+START_TEST(db_rrdp_journal_round_trip)
+{
+	long last_update;
+
+	store_enabled = false;
+	remove(JOURNAL_PATH);
+
+	/* First run; nothing to recover */
+	ck_assert_int_eq(0, db_rrdp_init());
+	check_missing(NOTIF1);
+
+	add_notification(NOTIF1, "session-1", 10, "rsync://host1/a.mft");
+	ck_assert_int_eq(0, db_rrdp_uris_set_last_update(NOTIF1));
+	add_notification(NOTIF2, "session-2", 20, NULL);
+	add_notification(NOTIF3, "session-3", 30, "rsync://host3/a.mft");
+	ck_assert_int_eq(0, db_rrdp_uris_set_request_status(NOTIF3,
+	    RRDP_URI_REQ_ERROR));
+	ck_assert_int_eq(0, db_rrdp_save());
+	db_rrdp_cleanup();
+
+	/* Restart */
+	ck_assert_int_eq(0, db_rrdp_init());
+	check_notification(NOTIF1, "session-1", 10, 1);
+	ck_assert_int_eq(0, db_rrdp_uris_get_last_update(NOTIF1,
+	    &last_update));
+	ck_assert_int_gt(last_update, 0);
+	check_notification(NOTIF2, "session-2", 20, 0);
+	/* Errored notifications are not worth remembering */
+	check_missing(NOTIF3);
+	db_rrdp_cleanup();
+
+	/* The objects used to be somewhere else */
+	store_enabled = true;
+	ck_assert_int_eq(0, db_rrdp_init());
+	check_missing(NOTIF1);
+	db_rrdp_cleanup();
+
+	ck_assert_int_eq(0, remove(JOURNAL_PATH));
+}
+END_TEST
+
+START_TEST(db_rrdp_journal_corruption)
+{
+	store_enabled = false;
+
+	/* Sanity check */
+	write_journal_file("fort-rrdp-journal 2\n"
+	    "store 0\n"
+	    "notification 1600000000 10 session-1 " NOTIF1 "\n"
+	    "mft rsync://host1/a.mft\n"
+	    "notification 0 20 session-2 " NOTIF2 "\n");
+	ck_assert_int_eq(0, db_rrdp_init());
+	check_notification(NOTIF1, "session-1", 10, 1);
+	check_notification(NOTIF2, "session-2", 20, 0);
+	db_rrdp_cleanup();
+
+	/* Empty */
+	check_rejected("");
+	/* Unknown version */
+	check_rejected("fort-rrdp-journal 1\n"
+	    "store 0\n"
+	    "notification 0 10 session-1 " NOTIF1 "\n");
+	/* No store line */
+	check_rejected("fort-rrdp-journal 2\n"
+	    "notification 0 10 session-1 " NOTIF1 "\n");
+	/* Objects in the object store */
+	check_rejected("fort-rrdp-journal 2\n"
+	    "store 1\n"
+	    "notification 0 10 session-1 " NOTIF1 "\n");
+	/* Manifest without notification */
+	check_rejected("fort-rrdp-journal 2\n"
+	    "store 0\n"
+	    "mft rsync://host1/a.mft\n"
+	    "notification 0 10 session-1 " NOTIF1 "\n");
+	/* Unknown line */
+	check_rejected("fort-rrdp-journal 2\n"
+	    "store 0\n"
+	    "notification 0 10 session-1 " NOTIF1 "\n"
+	    "garbage\n");
+	/* Truncated in the middle of a notification */
+	check_rejected("fort-rrdp-journal 2\n"
+	    "store 0\n"
+	    "notification 0 10 session-1 " NOTIF1 "\n"
+	    "notification 0 20 sess");
+	/* Serial isn't a number */
+	check_rejected("fort-rrdp-journal 2\n"
+	    "store 0\n"
+	    "notification 0 ten session-1 " NOTIF1 "\n");
+
+	ck_assert_int_eq(0, remove(JOURNAL_PATH));
+}
+END_TEST
+
+START_TEST(db_rrdp_sweep)
+{
+	rrdp_req_status_t status;
+
+	store_enabled = false;
+	remove(JOURNAL_PATH);
+	ck_assert_int_eq(0, db_rrdp_init());
+
+	add_notification(NOTIF1, "session-1", 10, "rsync://host1/a.mft");
+	add_notification(NOTIF2, "session-2", 20, "rsync://host2/a.mft");
+	add_notification(NOTIF3, "session-3", 30, "rsync://host3/a.mft");
+
+	/* Next cycle; NOTIF2's CA is gone, and NOTIF3 errors */
+	db_rrdp_reset_visited();
+	add_notification(NOTIF1, "session-1", 11, "rsync://host1/a.mft");
+	ck_assert_int_eq(0, db_rrdp_uris_set_request_status(NOTIF3,
+	    RRDP_URI_REQ_ERROR));
+
+	deleted_roots = 0;
+	ck_assert_int_eq(0, db_rrdp_rem_nonvisited());
+	ck_assert_uint_eq(1, deleted_roots);
+	check_missing(NOTIF2);
+	ck_assert_int_eq(0, db_rrdp_uris_get_request_status(NOTIF1, &status));
+	ck_assert_int_eq(RRDP_URI_REQ_VISITED, status);
+	ck_assert_int_eq(0, db_rrdp_uris_get_request_status(NOTIF3, &status));
+	ck_assert_int_eq(RRDP_URI_REQ_ERROR, status);
+
+	/* Nothing else to sweep */
+	deleted_roots = 0;
+	ck_assert_int_eq(0, db_rrdp_rem_nonvisited());
+	ck_assert_uint_eq(0, deleted_roots);
+
+	db_rrdp_cleanup();
+}
+END_TEST
+
+Suite *db_rrdp_suite(void)
+{
+	Suite *suite;
+	TCase *core;
+
+	core = tcase_create("Core");
+	tcase_add_test(core, db_rrdp_journal_round_trip);
+	tcase_add_test(core, db_rrdp_journal_corruption);
+	tcase_add_test(core, db_rrdp_sweep);
+
+	suite = suite_create("db_rrdp");
+	suite_add_tcase(suite, core);
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite;
+	SRunner *runner;
+	int tests_failed;
+
+	suite = db_rrdp_suite();
+
+	runner = srunner_create(suite);
+	srunner_run_all(runner, CK_NORMAL);
+	tests_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+
+	return (tests_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,152 @@
+#include <check.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "common.c"
+#include "file.c"
+#include "impersonator.c"
+#include "line_file.c"
+#include "log.c"
+#include "crypto/hash_cache.c"
+
+#define CACHE_PATH "repository/" CACHE_NAME
+
+static unsigned char const HASH1[SHA256_DIGEST_LENGTH] = { 1, 2, 3 };
+static unsigned char const HASH2[SHA256_DIGEST_LENGTH] = { 4, 5, 6 };
+
+static void
+init_meta(struct stat *meta)
+{
+	memset(meta, 0, sizeof(*meta));
+	meta->st_ino = 1234;
+	meta->st_size = 100;
+	meta->st_mtim.tv_sec = 1600000000;
+	meta->st_mtim.tv_nsec = 123456789;
+}
+
+static void
+check_hash(char const *path, struct stat const *meta,
+    unsigned char const *expected)
+{
+	unsigned char actual[SHA256_DIGEST_LENGTH];
+
+	ck_assert(hash_cache_get(path, meta, actual));
+	ck_assert_int_eq(0, memcmp(expected, actual, SHA256_DIGEST_LENGTH));
+}
+
+static void
+check_missing(char const *path, struct stat const *meta)
+{
+	unsigned char actual[SHA256_DIGEST_LENGTH];
+
+	ck_assert(!hash_cache_get(path, meta, actual));
+}
+
+START_TEST(hash_cache_keys)
+{
+	struct stat meta;
+	struct stat changed;
+
+	ck_assert_int_eq(0, hash_cache_init());
+
+	init_meta(&meta);
+	check_missing("repository/a.mft", &meta);
+	hash_cache_put("repository/a.mft", &meta, HASH1);
+	check_hash("repository/a.mft", &meta, HASH1);
+	check_missing("repository/b.mft", &meta);
+
+	/* Any change to the file's identity makes the hash stale */
+	changed = meta;
+	changed.st_ino++;
+	check_missing("repository/a.mft", &changed);
+	changed = meta;
+	changed.st_size++;
+	check_missing("repository/a.mft", &changed);
+	changed = meta;
+	changed.st_mtim.tv_sec++;
+	check_missing("repository/a.mft", &changed);
+	changed = meta;
+	changed.st_mtim.tv_nsec++;
+	check_missing("repository/a.mft", &changed);
+
+	/* Other fields don't matter */
+	changed = meta;
+	changed.st_atim.tv_sec++;
+	changed.st_ctim.tv_sec++;
+	check_hash("repository/a.mft", &changed, HASH1);
+
+	/* The file was rewritten */
+	changed = meta;
+	changed.st_mtim.tv_nsec++;
+	hash_cache_put("repository/a.mft", &changed, HASH2);
+	check_hash("repository/a.mft", &changed, HASH2);
+	check_missing("repository/a.mft", &meta);
+
+	hash_cache_cleanup();
+}
+END_TEST
+
+START_TEST(hash_cache_persistence)
+{
+	struct stat meta1;
+	struct stat meta2;
+
+	ck_assert_int_eq(0, hash_cache_init());
+
+	init_meta(&meta1);
+	init_meta(&meta2);
+	meta2.st_ino++;
+	hash_cache_put("repository/a.mft", &meta1, HASH1);
+	hash_cache_put("repository/b.mft", &meta2, HASH2);
+	ck_assert_int_eq(0, hash_cache_save());
+	hash_cache_cleanup();
+
+	/* a.mft survives the restart, nanoseconds included */
+	ck_assert_int_eq(0, hash_cache_init());
+	check_hash("repository/a.mft", &meta1, HASH1);
+	meta1.st_mtim.tv_nsec--;
+	check_missing("repository/a.mft", &meta1);
+	meta1.st_mtim.tv_nsec++;
+
+	/* b.mft wasn't used during this "cycle" */
+	ck_assert_int_eq(0, hash_cache_save());
+	hash_cache_cleanup();
+
+	ck_assert_int_eq(0, hash_cache_init());
+	check_hash("repository/a.mft", &meta1, HASH1);
+	check_missing("repository/b.mft", &meta2);
+	hash_cache_cleanup();
+
+	ck_assert_int_eq(0, remove(CACHE_PATH));
+}
+END_TEST
+
+Suite *hash_cache_suite(void)
+{
+	Suite *suite;
+	TCase *core;
+
+	core = tcase_create("Core");
+	tcase_add_test(core, hash_cache_keys);
+	tcase_add_test(core, hash_cache_persistence);
+
+	suite = suite_create("hash_cache");
+	suite_add_tcase(suite, core);
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite;
+	SRunner *runner;
+	int tests_failed;
+
+	suite = hash_cache_suite();
+
+	runner = srunner_create(suite);
+	srunner_run_all(runner, CK_NORMAL);
+	tests_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+
+	return (tests_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
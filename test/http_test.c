@@ -9,6 +9,30 @@
 #include "uri.c"
 #include "http/http.c"
 
+void
+metrics_http_received(size_t bytes)
+{
+	/* No-op */
+}
+
+unsigned int
+config_get_max_fetches_per_host(void)
+{
+	return 4;
+}
+
+unsigned int
+config_get_http_retry_count(void)
+{
+	return 0;
+}
+
+unsigned int
+config_get_http_retry_interval(void)
+{
+	return 0;
+}
+
 struct response {
 	unsigned char *content;
 	size_t size;
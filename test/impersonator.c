@@ -12,6 +12,8 @@ static char addr_buffer2[INET6_ADDRSTRLEN];
 
 static unsigned int http_priority = 60;
 static unsigned int rsync_priority = 50;
+/* Tests that write the same files point it elsewhere; they can run at once */
+static char const *local_repository = "repository/";
 
 char const *
 v4addr2str(struct in_addr const *addr)
@@ -76,7 +78,7 @@ config_get_max_cert_depth(void)
 char const *
 config_get_local_repository(void)
 {
-	return "repository/";
+	return local_repository;
 }
 
 enum rsync_strategy
@@ -0,0 +1,244 @@
+#include <check.h>
+#include <stdlib.h>
+#include <sys/un.h>
+
+#include "address.c"
+#include "common.c"
+#include "impersonator.c"
+#include "log.c"
+#include "metrics.c"
+
+#define SOCKET_PATH "/tmp/fort-metrics-test.sock"
+
+static char const *metrics_address;
+
+char const *
+config_get_metrics_address(void)
+{
+	return metrics_address;
+}
+
+char const *
+config_get_metrics_port(void)
+{
+	return "9324";
+}
+
+void
+trace_print(FILE *out)
+{
+	fputs("{\"traceEvents\":[]}\n", out);
+}
+
+int
+vrps_get_summary(struct vrps_summary *result)
+{
+	result->serial = 7;
+	result->deltas = 3;
+	result->prefixes = 100;
+	result->router_keys = 2;
+	return 0;
+}
+
+int
+clients_foreach(clients_foreach_cb cb, void *arg)
+{
+	struct client client;
+	struct sockaddr_in *addr;
+	int error;
+
+	memset(&client, 0, sizeof(client));
+	client.fd = 10;
+	addr = (struct sockaddr_in *) &client.addr;
+	addr->sin_family = AF_INET;
+	addr->sin_addr.s_addr = htonl(0xC0000201);
+	addr->sin_port = htons(40000);
+	client.serial_number = 6;
+	client.serial_number_set = true;
+	client.rtr_version = 1;
+	client.rtr_version_set = true;
+	error = cb(&client, arg);
+	if (error)
+		return error;
+
+	/* Hasn't asked for anything yet */
+	client.fd = 11;
+	addr->sin_port = htons(40001);
+	client.serial_number_set = false;
+	client.rtr_version_set = false;
+	return cb(&client, arg);
+}
+
+static char *
+print(void)
+{
+	FILE *out;
+	char *result;
+	size_t len;
+
+	out = open_memstream(&result, &len);
+	ck_assert_ptr_ne(NULL, out);
+	print_metrics(out);
+	fclose(out);
+
+	return result;
+}
+
+static void
+assert_line(char const *text, char const *line)
+{
+	char expected[256];
+
+	snprintf(expected, sizeof(expected), "\n%s\n", line);
+	if (strstr(text, expected) == NULL)
+		ck_abort_msg("Line '%s' not found in:\n%s", line, text);
+}
+
+START_TEST(metrics_print)
+{
+	char const *repo = "rsync://example.com/repo/sub/dir";
+	char *text;
+
+	metrics_object(MO_ROA, 0);
+	metrics_object(MO_ROA, 0);
+	metrics_object(MO_ROA, -EINVAL);
+	metrics_object(MO_CRL, 0);
+	metrics_tal("tal/\"quoted\"\\.tal", 1.5, 0);
+	metrics_tal("tal/bad.tal", 2, -EINVAL);
+	metrics_tal("tal/bad.tal", 0.25, 0);
+	metrics_fetch(MP_RSYNC, repo, strlen("rsync://example.com/repo"), 1, 0,
+	    0);
+	metrics_fetch(MP_RSYNC, repo, strlen("rsync://example.com/repo"), 2, 0,
+	    EREQFAILED);
+	metrics_fetch(MP_RRDP, "https://example.com/notification.xml",
+	    strlen("https://example.com/notification.xml"), 0.5, 2048, 0);
+	metrics_phase_end(MPH_SLURM, metrics_now());
+	metrics_rtr_sent(100);
+	metrics_rtr_sent(24);
+
+	text = print();
+
+	assert_line(text, "fort_objects_total{type=\"roa\",result=\"valid\"} 2");
+	assert_line(text, "fort_objects_total{type=\"roa\",result=\"invalid\"} 1");
+	assert_line(text, "fort_objects_total{type=\"crl\",result=\"valid\"} 1");
+	assert_line(text, "fort_objects_total{type=\"manifest\",result=\"valid\"} 0");
+
+	assert_line(text, "fort_tal_validation_duration_seconds{tal=\"tal/\\\"quoted\\\"\\\\.tal\"} 1.500");
+	assert_line(text, "fort_tal_validation_duration_seconds{tal=\"tal/bad.tal\"} 0.250");
+	assert_line(text, "fort_tal_validation_success{tal=\"tal/bad.tal\"} 1");
+
+	assert_line(text, "fort_fetches_total{protocol=\"rsync\",repository=\"rsync://example.com/repo\"} 2");
+	assert_line(text, "fort_fetch_failures_total{protocol=\"rsync\",repository=\"rsync://example.com/repo\"} 1");
+	assert_line(text, "fort_fetch_duration_seconds_total{protocol=\"rsync\",repository=\"rsync://example.com/repo\"} 3.000");
+	assert_line(text, "fort_fetch_last_duration_seconds{protocol=\"rsync\",repository=\"rsync://example.com/repo\"} 2.000");
+	assert_line(text, "fort_fetch_received_bytes_total{protocol=\"rrdp\",repository=\"https://example.com/notification.xml\"} 2048");
+	ck_assert_ptr_eq(NULL, strstr(text,
+	    "fort_fetch_received_bytes_total{protocol=\"rsync\""));
+
+	assert_line(text, "# TYPE fort_update_phase_duration_seconds gauge");
+	assert_line(text, "fort_update_phase_duration_seconds{phase=\"validation\"} 0.000");
+
+	assert_line(text, "fort_rtr_serial 7");
+	assert_line(text, "fort_rtr_delta_history 3");
+	assert_line(text, "fort_valid_prefixes 100");
+	assert_line(text, "fort_valid_router_keys 2");
+	assert_line(text, "fort_rtr_client_serial{address=\"192.0.2.1\",port=\"40000\",version=\"1\"} 6");
+	ck_assert_ptr_eq(NULL, strstr(text, "port=\"40001\""));
+	assert_line(text, "fort_rtr_clients 2");
+	assert_line(text, "fort_rtr_sent_bytes_total 124");
+
+	free(text);
+	metrics_stop();
+}
+END_TEST
+
+static char *
+scrape(char const *request)
+{
+	struct sockaddr_un addr;
+	char *response;
+	size_t len;
+	ssize_t consumed;
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, SOCKET_PATH);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	ck_assert_int_ge(fd, 0);
+	ck_assert_int_eq(0, connect(fd, (struct sockaddr *) &addr,
+	    sizeof(addr)));
+	ck_assert_int_eq(strlen(request), send(fd, request, strlen(request),
+	    0));
+
+	response = malloc(65536);
+	ck_assert_ptr_ne(NULL, response);
+	len = 0;
+	do {
+		consumed = recv(fd, response + len, 65535 - len, 0);
+		ck_assert_int_ge(consumed, 0);
+		len += consumed;
+	} while (consumed > 0);
+	response[len] = '\0';
+
+	close(fd);
+	return response;
+}
+
+START_TEST(metrics_serve)
+{
+	char *response;
+
+	metrics_address = SOCKET_PATH;
+	ck_assert_int_eq(0, metrics_start());
+
+	response = scrape("GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n");
+	ck_assert_ptr_eq(response, strstr(response, "HTTP/1.1 200 OK\r\n"));
+	ck_assert_ptr_ne(NULL, strstr(response, "\r\n\r\n# HELP "));
+	ck_assert_ptr_ne(NULL, strstr(response, "\nfort_rtr_serial 7\n"));
+	free(response);
+
+	response = scrape("GET /nope HTTP/1.1\r\n\r\n");
+	ck_assert_ptr_eq(response, strstr(response, "HTTP/1.1 404 "));
+	free(response);
+
+	response = scrape("POST /metrics HTTP/1.1\r\n\r\n");
+	ck_assert_ptr_eq(response, strstr(response, "HTTP/1.1 405 "));
+	free(response);
+
+	metrics_stop();
+	ck_assert_int_ne(0, access(SOCKET_PATH, F_OK));
+	metrics_address = NULL;
+}
+END_TEST
+
+Suite *metrics_suite(void)
+{
+	Suite *suite;
+	TCase *core;
+
+	core = tcase_create("Core");
+	tcase_add_test(core, metrics_print);
+	tcase_add_test(core, metrics_serve);
+
+	suite = suite_create("metrics");
+	suite_add_tcase(suite, core);
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite;
+	SRunner *runner;
+	int tests_failed;
+
+	suite = metrics_suite();
+
+	runner = srunner_create(suite);
+	srunner_run_all(runner, CK_NORMAL);
+	tests_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+
+	return (tests_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
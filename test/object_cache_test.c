@@ -0,0 +1,162 @@
+#include <check.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "common.c"
+#include "file.c"
+#include "impersonator.c"
+#include "line_file.c"
+#include "log.c"
+#include "object_cache.c"
+#include "object_store.c"
+#include "crypto/hash.c"
+#include "crypto/hash_cache.c"
+
+#define REPOSITORY "repository/object_cache/"
+#define PACK_PATH REPOSITORY PACK_NAME
+#define OBJECT_SIZE (400 * 1024)
+
+bool
+config_get_rrdp_object_store(void)
+{
+	return true;
+}
+
+unsigned int
+config_get_object_cache_encoded_size(void)
+{
+	return 1; /* Megabyte; fits two objects */
+}
+
+char const *
+uri_get_local(struct rpki_uri *uri)
+{
+	return NULL;
+}
+
+char const *
+uri_val_get_printable(struct rpki_uri *uri)
+{
+	return NULL;
+}
+
+/* A fake decoded object. */
+struct dummy {
+	unsigned int references;
+};
+
+static void
+dummy_refget(void *arg)
+{
+	((struct dummy *) arg)->references++;
+}
+
+static void
+dummy_refput(void *arg)
+{
+	((struct dummy *) arg)->references--;
+}
+
+static struct object_cache_type const dummy_type = {
+	.refget = dummy_refget,
+	.refput = dummy_refput,
+};
+
+static void
+put(char const *path, char fill)
+{
+	unsigned char *content;
+
+	content = malloc(OBJECT_SIZE);
+	ck_assert_ptr_ne(NULL, content);
+	memset(content, fill, OBJECT_SIZE);
+	ck_assert_int_eq(0, object_store_put(path, content, OBJECT_SIZE));
+	free(content);
+}
+
+static void
+offer(char const *path, struct dummy *dummy)
+{
+	struct object_cache_key key;
+
+	ck_assert(object_cache_key(path, &key));
+	ck_assert_ptr_eq(NULL, object_cache_get(&key, &dummy_type));
+	object_cache_put(path, &key, &dummy_type, dummy);
+}
+
+static struct dummy *
+get(char const *path)
+{
+	struct object_cache_key key;
+
+	ck_assert(object_cache_key(path, &key));
+	return object_cache_get(&key, &dummy_type);
+}
+
+START_TEST(object_cache_lru)
+{
+	struct dummy a = { 1 }, b = { 1 }, c = { 1 };
+
+	ck_assert_int_eq(0, object_store_init());
+	ck_assert_int_eq(0, object_cache_init());
+
+	put("ws/host/a.cer", 'a');
+	put("ws/host/b.cer", 'b');
+	put("ws/host/c.cer", 'c');
+
+	offer("ws/host/a.cer", &a);
+	offer("ws/host/b.cer", &b);
+	ck_assert_uint_eq(2, a.references);
+	ck_assert_uint_eq(2, b.references);
+
+	/* Same content, different path */
+	put("ws/other/a.cer", 'a');
+	ck_assert_ptr_eq(&a, get("ws/other/a.cer"));
+	ck_assert_uint_eq(3, a.references);
+
+	/* The least recently used object is now @b */
+	offer("ws/host/c.cer", &c);
+	ck_assert_uint_eq(1, b.references);
+	ck_assert_ptr_eq(NULL, get("ws/host/b.cer"));
+	ck_assert_ptr_eq(&a, get("ws/host/a.cer"));
+	ck_assert_ptr_eq(&c, get("ws/host/c.cer"));
+
+	object_cache_cleanup();
+	ck_assert_uint_eq(3, a.references);
+	ck_assert_uint_eq(1, b.references);
+	ck_assert_uint_eq(2, c.references);
+
+	object_store_cleanup();
+	ck_assert_int_eq(0, remove(PACK_PATH));
+}
+END_TEST
+
+Suite *object_cache_suite(void)
+{
+	Suite *suite;
+	TCase *core;
+
+	core = tcase_create("Core");
+	tcase_add_test(core, object_cache_lru);
+
+	suite = suite_create("object_cache");
+	suite_add_tcase(suite, core);
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite;
+	SRunner *runner;
+	int tests_failed;
+
+	local_repository = REPOSITORY;
+	suite = object_cache_suite();
+
+	runner = srunner_create(suite);
+	srunner_run_all(runner, CK_NORMAL);
+	tests_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+
+	return (tests_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,449 @@
+#include <check.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "common.c"
+#include "file.c"
+#include "impersonator.c"
+#include "line_file.c"
+#include "log.c"
+#include "object_store.c"
+#include "crypto/hash.c"
+#include "crypto/hash_cache.c"
+
+#define REPOSITORY "repository/object_store/"
+#define PACK_PATH REPOSITORY PACK_NAME
+#define INDEX_PATH PACK_PATH INDEX_EXTENSION
+
+bool
+config_get_rrdp_object_store(void)
+{
+	return true;
+}
+
+char const *
+uri_get_local(struct rpki_uri *uri)
+{
+	return NULL;
+}
+
+char const *
+uri_val_get_printable(struct rpki_uri *uri)
+{
+	return NULL;
+}
+
+static void
+put(char const *path, char const *content)
+{
+	ck_assert_int_eq(0, object_store_put(path,
+	    (unsigned char const *) content, strlen(content)));
+}
+
+static void
+check_object(char const *path, char const *expected)
+{
+	struct stored_object object;
+
+	ck_assert_int_eq(0, object_store_get(path, &object));
+	ck_assert_uint_eq(strlen(expected), object.content_len);
+	ck_assert_int_eq(0, memcmp(expected, object.content,
+	    object.content_len));
+}
+
+static void
+check_missing(char const *path)
+{
+	struct stored_object object;
+
+	ck_assert_int_eq(-ENOENT, object_store_get(path, &object));
+}
+
+static off_t
+pack_size(void)
+{
+	struct stat meta;
+
+	ck_assert_int_eq(0, stat(PACK_PATH, &meta));
+	return meta.st_size;
+}
+
+START_TEST(object_store_put_get)
+{
+	ck_assert_int_eq(0, object_store_init());
+
+	put("ws/host/a/1.roa", "first");
+	put("ws/host/a/2.roa", "second");
+	check_object("ws/host/a/1.roa", "first");
+	check_object("ws/host/a/2.roa", "second");
+	check_missing("ws/host/a/3.roa");
+
+	/* Replace an object after its old version has been mapped */
+	put("ws/host/a/1.roa", "third");
+	check_object("ws/host/a/1.roa", "third");
+	check_object("ws/host/a/2.roa", "second");
+
+	object_store_remove("ws/host/a/2.roa");
+	check_missing("ws/host/a/2.roa");
+	check_object("ws/host/a/1.roa", "third");
+
+	object_store_cleanup();
+	ck_assert_int_eq(0, remove(PACK_PATH));
+}
+END_TEST
+
+START_TEST(object_store_dedup)
+{
+	ck_assert_int_eq(0, object_store_init());
+
+	put("ws/host/a/1.cer", "same");
+	put("ws/host/b/1.cer", "same");
+	put("ws/host/a/1.cer", "same");
+	ck_assert_int_eq(strlen("same"), pack_size());
+	check_object("ws/host/a/1.cer", "same");
+	check_object("ws/host/b/1.cer", "same");
+
+	object_store_cleanup();
+	ck_assert_int_eq(0, remove(PACK_PATH));
+}
+END_TEST
+
+static void
+stage(struct staged_objects *stage, char const *path, char const *content)
+{
+	ck_assert_int_eq(0, object_store_stage(stage, path,
+	    (unsigned char const *) content, strlen(content)));
+}
+
+START_TEST(object_store_staging)
+{
+	struct staged_objects *objects;
+
+	ck_assert_int_eq(0, object_store_init());
+
+	put("ws/host/a/1.mft", "old");
+
+	/* Staged objects stay out of sight, and vanish if not committed */
+	ck_assert_int_eq(0, object_store_stage_create(&objects));
+	stage(objects, "ws/host/a/1.mft", "bad");
+	stage(objects, "ws/host/a/2.roa", "bad roa");
+	check_object("ws/host/a/1.mft", "old");
+	check_missing("ws/host/a/2.roa");
+	object_store_stage_destroy(objects);
+	check_object("ws/host/a/1.mft", "old");
+	check_missing("ws/host/a/2.roa");
+
+	/* Committed ones replace the old objects */
+	ck_assert_int_eq(0, object_store_stage_create(&objects));
+	stage(objects, "ws/host/a/1.mft", "new");
+	stage(objects, "ws/host/a/2.roa", "new roa");
+	check_object("ws/host/a/1.mft", "old");
+	ck_assert_int_eq(0, object_store_commit(objects));
+	object_store_stage_destroy(objects);
+	check_object("ws/host/a/1.mft", "new");
+	check_object("ws/host/a/2.roa", "new roa");
+
+	/* The discarded ones are garbage */
+	ck_assert_int_eq(strlen("old") + strlen("bad") + strlen("bad roa"),
+	    store.garbage);
+
+	object_store_cleanup();
+	ck_assert_int_eq(0, remove(PACK_PATH));
+}
+END_TEST
+
+START_TEST(object_store_roots)
+{
+	char *roots[] = { "rsync://host/a", "rsync://host/c/" };
+
+	ck_assert_int_eq(0, object_store_init());
+
+	put(REPOSITORY "ws/host/a/1.mft", "a1");
+	put(REPOSITORY "ws/host/a/b/2.mft", "a2");
+	put(REPOSITORY "ws/host/ab/3.mft", "ab");
+	put(REPOSITORY "ws/host/c/4.mft", "c");
+	put(REPOSITORY "other/host/a/5.mft", "other");
+
+	ck_assert_int_eq(0, object_store_remove_roots(roots, 2, "ws/"));
+	check_missing(REPOSITORY "ws/host/a/1.mft");
+	check_missing(REPOSITORY "ws/host/a/b/2.mft");
+	check_missing(REPOSITORY "ws/host/c/4.mft");
+	check_object(REPOSITORY "ws/host/ab/3.mft", "ab");
+	check_object(REPOSITORY "other/host/a/5.mft", "other");
+
+	object_store_cleanup();
+	ck_assert_int_eq(0, remove(PACK_PATH));
+}
+END_TEST
+
+START_TEST(object_store_compaction)
+{
+	char name[32];
+	char content[32];
+	unsigned int i;
+
+	ck_assert_int_eq(0, object_store_init());
+
+	for (i = 0; i < 100; i++) {
+		sprintf(name, "ws/host/%u.roa", i);
+		sprintf(content, "content %u", i);
+		put(name, content);
+	}
+	check_object("ws/host/7.roa", "content 7");
+
+	/* Not enough garbage yet */
+	for (i = 0; i < 10; i++) {
+		sprintf(name, "ws/host/%u.roa", i);
+		object_store_remove(name);
+	}
+	object_store_compact();
+	ck_assert_int_eq(strlen("content 0") * 10 + strlen("content 10") * 90,
+	    pack_size());
+
+	for (i = 10; i < 80; i++) {
+		sprintf(name, "ws/host/%u.roa", i);
+		object_store_remove(name);
+	}
+	object_store_compact();
+	ck_assert_int_eq(strlen("content 80") * 20, pack_size());
+
+	for (i = 0; i < 80; i++) {
+		sprintf(name, "ws/host/%u.roa", i);
+		check_missing(name);
+	}
+	for (i = 80; i < 100; i++) {
+		sprintf(name, "ws/host/%u.roa", i);
+		sprintf(content, "content %u", i);
+		check_object(name, content);
+	}
+
+	/* The store remains usable */
+	put("ws/host/100.roa", "content 100");
+	check_object("ws/host/100.roa", "content 100");
+	check_object("ws/host/99.roa", "content 99");
+
+	object_store_cleanup();
+	ck_assert_int_eq(0, remove(PACK_PATH));
+}
+END_TEST
+
+START_TEST(object_store_restart)
+{
+	ck_assert_int_eq(0, object_store_init());
+	ck_assert(!object_store_restored());
+
+	put("ws/host/1.roa", "first");
+	put("ws/host/2.roa", "second");
+	put("ws/host/3 with spaces.roa", "first");
+	object_store_remove("ws/host/2.roa");
+	ck_assert_int_eq(0, object_store_save());
+	/* Not in the index; lost on restart */
+	put("ws/host/4.roa", "fourth");
+	object_store_cleanup();
+
+	ck_assert_int_eq(0, object_store_init());
+	ck_assert(object_store_restored());
+	check_object("ws/host/1.roa", "first");
+	check_missing("ws/host/2.roa");
+	check_object("ws/host/3 with spaces.roa", "first");
+	check_missing("ws/host/4.roa");
+
+	/* The pack keeps growing where it left off */
+	put("ws/host/5.roa", "fifth");
+	check_object("ws/host/5.roa", "fifth");
+	check_object("ws/host/1.roa", "first");
+	object_store_cleanup();
+
+	/* Without the index, the pack is useless */
+	ck_assert_int_eq(0, remove(INDEX_PATH));
+	ck_assert_int_eq(0, object_store_init());
+	ck_assert(!object_store_restored());
+	check_missing("ws/host/1.roa");
+	ck_assert_int_eq(0, pack_size());
+	object_store_cleanup();
+
+	ck_assert_int_eq(0, remove(PACK_PATH));
+}
+END_TEST
+
+/*
+ * Builds a store with two objects, and returns (in @index) the index that
+ * describes it. Release @index with free().
+ */
+static void
+prepare_restart(char **index, size_t *index_len)
+{
+	FILE *file;
+	long len;
+
+	ck_assert_int_eq(0, object_store_init());
+	put("ws/host/1.roa", "first");
+	put("ws/host/2.roa", "second");
+	ck_assert_int_eq(0, object_store_save());
+	object_store_cleanup();
+
+	file = fopen(INDEX_PATH, "rb");
+	ck_assert_ptr_ne(NULL, file);
+	ck_assert_int_eq(0, fseek(file, 0, SEEK_END));
+	len = ftell(file);
+	ck_assert_int_gt(len, 0);
+	rewind(file);
+
+	*index = malloc(len + 1);
+	ck_assert_ptr_ne(NULL, *index);
+	ck_assert_uint_eq(len, fread(*index, 1, len, file));
+	(*index)[len] = '\0';
+	*index_len = len;
+	fclose(file);
+}
+
+/* Replaces the index with @len bytes of @content, followed by @extra. */
+static void
+write_index(char const *content, size_t len, char const *extra)
+{
+	FILE *file;
+
+	file = fopen(INDEX_PATH, "wb");
+	ck_assert_ptr_ne(NULL, file);
+	ck_assert_uint_eq(len, fwrite(content, 1, len, file));
+	fputs(extra, file);
+	fclose(file);
+}
+
+/* The store has to notice it can't trust its files, and start over. */
+static void
+check_not_restored(void)
+{
+	ck_assert_int_eq(0, object_store_init());
+	ck_assert(!object_store_restored());
+	check_missing("ws/host/1.roa");
+	check_missing("ws/host/2.roa");
+	ck_assert_int_eq(0, pack_size());
+	/* And it still works */
+	put("ws/host/1.roa", "other");
+	check_object("ws/host/1.roa", "other");
+	object_store_cleanup();
+}
+
+START_TEST(object_store_corruption)
+{
+	char *index;
+	size_t len;
+	char *last_line;
+	char *version;
+	int fd;
+
+	/* Untouched */
+	prepare_restart(&index, &len);
+	ck_assert_int_eq(0, object_store_init());
+	ck_assert(object_store_restored());
+	check_object("ws/host/1.roa", "first");
+	check_object("ws/host/2.roa", "second");
+	object_store_cleanup();
+	free(index);
+
+	/* Unknown version */
+	prepare_restart(&index, &len);
+	version = index + strlen("fort-object-store ");
+	ck_assert_int_eq('1', *version);
+	*version = '9';
+	write_index(index, len, "");
+	check_not_restored();
+	free(index);
+
+	/* Index cut in the middle of a line */
+	prepare_restart(&index, &len);
+	last_line = strrchr(index, '\n');
+	*last_line = '\0';
+	last_line = strrchr(index, '\n') + 1;
+	write_index(index, (last_line - index) + 10, "");
+	check_not_restored();
+	free(index);
+
+	/* Garbage */
+	prepare_restart(&index, &len);
+	write_index(index, len, "fort-object-store garbage\n");
+	check_not_restored();
+	free(index);
+
+	/* Same path twice */
+	prepare_restart(&index, &len);
+	last_line = strrchr(index, '\n');
+	*last_line = '\0';
+	last_line = strrchr(index, '\n') + 1;
+	write_index(index, len, last_line);
+	check_not_restored();
+	free(index);
+
+	/* Points beyond the pack */
+	prepare_restart(&index, &len);
+	write_index(index, len, "1000000 5 "
+	    "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+	    " ws/host/3.roa\n");
+	check_not_restored();
+	free(index);
+
+	/* Malformed hash */
+	prepare_restart(&index, &len);
+	write_index(index, len, "0 5 0123456789abcdefXX ws/host/3.roa\n");
+	check_not_restored();
+	free(index);
+
+	/* Pack truncated after the index was written */
+	prepare_restart(&index, &len);
+	fd = open(PACK_PATH, O_WRONLY);
+	ck_assert_int_ne(-1, fd);
+	ck_assert_int_eq(0, ftruncate(fd, 4));
+	close(fd);
+	check_not_restored();
+	free(index);
+
+	/* Pack replaced (different inode) */
+	prepare_restart(&index, &len);
+	fd = open(PACK_PATH ".new", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	ck_assert_int_ne(-1, fd);
+	ck_assert_int_eq(11, write(fd, "firstsecond", 11));
+	close(fd);
+	ck_assert_int_eq(0, rename(PACK_PATH ".new", PACK_PATH));
+	check_not_restored();
+	free(index);
+
+	ck_assert_int_eq(0, remove(PACK_PATH));
+}
+END_TEST
+
+Suite *object_store_suite(void)
+{
+	Suite *suite;
+	TCase *core;
+
+	core = tcase_create("Core");
+	tcase_add_test(core, object_store_put_get);
+	tcase_add_test(core, object_store_dedup);
+	tcase_add_test(core, object_store_staging);
+	tcase_add_test(core, object_store_roots);
+	tcase_add_test(core, object_store_compaction);
+	tcase_add_test(core, object_store_restart);
+	tcase_add_test(core, object_store_corruption);
+
+	suite = suite_create("object_store");
+	suite_add_tcase(suite, core);
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite;
+	SRunner *runner;
+	int tests_failed;
+
+	local_repository = REPOSITORY;
+	suite = object_store_suite();
+
+	runner = srunner_create(suite);
+	srunner_run_all(runner, CK_NORMAL);
+	tests_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+
+	return (tests_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,204 @@
+#include <check.h>
+#include <stdlib.h>
+
+#include "common.c"
+#include "impersonator.c"
+#include "log.c"
+#include "rpp_memo.c"
+#include "validation_handler.c"
+
+static unsigned char const KEY1[SHA256_DIGEST_LENGTH] = { 1 };
+static unsigned char const KEY2[SHA256_DIGEST_LENGTH] = { 2 };
+
+/* The current thread's validation state; only its handler matters. */
+static struct validation_handler handler;
+static unsigned int vrps_v4;
+static unsigned int vrps_v6;
+
+struct validation *
+state_retrieve(void)
+{
+	return (struct validation *) &handler;
+}
+
+struct validation_handler const *
+validation_get_validation_handler(struct validation *state)
+{
+	return &handler;
+}
+
+void
+validation_set_validation_handler(struct validation *state,
+    struct validation_handler const *new_handler)
+{
+	handler = *new_handler;
+}
+
+static int
+count_roa_v4(uint32_t as, struct ipv4_prefix const *prefix,
+    uint8_t max_length, void *arg)
+{
+	vrps_v4++;
+	return 0;
+}
+
+static int
+count_roa_v6(uint32_t as, struct ipv6_prefix const *prefix,
+    uint8_t max_length, void *arg)
+{
+	vrps_v6++;
+	return 0;
+}
+
+static void
+reset_handler(void)
+{
+	memset(&handler, 0, sizeof(handler));
+	handler.handle_roa_v4 = count_roa_v4;
+	handler.handle_roa_v6 = count_roa_v6;
+	vrps_v4 = 0;
+	vrps_v6 = 0;
+}
+
+/* Pretends the ROAs of the publication point identified by @key validated. */
+static void
+record(unsigned char const *key, time_t expiration, bool success)
+{
+	struct rpp_memo_recording recording;
+	struct ipv4_prefix v4;
+	struct ipv6_prefix v6;
+
+	memset(&v4, 0, sizeof(v4));
+	memset(&v6, 0, sizeof(v6));
+	v4.len = 24;
+	v6.len = 48;
+	vrps_v4 = 0;
+	vrps_v6 = 0;
+
+	ck_assert_int_eq(0, rpp_memo_record_start(&recording, key));
+	ck_assert_int_eq(0, vhandler_handle_roa_v4(64496, &v4, 24));
+	ck_assert_int_eq(0, vhandler_handle_roa_v4(64497, &v4, 24));
+	ck_assert_int_eq(0, vhandler_handle_roa_v6(64496, &v6, 48));
+	rpp_memo_record_expiration(&recording, expiration);
+	rpp_memo_record_stop(&recording, success);
+
+	/* The original handler saw them, and got reinstated */
+	ck_assert_uint_eq(2, vrps_v4);
+	ck_assert_uint_eq(1, vrps_v6);
+	ck_assert_ptr_eq(count_roa_v4, handler.handle_roa_v4);
+	vrps_v4 = 0;
+	vrps_v6 = 0;
+}
+
+START_TEST(rpp_memo_hit)
+{
+	time_t now;
+
+	ck_assert_int_eq(0, get_current_time(&now));
+	reset_handler();
+
+	ck_assert(!rpp_memo_replay(KEY1));
+	record(KEY1, now + 3600, true);
+
+	ck_assert(rpp_memo_replay(KEY1));
+	ck_assert_uint_eq(2, vrps_v4);
+	ck_assert_uint_eq(1, vrps_v6);
+
+	/* Different manifest or certificate chain */
+	ck_assert(!rpp_memo_replay(KEY2));
+
+	/* Failed publication points are not remembered */
+	record(KEY2, now + 3600, false);
+	ck_assert(!rpp_memo_replay(KEY2));
+
+	rpp_memo_cleanup();
+}
+END_TEST
+
+START_TEST(rpp_memo_expiration)
+{
+	struct memo_entry *entry;
+	time_t now;
+
+	ck_assert_int_eq(0, get_current_time(&now));
+	reset_handler();
+
+	/* Already expired */
+	record(KEY1, now - 1, true);
+	ck_assert(!rpp_memo_replay(KEY1));
+
+	record(KEY1, now + 3600, true);
+	HASH_FIND(hh, memo, KEY1, SHA256_DIGEST_LENGTH, entry);
+	ck_assert_ptr_ne(NULL, entry);
+
+	/* Time passes; one of the ROAs expires */
+	entry->expiration = now;
+	ck_assert(!rpp_memo_replay(KEY1));
+	ck_assert_uint_eq(0, vrps_v4);
+	ck_assert_uint_eq(0, HASH_COUNT(memo));
+	/* It's only released between cycles */
+	ck_assert_ptr_eq(entry, SLIST_FIRST(&retired));
+
+	rpp_memo_sweep();
+	ck_assert(SLIST_EMPTY(&retired));
+
+	rpp_memo_cleanup();
+}
+END_TEST
+
+START_TEST(rpp_memo_sweeping)
+{
+	time_t now;
+
+	ck_assert_int_eq(0, get_current_time(&now));
+	reset_handler();
+
+	record(KEY1, now + 3600, true);
+	record(KEY2, now + 3600, true);
+
+	/* Both were used during the "cycle" */
+	rpp_memo_sweep();
+	ck_assert_uint_eq(2, HASH_COUNT(memo));
+
+	/* Only KEY1 is used during the next one */
+	ck_assert(rpp_memo_replay(KEY1));
+	rpp_memo_sweep();
+	ck_assert_uint_eq(1, HASH_COUNT(memo));
+	ck_assert(rpp_memo_replay(KEY1));
+	ck_assert(!rpp_memo_replay(KEY2));
+
+	rpp_memo_cleanup();
+	ck_assert_uint_eq(0, HASH_COUNT(memo));
+}
+END_TEST
+
+Suite *rpp_memo_suite(void)
+{
+	Suite *suite;
+	TCase *core;
+
+	core = tcase_create("Core");
+	tcase_add_test(core, rpp_memo_hit);
+	tcase_add_test(core, rpp_memo_expiration);
+	tcase_add_test(core, rpp_memo_sweeping);
+
+	suite = suite_create("rpp_memo");
+	suite_add_tcase(suite, core);
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite;
+	SRunner *runner;
+	int tests_failed;
+
+	suite = rpp_memo_suite();
+
+	runner = srunner_create(suite);
+	srunner_run_all(runner, CK_NORMAL);
+	tests_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+
+	return (tests_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
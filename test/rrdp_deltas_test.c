@@ -0,0 +1,479 @@
+#include <check.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "common.c"
+#include "file.c"
+#include "impersonator.c"
+#include "log.c"
+#include "uri.c"
+#include "crypto/hash.c"
+#include "rrdp/rrdp_objects.c"
+#include "rrdp/rrdp_parser.c"
+
+#define OBJ_URI "rsync://deltas.test/repo/a.roa"
+#define OBJ_PATH "repository/deltas.test/repo/a.roa"
+
+/* Deltas, in serial order, and what they say */
+#define DELTAS 2
+static struct delta_changes changes[DELTAS];
+static struct rpki_uri *delta_uris[DELTAS];
+static struct pending_deltas pending;
+
+unsigned int
+config_get_max_fetches_per_host(void)
+{
+	return 1;
+}
+
+void
+fnstack_init(void)
+{
+	/* Empty */
+}
+
+void
+fnstack_cleanup(void)
+{
+	/* Empty */
+}
+
+void
+fnstack_push_uri(struct rpki_uri *uri)
+{
+	/* Empty */
+}
+
+void
+fnstack_pop(void)
+{
+	/* Empty */
+}
+
+bool
+hash_cache_get(char const *path, struct stat const *meta,
+    unsigned char *result)
+{
+	return false;
+}
+
+void
+hash_cache_put(char const *path, struct stat const *meta,
+    unsigned char const *hash)
+{
+	/* Empty */
+}
+
+bool
+object_store_enabled(void)
+{
+	return false;
+}
+
+int
+object_store_get(char const *path, struct stored_object *result)
+{
+	return -ENOENT;
+}
+
+int
+object_store_put(char const *path, unsigned char const *content, size_t len)
+{
+	return -EINVAL;
+}
+
+void
+object_store_remove(char const *path)
+{
+	/* Empty */
+}
+
+int
+object_store_stage_create(struct staged_objects **result)
+{
+	return -EINVAL;
+}
+
+int
+object_store_stage(struct staged_objects *stage, char const *path,
+    unsigned char const *content, size_t len)
+{
+	return -EINVAL;
+}
+
+int
+object_store_commit(struct staged_objects *stage)
+{
+	return -EINVAL;
+}
+
+void
+object_store_stage_destroy(struct staged_objects *stage)
+{
+	/* Empty */
+}
+
+int
+visited_uris_add(struct visited_uris *uris, char const *uri)
+{
+	return 0;
+}
+
+int
+visited_uris_remove(struct visited_uris *uris, char const *uri)
+{
+	return 0;
+}
+
+int
+base64_decode_str(char const *in, size_t in_len, unsigned char *out,
+    size_t *out_len)
+{
+	return -EINVAL;
+}
+
+int
+relax_ng_parse(const char *path, xml_read_cb cb, void *arg)
+{
+	return -EINVAL;
+}
+
+int
+relax_ng_parse_io(char const *name, xmlInputReadCallback read_cb, void *ctx,
+    xml_read_cb cb, void *arg)
+{
+	return -EINVAL;
+}
+
+int
+http_download_file(struct rpki_uri *uri, http_write_cb cb, bool log_operation)
+{
+	return -EINVAL;
+}
+
+int
+http_download_file_with_ims(struct rpki_uri *uri, http_write_cb cb, long value,
+    bool log_operation)
+{
+	return -EINVAL;
+}
+
+int
+http_download_files(struct rpki_uri **uris, size_t count, http_write_cb cb,
+    bool log_operation)
+{
+	return -EINVAL;
+}
+
+int
+http_stream_open(struct rpki_uri *uri, bool log_operation,
+    struct http_stream **result)
+{
+	return -EINVAL;
+}
+
+int
+http_stream_read(struct http_stream *stream, unsigned char *buffer,
+    size_t size)
+{
+	return -EINVAL;
+}
+
+int
+http_stream_close(struct http_stream *stream)
+{
+	return -EINVAL;
+}
+
+int
+db_rrdp_uris_get_last_update(char const *uri, long *result)
+{
+	return -ENOENT;
+}
+
+int
+db_rrdp_uris_set_request_status(char const *uri, rrdp_req_status_t value)
+{
+	return -ENOENT;
+}
+
+static void
+set_doc_data(struct doc_data *data, char const *hashed)
+{
+	unsigned int hash_len;
+
+	data->uri = strdup(OBJ_URI);
+	ck_assert_ptr_ne(NULL, data->uri);
+
+	if (hashed == NULL)
+		return;
+
+	data->hash = malloc(EVP_MAX_MD_SIZE);
+	ck_assert_ptr_ne(NULL, data->hash);
+	ck_assert_int_eq(0, hash_buffer("sha256", (unsigned char *) hashed,
+	    strlen(hashed), data->hash, &hash_len));
+	data->hash_len = hash_len;
+}
+
+/*
+ * Adds a <publish> of @content to delta @d. @replaced is the content it
+ * expects to replace; NULL if the object is supposed to be new.
+ */
+static void
+publish(unsigned int d, char const *content, char const *replaced)
+{
+	struct publish *publish;
+
+	ck_assert_int_eq(0, publish_create(&publish));
+	set_doc_data(&publish->doc_data, replaced);
+	publish->content = (unsigned char *) strdup(content);
+	ck_assert_ptr_ne(NULL, publish->content);
+	publish->content_len = strlen(content);
+
+	ck_assert_int_eq(0, add_delta_change(&changes[d], publish, NULL));
+}
+
+/* Adds a <withdraw> of the object (expected to contain @content) to @d. */
+static void
+withdraw(unsigned int d, char const *content)
+{
+	struct withdraw *withdraw;
+
+	ck_assert_int_eq(0, withdraw_create(&withdraw));
+	set_doc_data(&withdraw->doc_data, content);
+
+	ck_assert_int_eq(0, add_delta_change(&changes[d], NULL, withdraw));
+}
+
+static void
+init_deltas(void)
+{
+	unsigned int d;
+
+	for (d = 0; d < DELTAS; d++) {
+		delta_changes_init(&changes[d]);
+		delta_uris[d] = NULL;
+	}
+
+	memset(&pending, 0, sizeof(pending));
+	pending.uris = delta_uris;
+	pending.changes = changes;
+	pending.count = DELTAS;
+}
+
+static void
+cleanup_deltas(void)
+{
+	unsigned int d;
+
+	for (d = 0; d < DELTAS; d++)
+		delta_changes_cleanup(&changes[d], delta_change_cleanup);
+}
+
+static void
+write_object(char const *content)
+{
+	char path[] = OBJ_PATH; /* create_dir_recursive() needs it writable */
+	struct stat meta;
+
+	ck_assert_int_eq(0, write_file(path, (unsigned char *) content,
+	    strlen(content), &meta));
+}
+
+static void
+check_object(char const *expected)
+{
+	char buffer[64];
+	FILE *file;
+	size_t len;
+
+	file = fopen(OBJ_PATH, "rb");
+	ck_assert_ptr_ne(NULL, file);
+	len = fread(buffer, 1, sizeof(buffer) - 1, file);
+	fclose(file);
+	buffer[len] = '\0';
+
+	ck_assert_str_eq(expected, buffer);
+}
+
+static bool
+object_exists(void)
+{
+	struct stat meta;
+	return stat(OBJ_PATH, &meta) == 0;
+}
+
+START_TEST(deltas_publish_withdraw)
+{
+	struct net_change *net, *node;
+
+	/* Created by the first delta, gone by the second */
+	init_deltas();
+	publish(0, "v1", NULL);
+	withdraw(1, "v1");
+
+	net = NULL;
+	ck_assert_int_eq(0, net_changes_add(&net, &changes[0].array[0]));
+	ck_assert_int_eq(0, net_changes_add(&net, &changes[1].array[0]));
+	ck_assert_uint_eq(1, HASH_COUNT(net));
+	HASH_FIND_STR(net, OBJ_URI, node);
+	ck_assert_ptr_ne(NULL, node);
+	ck_assert(!node->existed);
+	ck_assert_ptr_eq(&changes[1].array[0], node->last);
+	net_changes_destroy(net);
+
+	/* The object never reaches the disk */
+	ck_assert_int_eq(0, apply_deltas(&pending, NULL));
+	ck_assert(!object_exists());
+
+	cleanup_deltas();
+}
+END_TEST
+
+START_TEST(deltas_withdraw_publish)
+{
+	struct net_change *net, *node;
+
+	/* Replaced by means of a withdraw and a fresh publish */
+	write_object("v1");
+	init_deltas();
+	withdraw(0, "v1");
+	publish(1, "v2", NULL);
+
+	net = NULL;
+	ck_assert_int_eq(0, net_changes_add(&net, &changes[0].array[0]));
+	ck_assert_int_eq(0, net_changes_add(&net, &changes[1].array[0]));
+	HASH_FIND_STR(net, OBJ_URI, node);
+	ck_assert_ptr_ne(NULL, node);
+	ck_assert(node->existed);
+	ck_assert_ptr_eq(&changes[1].array[0], node->last);
+	net_changes_destroy(net);
+
+	ck_assert_int_eq(0, apply_deltas(&pending, NULL));
+	check_object("v2");
+	cleanup_deltas();
+
+	/* Once withdrawn, it can't be replaced */
+	init_deltas();
+	withdraw(0, "v2");
+	publish(1, "v3", "v2");
+	ck_assert_int_ne(0, apply_deltas(&pending, NULL));
+	check_object("v2");
+	cleanup_deltas();
+
+	ck_assert_int_eq(0, delete_dir_recursive_bottom_up(OBJ_PATH));
+}
+END_TEST
+
+START_TEST(deltas_hash_mismatch)
+{
+	/* The second delta expects a version the first one didn't publish */
+	write_object("v1");
+	init_deltas();
+	publish(0, "v2", "v1");
+	publish(1, "v3", "v1");
+
+	ck_assert_int_eq(EINVAL, apply_deltas(&pending, NULL));
+	/* Nothing was applied */
+	check_object("v1");
+	cleanup_deltas();
+
+	/* Same, with a withdraw */
+	init_deltas();
+	publish(0, "v2", "v1");
+	withdraw(1, "v1");
+	ck_assert_int_ne(0, apply_deltas(&pending, NULL));
+	check_object("v1");
+	cleanup_deltas();
+
+	/* The right chain of hashes */
+	init_deltas();
+	publish(0, "v2", "v1");
+	publish(1, "v3", "v2");
+	ck_assert_int_eq(0, apply_deltas(&pending, NULL));
+	check_object("v3");
+	cleanup_deltas();
+
+	ck_assert_int_eq(0, delete_dir_recursive_bottom_up(OBJ_PATH));
+}
+END_TEST
+
+static int
+count_delta(struct delta_head *head, void *arg)
+{
+	(*(unsigned int *) arg)++;
+	return 0;
+}
+
+START_TEST(deltas_coverage)
+{
+	struct update_notification *notification;
+	unsigned char hash[] = { 1 };
+	unsigned int count;
+
+	/* The notification only lists serials 9 and 10 */
+	ck_assert_int_eq(0, update_notification_create(&notification));
+	notification->global_data.serial = 10;
+	ck_assert_int_eq(0, deltas_head_set_size(notification->deltas_list, 2));
+	ck_assert_int_eq(0, deltas_head_add(notification->deltas_list, 10, 9,
+	    "https://deltas.test/9.xml", hash, sizeof(hash)));
+	ck_assert_int_eq(0, deltas_head_add(notification->deltas_list, 10, 10,
+	    "https://deltas.test/10.xml", hash, sizeof(hash)));
+
+	count = 0;
+	ck_assert_int_eq(0, deltas_head_for_each(notification->deltas_list, 10,
+	    8, count_delta, &count));
+	ck_assert_uint_eq(2, count);
+	count = 0;
+	ck_assert_int_eq(0, deltas_head_for_each(notification->deltas_list, 10,
+	    9, count_delta, &count));
+	ck_assert_uint_eq(1, count);
+
+	/* Serial 8 is missing, so the snapshot has to be used instead */
+	ck_assert_int_eq(-ENOENT, deltas_head_for_each(
+	    notification->deltas_list, 10, 7, count_delta, &count));
+	ck_assert_int_ne(0, rrdp_process_deltas(notification, 7, NULL, false));
+	/* Whatever the server claims */
+	ck_assert_int_ne(0, rrdp_process_deltas(notification, 0, NULL, false));
+	notification->global_data.serial = ULONG_MAX;
+	ck_assert_int_ne(0, rrdp_process_deltas(notification, 7, NULL, false));
+
+	update_notification_destroy(notification);
+
+	/* Nothing to parse */
+	memset(&pending, 0, sizeof(pending));
+	ck_assert_int_eq(0, parse_deltas(&pending));
+}
+END_TEST
+
+Suite *rrdp_deltas_suite(void)
+{
+	Suite *suite;
+	TCase *core;
+
+	core = tcase_create("Core");
+	tcase_add_test(core, deltas_publish_withdraw);
+	tcase_add_test(core, deltas_withdraw_publish);
+	tcase_add_test(core, deltas_hash_mismatch);
+	tcase_add_test(core, deltas_coverage);
+
+	suite = suite_create("rrdp_deltas");
+	suite_add_tcase(suite, core);
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite;
+	SRunner *runner;
+	int tests_failed;
+
+	suite = rrdp_deltas_suite();
+
+	runner = srunner_create(suite);
+	srunner_run_all(runner, CK_NORMAL);
+	tests_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+
+	return (tests_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
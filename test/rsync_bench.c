@@ -0,0 +1,207 @@
+/*
+ * Compares the trie of downloaded rsync URIs against the linear scan it
+ * replaced, on a synthetic repository tree.
+ *
+ * Not part of `make check`. Build and run it with
+ *
+ * 	make rsync.bench && ./rsync.bench [<CAs> [<scanned lookups>]]
+ *
+ * Every CA publishes in a directory of its own, spread over 64 servers, and
+ * every directory is marked as downloaded. Half the lookups are objects inside
+ * those directories, the other half miss. The linear scan is quadratic, so it
+ * only runs the first <scanned lookups> lookups.
+ */
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "common.c"
+#include "log.c"
+#include "impersonator.c"
+#include "str_token.c"
+#include "uri.c"
+#include "rsync/rsync.c"
+
+struct validation *
+state_retrieve(void)
+{
+	return NULL;
+}
+
+struct uri_list *
+validation_rsync_visited_uris(struct validation *state)
+{
+	return NULL;
+}
+
+unsigned int
+config_get_rsync_retry_count(void)
+{
+	return 0;
+}
+
+unsigned int
+config_get_rsync_retry_interval(void)
+{
+	return 0;
+}
+
+int
+reqs_errors_add_uri(char const *uri)
+{
+	return 0;
+}
+
+void
+reqs_errors_rem_uri(char const *uri)
+{
+	/* No-op */
+}
+
+bool
+reqs_errors_log_uri(char const *uri)
+{
+	return true;
+}
+
+int
+reqs_errors_foreach(reqs_errors_cb cb, void *arg)
+{
+	return 0;
+}
+
+double
+metrics_now(void)
+{
+	return 0;
+}
+
+void
+metrics_fetch(enum metrics_protocol protocol, char const *uri, size_t len,
+    double seconds, size_t bytes, int error)
+{
+	/* No-op */
+}
+
+void
+trace_begin(struct trace_span *span, char const *name)
+{
+	/* No-op */
+}
+
+void
+trace_end(struct trace_span *span, char const *uri)
+{
+	/* No-op */
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct rpki_uri *
+create_uri(char const *format, unsigned int ca)
+{
+	struct rpki_uri *uri;
+	char str[128];
+
+	snprintf(str, sizeof(str), format, ca % 64, ca / 256, ca);
+	if (uri_create_rsync_str(&uri, str, strlen(str)) != 0)
+		exit(EXIT_FAILURE);
+	return uri;
+}
+
+static void
+report(char const *name, double seconds, unsigned int lookups)
+{
+	printf("%-14s %10u %14.0f\n", name, lookups, lookups / seconds);
+}
+
+/* The old is_already_downloaded(). */
+static bool
+scan(struct rpki_uri **downloaded, unsigned int count, struct rpki_uri *uri)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+		if (is_descendant(downloaded[i], uri))
+			return true;
+	return false;
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned int cas, scanned;
+	struct rpki_uri **dirs, **lookups;
+	struct uri_list *list;
+	unsigned int i, hits;
+	double start;
+
+	cas = (argc > 1) ? strtoul(argv[1], NULL, 10) : 50000;
+	scanned = (argc > 2) ? strtoul(argv[2], NULL, 10) : 1000;
+	if (scanned > 2 * cas)
+		scanned = 2 * cas;
+
+	dirs = malloc(cas * sizeof(struct rpki_uri *));
+	lookups = malloc(2 * cas * sizeof(struct rpki_uri *));
+	if (dirs == NULL || lookups == NULL)
+		return EXIT_FAILURE;
+	for (i = 0; i < cas; i++) {
+		dirs[i] = create_uri("rsync://rpki%u.example.net/repository/%u/ca%u/",
+		    i);
+		lookups[2 * i] = create_uri("rsync://rpki%u.example.net/repository/%u/ca%u/ca.mft",
+		    i);
+		lookups[2 * i + 1] = create_uri("rsync://rpki%u.example.net/repository/%u/ca%u-new/ca.mft",
+		    i);
+	}
+
+	if (rsync_create(&list) != 0)
+		return EXIT_FAILURE;
+
+	printf("%u CAs\n", cas);
+	printf("%-14s %10s %14s\n", "", "lookups", "lookups/s");
+
+	start = now();
+	for (i = 0; i < cas; i++)
+		if (mark_as_downloaded(dirs[i], list) != 0)
+			return EXIT_FAILURE;
+	report("trie (insert)", now() - start, cas);
+
+	hits = 0;
+	start = now();
+	for (i = 0; i < 2 * cas; i++)
+		if (is_already_downloaded(lookups[i], list))
+			hits++;
+	report("trie", now() - start, 2 * cas);
+	if (hits != cas) {
+		fprintf(stderr, "Trie: %u hits, expected %u.\n", hits, cas);
+		return EXIT_FAILURE;
+	}
+
+	hits = 0;
+	start = now();
+	for (i = 0; i < scanned; i++)
+		if (scan(dirs, cas, lookups[i]))
+			hits++;
+	report("linear scan", now() - start, scanned);
+	if (hits != (scanned + 1) / 2) {
+		fprintf(stderr, "Scan: %u hits, expected %u.\n", hits,
+		    (scanned + 1) / 2);
+		return EXIT_FAILURE;
+	}
+
+	rsync_destroy(list);
+	for (i = 0; i < cas; i++) {
+		uri_refput(dirs[i]);
+		uri_refput(lookups[2 * i]);
+		uri_refput(lookups[2 * i + 1]);
+	}
+	free(lookups);
+	free(dirs);
+	return EXIT_SUCCESS;
+}
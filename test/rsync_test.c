@@ -16,6 +16,31 @@ state_retrieve(void)
 	return NULL;
 }
 
+double
+metrics_now(void)
+{
+	return 0;
+}
+
+void
+metrics_fetch(enum metrics_protocol protocol, char const *uri, size_t len,
+    double seconds, size_t bytes, int error)
+{
+	/* No-op */
+}
+
+void
+trace_begin(struct trace_span *span, char const *name)
+{
+	/* No-op */
+}
+
+void
+trace_end(struct trace_span *span, char const *uri)
+{
+	/* No-op */
+}
+
 START_TEST(rsync_load_normal)
 {
 
@@ -68,6 +93,15 @@ __mark_as_downloaded(char *uri_str, struct uri_list *visited_uris)
 	uri_refput(uri);
 }
 
+static void
+__unmark_as_downloaded(char *uri_str, struct uri_list *visited_uris)
+{
+	struct rpki_uri *uri;
+	ck_assert_int_eq(0, uri_create_rsync_str(&uri, uri_str, strlen(uri_str)));
+	unmark_as_downloaded(uri, visited_uris);
+	uri_refput(uri);
+}
+
 static void
 assert_downloaded(char *uri_str, struct uri_list *visited_uris, bool expected)
 {
@@ -102,7 +136,92 @@ START_TEST(rsync_test_list)
 	    false);
 	assert_downloaded("rsync://example.potato/rpki/abc/", visited_uris,
 	    true);
+	assert_downloaded("rsync://example.foo/repository", visited_uris,
+	    true);
+	assert_downloaded("rsync://example.foo/repositor", visited_uris,
+	    false);
+	assert_downloaded("rsync://example.foo/repository2/", visited_uris,
+	    false);
+	assert_downloaded("rsync://example.foo/", visited_uris, false);
+
+	/* As reset_downloaded(); other repositories are left alone */
+	__unmark_as_downloaded("rsync://example.foo/repository/abc",
+	    visited_uris);
+	assert_downloaded("rsync://example.foo/repository/", visited_uris,
+	    false);
+	assert_downloaded("rsync://example.foo/repository/abc/cdfg",
+	    visited_uris, false);
+	assert_downloaded("rsync://example.foo/member_repository/bca",
+	    visited_uris, true);
+	assert_downloaded("rsync://example.potato/rpki/abc/", visited_uris,
+	    true);
+	__mark_as_downloaded("rsync://example.foo/repository/abc",
+	    visited_uris);
+	assert_downloaded("rsync://example.foo/repository/", visited_uris,
+	    false);
+	assert_downloaded("rsync://example.foo/repository/abc/d",
+	    visited_uris, true);
+
+	/* The subtree goes away as well */
+	__mark_as_downloaded("rsync://example.foo/repository/abc/d/e",
+	    visited_uris);
+	__unmark_as_downloaded("rsync://example.foo/repository/abc",
+	    visited_uris);
+	assert_downloaded("rsync://example.foo/repository/abc/d/e/f",
+	    visited_uris, false);
+	assert_downloaded("rsync://example.foo/member_repository/",
+	    visited_uris, true);
+
+	/* Unknown repositories are no-ops */
+	__unmark_as_downloaded("rsync://example.bar/repository/",
+	    visited_uris);
+	assert_downloaded("rsync://example.potato/rpki/", visited_uris, true);
+
+	rsync_destroy(visited_uris);
+}
+END_TEST
+
+static void
+assert_downloading(char *uri_str, struct uri_list *visited_uris,
+    bool expected)
+{
+	struct rpki_uri *uri;
+	ck_assert_int_eq(0, uri_create_rsync_str(&uri, uri_str, strlen(uri_str)));
+	ck_assert_int_eq(is_being_downloaded(uri, visited_uris), expected);
+	uri_refput(uri);
+}
+
+START_TEST(rsync_test_downloading)
+{
+	struct uri_list *visited_uris;
+	struct rpki_uri *uri;
+	char *uri_str;
+
+	ck_assert_int_eq(rsync_create(&visited_uris), 0);
+
+	uri_str = "rsync://example.foo/repository/abc/";
+	ck_assert_int_eq(0, uri_create_rsync_str(&uri, uri_str,
+	    strlen(uri_str)));
+	ck_assert_int_eq(uri_slist_add(&visited_uris->downloading, uri), 0);
+
+	assert_downloading("rsync://example.foo/repository/abc/",
+	    visited_uris, true);
+	assert_downloading("rsync://example.foo/repository/abc/def",
+	    visited_uris, true);
+	assert_downloading("rsync://example.foo/repository/", visited_uris,
+	    true);
+	assert_downloading("rsync://example.foo/repository/abcd",
+	    visited_uris, false);
+	assert_downloading("rsync://example.foo/member_repository/",
+	    visited_uris, false);
+	assert_downloaded("rsync://example.foo/repository/abc/", visited_uris,
+	    false);
 
+	unmark_as_downloading(uri, visited_uris);
+	assert_downloading("rsync://example.foo/repository/abc/",
+	    visited_uris, false);
+
+	uri_refput(uri);
 	rsync_destroy(visited_uris);
 }
 END_TEST
@@ -151,6 +270,7 @@ Suite *rsync_load_suite(void)
 
 	uri_list = tcase_create("uriList");
 	tcase_add_test(uri_list, rsync_test_list);
+	tcase_add_test(uri_list, rsync_test_downloading);
 
 	test_get_prefix = tcase_create("test_get_prefix");
 	tcase_add_test(test_get_prefix, rsync_test_get_prefix);
@@ -256,6 +256,270 @@ START_TEST(test_merge)
 }
 END_TEST
 
+static int
+remove_odd_asns(struct vrp const *vrp, void *arg)
+{
+	struct db_table *table = arg;
+
+	if (vrp->asn % 2 == 1)
+		db_table_remove_roa(table, vrp);
+	return 0;
+}
+
+static int
+count_even_asns(struct vrp const *vrp, void *arg)
+{
+	unsigned int *count = arg;
+
+	ck_assert_uint_eq(0, vrp->asn % 2);
+	(*count)++;
+	return 0;
+}
+
+START_TEST(test_remove)
+{
+	struct ipv4_prefix prefix4;
+	struct db_table *table, *clone;
+	struct vrp vrp;
+	unsigned int asn;
+	unsigned int count;
+
+	table = db_table_create();
+	ck_assert_ptr_ne(NULL, table);
+
+	prefix4.addr.s_addr = ADDR1;
+	prefix4.len = 24;
+	for (asn = 0; asn < 1000; asn++)
+		ck_assert_int_eq(0, rtrhandler_handle_roa_v4(table, asn,
+		    &prefix4, 32));
+	/* Duplicates are ignored */
+	ck_assert_int_eq(0, rtrhandler_handle_roa_v4(table, 5, &prefix4, 32));
+	ck_assert_uint_eq(1000, db_table_roa_count(table));
+
+	/* Removing the current element from the foreach is allowed */
+	ck_assert_int_eq(0, db_table_foreach_roa(table, remove_odd_asns, table));
+	ck_assert_uint_eq(500, db_table_roa_count(table));
+
+	ck_assert_int_eq(0, db_table_clone(&clone, table));
+	db_table_destroy(table);
+
+	count = 0;
+	ck_assert_int_eq(0, db_table_foreach_roa(clone, count_even_asns,
+	    &count));
+	ck_assert_uint_eq(500, count);
+
+	/* The survivors are still reachable through the index */
+	memset(&vrp, 0, sizeof(vrp));
+	vrp.prefix.v4.s_addr = ADDR1;
+	vrp.prefix_length = 24;
+	vrp.max_prefix_length = 32;
+	vrp.addr_fam = AF_INET;
+	for (asn = 0; asn < 1000; asn += 2) {
+		vrp.asn = asn;
+		db_table_remove_roa(clone, &vrp);
+	}
+	ck_assert_uint_eq(0, db_table_roa_count(clone));
+
+	db_table_destroy(clone);
+}
+END_TEST
+
+static void
+add_numbered_roas(struct db_table *table, unsigned int first,
+    unsigned int last)
+{
+	struct ipv4_prefix prefix4;
+	struct ipv6_prefix prefix6;
+	unsigned int i;
+
+	prefix4.len = 32;
+	prefix6.len = 128;
+	for (i = first; i < last; i++) {
+		prefix4.addr.s_addr = htonl(i);
+		ck_assert_int_eq(0, rtrhandler_handle_roa_v4(table, 10,
+		    &prefix4, 32));
+		in6_addr_init(&prefix6.addr, 0x20010DB8u, 0, 0, i);
+		ck_assert_int_eq(0, rtrhandler_handle_roa_v6(table, 10,
+		    &prefix6, 128));
+	}
+}
+
+static int
+count_delta(struct delta_vrp const *delta, void *arg)
+{
+	unsigned int *counts = arg;
+	unsigned int i;
+
+	i = (delta->vrp.addr_fam == AF_INET) ? 0 : 2;
+	if (delta->flags == FLAG_WITHDRAWAL)
+		i++;
+	counts[i]++;
+	return 0;
+}
+
+static int
+count_rk_delta(struct delta_router_key const *delta, void *arg)
+{
+	ck_abort_msg("Unexpected Router Key delta");
+	return 0;
+}
+
+START_TEST(test_compute_deltas)
+{
+	struct db_table *old, *new;
+	struct deltas *deltas;
+	/* v4 announcements, v4 withdrawals, v6 announcements, v6 withdrawals */
+	unsigned int counts[4];
+
+	/* Big enough to diff both address families in parallel */
+	old = db_table_create();
+	ck_assert_ptr_ne(NULL, old);
+	add_numbered_roas(old, 0, 20000);
+	new = db_table_create();
+	ck_assert_ptr_ne(NULL, new);
+	add_numbered_roas(new, 15000, 40000);
+
+	ck_assert_int_eq(0, compute_deltas(old, new, &deltas));
+
+	memset(counts, 0, sizeof(counts));
+	ck_assert_int_eq(0, deltas_foreach(1, deltas, count_delta,
+	    count_rk_delta, counts));
+	ck_assert_uint_eq(20000, counts[0]);
+	ck_assert_uint_eq(15000, counts[1]);
+	ck_assert_uint_eq(20000, counts[2]);
+	ck_assert_uint_eq(15000, counts[3]);
+	deltas_refput(deltas);
+
+	/* No changes */
+	ck_assert_int_eq(0, compute_deltas(new, new, &deltas));
+	ck_assert_int_eq(true, deltas_is_empty(deltas));
+	deltas_refput(deltas);
+
+	db_table_destroy(old);
+	db_table_destroy(new);
+}
+END_TEST
+
+START_TEST(test_join)
+{
+	static unsigned char const ski[RK_SKI_LEN] = { 1 };
+	static unsigned char const spk[RK_SPKI_LEN] = { 2 };
+	struct db_table *buffers[3];
+	struct db_table *joined, *expected;
+	struct deltas *deltas;
+	struct vrp vrp;
+	unsigned int i;
+
+	/* Overlapping, and big enough to be sorted in parallel */
+	for (i = 0; i < 3; i++) {
+		buffers[i] = db_table_create_buffer();
+		ck_assert_ptr_ne(NULL, buffers[i]);
+		ck_assert_int_eq(0, rtrhandler_handle_router_key(buffers[i],
+		    ski, 10, spk));
+	}
+	add_numbered_roas(buffers[0], 0, 20000);
+	add_numbered_roas(buffers[1], 10000, 30000);
+	add_numbered_roas(buffers[2], 25000, 26000);
+	/* Buffers don't look for duplicates */
+	add_numbered_roas(buffers[2], 25000, 26000);
+	ck_assert_uint_eq(4000, db_table_roa_count(buffers[2]));
+
+	ck_assert_int_eq(0, db_table_join(buffers, 3, &joined));
+	for (i = 0; i < 3; i++)
+		db_table_destroy(buffers[i]);
+
+	ck_assert_uint_eq(60000, db_table_roa_count(joined));
+	ck_assert_uint_eq(1, db_table_router_key_count(joined));
+	ck_assert_uint_eq(30000, joined->roas_v4);
+
+	expected = db_table_create();
+	ck_assert_ptr_ne(NULL, expected);
+	add_numbered_roas(expected, 0, 30000);
+	ck_assert_int_eq(0, rtrhandler_handle_router_key(expected, ski, 10,
+	    spk));
+	ck_assert_int_eq(0, compute_deltas(expected, joined, &deltas));
+	ck_assert_int_eq(true, deltas_is_empty(deltas));
+	deltas_refput(deltas);
+	db_table_destroy(expected);
+
+	/* The index works */
+	memset(&vrp, 0, sizeof(vrp));
+	vrp.asn = 10;
+	vrp.prefix.v4.s_addr = htonl(29999);
+	vrp.prefix_length = 32;
+	vrp.max_prefix_length = 32;
+	vrp.addr_fam = AF_INET;
+	db_table_remove_roa(joined, &vrp);
+	ck_assert_uint_eq(59999, db_table_roa_count(joined));
+
+	db_table_destroy(joined);
+
+	/* No buffers at all */
+	ck_assert_int_eq(0, db_table_join(NULL, 0, &joined));
+	ck_assert_uint_eq(0, db_table_roa_count(joined));
+	db_table_destroy(joined);
+}
+END_TEST
+
+/* Same as slurm_apply(): clone the table, and filter out some VRPs. */
+START_TEST(test_join_filter)
+{
+	struct db_table *buffer, *joined, *filtered;
+	struct deltas *deltas;
+	struct ipv4_prefix prefix4;
+	struct vrp vrp;
+	unsigned int counts[4];
+	unsigned int i;
+
+	/* IPv4 only */
+	buffer = db_table_create_buffer();
+	ck_assert_ptr_ne(NULL, buffer);
+	prefix4.len = 32;
+	for (i = 0; i < 10; i++) {
+		prefix4.addr.s_addr = htonl(i);
+		ck_assert_int_eq(0, rtrhandler_handle_roa_v4(buffer, 10,
+		    &prefix4, 32));
+	}
+	ck_assert_int_eq(0, db_table_join(&buffer, 1, &joined));
+	db_table_destroy(buffer);
+
+	ck_assert_int_eq(0, db_table_clone(&filtered, joined));
+	ck_assert_uint_eq(10, filtered->roas_v4);
+
+	/* The highest one, which is the last entry */
+	memset(&vrp, 0, sizeof(vrp));
+	vrp.asn = 10;
+	vrp.prefix.v4.s_addr = htonl(9);
+	vrp.prefix_length = 32;
+	vrp.max_prefix_length = 32;
+	vrp.addr_fam = AF_INET;
+	db_table_remove_roa(filtered, &vrp);
+	ck_assert_uint_eq(9, db_table_roa_count(filtered));
+
+	ck_assert_int_eq(0, compute_deltas(joined, filtered, &deltas));
+	ck_assert_uint_eq(9, filtered->roas_v4);
+	memset(counts, 0, sizeof(counts));
+	ck_assert_int_eq(0, deltas_foreach(1, deltas, count_delta,
+	    count_rk_delta, counts));
+	ck_assert_uint_eq(0, counts[0]);
+	ck_assert_uint_eq(1, counts[1]);
+	ck_assert_uint_eq(0, counts[2]);
+	ck_assert_uint_eq(0, counts[3]);
+	deltas_refput(deltas);
+
+	/* Merging into a table that already has entries */
+	ck_assert_int_eq(0, db_table_merge(filtered, joined));
+	ck_assert_uint_eq(10, db_table_roa_count(filtered));
+	ck_assert_int_eq(0, compute_deltas(joined, filtered, &deltas));
+	ck_assert_uint_eq(10, filtered->roas_v4);
+	ck_assert_int_eq(true, deltas_is_empty(deltas));
+	deltas_refput(deltas);
+
+	db_table_destroy(filtered);
+	db_table_destroy(joined);
+}
+END_TEST
+
 Suite *pdu_suite(void)
 {
 	Suite *suite;
@@ -266,6 +530,10 @@ Suite *pdu_suite(void)
 
 	merge = tcase_create("Merge");
 	tcase_add_test(core, test_merge);
+	tcase_add_test(core, test_remove);
+	tcase_add_test(core, test_compute_deltas);
+	tcase_add_test(core, test_join);
+	tcase_add_test(core, test_join_filter);
 
 	suite = suite_create("DB Table");
 	suite_add_tcase(suite, core);
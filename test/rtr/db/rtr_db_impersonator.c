@@ -49,35 +49,14 @@ add_rk(struct validation_handler *handler, uint32_t as)
 }
 
 int
-__handle_roa_v4(uint32_t as, struct ipv4_prefix const *prefix,
-    uint8_t max_length, void *arg)
-{
-	return rtrhandler_handle_roa_v4(arg, as, prefix, max_length);
-}
-
-int
-__handle_roa_v6(uint32_t as, struct ipv6_prefix const * prefix,
-    uint8_t max_length, void *arg)
-{
-	return rtrhandler_handle_roa_v6(arg, as, prefix, max_length);
-}
-
-int
-__handle_router_key(unsigned char const *ski, uint32_t as,
-    unsigned char const *spk, void *arg)
-{
-	return rtrhandler_handle_router_key(arg, ski, as, spk);
-}
-
-int
-perform_standalone_validation(struct db_table *table)
+perform_standalone_validation(struct vrp_collector *vrps)
 {
 	struct validation_handler handler;
 
-	handler.handle_roa_v4 = __handle_roa_v4;
-	handler.handle_roa_v6 = __handle_roa_v6;
-	handler.handle_router_key = __handle_router_key;
-	handler.arg = table;
+	handler.handle_roa_v4 = handle_roa_v4;
+	handler.handle_roa_v6 = handle_roa_v6;
+	handler.handle_router_key = handle_router_key;
+	handler.arg = vrps;
 
 	switch (iteration) {
 	case 0:
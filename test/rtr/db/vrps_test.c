@@ -11,6 +11,9 @@
 #include "log.c"
 #include "output_printer.c"
 #include "object/router_key.c"
+#include "rtr/pdu_serializer.c"
+#include "rtr/pdu_stream.c"
+#include "rtr/primitive_writer.c"
 #include "rtr/db/delta.c"
 #include "rtr/db/db_table.c"
 #include "rtr/db/rtr_db_impersonator.c"
@@ -77,6 +80,30 @@ clients_get_min_serial(serial_t *result)
 	return 0;
 }
 
+double
+metrics_now(void)
+{
+	return 0;
+}
+
+double
+metrics_phase_end(enum metrics_phase phase, double start)
+{
+	return start;
+}
+
+void
+trace_begin(struct trace_span *span, char const *name)
+{
+	/* No-op */
+}
+
+void
+trace_end(struct trace_span *span, char const *uri)
+{
+	/* No-op */
+}
+
 /* Test functions */
 
 static int
@@ -337,6 +364,29 @@ check_deltas(serial_t from, serial_t to, bool const *expected_deltas,
 		ck_assert_uint_eq(expected_deltas[i], actual_deltas[i]);
 }
 
+static void
+check_delta_pdus_cached(serial_t from, serial_t to)
+{
+	struct pdu_stream *first, *second, *v0;
+	serial_t actual_serial;
+
+	ck_assert_int_eq(0, vrps_get_delta_pdus(from, RTR_V1, &first,
+	    &actual_serial));
+	ck_assert_uint_eq(to, actual_serial);
+	ck_assert_int_eq(0, vrps_get_delta_pdus(from, RTR_V1, &second,
+	    &actual_serial));
+	ck_assert_uint_eq(to, actual_serial);
+	ck_assert_ptr_eq(first, second);
+
+	ck_assert_int_eq(0, vrps_get_delta_pdus(from, RTR_V0, &v0,
+	    &actual_serial));
+	ck_assert_ptr_ne(first, v0);
+
+	pdu_stream_refput(first);
+	pdu_stream_refput(second);
+	pdu_stream_refput(v0);
+}
+
 static void
 check_no_deltas(serial_t from, serial_t to)
 {
@@ -461,6 +511,10 @@ START_TEST(test_delta_ovrd)
 	check_deltas(2, 3, deltas_2to3_clean, true);
 	check_deltas(3, 3, deltas_3to3_clean, true);
 
+	/* Serialized deltas are built once, then shared */
+	check_delta_pdus_cached(0, 3);
+	check_delta_pdus_cached(2, 3);
+
 	vrps_destroy();
 
 	/* Return to its initial value */
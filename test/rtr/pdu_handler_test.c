@@ -14,6 +14,8 @@
 #include "object/router_key.c"
 #include "rtr/pdu.c"
 #include "rtr/pdu_handler.c"
+#include "rtr/pdu_serializer.c"
+#include "rtr/pdu_stream.c"
 #include "rtr/primitive_reader.c"
 #include "rtr/primitive_writer.c"
 #include "rtr/err_pdu.c"
@@ -114,6 +116,30 @@ clients_get_min_serial(serial_t *result)
 	return 0;
 }
 
+double
+metrics_now(void)
+{
+	return 0;
+}
+
+double
+metrics_phase_end(enum metrics_phase phase, double start)
+{
+	return start;
+}
+
+void
+trace_begin(struct trace_span *span, char const *name)
+{
+	/* No-op */
+}
+
+void
+trace_end(struct trace_span *span, char const *uri)
+{
+	/* No-op */
+}
+
 int
 clients_set_rtr_version(int fd, uint8_t rtr_version)
 {
@@ -144,8 +170,8 @@ send_cache_response_pdu(int fd, uint8_t version)
 	return 0;
 }
 
-int
-send_prefix_pdu(int fd, uint8_t version, struct vrp const *vrp, uint8_t flags)
+static void
+check_prefix_pdu(void)
 {
 	/*
 	 * We don't care about order.
@@ -157,52 +183,42 @@ send_prefix_pdu(int fd, uint8_t version, struct vrp const *vrp, uint8_t flags)
 	ck_assert_msg(pdu_type == PDU_TYPE_IPV4_PREFIX
 	    || pdu_type == PDU_TYPE_IPV6_PREFIX,
 	    "Server's PDU type is %d, not one of the IP Prefixes.", pdu_type);
-	return 0;
 }
 
-int
-send_router_key_pdu(int fd, uint8_t version,
-    struct router_key const *router_key, uint8_t flags)
+static void
+check_router_key_pdu(void)
 {
-	/*
-	 * We don't care about order.
-	 * If the server is expected to return `M` IPv4 PDUs and `N` IPv6 PDUs,
-	 * we'll just check `M + N` contiguous Prefix PDUs.
-	 */
 	uint8_t pdu_type = pop_expected_pdu();
 	pr_op_info("    Server sent Router Key PDU.");
 	ck_assert_msg(pdu_type == PDU_TYPE_ROUTER_KEY,
 	    "Server's PDU type is %d, not Router Key type.", pdu_type);
-	return 0;
-}
-
-static int
-handle_delta(struct delta_vrp const *delta, void *arg)
-{
-	int *fd = arg;
-	ck_assert_int_eq(0, send_prefix_pdu(*fd, RTR_V1, &delta->vrp,
-	    delta->flags));
-	return 0;
-}
-
-static int
-handle_delta_router_key(struct delta_router_key const *delta, void *arg)
-{
-	int *fd = arg;
-	ck_assert_int_eq(0, send_router_key_pdu(*fd, RTR_V1, &delta->router_key,
-	    delta->flags));
-	return 0;
 }
 
 int
-send_delta_pdus(int fd, uint8_t version, struct deltas_db *deltas)
+send_pdu_stream(int fd, struct pdu_stream *stream)
 {
-	struct delta_group *group;
-	array_index i;
-
-	ARRAYLIST_FOREACH(deltas, group, i)
-		ck_assert_int_eq(0, deltas_foreach(group->serial, group->deltas,
-		    handle_delta, handle_delta_router_key, &fd));
+	unsigned char *cursor;
+	uint32_t length;
+
+	for (cursor = stream->bytes; cursor < stream->bytes + stream->len;
+	    cursor += length) {
+		length = ((uint32_t)cursor[4] << 24) | (cursor[5] << 16)
+		    | (cursor[6] << 8) | cursor[7];
+		ck_assert_uint_ge(length, RTRPDU_HDR_LEN);
+
+		switch (cursor[1]) {
+		case PDU_TYPE_IPV4_PREFIX:
+		case PDU_TYPE_IPV6_PREFIX:
+			check_prefix_pdu();
+			break;
+		case PDU_TYPE_ROUTER_KEY:
+			check_router_key_pdu();
+			break;
+		default:
+			ck_abort_msg("Unexpected PDU type in stream: %u",
+			    cursor[1]);
+		}
+	}
 
 	return 0;
 }
@@ -270,14 +286,17 @@ START_TEST(test_typical_exchange)
 	/* From serial 0: Init client request */
 	init_serial_query(&request, &client_pdu, 0);
 
-	/* From serial 0: Define expected server response */
+	/*
+	 * From serial 0: Define expected server response
+	 * (Filtered deltas are sent prefixes first, then router keys.)
+	 */
 	expected_pdu_add(PDU_TYPE_CACHE_RESPONSE);
 	expected_pdu_add(PDU_TYPE_IPV4_PREFIX);
 	expected_pdu_add(PDU_TYPE_IPV6_PREFIX);
-	expected_pdu_add(PDU_TYPE_ROUTER_KEY);
 	expected_pdu_add(PDU_TYPE_IPV4_PREFIX);
 	expected_pdu_add(PDU_TYPE_IPV6_PREFIX);
 	expected_pdu_add(PDU_TYPE_ROUTER_KEY);
+	expected_pdu_add(PDU_TYPE_ROUTER_KEY);
 	expected_pdu_add(PDU_TYPE_END_OF_DATA);
 
 	/* From serial 0: Run and validate */
@@ -427,7 +446,6 @@ START_TEST(test_bad_length)
 	struct serial_query_pdu client_pdu;
 	struct pdu_metadata const *meta;
 	unsigned char buf[BUF_SIZE];
-	int fd;
 
 	pr_op_info("-- Bad Length --");
 
@@ -440,19 +458,17 @@ START_TEST(test_bad_length)
 	client_pdu.header.length--;
 
 	ck_assert_int_gt(serialize_serial_query_pdu(&client_pdu, buf), 0);
-	fd = buffer2fd(buf, BUF_SIZE);
-	ck_assert_int_ge(fd, 0);
 
 	/* Define expected server response */
 	expected_pdu_add(PDU_TYPE_ERROR_REPORT);
 
 	/* Run and validate, before handling */
-	ck_assert_int_eq(-EINVAL, pdu_load(fd, NULL, &request, &meta));
+	ck_assert_int_eq(-EINVAL, pdu_load(0, NULL, buf, BUF_SIZE,
+	    &request, &meta));
 	ck_assert_uint_eq(false, has_expected_pdus());
 
 	/* Clean up */
 	vrps_destroy();
-	close(fd);
 #undef BUF_SIZE
 }
 END_TEST
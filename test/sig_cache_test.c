@@ -0,0 +1,113 @@
+#include <check.h>
+#include <stdlib.h>
+#include <openssl/evp.h>
+#include <openssl/rsa.h>
+
+#include "impersonator.c"
+#include "log.c"
+#include "crypto/sig_cache.c"
+
+static unsigned char const ATTRS[] = "signed attributes";
+static unsigned char const SIG1[] = "signature 1";
+static unsigned char const SIG2[] = "signature 2";
+
+/* A certificate that only has a (random) public key. */
+static X509 *
+create_signer(void)
+{
+	EVP_PKEY_CTX *ctx;
+	EVP_PKEY *pkey;
+	X509 *cert;
+
+	ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+	ck_assert_ptr_ne(NULL, ctx);
+	ck_assert_int_eq(1, EVP_PKEY_keygen_init(ctx));
+	ck_assert_int_eq(1, EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, 1024));
+	pkey = NULL;
+	ck_assert_int_eq(1, EVP_PKEY_keygen(ctx, &pkey));
+	EVP_PKEY_CTX_free(ctx);
+
+	cert = X509_new();
+	ck_assert_ptr_ne(NULL, cert);
+	ck_assert_int_eq(1, X509_set_pubkey(cert, pkey));
+	EVP_PKEY_free(pkey);
+
+	return cert;
+}
+
+static void
+key(X509 *signer, unsigned char const *sig, struct sig_cache_key *result)
+{
+	ck_assert_int_eq(0, sig_cache_key_signed_attrs(signer, ATTRS,
+	    sizeof(ATTRS), sig, sizeof(SIG1), result));
+}
+
+START_TEST(sig_cache_lookups)
+{
+	X509 *signer1, *signer2;
+	struct sig_cache_key k11, k12, k21;
+
+	signer1 = create_signer();
+	signer2 = create_signer();
+	key(signer1, SIG1, &k11);
+	key(signer1, SIG2, &k12);
+	key(signer2, SIG1, &k21);
+
+	ck_assert_int_eq(0, sig_cache_init());
+
+	ck_assert(!sig_cache_contains(&k11));
+	sig_cache_add(&k11);
+	ck_assert(sig_cache_contains(&k11));
+	/* Same signed bytes, but different signature or signer */
+	ck_assert(!sig_cache_contains(&k12));
+	ck_assert(!sig_cache_contains(&k21));
+
+	sig_cache_add(&k21);
+	sig_cache_add(&k21);
+	ck_assert_uint_eq(2, HASH_COUNT(sigs));
+
+	/* Both were used during the "cycle" */
+	sig_cache_sweep();
+	ck_assert_uint_eq(2, HASH_COUNT(sigs));
+
+	/* Only @k11 is used during the next one */
+	ck_assert(sig_cache_contains(&k11));
+	sig_cache_sweep();
+	ck_assert_uint_eq(1, HASH_COUNT(sigs));
+	ck_assert(sig_cache_contains(&k11));
+	ck_assert(!sig_cache_contains(&k21));
+
+	sig_cache_cleanup();
+	X509_free(signer1);
+	X509_free(signer2);
+}
+END_TEST
+
+Suite *sig_cache_suite(void)
+{
+	Suite *suite;
+	TCase *core;
+
+	core = tcase_create("Core");
+	tcase_add_test(core, sig_cache_lookups);
+
+	suite = suite_create("sig_cache");
+	suite_add_tcase(suite, core);
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite;
+	SRunner *runner;
+	int tests_failed;
+
+	suite = sig_cache_suite();
+
+	runner = srunner_create(suite);
+	srunner_run_all(runner, CK_NORMAL);
+	tests_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+
+	return (tests_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
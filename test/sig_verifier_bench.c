@@ -0,0 +1,163 @@
+/*
+ * Measures the throughput of the signature verifier (RSA-2048 verifications
+ * per second) for several worker counts.
+ *
+ * Not part of `make check`. Build and run it with
+ *
+ * 	make sig_verifier.bench && ./sig_verifier.bench [<signatures> [<max workers>]]
+ *
+ * The thread that runs the batch helps the workers, so "threads" is the worker
+ * count plus one.
+ */
+
+#include <stdlib.h>
+#include <time.h>
+#include <openssl/evp.h>
+#include <openssl/rsa.h>
+
+#include "log.c"
+#include "impersonator.c"
+#include "crypto/sig_cache.c"
+#include "crypto/sig_verifier.c"
+
+static unsigned int signature_workers;
+
+unsigned int
+config_get_signature_workers(void)
+{
+	return signature_workers;
+}
+
+struct signature {
+	unsigned char md[SHA256_DIGEST_LENGTH];
+	unsigned char sig[256];
+	size_t sig_len;
+	struct sig_cache_key key;
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static EVP_PKEY *
+create_key(void)
+{
+	EVP_PKEY_CTX *ctx;
+	EVP_PKEY *pkey;
+
+	ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+	if (ctx == NULL || EVP_PKEY_keygen_init(ctx) <= 0 ||
+	    EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, 2048) <= 0)
+		exit(EXIT_FAILURE);
+	pkey = NULL;
+	if (EVP_PKEY_keygen(ctx, &pkey) <= 0)
+		exit(EXIT_FAILURE);
+	EVP_PKEY_CTX_free(ctx);
+
+	return pkey;
+}
+
+static void
+sign(EVP_PKEY *pkey, X509 *signer, unsigned int i, struct signature *result)
+{
+	EVP_PKEY_CTX *ctx;
+
+	if (!EVP_Digest(&i, sizeof(i), result->md, NULL, EVP_sha256(), NULL))
+		exit(EXIT_FAILURE);
+
+	ctx = EVP_PKEY_CTX_new(pkey, NULL);
+	result->sig_len = sizeof(result->sig);
+	if (ctx == NULL || EVP_PKEY_sign_init(ctx) <= 0 ||
+	    EVP_PKEY_CTX_set_signature_md(ctx, EVP_sha256()) <= 0 ||
+	    EVP_PKEY_sign(ctx, result->sig, &result->sig_len, result->md,
+	    SHA256_DIGEST_LENGTH) <= 0)
+		exit(EXIT_FAILURE);
+	EVP_PKEY_CTX_free(ctx);
+
+	if (sig_cache_key_signed_attrs(signer, result->md, SHA256_DIGEST_LENGTH,
+	    result->sig, result->sig_len, &result->key) != 0)
+		exit(EXIT_FAILURE);
+}
+
+/* Returns the number of valid signatures. */
+static unsigned int
+run_batch(X509 *signer, struct signature *signatures, unsigned int count)
+{
+	struct sig_batch *batch;
+	unsigned int i;
+
+	if (sig_batch_create(&batch) != 0)
+		exit(EXIT_FAILURE);
+	for (i = 0; i < count; i++)
+		if (sig_batch_add_digest(batch, signer, signatures[i].md,
+		    signatures[i].sig, signatures[i].sig_len,
+		    &signatures[i].key) != 0)
+			exit(EXIT_FAILURE);
+
+	sig_batch_run(batch);
+	sig_batch_destroy(batch);
+
+	/* The valid ones end up in the signature cache */
+	return HASH_COUNT(sigs);
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned int count, max_workers;
+	EVP_PKEY *pkey;
+	X509 *signer;
+	struct signature *signatures;
+	unsigned int i, valid;
+	double start, seconds;
+
+	count = (argc > 1) ? strtoul(argv[1], NULL, 10) : 4000;
+	max_workers = (argc > 2) ? strtoul(argv[2], NULL, 10) : 8;
+
+	pkey = create_key();
+	signer = X509_new();
+	if (signer == NULL || !X509_set_pubkey(signer, pkey))
+		return EXIT_FAILURE;
+
+	signatures = malloc(count * sizeof(struct signature));
+	if (signatures == NULL)
+		return EXIT_FAILURE;
+	for (i = 0; i < count; i++)
+		sign(pkey, signer, i, &signatures[i]);
+
+	printf("%u RSA-2048 signatures\n", count);
+	printf("%8s %8s %14s\n", "workers", "threads", "verifies/s");
+
+	signature_workers = 0;
+	while (signature_workers <= max_workers) {
+		if (sig_verifier_init() != 0 || sig_cache_init() != 0)
+			return EXIT_FAILURE;
+
+		start = now();
+		valid = run_batch(signer, signatures, count);
+		seconds = now() - start;
+
+		sig_cache_cleanup();
+		sig_verifier_cleanup();
+
+		if (valid != count) {
+			fprintf(stderr, "Only %u signatures were valid.\n",
+			    valid);
+			return EXIT_FAILURE;
+		}
+		printf("%8u %8u %14.0f\n", signature_workers,
+		    signature_workers + 1, count / seconds);
+
+		signature_workers = (signature_workers == 0)
+		    ? 1 : 2 * signature_workers;
+	}
+
+	free(signatures);
+	X509_free(signer);
+	EVP_PKEY_free(pkey);
+	return EXIT_SUCCESS;
+}
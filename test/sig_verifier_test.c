@@ -0,0 +1,156 @@
+#include <check.h>
+#include <stdlib.h>
+#include <openssl/evp.h>
+#include <openssl/rsa.h>
+
+#include "impersonator.c"
+#include "log.c"
+#include "crypto/sig_cache.c"
+#include "crypto/sig_verifier.c"
+
+unsigned int
+config_get_signature_workers(void)
+{
+	return 2;
+}
+
+static EVP_PKEY *
+create_key(void)
+{
+	EVP_PKEY_CTX *ctx;
+	EVP_PKEY *pkey;
+
+	ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+	ck_assert_ptr_ne(NULL, ctx);
+	ck_assert_int_eq(1, EVP_PKEY_keygen_init(ctx));
+	ck_assert_int_eq(1, EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, 1024));
+	pkey = NULL;
+	ck_assert_int_eq(1, EVP_PKEY_keygen(ctx, &pkey));
+	EVP_PKEY_CTX_free(ctx);
+
+	return pkey;
+}
+
+/* A certificate that holds @pkey, signed by @signer. */
+static X509 *
+create_cert(EVP_PKEY *pkey, EVP_PKEY *signer)
+{
+	X509 *cert;
+
+	cert = X509_new();
+	ck_assert_ptr_ne(NULL, cert);
+	ck_assert_int_eq(1, X509_set_pubkey(cert, pkey));
+	ck_assert_int_ne(0, X509_sign(cert, signer, EVP_sha256()));
+
+	return cert;
+}
+
+static void
+sign(EVP_PKEY *pkey, unsigned char const *md, unsigned char *sig,
+    size_t *sig_len)
+{
+	EVP_PKEY_CTX *ctx;
+
+	ctx = EVP_PKEY_CTX_new(pkey, NULL);
+	ck_assert_ptr_ne(NULL, ctx);
+	ck_assert_int_eq(1, EVP_PKEY_sign_init(ctx));
+	ck_assert_int_eq(1, EVP_PKEY_CTX_set_signature_md(ctx, EVP_sha256()));
+	ck_assert_int_eq(1, EVP_PKEY_sign(ctx, sig, sig_len, md,
+	    SHA256_DIGEST_LENGTH));
+	EVP_PKEY_CTX_free(ctx);
+}
+
+START_TEST(sig_verifier_verdicts)
+{
+	EVP_PKEY *ca_key, *ee_key, *rogue_key;
+	X509 *ca, *ee, *rogue;
+	struct sig_batch *batch;
+	unsigned char md[SHA256_DIGEST_LENGTH];
+	unsigned char sig[256];
+	size_t sig_len;
+	struct sig_cache_key good_digest, bad_digest, good_cert, bad_cert;
+
+	ck_assert_int_eq(0, sig_cache_init());
+	ck_assert_int_eq(0, sig_verifier_init());
+	ck_assert(sig_verifier_enabled());
+
+	ca_key = create_key();
+	ee_key = create_key();
+	rogue_key = create_key();
+	ca = create_cert(ca_key, ca_key);
+	ee = create_cert(ee_key, ca_key);
+	rogue = create_cert(ee_key, rogue_key);
+
+	ck_assert_int_eq(1, EVP_Digest("content", 7, md, NULL, EVP_sha256(),
+	    NULL));
+	sig_len = sizeof(sig);
+	sign(ee_key, md, sig, &sig_len);
+	ck_assert_int_eq(0, sig_cache_key_signed_attrs(ee, md, sizeof(md),
+	    sig, sig_len, &good_digest));
+	ck_assert_int_eq(0, sig_cache_key_cert(ca, ee, &good_cert));
+	ck_assert_int_eq(0, sig_cache_key_cert(ca, rogue, &bad_cert));
+
+	ck_assert_int_eq(0, sig_batch_create(&batch));
+	ck_assert_int_eq(0, sig_batch_add_digest(batch, ee, md, sig, sig_len,
+	    &good_digest));
+	/* @md no longer matches the signature */
+	md[0] ^= 1;
+	ck_assert_int_eq(0, sig_cache_key_signed_attrs(ee, md, sizeof(md),
+	    sig, sig_len, &bad_digest));
+	ck_assert_int_eq(0, sig_batch_add_digest(batch, ee, md, sig, sig_len,
+	    &bad_digest));
+	ck_assert_int_eq(0, sig_batch_add_cert(batch, ca, ee));
+	ck_assert_int_eq(0, sig_batch_add_cert(batch, ca, rogue));
+	sig_batch_run(batch);
+	sig_batch_destroy(batch);
+
+	ck_assert(sig_cache_contains(&good_digest));
+	ck_assert(!sig_cache_contains(&bad_digest));
+	ck_assert(sig_cache_contains(&good_cert));
+	ck_assert(!sig_cache_contains(&bad_cert));
+
+	/* Known signatures are not verified again */
+	ck_assert_int_eq(0, sig_batch_create(&batch));
+	ck_assert_int_eq(0, sig_batch_add_cert(batch, ca, ee));
+	ck_assert_uint_eq(0, batch->jobs.len);
+	sig_batch_destroy(batch);
+
+	sig_verifier_cleanup();
+	sig_cache_cleanup();
+	X509_free(ca);
+	X509_free(ee);
+	X509_free(rogue);
+	EVP_PKEY_free(ca_key);
+	EVP_PKEY_free(ee_key);
+	EVP_PKEY_free(rogue_key);
+}
+END_TEST
+
+Suite *sig_verifier_suite(void)
+{
+	Suite *suite;
+	TCase *core;
+
+	core = tcase_create("Core");
+	tcase_add_test(core, sig_verifier_verdicts);
+
+	suite = suite_create("sig_verifier");
+	suite_add_tcase(suite, core);
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite;
+	SRunner *runner;
+	int tests_failed;
+
+	suite = sig_verifier_suite();
+
+	runner = srunner_create(suite);
+	srunner_run_all(runner, CK_NORMAL);
+	tests_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+
+	return (tests_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
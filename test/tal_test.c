@@ -20,6 +20,7 @@
 
 int
 validation_prepare(struct validation **out, struct tal *tal,
+    struct uri_list *rsync_visited_uris,
     struct validation_handler *validation_handler)
 {
 	return 0;
@@ -98,13 +99,86 @@ state_retrieve(void)
 }
 
 void
-db_rrdp_reset_visited_tals(void)
+db_rrdp_reset_visited(void)
+{
+	/* Empty */
+}
+
+int
+db_rrdp_rem_nonvisited(void)
+{
+	return 0;
+}
+
+double
+metrics_now(void)
+{
+	return 0;
+}
+
+void
+metrics_tal(char const *file, double seconds, int error)
+{
+	/* Empty */
+}
+
+void
+metrics_fetch(enum metrics_protocol protocol, char const *uri, size_t len,
+    double seconds, size_t bytes, int error)
+{
+	/* Empty */
+}
+
+void
+trace_begin(struct trace_span *span, char const *name)
+{
+	/* Empty */
+}
+
+void
+trace_end(struct trace_span *span, char const *uri)
+{
+	/* Empty */
+}
+
+void
+object_store_compact(void)
+{
+	/* Empty */
+}
+
+int
+object_store_save(void)
+{
+	return 0;
+}
+
+int
+db_rrdp_save(void)
+{
+	return 0;
+}
+
+int
+hash_cache_save(void)
+{
+	return 0;
+}
+
+void
+rpp_memo_sweep(void)
+{
+	/* Empty */
+}
+
+void
+object_cache_log_stats(void)
 {
 	/* Empty */
 }
 
 void
-db_rrdp_rem_nonvisited_tals(void)
+sig_cache_sweep(void)
 {
 	/* Empty */
 }
@@ -0,0 +1,190 @@
+#include <check.h>
+#include <stdlib.h>
+
+#include "impersonator.c"
+#include "log.c"
+#include "trace.c"
+
+static unsigned int trace_spans;
+
+unsigned int
+config_get_metrics_trace_spans(void)
+{
+	return trace_spans;
+}
+
+char const *
+config_get_metrics_address(void)
+{
+	return "localhost";
+}
+
+static char *
+print(void)
+{
+	FILE *out;
+	char *result;
+	size_t len;
+
+	out = open_memstream(&result, &len);
+	ck_assert_ptr_ne(NULL, out);
+	trace_print(out);
+	fclose(out);
+
+	return result;
+}
+
+static void
+record(char const *name, char const *uri)
+{
+	struct trace_span span;
+
+	trace_begin(&span, name);
+	trace_end(&span, uri);
+}
+
+static unsigned int
+count_buffers(void)
+{
+	struct trace_buffer *ring;
+	unsigned int result;
+
+	result = 0;
+	SLIST_FOREACH(ring, &buffers, next_buffer)
+		result++;
+	return result;
+}
+
+START_TEST(trace_disabled)
+{
+	char *text;
+
+	trace_spans = 0;
+	ck_assert_int_eq(0, trace_init());
+	record("tal_load", "a.tal");
+	ck_assert_uint_eq(0, count_buffers());
+
+	text = print();
+	ck_assert_str_eq("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n]}\n",
+	    text);
+	free(text);
+
+	trace_cleanup();
+}
+END_TEST
+
+START_TEST(trace_ring)
+{
+	char *text;
+	char *first, *second, *third;
+
+	trace_spans = 3;
+	ck_assert_int_eq(0, trace_init());
+
+	record("tal_load", "a.tal");
+	record("certificate_traverse", "rsync://a/b.cer");
+	record("handle_manifest", "rsync://a/\"b\"\\c\n.mft");
+	record("compute_deltas", NULL);
+	record("roa_traverse", "rsync://a/b.roa");
+
+	text = print();
+
+	/* The two oldest ones were overwritten */
+	ck_assert_ptr_eq(NULL, strstr(text, "tal_load"));
+	ck_assert_ptr_eq(NULL, strstr(text, "certificate_traverse"));
+
+	first = strstr(text, "{\"name\":\"handle_manifest\",\"cat\":\"fort\",\"ph\":\"X\",");
+	second = strstr(text, "{\"name\":\"compute_deltas\",");
+	third = strstr(text, "{\"name\":\"roa_traverse\",");
+	ck_assert_ptr_ne(NULL, first);
+	ck_assert_ptr_ne(NULL, second);
+	ck_assert_ptr_ne(NULL, third);
+	ck_assert(first < second);
+	ck_assert(second < third);
+
+	ck_assert_ptr_ne(NULL, strstr(first,
+	    "\"args\":{\"uri\":\"rsync://a/\\\"b\\\"\\\\c\\u000a.mft\"}}"));
+	ck_assert_ptr_ne(NULL, strstr(third,
+	    "\"args\":{\"uri\":\"rsync://a/b.roa\"}}\n]}\n"));
+	/* No URI, no args */
+	*third = '\0';
+	ck_assert_ptr_eq(NULL, strstr(second, "\"args\""));
+
+	free(text);
+	trace_cleanup();
+}
+END_TEST
+
+static void *
+record_in_thread(void *arg)
+{
+	record(arg, NULL);
+	return NULL;
+}
+
+static void
+run_thread(char *name)
+{
+	pthread_t thread;
+
+	ck_assert_int_eq(0, pthread_create(&thread, NULL, record_in_thread,
+	    name));
+	ck_assert_int_eq(0, pthread_join(thread, NULL));
+}
+
+START_TEST(trace_threads)
+{
+	char *text;
+
+	trace_spans = 4;
+	ck_assert_int_eq(0, trace_init());
+
+	record("slurm_apply", NULL);
+	run_thread("download_files");
+	/* Inherits the dead thread's buffer, and its spans */
+	run_thread("rrdp_load");
+	ck_assert_uint_eq(2, count_buffers());
+
+	text = print();
+	ck_assert_ptr_ne(NULL, strstr(text, "\"name\":\"slurm_apply\""));
+	ck_assert_ptr_ne(NULL, strstr(text, "\"name\":\"download_files\""));
+	ck_assert_ptr_ne(NULL, strstr(text, "\"name\":\"rrdp_load\""));
+	ck_assert_ptr_ne(NULL, strstr(text, "\"tid\":1,"));
+	ck_assert_ptr_ne(NULL, strstr(text, "\"tid\":2,"));
+	ck_assert_ptr_ne(NULL, strstr(text, "\"tid\":3,"));
+	free(text);
+
+	trace_cleanup();
+}
+END_TEST
+
+Suite *trace_suite(void)
+{
+	Suite *suite;
+	TCase *core;
+
+	core = tcase_create("Core");
+	tcase_add_test(core, trace_disabled);
+	tcase_add_test(core, trace_ring);
+	tcase_add_test(core, trace_threads);
+
+	suite = suite_create("trace");
+	suite_add_tcase(suite, core);
+	return suite;
+}
+
+int main(void)
+{
+	Suite *suite;
+	SRunner *runner;
+	int tests_failed;
+
+	suite = trace_suite();
+
+	runner = srunner_create(suite);
+	srunner_run_all(runner, CK_NORMAL);
+	tests_failed = srunner_ntests_failed(runner);
+	srunner_free(runner);
+
+	return (tests_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
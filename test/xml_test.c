@@ -74,6 +74,40 @@ START_TEST(relax_ng_valid)
 }
 END_TEST
 
+/* Hands the file over a few bytes at a time, like a slow download would. */
+static int
+chunk_read(void *arg, char *buffer, int len)
+{
+	FILE *file = arg;
+
+	if (len > 7)
+		len = 7;
+	return fread(buffer, 1, len, file);
+}
+
+START_TEST(relax_ng_valid_io)
+{
+	struct reader_ctx ctx;
+	FILE *file;
+
+	ctx.delta_count = 0;
+	ctx.snapshot_count = 0;
+	ctx.serial = NULL;
+	file = fopen("xml/notification.xml", "rb");
+	ck_assert_ptr_ne(file, NULL);
+
+	relax_ng_init();
+	ck_assert_int_eq(relax_ng_parse_io("notification.xml", chunk_read, file,
+	    reader_cb, &ctx), 0);
+	ck_assert_int_eq(ctx.snapshot_count, 1);
+	ck_assert_int_eq(ctx.delta_count, 5);
+	ck_assert_str_eq(ctx.serial, "1510");
+	free(ctx.serial);
+	relax_ng_cleanup();
+	fclose(file);
+}
+END_TEST
+
 Suite *xml_load_suite(void)
 {
 	Suite *suite;
@@ -81,6 +115,7 @@ Suite *xml_load_suite(void)
 
 	validate = tcase_create("Validate");
 	tcase_add_test(validate, relax_ng_valid);
+	tcase_add_test(validate, relax_ng_valid_io);
 
 	suite = suite_create("xml_test()");
 	suite_add_tcase(suite, validate);